@@ -0,0 +1,171 @@
+#include "LiveOutput.h"
+#include "xop/H264Parser.h"
+#include "xop/AV1Parser.h"
+#include <cstring>
+
+RtmpOutput::RtmpOutput(std::shared_ptr<xop::RtmpPublisher> publisher, const StreamInfo& info)
+	: publisher_(publisher)
+	, info_(info)
+{
+
+}
+
+RtmpOutput::~RtmpOutput()
+{
+
+}
+
+void RtmpOutput::PushVideo(const MediaPacket& packet)
+{
+	if (packet.size <= 4 || !publisher_->IsConnected()) {
+		return;
+	}
+
+	/* -4 without the h.264 start code, av1 has none */
+	uint32_t offset = info_.is_av1 ? 0 : 4;
+	publisher_->PushVideoFrame(packet.data.get() + offset, packet.size - offset,
+		packet.composition_time, packet.timestamp);
+}
+
+void RtmpOutput::PushAudio(const MediaPacket& packet)
+{
+	if (info_.is_opus || !publisher_->IsConnected()) {
+		return;
+	}
+
+	/* the same 90kHz capture clock as the video */
+	uint32_t timestamp = (uint32_t)((packet.capture_usec + 500) / 1000 * 90);
+	publisher_->PushAudioFrame(packet.data.get(), packet.size, timestamp);
+}
+
+bool RtmpOutput::IsConnected()
+{
+	return publisher_->IsConnected();
+}
+
+bool RtmpOutput::IsReconnecting()
+{
+	return publisher_->IsReconnecting();
+}
+
+void RtmpOutput::Close()
+{
+	publisher_->Close();
+}
+
+RtspOutput::RtspOutput(std::shared_ptr<xop::RtspServer> server, xop::MediaSessionId session_id, const StreamInfo& info)
+	: server_(server)
+	, session_id_(session_id)
+	, info_(info)
+{
+
+}
+
+RtspOutput::RtspOutput(std::shared_ptr<xop::RtspPusher> pusher, const StreamInfo& info)
+	: pusher_(pusher)
+	, info_(info)
+{
+
+}
+
+RtspOutput::~RtspOutput()
+{
+
+}
+
+void RtspOutput::PushVideo(const MediaPacket& packet)
+{
+	uint8_t* data = packet.data.get();
+	uint32_t size = packet.size;
+
+	/* av1 goes out by temporal unit, AV1Source packetizes it */
+	if (info_.is_av1) {
+		bool has_seq_header = false;
+		xop::AV1Parser::ForEachObu(data, size, [&has_seq_header](const uint8_t* obu, uint32_t, uint32_t) {
+			has_seq_header = xop::AV1Parser::GetObuType(obu) == xop::AV1Parser::OBU_SEQUENCE_HEADER;
+			return !has_seq_header;
+		});
+
+		/* the sequence header goes in front of a key frame */
+		const std::vector<uint8_t>* seq_header = nullptr;
+		if (packet.is_key_frame && !has_seq_header && !info_.parameter_sets.empty()) {
+			seq_header = &info_.parameter_sets.front();
+		}
+
+		uint32_t seq_header_size = seq_header ? (uint32_t)seq_header->size() : 0;
+		xop::AVFrame video_frame(seq_header_size + size);
+		video_frame.type = packet.is_key_frame ? xop::VIDEO_FRAME_I : xop::VIDEO_FRAME_P;
+		video_frame.timestamp = packet.timestamp;
+		if (seq_header_size > 0) {
+			memcpy(video_frame.buffer.get(), seq_header->data(), seq_header_size);
+		}
+		memcpy(video_frame.buffer.get() + seq_header_size, data, size);
+		PushFrame(xop::channel_0, video_frame);
+		return;
+	}
+
+	/* nal unit by nal unit, the parameter sets go in front of a key frame */
+	uint8_t frame_type = packet.is_key_frame ? xop::VIDEO_FRAME_I : xop::VIDEO_FRAME_P;
+	uint32_t timestamp = packet.timestamp;
+	auto push_nal = [this, frame_type, timestamp](const uint8_t* nal, uint32_t nal_size) {
+		xop::AVFrame video_frame(nal_size);
+		video_frame.type = frame_type;
+		video_frame.timestamp = timestamp;
+		memcpy(video_frame.buffer.get(), nal, nal_size);
+		PushFrame(xop::channel_0, video_frame);
+		return true;
+	};
+
+	if (packet.is_key_frame) {
+		for (auto& nal : info_.parameter_sets) {
+			push_nal(nal.data(), (uint32_t)nal.size());
+		}
+	}
+
+	xop::H264Parser::ForEachNal(data, size, push_nal);
+}
+
+void RtspOutput::PushAudio(const MediaPacket& packet)
+{
+	if (info_.audio_samplerate == 0) {
+		return;
+	}
+
+	/* the clock rate is the samplerate, 48kHz for opus */
+	xop::AVFrame audio_frame(packet.size);
+	audio_frame.type = xop::AUDIO_FRAME;
+	audio_frame.timestamp = (uint32_t)(packet.capture_usec * info_.audio_samplerate / 1000000);
+	memcpy(audio_frame.buffer.get(), packet.data.get(), packet.size);
+	PushFrame(xop::channel_1, audio_frame);
+}
+
+bool RtspOutput::IsConnected()
+{
+	if (pusher_ != nullptr) {
+		return pusher_->IsConnected();
+	}
+
+	return server_ != nullptr;
+}
+
+void RtspOutput::Close()
+{
+	if (pusher_ != nullptr) {
+		pusher_->Close();
+	}
+
+	/* the server is shared by the renditions, its owner stops it */
+	if (server_ != nullptr) {
+		server_->RemoveSession(session_id_);
+	}
+}
+
+void RtspOutput::PushFrame(xop::MediaChannelId channel_id, const xop::AVFrame& frame)
+{
+	if (pusher_ != nullptr) {
+		pusher_->PushFrame(channel_id, frame);
+	}
+	else if (server_ != nullptr) {
+		server_->PushFrame(session_id_, channel_id, frame);
+	}
+}
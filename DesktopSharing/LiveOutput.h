@@ -0,0 +1,88 @@
+#ifndef SCREEN_LIVE_OUTPUT_H
+#define SCREEN_LIVE_OUTPUT_H
+
+#include "xop/RtspServer.h"
+#include "xop/RtspPusher.h"
+#include "xop/RtmpPublisher.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* one encoded frame, shared by all the outputs */
+struct MediaPacket
+{
+	bool is_video = true;
+	std::shared_ptr<uint8_t> data; /* video: as the encoder gave it, annex-b or av1 temporal unit */
+	uint32_t size = 0;
+	bool is_key_frame = false;
+	uint32_t timestamp = 0;        /* video: 90kHz capture clock */
+	uint32_t composition_time = 0; /* video: msec */
+	int64_t capture_usec = 0;      /* audio */
+};
+
+/* what the outputs need to know about the encoded streams */
+struct StreamInfo
+{
+	bool is_av1 = false;
+	bool is_opus = false;          /* flv has no opus, the rtmp outputs are video only then */
+	uint32_t audio_samplerate = 0; /* rtp clock of the audio, opus: 48000 */
+	std::vector<std::vector<uint8_t>> parameter_sets; /* (vps) sps pps without start code, av1: sequence header obu */
+};
+
+/* a destination of the stream, the router calls PushVideo and PushAudio
+   from one thread per output */
+class LiveOutput
+{
+public:
+	virtual ~LiveOutput() {}
+
+	virtual void PushVideo(const MediaPacket& packet) = 0;
+	virtual void PushAudio(const MediaPacket& packet) = 0;
+
+	virtual bool IsConnected() = 0;
+	virtual bool IsReconnecting() { return false; }
+	virtual void Close() = 0;
+};
+
+class RtmpOutput : public LiveOutput
+{
+public:
+	RtmpOutput(std::shared_ptr<xop::RtmpPublisher> publisher, const StreamInfo& info);
+	virtual ~RtmpOutput();
+
+	virtual void PushVideo(const MediaPacket& packet);
+	virtual void PushAudio(const MediaPacket& packet);
+
+	virtual bool IsConnected();
+	virtual bool IsReconnecting();
+	virtual void Close();
+
+private:
+	std::shared_ptr<xop::RtmpPublisher> publisher_;
+	StreamInfo info_;
+};
+
+/* the local rtsp server, or a pusher recording to a remote one */
+class RtspOutput : public LiveOutput
+{
+public:
+	RtspOutput(std::shared_ptr<xop::RtspServer> server, xop::MediaSessionId session_id, const StreamInfo& info);
+	RtspOutput(std::shared_ptr<xop::RtspPusher> pusher, const StreamInfo& info);
+	virtual ~RtspOutput();
+
+	virtual void PushVideo(const MediaPacket& packet);
+	virtual void PushAudio(const MediaPacket& packet);
+
+	virtual bool IsConnected();
+	virtual void Close();
+
+private:
+	void PushFrame(xop::MediaChannelId channel_id, const xop::AVFrame& frame);
+
+	std::shared_ptr<xop::RtspServer> server_;
+	xop::MediaSessionId session_id_ = 0;
+	std::shared_ptr<xop::RtspPusher> pusher_;
+	StreamInfo info_;
+};
+
+#endif
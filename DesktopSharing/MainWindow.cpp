@@ -1,5 +1,6 @@
 #include "MainWindow.h"
 #include <mutex>
+#include <sstream>
 
 MainWindow::MainWindow()
 {
@@ -272,27 +273,51 @@ bool MainWindow::StartLive(int& event_type,
 		(avconfig.codec == "h264_qsv" && !QsvEncoder::IsSupported())) {
 		avconfig.codec = "x264";	
 	}
+	else if ((avconfig.codec == "hevc_nvenc" && !nvenc_info.is_supported()) ||
+		(avconfig.codec == "hevc_qsv" && !QsvEncoder::IsSupported())) {
+		avconfig.codec = "x265";
+	}
 
 	/* reset video encoder */
 	if (avconfig_ != avconfig) {
 		ScreenLive::Instance().StopLive(SCREEN_LIVE_RTMP_PUSHER);
+		ScreenLive::Instance().StopLive(SCREEN_LIVE_RTSP_PUSHER);
+		ScreenLive::Instance().StopLive(SCREEN_LIVE_RTSP_SERVER);
 		overlay_->SetLiveState(EVENT_TYPE_RTMP_PUSHER, false);
 		ScreenLive::Instance().StopEncoder();
 		if (ScreenLive::Instance().StartEncoder(avconfig) < 0) {
 			return false;
 		}
 		avconfig_ = avconfig;		
+
+		/* the rtsp media source follows the codec of the encoder */
+		LiveConfig rtsp_config;
+		ScreenLive::Instance().StartLive(SCREEN_LIVE_RTSP_SERVER, rtsp_config);
 	}
 
 	if (!ScreenLive::Instance().IsEncoderInitialized()) {
 		return false;
 	}
 
-	LiveConfig live_config;
+	/* several urls separated by spaces, one encode is pushed to all of them */
+	std::istringstream urls(live_settings[0]);
+	std::string url;
 	bool ret = false;
 
-	live_config.rtmp_url = live_settings[0];
-	ret = ScreenLive::Instance().StartLive(SCREEN_LIVE_RTMP_PUSHER, live_config);
+	while (urls >> url) {
+		LiveConfig live_config;
+		bool is_rtsp = (url.compare(0, 7, "rtsp://") == 0);
+		if (is_rtsp) {
+			live_config.rtsp_url = url;
+		}
+		else {
+			live_config.rtmp_url = url;
+		}
+
+		if (ScreenLive::Instance().StartLive(is_rtsp ? SCREEN_LIVE_RTSP_PUSHER : SCREEN_LIVE_RTMP_PUSHER, live_config)) {
+			ret = true;
+		}
+	}
 
 	return ret;
 }
@@ -300,4 +325,5 @@ bool MainWindow::StartLive(int& event_type,
 void MainWindow::StopLive(int event_type)
 {
 	ScreenLive::Instance().StopLive(SCREEN_LIVE_RTMP_PUSHER);
+	ScreenLive::Instance().StopLive(SCREEN_LIVE_RTSP_PUSHER);
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "OutputRouter.h"
+#include <chrono>
+
+OutputRouter::OutputRouter()
+{
+
+}
+
+OutputRouter::~OutputRouter()
+{
+	RemoveOutputs(-1);
+}
+
+OutputRouter::OutputId OutputRouter::AddOutput(int type, std::string name, std::shared_ptr<LiveOutput> output)
+{
+	auto out = std::make_shared<Output>();
+	out->type = type;
+	out->name = name;
+	out->output = output;
+	out->thread.reset(new std::thread(&OutputRouter::Run, out));
+
+	std::lock_guard<std::mutex> locker(mutex_);
+	out->id = next_id_++;
+	outputs_[out->id] = out;
+	return out->id;
+}
+
+void OutputRouter::RemoveOutput(OutputId id)
+{
+	std::shared_ptr<Output> output;
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		auto iter = outputs_.find(id);
+		if (iter == outputs_.end()) {
+			return;
+		}
+		output = iter->second;
+		outputs_.erase(iter);
+	}
+
+	Stop(output);
+}
+
+void OutputRouter::RemoveOutputs(int type)
+{
+	std::vector<std::shared_ptr<Output>> outputs;
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		for (auto iter = outputs_.begin(); iter != outputs_.end(); ) {
+			if (type < 0 || iter->second->type == type) {
+				outputs.push_back(iter->second);
+				iter = outputs_.erase(iter);
+			}
+			else {
+				iter++;
+			}
+		}
+	}
+
+	for (auto& output : outputs) {
+		Stop(output);
+	}
+}
+
+void OutputRouter::PushPacket(const MediaPacket& packet)
+{
+	int64_t now = GetMsec();
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (auto& iter : outputs_) {
+		Output& output = *iter.second;
+		std::lock_guard<std::mutex> lock(output.mutex);
+
+		/* too far behind, what is queued is stale */
+		if (!output.queue.empty() && (now - output.queue.front().first > kMaxQueueMsec ||
+			output.queue_bytes + packet.size > kMaxQueueBytes)) {
+			output.dropped_frames += (uint32_t)output.queue.size();
+			output.queue.clear();
+			output.queue_bytes = 0;
+			output.wait_key_frame = true;
+		}
+
+		/* an output starts, and starts again, on a key frame */
+		if (output.wait_key_frame) {
+			if (!packet.is_video || !packet.is_key_frame) {
+				output.dropped_frames += 1;
+				continue;
+			}
+			output.wait_key_frame = false;
+		}
+
+		output.queue.emplace_back(now, packet);
+		output.queue_bytes += packet.size;
+		output.cv.notify_one();
+	}
+}
+
+std::vector<OutputRouter::OutputInfo> OutputRouter::GetOutputs()
+{
+	std::vector<std::shared_ptr<Output>> outputs;
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		for (auto& iter : outputs_) {
+			outputs.push_back(iter.second);
+		}
+	}
+
+	/* the outputs take their own locks */
+	std::vector<OutputInfo> infos;
+	for (auto& output : outputs) {
+		OutputInfo info;
+		info.id = output->id;
+		info.type = output->type;
+		info.name = output->name;
+		info.is_connected = output->output->IsConnected();
+		info.is_reconnecting = output->output->IsReconnecting();
+		{
+			std::lock_guard<std::mutex> lock(output->mutex);
+			info.dropped_frames = output->dropped_frames;
+		}
+		infos.push_back(info);
+	}
+
+	return infos;
+}
+
+bool OutputRouter::IsConnected(int type)
+{
+	for (auto& info : GetOutputs()) {
+		if (info.type == type && info.is_connected) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void OutputRouter::Run(std::shared_ptr<Output> output)
+{
+	while (true) {
+		MediaPacket packet;
+		{
+			std::unique_lock<std::mutex> lock(output->mutex);
+			output->cv.wait(lock, [&output] {
+				return !output->is_running || !output->queue.empty();
+			});
+
+			if (!output->is_running) {
+				break;
+			}
+
+			packet = output->queue.front().second;
+			output->queue.pop_front();
+			output->queue_bytes -= packet.size;
+		}
+
+		if (packet.is_video) {
+			output->output->PushVideo(packet);
+		}
+		else {
+			output->output->PushAudio(packet);
+		}
+	}
+}
+
+void OutputRouter::Stop(std::shared_ptr<Output> output)
+{
+	{
+		std::lock_guard<std::mutex> lock(output->mutex);
+		output->is_running = false;
+		output->queue.clear();
+		output->queue_bytes = 0;
+		output->cv.notify_one();
+	}
+
+	if (output->thread) {
+		output->thread->join();
+		output->thread = nullptr;
+	}
+
+	output->output->Close();
+}
+
+int64_t OutputRouter::GetMsec()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
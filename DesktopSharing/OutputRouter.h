@@ -0,0 +1,78 @@
+#ifndef SCREEN_LIVE_OUTPUT_ROUTER_H
+#define SCREEN_LIVE_OUTPUT_ROUTER_H
+
+#include "LiveOutput.h"
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Fans one encoded stream out to several outputs. Each output has its own
+   queue and thread, an output falling behind drops its queue and starts again
+   from the next key frame, the encoder and the other outputs never wait for it. */
+class OutputRouter
+{
+public:
+	typedef uint32_t OutputId;
+
+	struct OutputInfo
+	{
+		OutputId id = 0;
+		int type = 0;
+		std::string name;
+		bool is_connected = false;
+		bool is_reconnecting = false;
+		uint32_t dropped_frames = 0;
+	};
+
+	OutputRouter & operator=(const OutputRouter &) = delete;
+	OutputRouter(const OutputRouter &) = delete;
+	OutputRouter();
+	~OutputRouter();
+
+	OutputId AddOutput(int type, std::string name, std::shared_ptr<LiveOutput> output);
+	void RemoveOutput(OutputId id);
+	void RemoveOutputs(int type); /* -1: all */
+
+	/* from the encoder threads, queues the packet for every output */
+	void PushPacket(const MediaPacket& packet);
+
+	std::vector<OutputInfo> GetOutputs();
+	bool IsConnected(int type);
+
+private:
+	struct Output
+	{
+		OutputId id = 0;
+		int type = 0;
+		std::string name;
+		std::shared_ptr<LiveOutput> output;
+		std::shared_ptr<std::thread> thread;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<std::pair<int64_t, MediaPacket>> queue; /* queued at msec, packet */
+		uint32_t queue_bytes = 0;
+		bool is_running = true;
+		bool wait_key_frame = true;
+		uint32_t dropped_frames = 0;
+	};
+
+	static void Run(std::shared_ptr<Output> output);
+	static void Stop(std::shared_ptr<Output> output);
+	static int64_t GetMsec();
+
+	std::mutex mutex_;
+	OutputId next_id_ = 1;
+	std::map<OutputId, std::shared_ptr<Output>> outputs_;
+
+	static const int64_t  kMaxQueueMsec = 1000;
+	static const uint32_t kMaxQueueBytes = 16 * 1024 * 1024;
+};
+
+#endif
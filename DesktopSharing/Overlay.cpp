@@ -207,6 +207,14 @@ bool Overlay::Copy()
 	ImGui::SetNextItemWidth(50);
 	ImGui::SetCursorPos(ImVec2(start_x + 345, start_y - 1));
 	ImGui::InputText("##encoder-bitrate", encoder_bitrate_kbps_, sizeof(encoder_bitrate_kbps_), ImGuiInputTextFlags_CharsDecimal);
+	ImGui::SetCursorPos(ImVec2(start_x + 405, start_y - 3));
+	if (ImGui::Checkbox("H.265##encoder-hevc", &encoder_hevc_) && encoder_hevc_) {
+		encoder_av1_ = false;
+	}
+	ImGui::SetCursorPos(ImVec2(start_x + 465, start_y - 3));
+	if (ImGui::Checkbox("AV1##encoder-av1", &encoder_av1_) && encoder_av1_) {
+		encoder_hevc_ = false;
+	}
 
 
 	/* RTMP Pusher setting */
@@ -254,12 +262,17 @@ void Overlay::NotifyEvent(int event_type)
 		return;
 	}
 
-	encoder_settings[0] = std::string("x264");
+	encoder_settings[0] = std::string(encoder_hevc_ ? "x265" : "x264");
 	if(encoder_index_ == 2) {
-		encoder_settings[0] = std::string("h264_nvenc");
+		encoder_settings[0] = std::string(encoder_hevc_ ? "hevc_nvenc" : "h264_nvenc");
 	}
 	else if (encoder_index_ == 3) {
-		encoder_settings[0] = std::string("h264_qsv");
+		encoder_settings[0] = std::string(encoder_hevc_ ? "hevc_qsv" : "h264_qsv");
+	}
+
+	/* av1 is encoded on the cpu only */
+	if (encoder_av1_) {
+		encoder_settings[0] = std::string("av1");
 	}
 
 	encoder_settings[1] = std::string(encoder_framerate_);
@@ -55,7 +55,7 @@ public:
 	void NotifyEvent(int event_type);
 
 	struct LiveInfo {
-		char pusher_url[60];
+		char pusher_url[512];
 
 		bool state = false;
 		char state_info[16];
@@ -80,6 +80,8 @@ private:
 
 	/* live config */
 	int  encoder_index_ = 1;
+	bool encoder_hevc_ = false;
+	bool encoder_av1_ = false;
 	char encoder_bitrate_kbps_[8];
 	char encoder_framerate_[3];
 };
@@ -1,16 +1,25 @@
 ﻿#include "ScreenLive.h"
 #include "net/NetInterface.h"
 #include "net/Timestamp.h"
-#include "xop/RtspServer.h"
 #include "xop/H264Parser.h"
+#include "xop/H264Source.h"
+#include "xop/H265Source.h"
+#include "xop/AV1Source.h"
+#include "xop/AACSource.h"
+#include "xop/OpusSource.h"
 #include "ScreenCapture/DXGIScreenCapture.h"
 #include "ScreenCapture/GDIScreenCapture.h"
+#include "libyuv.h"
 #include <versionhelpers.h>
+#include <cstdlib>
 
 ScreenLive::ScreenLive()
 	: event_loop_(new xop::EventLoop)
 {
 	encoding_fps_ = 0;
+	encoding_frames_ = 0;
+	encoding_latency_ = 0;
+	is_audio_started_ = false;
 }
 
 ScreenLive::~ScreenLive()
@@ -37,16 +46,55 @@ bool ScreenLive::GetScreenImage(std::vector<uint8_t>& bgra_image, uint32_t& widt
 
 std::string ScreenLive::GetStatusInfo()
 {
+	std::lock_guard<std::mutex> locker(mutex_);
 	std::string info;
 
 	if (is_encoder_started_) {
 		info += u8"编码: " + av_config_.codec + " \n\n";
+		if (av_config_.codec == "x264") {
+			info += u8"配置: " + av_config_.profile + " \n\n";
+		}
+		if (av_config_.intra_refresh) {
+			info += u8"帧内刷新: 开启 \n\n";
+		}
 		info += u8"刷新率: " + std::to_string(encoding_fps_) + " \n\n";
+		info += u8"编码延时: " + std::to_string(encoding_latency_) + " ms \n\n";
+		if (is_audio_started_ && is_opus_) {
+			info += u8"音频: Opus " + std::to_string(opus_encoder_.GetFrameMsec()) + "ms "
+				+ std::to_string(opus_encoder_.GetChannel()) + "ch \n\n";
+		}
+		else if (is_audio_started_) {
+			info += u8"音频: AAC " + std::to_string(aac_encoder_.GetSamplerate()) + "Hz "
+				+ std::to_string(aac_encoder_.GetChannel()) + "ch \n\n";
+		}
 	}
 
-	if (rtmp_pusher_ != nullptr) {
-		std::string status = rtmp_pusher_->IsConnected() ? u8"推送中" : u8"断开";
-		info += u8"状态: " + status + " \n\n";
+	if (rtsp_server_ != nullptr) {
+		info += u8"RTSP服务: 开启 \n\n";
+	}
+
+	for (uint32_t rendition = 0; rendition <= rungs_.size(); rendition++) {
+		if (rendition > 0) {
+			Rung& rung = rungs_[rendition - 1];
+			info += u8"阶梯: " + std::to_string(rung.width) + "x" + std::to_string(rung.height) + " "
+				+ std::to_string(rung.bitrate_bps / 1000) + "kbps \n\n";
+		}
+
+		for (auto& output : GetOutputRouter(rendition)->GetOutputs()) {
+			if (output.type == SCREEN_LIVE_RTSP_SERVER) {
+				continue;
+			}
+
+			std::string status = output.is_connected ? u8"推送中"
+				: (output.is_reconnecting ? u8"重连中" : u8"断开");
+			info += (output.type == SCREEN_LIVE_RTMP_PUSHER ? u8"RTMP推流: " : u8"RTSP推流: ") + status;
+
+			/* dropped by the output falling behind, not by the encoder */
+			if (output.dropped_frames > 0) {
+				info += u8" 丢帧: " + std::to_string(output.dropped_frames);
+			}
+			info += " \n\n";
+		}
 	}
 
 	return info;
@@ -72,16 +120,15 @@ bool ScreenLive::Init(AVConfig& config)
 
 void ScreenLive::Destroy()
 {
+	StopLive(SCREEN_LIVE_RTSP_SERVER);
+	output_router_.RemoveOutputs(-1);
+
+	StopEncoder();
 	{
 		std::lock_guard<std::mutex> locker(mutex_);
-
-		if (rtmp_pusher_ != nullptr && rtmp_pusher_->IsConnected()) {
-			rtmp_pusher_->Close();
-			rtmp_pusher_ = nullptr;
-		}
+		rungs_.clear();
 	}
 
-	StopEncoder();
 	StopCapture();
 	is_initialized_ = false;
 }
@@ -92,34 +139,113 @@ bool ScreenLive::StartLive(int type, LiveConfig& config)
 		return false;
 	}
 
+	if (type == SCREEN_LIVE_RTSP_SERVER) {
+		/* one local server, a new one takes the place of the old */
+		StopLive(SCREEN_LIVE_RTSP_SERVER);
+
+		auto rtsp_server = xop::RtspServer::Create(event_loop_.get());
+		if (!rtsp_server->Start(config.ip, config.port)) {
+			printf("RTSP Server: Listen on %s:%hu failed. \n", config.ip.c_str(), config.port);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> locker(mutex_);
+		rtsp_server_ = rtsp_server;
+		rtsp_server_config_ = config;
+
+		/* a session for every rendition: <suffix>, <suffix>_720p ... */
+		for (uint32_t rendition = 0; rendition <= rungs_.size(); rendition++) {
+			AddRtspSession(rendition);
+		}
+		return true;
+	}
+
+	std::shared_ptr<OutputRouter> output_router;
+	StreamInfo stream_info;
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		output_router = GetOutputRouter(config.rendition);
+		if (output_router != nullptr) {
+			stream_info = GetStreamInfo(config.rendition);
+		}
+	}
+
+	if (output_router == nullptr) {
+		printf("Rendition %u not found. \n", config.rendition);
+		return false;
+	}
+
+	if (type == SCREEN_LIVE_RTSP_PUSHER) {
+		auto rtsp_pusher = xop::RtspPusher::Create(event_loop_.get());
+		rtsp_pusher->AddSession(CreateMediaSession(config.suffix));
+		if (rtsp_pusher->OpenUrl(config.rtsp_url, 3000) < 0) {
+			printf("RTSP Pusher: Open url(%s) failed. \n", config.rtsp_url.c_str());
+			return false;
+		}
+
+		output_router->AddOutput(type, config.rtsp_url, std::make_shared<RtspOutput>(rtsp_pusher, stream_info));
+		printf("RTSP Pusher start: Push stream to %s ... \n", config.rtsp_url.c_str());
+		return true;
+	}
+	else if (type != SCREEN_LIVE_RTMP_PUSHER) {
+		return false;
+	}
 
 	auto rtmp_pusher = xop::RtmpPublisher::Create(event_loop_.get());
 
 	xop::MediaInfo mediaInfo;
-	uint8_t extradata[1024] = { 0 };
-	int  extradata_size = 0;
-
+	bool is_hevc = h264_encoder_.IsHevc();
+	mediaInfo.video_codec_id = is_hevc ? RTMP_CODEC_ID_H265 : RTMP_CODEC_ID_H264;
 
-	extradata_size = h264_encoder_.GetSequenceParams(extradata, 1024);
-	if (extradata_size <= 0) {
+	std::vector<std::vector<uint8_t>>& parameter_sets = stream_info.parameter_sets;
+	if (parameter_sets.empty()) {
 		printf("Get video specific config failed. \n");
 		return false;
 	}
 
-	xop::Nal sps = xop::H264Parser::findNal((uint8_t*)extradata, extradata_size);
-	if (sps.first != nullptr && sps.second != nullptr && ((*sps.first & 0x1f) == 7)) {
-		mediaInfo.sps_size = sps.second - sps.first + 1;
-		mediaInfo.sps.reset(new uint8_t[mediaInfo.sps_size], std::default_delete<uint8_t[]>());
-		memcpy(mediaInfo.sps.get(), sps.first, mediaInfo.sps_size);
-
-		xop::Nal pps = xop::H264Parser::findNal(sps.second, extradata_size - (sps.second - (uint8_t*)extradata));
-		if (pps.first != nullptr && pps.second != nullptr && ((*pps.first&0x1f) == 8)) {
-			mediaInfo.pps_size = pps.second - pps.first + 1;
-			mediaInfo.pps.reset(new uint8_t[mediaInfo.pps_size], std::default_delete<uint8_t[]>());
-			memcpy(mediaInfo.pps.get(), pps.first, mediaInfo.pps_size);
+	if (h264_encoder_.IsAv1()) {
+		/* sequence header obu */
+		std::vector<uint8_t>& seq_header = parameter_sets.front();
+		mediaInfo.video_codec_id = RTMP_CODEC_ID_AV1;
+		mediaInfo.sps.reset(new uint8_t[seq_header.size()], std::default_delete<uint8_t[]>());
+		mediaInfo.sps_size = (uint32_t)seq_header.size();
+		memcpy(mediaInfo.sps.get(), seq_header.data(), seq_header.size());
+	}
+	else {
+		for (auto& nal : parameter_sets) {
+			std::shared_ptr<uint8_t> data(new uint8_t[nal.size()], std::default_delete<uint8_t[]>());
+			memcpy(data.get(), nal.data(), nal.size());
+
+			/* h.264 sps:7 pps:8, h.265 vps:32 sps:33 pps:34 */
+			uint8_t nal_type = is_hevc ? ((nal[0] >> 1) & 0x3f) : (nal[0] & 0x1f);
+			if (is_hevc && nal_type == 32) {
+				mediaInfo.vps = data;
+				mediaInfo.vps_size = (uint32_t)nal.size();
+			}
+			else if (nal_type == (is_hevc ? 33 : 7)) {
+				mediaInfo.sps = data;
+				mediaInfo.sps_size = (uint32_t)nal.size();
+			}
+			else if (nal_type == (is_hevc ? 34 : 8)) {
+				mediaInfo.pps = data;
+				mediaInfo.pps_size = (uint32_t)nal.size();
+			}
 		}
 	}
 
+	uint8_t audio_specific_config[64] = { 0 };
+	int audio_specific_config_size = 0;
+	/* flv has no opus, the rtmp stream is video only then */
+	if (is_audio_started_ && !is_opus_) {
+		audio_specific_config_size = aac_encoder_.GetSpecificConfig(audio_specific_config, sizeof(audio_specific_config));
+	}
+
+	if (audio_specific_config_size > 0) {
+		mediaInfo.audio_specific_config.reset(new uint8_t[audio_specific_config_size], std::default_delete<uint8_t[]>());
+		mediaInfo.audio_specific_config_size = audio_specific_config_size;
+		memcpy(mediaInfo.audio_specific_config.get(), audio_specific_config, audio_specific_config_size);
+	}
+
 	rtmp_pusher->SetMediaInfo(mediaInfo);
 
 	std::string status;
@@ -128,8 +254,7 @@ bool ScreenLive::StartLive(int type, LiveConfig& config)
 		return false;
 	}
 
-	std::lock_guard<std::mutex> locker(mutex_);
-	rtmp_pusher_ = rtmp_pusher;
+	output_router->AddOutput(type, config.rtmp_url, std::make_shared<RtmpOutput>(rtmp_pusher, stream_info));
 	printf("RTMP Pusher start: Push stream to  %s ... \n", config.rtmp_url.c_str());
 
 	return true;
@@ -139,16 +264,28 @@ void ScreenLive::StopLive(int type)
 {
 	std::lock_guard<std::mutex> locker(mutex_);
 
+	for (uint32_t rendition = 0; rendition <= rungs_.size(); rendition++) {
+		GetOutputRouter(rendition)->RemoveOutputs(type);
+	}
+
 	switch (type)
 	{
-	case SCREEN_LIVE_RTMP_PUSHER:
-		if (rtmp_pusher_ != nullptr) {
-			rtmp_pusher_->Close();
-			rtmp_pusher_ = nullptr;
-			printf("RTMP Pusher stop. \n");
+	case SCREEN_LIVE_RTSP_SERVER:
+		if (rtsp_server_ != nullptr) {
+			rtsp_server_->Stop();
+			rtsp_server_ = nullptr;
+			printf("RTSP Server stop. \n");
 		}
 		break;
 
+	case SCREEN_LIVE_RTSP_PUSHER:
+		printf("RTSP Pusher stop. \n");
+		break;
+
+	case SCREEN_LIVE_RTMP_PUSHER:
+		printf("RTMP Pusher stop. \n");
+		break;
+
 	default:
 		break;
 	}
@@ -158,20 +295,62 @@ bool ScreenLive::IsConnected(int type)
 {
 	std::lock_guard<std::mutex> locker(mutex_);
 
-	bool is_connected = false;
-	switch (type)
-	{
-	case SCREEN_LIVE_RTMP_PUSHER:
-		if (rtmp_pusher_ != nullptr) {
-			is_connected = rtmp_pusher_->IsConnected();
+	for (uint32_t rendition = 0; rendition <= rungs_.size(); rendition++) {
+		if (GetOutputRouter(rendition)->IsConnected(type)) {
+			return true;
 		}
-		break;
+	}
 
-	default:
-		break;
+	return false;
+}
+
+std::shared_ptr<OutputRouter> ScreenLive::GetOutputRouter(uint32_t rendition)
+{
+	if (rendition == 0) {
+		/* not owned, output_router_ lives as long as ScreenLive */
+		return std::shared_ptr<OutputRouter>(std::shared_ptr<OutputRouter>(), &output_router_);
+	}
+
+	return (rendition <= rungs_.size()) ? rungs_[rendition - 1].output_router : nullptr;
+}
+
+StreamInfo ScreenLive::GetStreamInfo(uint32_t rendition)
+{
+	StreamInfo info;
+	info.is_av1 = h264_encoder_.IsAv1();
+	info.parameter_sets = (rendition > 0) ? rungs_[rendition - 1].parameter_sets : parameter_sets_;
+
+	if (is_audio_started_) {
+		info.is_opus = is_opus_;
+		info.audio_samplerate = is_opus_ ? opus_encoder_.GetSamplerate() : aac_encoder_.GetSamplerate();
+	}
+
+	return info;
+}
+
+xop::MediaSession* ScreenLive::CreateMediaSession(std::string suffix)
+{
+	xop::MediaSession* session = xop::MediaSession::CreateNew(suffix);
+	if (h264_encoder_.IsHevc()) {
+		session->AddSource(xop::channel_0, xop::H265Source::CreateNew(av_config_.framerate));
+	}
+	else if (h264_encoder_.IsAv1()) {
+		session->AddSource(xop::channel_0, xop::AV1Source::CreateNew(av_config_.framerate));
+	}
+	else {
+		session->AddSource(xop::channel_0, xop::H264Source::CreateNew(av_config_.framerate));
+	}
+
+	if (is_audio_started_ && is_opus_) {
+		session->AddSource(xop::channel_1, xop::OpusSource::CreateNew(opus_encoder_.GetChannel(),
+			opus_encoder_.GetFrameMsec()));
+	}
+	else if (is_audio_started_) {
+		session->AddSource(xop::channel_1, xop::AACSource::CreateNew(aac_encoder_.GetSamplerate(),
+			aac_encoder_.GetChannel(), false));
 	}
 
-	return is_connected;
+	return session;
 }
 
 int ScreenLive::StartCapture()
@@ -227,6 +406,8 @@ int ScreenLive::StopCapture()
 			delete screen_capture_;
 			screen_capture_ = nullptr;
 		}
+		audio_capture_.Destroy();
+		audio_source_.clear();
 		is_capture_started_ = false;
 	}
 
@@ -250,6 +431,16 @@ int ScreenLive::StartEncoder(AVConfig& config)
 	encoder_config.video.height = screen_capture_->GetHeight();
 
 	h264_encoder_.SetCodec(config.codec);
+	h264_encoder_.SetAsyncDepth(config.async_depth);
+	h264_encoder_.SetProfile(config.profile);
+	h264_encoder_.SetIntraRefresh(config.intra_refresh);
+	h264_encoder_.SetPacketCallback([this](const EncodedFrame& frame) {
+		/* 90kHz clock */
+		int latency = (int)((xop::H264Source::GetTimestamp() - frame.timestamp) / 90);
+		encoding_latency_ = (encoding_latency_ * 7 + latency) / 8;
+		encoding_frames_ += 1;
+		PushVideo(output_router_, frame);
+	});
 
 	if (!h264_encoder_.Init(av_config_.framerate, av_config_.bitrate_bps/1000,
 							AV_PIX_FMT_BGRA, screen_capture_->GetWidth(), 
@@ -257,8 +448,68 @@ int ScreenLive::StartEncoder(AVConfig& config)
 		return -1;
 	}
 
+	GetParameterSets(h264_encoder_, parameter_sets_);
+
+	/* the rungs share the capture and its conversion with the main encoder */
+	if (!av_config_.ladder.empty()) {
+		video_ladder_.SetPacketCallback([this](size_t index, const EncodedFrame& frame) {
+			PushVideo(*rungs_[index].output_router, frame);
+		});
+
+		video_ladder_.Init(av_config_.ladder, av_config_.codec, av_config_.profile, av_config_.intra_refresh,
+			av_config_.framerate, av_config_.bitrate_bps, screen_capture_->GetWidth(), screen_capture_->GetHeight());
+	}
+
+	/* 音频失败时只推视频 */
+	if (av_config_.audio_source != "none" && StartAudioEncoder() == 0) {
+		is_audio_started_ = true;
+	}
+
+	/* the new rungs get their rtsp sessions with the audio source, before the
+	   encoder threads push, the rung threads only wait for a frame until then */
+	UpdateRungs();
+
 	is_encoder_started_ = true;
 	encode_video_thread_.reset(new std::thread(&ScreenLive::EncodeVideo, this));
+	if (is_audio_started_) {
+		encode_audio_thread_.reset(new std::thread(&ScreenLive::EncodeAudio, this));
+	}
+
+	return 0;
+}
+
+int ScreenLive::StartAudioEncoder()
+{
+	if (!audio_capture_.CaptureStarted() || audio_source_ != av_config_.audio_source) {
+		audio_capture_.Destroy();
+		audio_source_.clear();
+
+		/* 1 second of 48kHz stereo */
+		if (!audio_capture_.Init(192000, av_config_.audio_source)) {
+			printf("Audio capture start failed, source: %s \n",
+				av_config_.audio_source.empty() ? "system" : av_config_.audio_source.c_str());
+			return -1;
+		}
+		audio_source_ = av_config_.audio_source;
+	}
+
+	/* wasapi is adjusted to 16 bits, the pcm source delivers 16 bits */
+	AVSampleFormat format = (audio_capture_.GetBitsPerSample() == 32) ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
+	is_opus_ = (av_config_.audio_codec == "opus");
+	if (is_opus_) {
+		if (!opus_encoder_.Init(audio_capture_.GetSamplerate(), audio_capture_.GetChannels(), format, 64,
+			av_config_.audio_frame_msec)) {
+			printf("Opus encoder init failed. \n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!aac_encoder_.Init(audio_capture_.GetSamplerate(), audio_capture_.GetChannels(), format, 128)) {
+		printf("AAC encoder init failed. \n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -272,36 +523,35 @@ int ScreenLive::StopEncoder()
 			encode_video_thread_ = nullptr;
 		}
 		h264_encoder_.Destroy();
-	}
 
-	return 0;
-}
-
-bool ScreenLive::IsKeyFrame(const uint8_t* data, uint32_t size)
-{
-	if (size > 4) {
-		//0x67:sps ,0x65:IDR, 0x6: SEI
-		if (data[4] == 0x67 || data[4] == 0x65 || 
-			data[4] == 0x6 || data[4] == 0x27) {
-			return true;
+		if (encode_audio_thread_) {
+			encode_audio_thread_->join();
+			encode_audio_thread_ = nullptr;
 		}
+		aac_encoder_.Destroy();
+		opus_encoder_.Destroy();
+		is_audio_started_ = false;
+
+		/* after the audio thread, the outputs of the rungs stay in rungs_ */
+		std::lock_guard<std::mutex> locker(mutex_);
+		video_ladder_.Destroy();
 	}
 
-	return false;
+	return 0;
 }
 
 void ScreenLive::EncodeVideo()
 {
 	static xop::Timestamp encoding_ts, update_ts;	
-	uint32_t encoding_fps = 0;
 	uint32_t msec = 1000 / av_config_.framerate;
+	std::vector<uint8_t> bgra_image;
 
+	encoding_frames_ = 0;
 
 	while (is_encoder_started_ && is_capture_started_) {
 		if (update_ts.Elapsed() >= 1000) {
 			update_ts.Reset();
-			encoding_fps_ = encoding_fps;
-			encoding_fps = 0;
+			encoding_fps_ = encoding_frames_.exchange(0);
 		}
 
 		uint32_t delay = msec;
@@ -316,39 +566,187 @@ void ScreenLive::EncodeVideo()
 		std::this_thread::sleep_for(std::chrono::milliseconds(delay));
 		encoding_ts.Reset();
 
-		std::vector<uint8_t> bgra_image;
 		uint32_t timestamp = xop::H264Source::GetTimestamp();
-		int frame_size = 0;
 		uint32_t width = 0, height = 0;
 
 		if (screen_capture_->CaptureFrame(bgra_image, width, height)) {
-			std::vector<uint8_t> out_frame;
-			if (h264_encoder_.Encode(&bgra_image[0], width, height, bgra_image.size(), out_frame) > 0) {
-				if (out_frame.size() > 0) {
-					encoding_fps += 1;
-					PushVideo(&out_frame[0], out_frame.size(), timestamp);
+			ffmpeg::AVFramePtr yuv_frame;
+			if (video_ladder_.GetSize() > 0) {
+				/* converted once, for the ladder and a software main encoder */
+				yuv_frame = video_ladder_.GetFrame();
+				if (yuv_frame != nullptr && libyuv::ARGBToI420(&bgra_image[0], width * 4,
+					yuv_frame->data[0], yuv_frame->linesize[0], yuv_frame->data[1], yuv_frame->linesize[1],
+					yuv_frame->data[2], yuv_frame->linesize[2], width, height) != 0) {
+					yuv_frame = nullptr;
 				}
 			}
+
+			if (yuv_frame == nullptr || h264_encoder_.Submit(yuv_frame, timestamp) < 0) {
+				h264_encoder_.Submit(&bgra_image[0], width, height, bgra_image.size(), timestamp);
+			}
+
+			if (yuv_frame != nullptr) {
+				video_ladder_.Submit(yuv_frame, timestamp);
+			}
 		}
+
+		/* deliver every finished frame through the packet callback */
+		h264_encoder_.Poll();
 	}
 
+	h264_encoder_.Flush();
 	encoding_fps_ = 0;
 }
 
-void ScreenLive::PushVideo(const uint8_t* data, uint32_t size, uint32_t timestamp)
+void ScreenLive::EncodeAudio()
 {
-	xop::AVFrame video_frame(size);
-	video_frame.size = size - 4; /* -4 去掉H.264起始码 */
-	video_frame.type = IsKeyFrame(data, size) ? xop::VIDEO_FRAME_I : xop::VIDEO_FRAME_P;
-	video_frame.timestamp = timestamp;
-	memcpy(video_frame.buffer.get(), data + 4, size - 4);
+	uint32_t frame_samples = is_opus_ ? opus_encoder_.GetFrames() : aac_encoder_.GetFrames();
+	uint32_t samplerate = audio_capture_.GetSamplerate();
+	uint32_t frame_size = frame_samples * audio_capture_.GetChannels() * audio_capture_.GetBitsPerSample() / 8;
+	std::vector<uint8_t> pcm(frame_size);
+	int64_t capture_usec = 0;
+
+	/* 丢弃编码器停止期间积压的数据 */
+	while (audio_capture_.Read(&pcm[0], frame_samples, capture_usec) > 0) {}
+
+	/* the timestamps count samples from start_usec, the capture clock only
+	   moves start_usec when it drifts away or samples were dropped */
+	int64_t start_usec = -1;
+	int64_t samples = 0;
+	std::vector<ffmpeg::AVPacketPtr> packets;
+
+	while (is_encoder_started_) {
+		if (audio_capture_.Read(&pcm[0], frame_samples, capture_usec) != (int)frame_samples) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
 
-	if (size > 0) {
-		std::lock_guard<std::mutex> locker(mutex_);
+		int64_t expected_usec = start_usec + samples * 1000000 / samplerate;
+		if (start_usec < 0 || std::abs(capture_usec - expected_usec) > 40000) {
+			start_usec = capture_usec - samples * 1000000 / samplerate;
+		}
+		samples += frame_samples;
+
+		if (is_opus_) {
+			/* pts counts 48kHz samples */
+			packets.clear();
+			opus_encoder_.Encode(&pcm[0], frame_samples, packets);
+			for (auto& pkt : packets) {
+				PushAudio(pkt->data, pkt->size, start_usec + pkt->pts * 1000000 / 48000);
+			}
+			continue;
+		}
+
+		ffmpeg::AVPacketPtr pkt = aac_encoder_.Encode(&pcm[0], frame_samples);
+		if (pkt != nullptr && pkt->size > 0) {
+			/* pts counts samples, the encoder delay included */
+			PushAudio(pkt->data, pkt->size, start_usec + pkt->pts * 1000000 / samplerate);
+		}
+	}
+}
+
+void ScreenLive::PushAudio(const uint8_t* data, uint32_t size, int64_t capture_usec)
+{
+	/* encoded once, one copy shared by all the outputs */
+	MediaPacket packet;
+	packet.is_video = false;
+	packet.data.reset(new uint8_t[size], std::default_delete<uint8_t[]>());
+	packet.size = size;
+	packet.capture_usec = capture_usec;
+	memcpy(packet.data.get(), data, size);
+	output_router_.PushPacket(packet);
+
+	/* the rungs share the audio of the main stream */
+	for (auto& rung : rungs_) {
+		rung.output_router->PushPacket(packet);
+	}
+}
+
+void ScreenLive::UpdateRungs()
+{
+	/* a rung of the same height keeps its outputs, those of a rung gone or
+	   resized are stopped, the rtsp server gets a session for every new rung */
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (size_t index = 0; index < rungs_.size(); index++) {
+		VideoLadder::Rendition* rendition = video_ladder_.GetRendition(index);
+		if (rendition == nullptr || rendition->height != rungs_[index].height) {
+			if (!rungs_[index].output_router->GetOutputs().empty()) {
+				printf("Rendition %u: %up removed, its outputs are stopped. \n",
+					(uint32_t)index + 1, rungs_[index].height);
+			}
+			rungs_[index].output_router->RemoveOutputs(-1);
+			rungs_[index].height = 0;
+		}
+	}
+
+	rungs_.resize(video_ladder_.GetSize());
+
+	for (size_t index = 0; index < rungs_.size(); index++) {
+		VideoLadder::Rendition* rendition = video_ladder_.GetRendition(index);
+		Rung& rung = rungs_[index];
+		bool is_new = (rung.height == 0);
+		rung.width = rendition->width;
+		rung.height = rendition->height;
+		rung.bitrate_bps = rendition->bitrate_bps;
+		GetParameterSets(rendition->encoder, rung.parameter_sets);
+		if (rung.output_router == nullptr) {
+			rung.output_router = std::make_shared<OutputRouter>();
+		}
 
-		/* RTMP推流 */
-		if (rtmp_pusher_ != nullptr && rtmp_pusher_->IsConnected()) {
-			rtmp_pusher_->PushVideoFrame(video_frame.buffer.get(), video_frame.size);
+		if (is_new && rtsp_server_ != nullptr) {
+			AddRtspSession((uint32_t)index + 1);
 		}
 	}
+}
+
+void ScreenLive::AddRtspSession(uint32_t rendition)
+{
+	std::string suffix = rtsp_server_config_.suffix;
+	if (rendition > 0) {
+		suffix += "_" + std::to_string(rungs_[rendition - 1].height) + "p";
+	}
+
+	xop::MediaSessionId session_id = rtsp_server_->AddSession(CreateMediaSession(suffix));
+	std::string name = "rtsp://" + rtsp_server_config_.ip + ":" + std::to_string(rtsp_server_config_.port) + "/" + suffix;
+	GetOutputRouter(rendition)->AddOutput(SCREEN_LIVE_RTSP_SERVER, name,
+		std::make_shared<RtspOutput>(rtsp_server_, session_id, GetStreamInfo(rendition)));
+	printf("RTSP Server start: Play stream from %s ... \n", name.c_str());
+}
+
+void ScreenLive::GetParameterSets(H264Encoder& encoder, std::vector<std::vector<uint8_t>>& parameter_sets)
+{
+	uint8_t extradata[1024] = { 0 };
+	int extradata_size = encoder.GetSequenceParams(extradata, 1024);
+
+	parameter_sets.clear();
+	if (extradata_size > 0 && encoder.IsAv1()) {
+		/* an av1C record carries the sequence header obu after its 4 bytes */
+		uint32_t offset = (extradata[0] == 0x81 && extradata_size > 4) ? 4 : 0;
+		parameter_sets.emplace_back(extradata + offset, extradata + extradata_size);
+	}
+	else if (extradata_size > 0) {
+		xop::H264Parser::ForEachNal(extradata, extradata_size, [&parameter_sets](const uint8_t* nal, uint32_t nal_size) {
+			parameter_sets.emplace_back(nal, nal + nal_size);
+			return true;
+		});
+	}
+}
+
+void ScreenLive::PushVideo(OutputRouter& output_router, const EncodedFrame& frame)
+{
+	if (frame.size <= 4) {
+		return;
+	}
+
+	/* the outputs share the encoder's arena slot, it is reused once the last
+	   output has sent it. The output queues are bounded, so are the slots held. */
+	MediaPacket packet;
+	packet.is_video = true;
+	packet.data = frame.data;
+	packet.size = frame.size;
+	packet.is_key_frame = frame.is_key_frame;
+	packet.timestamp = frame.timestamp;
+	packet.composition_time = frame.composition_time;
+	output_router.PushPacket(packet);
 }
\ No newline at end of file
@@ -1,16 +1,20 @@
 ﻿#ifndef SCREEN_LIVE_H
 #define SCREEN_LIVE_H
  
-#include "xop/RtspServer.h"
-#include "xop/RtspPusher.h"
-#include "xop/RtmpPublisher.h"
+#include "OutputRouter.h"
+#include "VideoLadder.h"
 #include "H264Encoder.h"
+#include "AACEncoder.h"
+#include "OpusEncoder.h"
+#include "AudioCapture/AudioCapture.h"
 #include "ScreenCapture/ScreenCapture.h"
-#include <mutex>
 #include <atomic>
+#include <mutex>
 #include <string>
 #include <set>
 
+#define SCREEN_LIVE_RTSP_SERVER 1
+#define SCREEN_LIVE_RTSP_PUSHER 2
 #define SCREEN_LIVE_RTMP_PUSHER 3
 
 struct AVConfig
@@ -19,21 +23,50 @@ struct AVConfig
 	uint32_t framerate = 25;
 	//uint32_t gop = 25;
 
-	std::string codec = "x264"; // [software codec: "x264"]  [hardware codec: "h264_nvenc, h264_qsv"]
+	std::string codec = "x264"; // [software codec: "x264", "x265", "av1"]  [hardware codec: "h264_nvenc, h264_qsv, hevc_nvenc, hevc_qsv"]
+
+	uint32_t async_depth = 1; // frames in flight in the hardware encoders, 1: lowest latency
+
+	std::string profile = "low-latency"; // x264: "low-latency", "balanced", "quality"
+
+	bool intra_refresh = false; // no periodic idr frames, avoids the bitrate spike of each gop
+
+	std::string audio_source = ""; // "": system audio, "none": video only, "sine" or a wav file
+
+	std::string audio_codec = "aac"; // "aac", "opus": rtsp only, the rtmp stream carries no audio
+	uint32_t audio_frame_msec = 20;  // opus: 10 or 20
+
+	std::vector<LadderRung> ladder; // lower renditions next to the captured one, e.g. 720p and 480p, encoded in software
 
 	bool operator != (const AVConfig &src) const {
 		if (src.bitrate_bps != bitrate_bps || src.framerate != framerate ||
-			src.codec != codec) {
+			src.codec != codec || src.async_depth != async_depth ||
+			src.profile != profile || src.intra_refresh != intra_refresh ||
+			src.audio_source != audio_source || src.audio_codec != audio_codec ||
+			src.audio_frame_msec != audio_frame_msec || src.ladder.size() != ladder.size()) {
 			return true;
 		}
+		for (size_t i = 0; i < ladder.size(); i++) {
+			if (src.ladder[i] != ladder[i]) {
+				return true;
+			}
+		}
 		return false;
 	}
 };
 
 struct LiveConfig
 {
+	// server
+	std::string ip = "0.0.0.0";
+	uint16_t port = 8554;
+	std::string suffix = "live";
+
 	// pusher
 	std::string rtmp_url;
+	std::string rtsp_url;
+
+	uint32_t rendition = 0; // pusher: 0 the captured resolution, n rung n of the ladder. the server serves all of them
 };
 
 class ScreenLive
@@ -55,6 +88,8 @@ public:
 	int StopEncoder();
 	bool IsEncoderInitialized() { return is_encoder_started_; };
 
+	/* every pusher started is one more output of the same encode,
+	   StopLive stops all the outputs of the type */
 	bool StartLive(int type, LiveConfig& config);
 	void StopLive(int type);
 	bool IsConnected(int type);
@@ -67,30 +102,67 @@ private:
 	ScreenLive();
 	
 	void EncodeVideo();
-	void PushVideo(const uint8_t* data, uint32_t size, uint32_t timestamp);
-	bool IsKeyFrame(const uint8_t* data, uint32_t size);
+	void PushVideo(OutputRouter& output_router, const EncodedFrame& frame);
+	void GetParameterSets(H264Encoder& encoder, std::vector<std::vector<uint8_t>>& parameter_sets);
+	void UpdateRungs();
+
+	/* under mutex_ */
+	void AddRtspSession(uint32_t rendition);
+	std::shared_ptr<OutputRouter> GetOutputRouter(uint32_t rendition);
+	StreamInfo GetStreamInfo(uint32_t rendition);
+	xop::MediaSession* CreateMediaSession(std::string suffix);
+
+	int  StartAudioEncoder();
+	void EncodeAudio();
+	void PushAudio(const uint8_t* data, uint32_t size, int64_t capture_usec);
 
 	bool is_initialized_ = false;
 	bool is_capture_started_ = false;
 	bool is_encoder_started_ = false;
 
 	AVConfig av_config_;
-	std::mutex mutex_;
 
 	// capture
 	ScreenCapture* screen_capture_ = nullptr;
+	AudioCapture audio_capture_;
+	std::string audio_source_;
 
     // encoder
 	H264Encoder h264_encoder_;
 	std::shared_ptr<std::thread> encode_video_thread_ = nullptr;
+	std::vector<std::vector<uint8_t>> parameter_sets_; // (vps) sps pps, without start code, av1: sequence header obu
+	VideoLadder video_ladder_;
+	AACEncoder aac_encoder_;
+	OpusEncoder opus_encoder_;
+	bool is_opus_ = false;
+	std::atomic_bool is_audio_started_;
+	std::shared_ptr<std::thread> encode_audio_thread_ = nullptr;
 
 	// streamer
-	xop::MediaSessionId media_session_id_ = 0;
 	std::unique_ptr<xop::EventLoop> event_loop_ = nullptr;
-	std::shared_ptr<xop::RtmpPublisher> rtmp_pusher_ = nullptr;
+	std::shared_ptr<xop::RtspServer> rtsp_server_ = nullptr; // one session for every rendition
+	LiveConfig rtsp_server_config_;
+	OutputRouter output_router_;
+
+	/* the outputs of a rung, kept over encoder restarts like those of output_router_ */
+	struct Rung
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t bitrate_bps = 0;
+		std::vector<std::vector<uint8_t>> parameter_sets; // as parameter_sets_
+		std::shared_ptr<OutputRouter> output_router;
+	};
+
+	/* rungs_ and rtsp_server_. rungs_ is resized only before the encoder threads
+	   push and after they stopped, they read it without the lock */
+	std::mutex mutex_;
+	std::vector<Rung> rungs_; // rendition n at n - 1
 
 	// status info
 	std::atomic_int encoding_fps_;
+	std::atomic_int encoding_frames_;
+	std::atomic_int encoding_latency_; // capture to packet, msec
 };
 
 #endif
@@ -0,0 +1,198 @@
+#include "VideoLadder.h"
+#include "libyuv.h"
+#include <algorithm>
+#include <cstdio>
+
+VideoLadder::VideoLadder()
+{
+
+}
+
+VideoLadder::~VideoLadder()
+{
+	Destroy();
+}
+
+std::string VideoLadder::GetSoftwareCodec(std::string codec)
+{
+	if (codec == "h264_nvenc" || codec == "h264_qsv") {
+		return "x264";
+	}
+	else if (codec == "hevc_nvenc" || codec == "hevc_qsv") {
+		return "x265";
+	}
+
+	return codec;
+}
+
+void VideoLadder::SetPacketCallback(const PacketCallback& callback)
+{
+	packet_callback_ = callback;
+}
+
+bool VideoLadder::Init(const std::vector<LadderRung>& rungs, std::string codec, std::string profile, bool intra_refresh,
+	uint32_t framerate, uint32_t bitrate_bps, uint32_t width, uint32_t height)
+{
+	Destroy();
+
+	if (width == 0 || height == 0) {
+		return false;
+	}
+
+	std::vector<LadderRung> ladder = rungs;
+	std::sort(ladder.begin(), ladder.end(), [](const LadderRung& a, const LadderRung& b) {
+		return a.height > b.height;
+	});
+
+	for (auto& rung : ladder) {
+		/* even sizes for the 4:2:0 chroma planes */
+		uint32_t out_height = rung.height & ~1u;
+		uint32_t out_width = (uint32_t)((uint64_t)width * out_height / height) & ~1u;
+		if (out_height < 2 || out_width < 2 || out_height >= height ||
+			(!renditions_.empty() && out_height >= renditions_.back()->height)) {
+			continue;
+		}
+
+		uint32_t bitrate = rung.bitrate_bps;
+		if (bitrate == 0) {
+			bitrate = (uint32_t)((uint64_t)bitrate_bps * out_width * out_height / ((uint64_t)width * height));
+		}
+
+		size_t index = renditions_.size();
+		std::unique_ptr<Rendition> rendition(new Rendition);
+		Rendition* r = rendition.get();
+		r->width = out_width;
+		r->height = out_height;
+		r->bitrate_bps = bitrate;
+		r->encoder.SetCodec(GetSoftwareCodec(codec));
+		r->encoder.SetProfile(profile);
+		r->encoder.SetIntraRefresh(intra_refresh);
+		r->encoder.SetPacketCallback([this, index](const EncodedFrame& frame) {
+			if (packet_callback_) {
+				packet_callback_(index, frame);
+			}
+		});
+
+		if (!r->frame_pool.Init(out_width, out_height, AV_PIX_FMT_YUV420P) ||
+			!r->encoder.Init(framerate, bitrate / 1000, AV_PIX_FMT_YUV420P, out_width, out_height)) {
+			printf("Ladder: %ux%u encoder init failed. \n", out_width, out_height);
+			Destroy();
+			return false;
+		}
+
+		printf("Ladder: %ux%u %ukbps \n", out_width, out_height, bitrate / 1000);
+		renditions_.push_back(std::move(rendition));
+	}
+
+	if (!renditions_.empty() && !frame_pool_.Init(width, height, AV_PIX_FMT_YUV420P)) {
+		Destroy();
+		return false;
+	}
+
+	for (size_t index = 0; index < renditions_.size(); index++) {
+		renditions_[index]->is_running = true;
+		renditions_[index]->thread.reset(new std::thread(&VideoLadder::Run, this, index));
+	}
+
+	return !renditions_.empty();
+}
+
+void VideoLadder::Destroy()
+{
+	/* from the top down, a stopped rung hands no more frames down */
+	for (auto& rendition : renditions_) {
+		{
+			std::lock_guard<std::mutex> lock(rendition->mutex);
+			rendition->is_running = false;
+			rendition->pending = nullptr;
+			rendition->cv.notify_one();
+		}
+
+		if (rendition->thread) {
+			rendition->thread->join();
+			rendition->thread = nullptr;
+		}
+
+		rendition->encoder.Destroy();
+		rendition->frame_pool.Destroy();
+	}
+
+	renditions_.clear();
+	frame_pool_.Destroy();
+}
+
+ffmpeg::AVFramePtr VideoLadder::GetFrame()
+{
+	return frame_pool_.GetFrame();
+}
+
+void VideoLadder::Submit(ffmpeg::AVFramePtr frame, uint32_t timestamp)
+{
+	if (!renditions_.empty()) {
+		Queue(0, frame, timestamp);
+	}
+}
+
+void VideoLadder::Queue(size_t index, ffmpeg::AVFramePtr frame, uint32_t timestamp)
+{
+	Rendition& rendition = *renditions_[index];
+
+	std::lock_guard<std::mutex> lock(rendition.mutex);
+	if (!rendition.is_running) {
+		return;
+	}
+
+	if (rendition.pending != nullptr) {
+		rendition.skipped_frames += 1;
+	}
+
+	rendition.pending = frame;
+	rendition.pending_timestamp = timestamp;
+	rendition.cv.notify_one();
+}
+
+void VideoLadder::Run(size_t index)
+{
+	Rendition& rendition = *renditions_[index];
+
+	while (true) {
+		ffmpeg::AVFramePtr src;
+		uint32_t timestamp = 0;
+		{
+			std::unique_lock<std::mutex> lock(rendition.mutex);
+			rendition.cv.wait(lock, [&rendition] {
+				return !rendition.is_running || rendition.pending != nullptr;
+			});
+
+			if (!rendition.is_running) {
+				break;
+			}
+
+			src.swap(rendition.pending);
+			timestamp = rendition.pending_timestamp;
+		}
+
+		ffmpeg::AVFramePtr frame = rendition.frame_pool.GetFrame();
+		if (frame == nullptr) {
+			continue;
+		}
+
+		libyuv::I420Scale(src->data[0], src->linesize[0], src->data[1], src->linesize[1],
+			src->data[2], src->linesize[2], src->width, src->height,
+			frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+			frame->data[2], frame->linesize[2], rendition.width, rendition.height,
+			libyuv::kFilterBox);
+		src = nullptr;
+
+		/* the rung below scales this level while this one encodes */
+		if (index + 1 < renditions_.size()) {
+			Queue(index + 1, frame, timestamp);
+		}
+
+		if (rendition.encoder.Submit(frame, timestamp) == 0) {
+			rendition.encoder.Poll();
+		}
+	}
+
+	rendition.encoder.Flush();
+}
@@ -0,0 +1,86 @@
+#ifndef SCREEN_LIVE_VIDEO_LADDER_H
+#define SCREEN_LIVE_VIDEO_LADDER_H
+
+#include "H264Encoder.h"
+#include "avcodec/frame_pool.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct LadderRung
+{
+	uint32_t height = 0;      /* the width keeps the aspect ratio of the capture */
+	uint32_t bitrate_bps = 0; /* 0: the bitrate of the main stream scaled by the pixel count */
+
+	bool operator != (const LadderRung &src) const {
+		return src.height != height || src.bitrate_bps != bitrate_bps;
+	}
+};
+
+/* Lower renditions of the captured screen, each one encoded and published on
+   its own. The capture is converted to I420 once, every rung scales the level
+   above it (libyuv, SIMD) on its own thread, hands its level down and feeds its
+   encoder, so no level is converted or scaled twice and the encoders run side
+   by side. A rung still busy with the last frame skips the next one. The frames
+   of each level come from a pool of that size. */
+class VideoLadder
+{
+public:
+	struct Rendition
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t bitrate_bps = 0;
+		H264Encoder encoder;
+		ffmpeg::FramePool frame_pool;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		ffmpeg::AVFramePtr pending; /* the latest frame of the level above */
+		uint32_t pending_timestamp = 0;
+		uint32_t skipped_frames = 0;
+		bool is_running = false;
+		std::shared_ptr<std::thread> thread;
+	};
+
+	using PacketCallback = std::function<void(size_t index, const EncodedFrame& frame)>;
+
+	VideoLadder & operator=(const VideoLadder &) = delete;
+	VideoLadder(const VideoLadder &) = delete;
+	VideoLadder();
+	~VideoLadder();
+
+	/* the settings of the main stream, hardware codecs run as their software one,
+	   rungs not below the captured height are left out */
+	bool Init(const std::vector<LadderRung>& rungs, std::string codec, std::string profile, bool intra_refresh,
+		uint32_t framerate, uint32_t bitrate_bps, uint32_t width, uint32_t height);
+	void Destroy();
+
+	void SetPacketCallback(const PacketCallback& callback); /* before Init(), called on the rung threads */
+
+	/* the captured frame in yuv420p, from the capture thread */
+	ffmpeg::AVFramePtr GetFrame(); /* of the captured size, for Submit() */
+	void Submit(ffmpeg::AVFramePtr frame, uint32_t timestamp);
+
+	size_t GetSize() const
+	{ return renditions_.size(); }
+
+	Rendition* GetRendition(size_t index)
+	{ return index < renditions_.size() ? renditions_[index].get() : nullptr; }
+
+	static std::string GetSoftwareCodec(std::string codec);
+
+private:
+	void Queue(size_t index, ffmpeg::AVFramePtr frame, uint32_t timestamp);
+	void Run(size_t index);
+
+	PacketCallback packet_callback_;
+	ffmpeg::FramePool frame_pool_; /* the captured size */
+	std::vector<std::unique_ptr<Rendition>> renditions_; /* from the largest down */
+};
+
+#endif
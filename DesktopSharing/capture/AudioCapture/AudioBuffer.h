@@ -2,18 +2,25 @@
 #define AUIDO_BUFFER_H
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
-#include <string>
-#include <memory>  
-#include <mutex>
+#include <atomic>
 
+/* Lock-free ring for one producer (the capture thread) and one consumer
+   (the audio encode thread). The indexes only grow, the position in the
+   ring is index & (capacity - 1), so the capacity is a power of two. */
 class AudioBuffer
 {
 public:
 	AudioBuffer(uint32_t size = 10240) 
-		: _bufferSize(size)
 	{
-		_buffer.resize(size);
+		uint32_t capacity = 1024;
+		while (capacity < size) {
+			capacity <<= 1;
+		}
+
+		_buffer.resize(capacity);
+		_mask = capacity - 1;
 	}
 
 	~AudioBuffer()
@@ -21,134 +28,80 @@ public:
 
 	}
 
+	/* producer, all or nothing: a partial write would shift the timing of every
+	   sample after it, returns 0 if the ring is full */
 	int write(const char *data, uint32_t size)
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
-		uint32_t bytes = writableBytes();
+		uint32_t writer_index = _writerIndex.load(std::memory_order_relaxed);
+		uint32_t reader_index = _readerIndex.load(std::memory_order_acquire);
 
-		if (bytes < size)
-		{			
-			size = bytes;
+		if (size == 0 || size > capacity() - (writer_index - reader_index)) {
+			return 0;
 		}
 
-		if (size > 0)
-		{
-			memcpy(beginWrite(), data, size);
-			_writerIndex += size;
-		}
-
-		retrieve(0);
+		copyIn(writer_index, data, size);
+		_writerIndex.store(writer_index + size, std::memory_order_release);
 		return size;
 	}
 
+	/* consumer, returns -1 if less than size bytes are buffered */
 	int read(char *data, uint32_t size)
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
-		if (size > readableBytes())
-		{		
-			retrieve(0);
+		uint32_t reader_index = _readerIndex.load(std::memory_order_relaxed);
+		uint32_t writer_index = _writerIndex.load(std::memory_order_acquire);
+
+		if (size > writer_index - reader_index) {
 			return -1;
 		}
 
-		memcpy(data, peek(), size);
-		retrieve(size);
+		copyOut(reader_index, data, size);
+		_readerIndex.store(reader_index + size, std::memory_order_release);
 		return size;
 	}
 
-	uint32_t size()
+	/* readable bytes, exact for the consumer, a lower bound for the producer */
+	uint32_t size() const
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
-		return readableBytes();
+		return _writerIndex.load(std::memory_order_acquire) - _readerIndex.load(std::memory_order_acquire);
 	}
 
-	void clear()
+	uint32_t capacity() const
 	{
-		std::lock_guard<std::mutex> lock(_mutex);
-		retrieveAll();
+		return _mask + 1;
 	}
 
-private:
-
-	uint32_t readableBytes() const
-	{
-		return _writerIndex - _readerIndex;
-	}
-
-	uint32_t writableBytes() const
-	{
-		return _buffer.size() - _writerIndex;
-	}
-
-	char* peek()
-	{
-		return begin() + _readerIndex;
-	}
-
-	const char* peek() const
-	{
-		return begin() + _readerIndex;
-	}
-
-	void retrieveAll()
-	{
-		_writerIndex = 0;
-		_readerIndex = 0;
-	}
-
-	void retrieve(size_t len)
-	{
-		if (len > 0)
-		{
-			if (len <= readableBytes())
-			{
-				_readerIndex += len;
-				if (_readerIndex == _writerIndex)
-				{
-					_readerIndex = 0;
-					_writerIndex = 0;
-				}
-			}
-		}
-
-		if (_readerIndex > 0 && _writerIndex > 0)
-		{
-			_buffer.erase(_buffer.begin(), _buffer.begin() + _readerIndex);
-			_buffer.resize(_bufferSize);
-			_writerIndex -= _readerIndex;
-			_readerIndex = 0;		
-		}
-	}
-
-	void retrieveUntil(const char* end)
-	{
-		retrieve(end - peek());
-	}
-
-	char* begin()
-	{
-		return &*_buffer.begin();
-	}
-
-	const char* begin() const
+	/* consumer, drops everything written so far */
+	void clear()
 	{
-		return &*_buffer.begin();
+		_readerIndex.store(_writerIndex.load(std::memory_order_acquire), std::memory_order_release);
 	}
 
-	char* beginWrite()
+private:
+	void copyIn(uint32_t index, const char *data, uint32_t size)
 	{
-		return begin() + _writerIndex;
+		uint32_t pos = index & _mask;
+		uint32_t first = (size < capacity() - pos) ? size : capacity() - pos;
+		memcpy(&_buffer[pos], data, first);
+		memcpy(&_buffer[0], data + first, size - first);
 	}
 
-	const char* beginWrite() const
+	void copyOut(uint32_t index, char *data, uint32_t size) const
 	{
-		return begin() + _writerIndex;
+		uint32_t pos = index & _mask;
+		uint32_t first = (size < capacity() - pos) ? size : capacity() - pos;
+		memcpy(data, &_buffer[pos], first);
+		memcpy(data + first, &_buffer[0], size - first);
 	}
 
-	std::mutex _mutex;
-	uint32_t _bufferSize = 0;
 	std::vector<char> _buffer;
-	size_t _readerIndex = 0;
-	size_t _writerIndex = 0;
+	uint32_t _mask = 0;
+
+	/* on separate cache lines, each one is written by a single thread */
+	char _pad0[64];
+	std::atomic<uint32_t> _writerIndex{ 0 };
+	char _pad1[64];
+	std::atomic<uint32_t> _readerIndex{ 0 };
+	char _pad2[64];
 };
 
-#endif
\ No newline at end of file
+#endif
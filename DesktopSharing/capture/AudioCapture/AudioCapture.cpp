@@ -1,10 +1,17 @@
 ﻿#include "AudioCapture.h"
 #include "net/log.h"
 #include "net/Timestamp.h"
+#include <chrono>
+
+static int64_t GetSteadyClockUsec()
+{
+	auto time_point = std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::steady_clock::now());
+	return time_point.time_since_epoch().count();
+}
 
 AudioCapture::AudioCapture()
 {
-   
+	clock_anchor_ = 0;
 }
 
 AudioCapture::~AudioCapture()
@@ -12,13 +19,23 @@ AudioCapture::~AudioCapture()
     
 }
 
-bool AudioCapture::Init(uint32_t buffer_size)
+bool AudioCapture::Init(uint32_t buffer_size, std::string pcm_source)
 {
 	if (is_initialized_) {
 		return true;
 	}
 
-	if (capture_.init() < 0) {
+	if (!pcm_source.empty()) {
+		pcm_source_.reset(new PcmSource());
+		if (!pcm_source_->Open(pcm_source)) {
+			pcm_source_.reset();
+			return false;
+		}
+		channels_ = pcm_source_->GetChannels();
+		samplerate_ = pcm_source_->GetSamplerate();
+		bits_per_sample_ = pcm_source_->GetBitsPerSample();
+	}
+	else if (capture_.init() < 0) {
 		return false;
 	}
 	else {
@@ -43,6 +60,7 @@ void AudioCapture::Destroy()
 {
 	if (is_initialized_) {
 		StopCapture();
+		pcm_source_.reset();
 		is_initialized_ = false;
 	}
 }
@@ -64,11 +82,21 @@ int AudioCapture::StartCapture()
 		channels_ = mixFormat->nChannels;
 		samplerate_ = mixFormat->nSamplesPerSec;
 		bits_per_sample_ = mixFormat->wBitsPerSample;
-		audio_buffer_->write((char*)data, mixFormat->nBlockAlign * samples);
+		OnCapture(data, samples);
 	});
 
 	audio_buffer_->clear();
-	if (capture_.start() < 0) {
+	start_usec_ = GetSteadyClockUsec();
+	samples_written_ = 0;
+	samples_read_ = 0;
+	clock_anchor_ = 0;
+
+	if (pcm_source_) {
+		if (!pcm_source_->Start([this](uint8_t *data, uint32_t samples) { OnCapture(data, samples); })) {
+			return -1;
+		}
+	}
+	else if (capture_.start() < 0) {
 		return -1;
 	}
 	else {
@@ -83,19 +111,50 @@ int AudioCapture::StartCapture()
 
 int AudioCapture::StopCapture()
 {
-	player_.stop();
-	capture_.stop();
+	if (pcm_source_) {
+		pcm_source_->Stop();
+	}
+	else {
+		player_.stop();
+		capture_.stop();
+	}
 	is_started_ = false;
 	return 0;
 }
 
+void AudioCapture::OnCapture(uint8_t *data, uint32_t samples)
+{
+	uint32_t size = samples * bits_per_sample_ / 8 * channels_;
+
+	/* a full ring drops the whole packet, the anchor keeps the timing right */
+	if (audio_buffer_->write((char*)data, size) == (int)size) {
+		samples_written_ += samples;
+		uint64_t elapsed_msec = (uint64_t)(GetSteadyClockUsec() - start_usec_) / 1000;
+		clock_anchor_.store((elapsed_msec << 32) | samples_written_, std::memory_order_release);
+	}
+}
+
 int AudioCapture::Read(uint8_t *data, uint32_t samples)
+{
+	int64_t capture_usec = 0;
+	return Read(data, samples, capture_usec);
+}
+
+int AudioCapture::Read(uint8_t *data, uint32_t samples, int64_t& capture_usec)
 {
 	if ((int)samples > this->GetSamples()) {
 		return 0;
 	}
 
-	audio_buffer_->read((char*)data, samples * bits_per_sample_ / 8 * channels_);
+	if (audio_buffer_->read((char*)data, samples * bits_per_sample_ / 8 * channels_) < 0) {
+		return 0;
+	}
+
+	/* the anchor is the time its last sample arrived, count back to the first one read */
+	uint64_t anchor = clock_anchor_.load(std::memory_order_acquire);
+	int32_t pending_samples = (int32_t)((uint32_t)anchor - samples_read_);
+	capture_usec = start_usec_ + (int64_t)(anchor >> 32) * 1000 - (int64_t)pending_samples * 1000000 / samplerate_;
+	samples_read_ += samples;
 	return samples;
 }
 
@@ -7,6 +7,9 @@
 #include "AudioCapture/WASAPICapture.h"
 #include "AudioCapture/WASAPIPlayer.h"
 #include "AudioBuffer.h"
+#include "PcmSource.h"
+#include <atomic>
+#include <string>
 
 class AudioCapture
 {
@@ -14,10 +17,15 @@ public:
 	AudioCapture();
 	virtual ~AudioCapture();
 
-	bool Init(uint32_t buffer_size = 20480);
+	/* pcm_source: "" for the system audio (wasapi loopback), "sine" or a wav file */
+	bool Init(uint32_t buffer_size = 20480, std::string pcm_source = "");
 	void Destroy();
 	
 	int Read(uint8_t*data,uint32_t samples);
+
+	/* capture_usec: steady clock time of the first sample read, the same clock
+	   as the video timestamps. Follows the sample count between callbacks. */
+	int Read(uint8_t*data, uint32_t samples, int64_t& capture_usec);
 	int GetSamples();
 
 	uint32_t GetSamplerate() const
@@ -35,6 +43,7 @@ public:
 private:
 	int StartCapture();
 	int StopCapture();
+	void OnCapture(uint8_t *data, uint32_t samples);
 	
 	bool is_initialized_ = false;
 	bool is_started_ = false;
@@ -45,7 +54,14 @@ private:
 
 	WASAPIPlayer player_;
 	WASAPICapture capture_;
+	std::unique_ptr<PcmSource> pcm_source_;
 	std::unique_ptr<AudioBuffer> audio_buffer_;
+
+	/* elapsed msec << 32 | samples written, published after each write */
+	int64_t start_usec_ = 0;
+	uint32_t samples_written_ = 0;
+	uint32_t samples_read_ = 0;
+	std::atomic<uint64_t> clock_anchor_;
 };
 
 #endif
\ No newline at end of file
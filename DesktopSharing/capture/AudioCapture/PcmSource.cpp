@@ -0,0 +1,174 @@
+﻿#include "PcmSource.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+namespace
+{
+
+uint32_t ReadUint16LE(const uint8_t *p)
+{ return p[0] | (p[1] << 8); }
+
+uint32_t ReadUint32LE(const uint8_t *p)
+{ return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+}
+
+PcmSource::PcmSource()
+{
+	is_started_ = false;
+}
+
+PcmSource::~PcmSource()
+{
+	Stop();
+}
+
+bool PcmSource::Open(std::string source)
+{
+	if (is_started_) {
+		return false;
+	}
+
+	samples_.clear();
+	position_ = 0;
+
+	if (source != "sine") {
+		return ReadWav(source);
+	}
+
+	/* one second holds a whole number of 440 Hz periods, the loop is seamless */
+	samplerate_ = 48000;
+	channels_ = 2;
+	samples_.resize(samplerate_ * channels_);
+	for (uint32_t i = 0; i < samplerate_; i++) {
+		double value = sin(2.0 * 3.14159265358979323846 * 440.0 * i / samplerate_);
+		int16_t sample = (int16_t)(value * 8192);
+		for (uint32_t ch = 0; ch < channels_; ch++) {
+			samples_[i * channels_ + ch] = sample;
+		}
+	}
+
+	return true;
+}
+
+bool PcmSource::ReadWav(std::string path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		printf("[PcmSource] open %s failed. \n", path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> wav((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (wav.size() < 12 || memcmp(wav.data(), "RIFF", 4) != 0 || memcmp(wav.data() + 8, "WAVE", 4) != 0) {
+		printf("[PcmSource] %s is not a wav file. \n", path.c_str());
+		return false;
+	}
+
+	uint32_t format_tag = 0, bits_per_sample = 0;
+	const uint8_t *data = nullptr;
+	uint32_t data_size = 0;
+	size_t pos = 12;
+
+	while (pos + 8 <= wav.size()) {
+		const uint8_t *chunk = wav.data() + pos;
+		uint32_t chunk_size = ReadUint32LE(chunk + 4);
+		if (chunk_size > wav.size() - pos - 8) {
+			chunk_size = (uint32_t)(wav.size() - pos - 8);
+		}
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+			format_tag = ReadUint16LE(chunk + 8);
+			channels_ = ReadUint16LE(chunk + 10);
+			samplerate_ = ReadUint32LE(chunk + 12);
+			bits_per_sample = ReadUint16LE(chunk + 22);
+			if (format_tag == 0xfffe && chunk_size >= 26) {
+				format_tag = ReadUint16LE(chunk + 32); // WAVE_FORMAT_EXTENSIBLE sub format
+			}
+		}
+		else if (memcmp(chunk, "data", 4) == 0) {
+			data = chunk + 8;
+			data_size = chunk_size;
+		}
+
+		pos += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	bool is_pcm16 = (format_tag == 1 && bits_per_sample == 16);
+	bool is_float = (format_tag == 3 && bits_per_sample == 32);
+	if (data == nullptr || channels_ == 0 || samplerate_ == 0 || (!is_pcm16 && !is_float)) {
+		printf("[PcmSource] %s: only 16 bit pcm and 32 bit float are supported. \n", path.c_str());
+		return false;
+	}
+
+	uint32_t count = data_size / (bits_per_sample / 8) / channels_ * channels_;
+	samples_.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (is_pcm16) {
+			samples_[i] = (int16_t)ReadUint16LE(data + i * 2);
+		}
+		else {
+			float value = 0;
+			memcpy(&value, data + i * 4, 4);
+			value = (value > 1.0f) ? 1.0f : ((value < -1.0f) ? -1.0f : value);
+			samples_[i] = (int16_t)(value * 32767);
+		}
+	}
+
+	if (samples_.size() < channels_) {
+		printf("[PcmSource] %s has no samples. \n", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool PcmSource::Start(const PacketCallback& callback)
+{
+	if (is_started_ || samples_.empty()) {
+		return false;
+	}
+
+	callback_ = callback;
+	is_started_ = true;
+	thread_.reset(new std::thread(&PcmSource::Run, this));
+	return true;
+}
+
+void PcmSource::Stop()
+{
+	if (is_started_) {
+		is_started_ = false;
+		if (thread_) {
+			thread_->join();
+			thread_.reset();
+		}
+	}
+}
+
+void PcmSource::Run()
+{
+	uint32_t block_samples = samplerate_ / 100;
+	std::vector<int16_t> block(block_samples * channels_);
+	auto next_time = std::chrono::steady_clock::now();
+
+	while (is_started_) {
+		for (auto& sample : block) {
+			sample = samples_[position_++];
+			if (position_ >= samples_.size()) {
+				position_ = 0;
+			}
+		}
+
+		if (callback_) {
+			callback_((uint8_t *)block.data(), block_samples);
+		}
+
+		next_time += std::chrono::microseconds(1000000ll * block_samples / samplerate_);
+		std::this_thread::sleep_until(next_time);
+	}
+}
@@ -0,0 +1,53 @@
+﻿#ifndef PCM_SOURCE_H
+#define PCM_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+/* Portable pcm input for machines without a capture device: a wav file
+   (16 bit pcm or 32 bit float, played in a loop) or a 440 Hz sine tone.
+   Samples are delivered as 16 bit interleaved pcm in 10 ms blocks, paced
+   by the steady clock like a sound card would. */
+class PcmSource
+{
+public:
+	using PacketCallback = std::function<void(uint8_t *data, uint32_t samples)>;
+
+	PcmSource& operator=(const PcmSource&) = delete;
+	PcmSource(const PcmSource&) = delete;
+	PcmSource();
+	virtual ~PcmSource();
+
+	bool Open(std::string source); /* "sine" or the path of a wav file */
+	bool Start(const PacketCallback& callback);
+	void Stop();
+
+	uint32_t GetSamplerate() const
+	{ return samplerate_; }
+
+	uint32_t GetChannels() const
+	{ return channels_; }
+
+	uint32_t GetBitsPerSample() const
+	{ return 16; }
+
+private:
+	bool ReadWav(std::string path);
+	void Run();
+
+	uint32_t samplerate_ = 48000;
+	uint32_t channels_ = 2;
+	std::vector<int16_t> samples_; /* interleaved, played in a loop */
+	size_t position_ = 0;
+
+	PacketCallback callback_;
+	std::atomic_bool is_started_;
+	std::unique_ptr<std::thread> thread_;
+};
+
+#endif
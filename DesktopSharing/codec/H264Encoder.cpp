@@ -1,4 +1,7 @@
 #include "H264Encoder.h"
+#include "xop/H264Parser.h"
+#include "xop/H265Parser.h"
+#include "xop/AV1Parser.h"
 
 H264Encoder::H264Encoder()
 {
@@ -15,6 +18,41 @@ void H264Encoder::SetCodec(std::string codec)
 	codec_ = codec;
 }
 
+bool H264Encoder::IsHevc() const
+{
+	return (codec_ == "x265" || codec_ == "hevc_nvenc" || codec_ == "hevc_qsv");
+}
+
+bool H264Encoder::IsAv1() const
+{
+	return (codec_ == "av1");
+}
+
+bool H264Encoder::IsSoftware() const
+{
+	return (nvenc_data_ == nullptr && !qsv_encoder_.IsInitialized());
+}
+
+void H264Encoder::SetAsyncDepth(uint32_t async_depth)
+{
+	async_depth_ = async_depth > 0 ? async_depth : 1;
+}
+
+void H264Encoder::SetProfile(std::string profile)
+{
+	encoder_config_.video.profile = profile;
+}
+
+void H264Encoder::SetIntraRefresh(bool enable)
+{
+	encoder_config_.video.intra_refresh = enable;
+}
+
+void H264Encoder::SetPacketCallback(const PacketCallback& callback)
+{
+	packet_callback_ = callback;
+}
+
 bool H264Encoder::Init(int framerate, int bitrate_kbps, int format, int width, int height)
 {
 	encoder_config_.video.framerate = framerate;
@@ -23,40 +61,54 @@ bool H264Encoder::Init(int framerate, int bitrate_kbps, int format, int width, i
 	encoder_config_.video.format = (AVPixelFormat)format;
 	encoder_config_.video.width = width;
 	encoder_config_.video.height = height;
+	encoder_config_.video.codec = IsHevc() ? "libx265" : (IsAv1() ? "libsvtav1" : "libx264");
 
+	/* software encoder of the same codec, used when the hardware one fails */
 	if (!h264_encoder_.Init(encoder_config_)) {
-		return false;
+		if (!IsAv1()) {
+			return false;
+		}
+
+		/* svt-av1 is the faster one, ffmpeg builds without it still have libaom */
+		encoder_config_.video.codec = "libaom-av1";
+		if (!h264_encoder_.Init(encoder_config_)) {
+			return false;
+		}
 	}
 
-	if (codec_ == "h264_nvenc") {
+	if (codec_ == "h264_nvenc" || codec_ == "hevc_nvenc") {
 		if (nvenc_info.is_supported()) {
 			nvenc_data_ = nvenc_info.create();
 		}
 
 		if (nvenc_data_ != nullptr) {
 			nvenc_config nvenc_config;
-			nvenc_config.codec = "h264";
+			nvenc_config.codec = IsHevc() ? "hevc" : "h264";
 			nvenc_config.format = DXGI_FORMAT_B8G8R8A8_UNORM;
 			nvenc_config.width = encoder_config_.video.width;
 			nvenc_config.height = encoder_config_.video.height;
 			nvenc_config.framerate = encoder_config_.video.framerate;
 			nvenc_config.gop = encoder_config_.video.gop;
 			nvenc_config.bitrate = encoder_config_.video.bitrate;
+			nvenc_config.async_depth = async_depth_;
+			nvenc_config.intra_refresh = encoder_config_.video.intra_refresh;
 			if (!nvenc_info.init(nvenc_data_, &nvenc_config)) {
 				nvenc_info.destroy(&nvenc_data_);
 				nvenc_data_ = nullptr;
 			}
 		}
 	}
-	else if (codec_ == "h264_qsv") {
+	else if (codec_ == "h264_qsv" || codec_ == "hevc_qsv") {
 		if (QsvEncoder::IsSupported()) {
 			QsvParams qsv_params;
-			qsv_params.codec = "h264";
+			qsv_params.codec = IsHevc() ? "hevc" : "h264";
 			qsv_params.bitrate_kbps = encoder_config_.video.bitrate / 1000;
 			qsv_params.framerate = encoder_config_.video.framerate;
 			qsv_params.gop = encoder_config_.video.gop;
 			qsv_params.width = encoder_config_.video.width;
 			qsv_params.height = encoder_config_.video.height;
+			qsv_params.async_depth = async_depth_;
+			qsv_params.intra_refresh = encoder_config_.video.intra_refresh;
 			if (!qsv_encoder_.Init(qsv_params)) {
 				qsv_encoder_.Destroy();
 			}
@@ -78,33 +130,72 @@ void H264Encoder::Destroy()
 	}
 
 	h264_encoder_.Destroy();
+
+	pts_ = 0;
+	x264_timestamps_.clear();
+	nvenc_timestamps_.clear();
+	bitstream_buffers_.clear(); /* slots still queued by the outputs are freed with them */
 }
 
 bool H264Encoder::IsKeyFrame(const uint8_t* data, uint32_t size)
 {
-	if (size > 4) {
-		//0x67:sps ,0x65:IDR, 0x6: SEI
-		if (data[4] == 0x67 || data[4] == 0x65 ||
-			data[4] == 0x6 || data[4] == 0x27) {
-			return true;
+	//(vps) sps, IDR/IRAP, or recovery point SEI with intra refresh
+	if (IsHevc()) {
+		return xop::H265Parser::IsRandomAccess(data, size);
+	}
+	else if (IsAv1()) {
+		return xop::AV1Parser::IsKeyFrame(data, size);
+	}
+
+	return xop::H264Parser::IsRandomAccess(data, size);
+}
+
+std::shared_ptr<std::vector<uint8_t>> H264Encoder::GetBitstreamBuffer(uint32_t size)
+{
+	std::shared_ptr<std::vector<uint8_t>> buffer;
+
+	for (auto& iter : bitstream_buffers_) {
+		if (iter.use_count() == 1) {
+			buffer = iter;
+			break;
 		}
 	}
 
-	return false;
+	if (buffer == nullptr) {
+		buffer = std::make_shared<std::vector<uint8_t>>();
+		/* every slot is queued by a slow output, this packet is not pooled */
+		if (bitstream_buffers_.size() < kMaxBitstreamBuffers) {
+			bitstream_buffers_.push_back(buffer);
+		}
+	}
+
+	/* the outputs count the packet size against their queues, so the slot
+	   follows it, one left large by an idr is given back */
+	if (buffer->size() < size || (buffer->size() > size * 2 && buffer->size() > kMinBitstreamBufferSize)) {
+		std::vector<uint8_t>(size).swap(*buffer);
+	}
+
+	return buffer;
 }
 
 int H264Encoder::Encode(uint8_t* in_buffer, uint32_t in_width, uint32_t in_height,
-						uint32_t image_size, std::vector<uint8_t>& out_frame)
+						uint32_t image_size, EncodedFrame& out_frame)
 {
-	out_frame.clear();
+	out_frame = EncodedFrame();
 
-	if (!h264_encoder_.GetAVCodecContext()) {
+	if (Submit(in_buffer, in_width, in_height, image_size, 0) < 0) {
 		return -1;
 	}
 
-	int frame_size = 0;
-	int max_buffer_size = encoder_config_.video.width * encoder_config_.video.height * 4;
-	std::shared_ptr<uint8_t> out_buffer(new uint8_t[max_buffer_size], std::default_delete<uint8_t[]>());
+	return Receive(out_frame, 60000);
+}
+
+int H264Encoder::Submit(uint8_t* in_buffer, uint32_t in_width, uint32_t in_height,
+						uint32_t image_size, uint32_t timestamp)
+{
+	if (!h264_encoder_.GetAVCodecContext()) {
+		return -1;
+	}
 
 	if (nvenc_data_ != nullptr) {
 		ID3D11Device* device = nvenc_info.get_device(nvenc_data_);
@@ -118,38 +209,154 @@ int H264Encoder::Encode(uint8_t* in_buffer, uint32_t in_width, uint32_t in_heigh
 		}
 		context->Unmap(texture, D3D11CalcSubresource(0, 0, 1));
 
-		frame_size = nvenc_info.encode_texture(nvenc_data_, texture, out_buffer.get(),
-			encoder_config_.video.width * encoder_config_.video.height * 4);
+		if (nvenc_info.submit_texture(nvenc_data_, texture) < 0) {
+			return -1;
+		}
+
+		/* nvenc low latency preset has no b-frames, packets come out in submission order */
+		nvenc_timestamps_.push_back(timestamp);
+	}
+	else if (qsv_encoder_.IsInitialized()) {
+		if (qsv_encoder_.Submit(in_buffer, in_width, in_height, timestamp) < 0) {
+			return -1;
+		}
+	}
+	else {
+		int64_t pts = pts_++;
+		if (h264_encoder_.Send(in_buffer, in_width, in_height, image_size, pts) < 0) {
+			return -1;
+		}
+
+		x264_timestamps_[pts] = timestamp;
+	}
+
+	return 0;
+}
+
+int H264Encoder::Submit(ffmpeg::AVFramePtr yuv_frame, uint32_t timestamp)
+{
+	if (!h264_encoder_.GetAVCodecContext() || !IsSoftware()) {
+		return -1;
+	}
+
+	/* pts counts the frames sent, a frame of another size is not one */
+	int64_t pts = pts_;
+	if (h264_encoder_.SendFrame(yuv_frame, pts) < 0) {
+		return -1;
+	}
+
+	pts_ += 1;
+	x264_timestamps_[pts] = timestamp;
+	return 0;
+}
+
+int H264Encoder::Poll()
+{
+	int num_frames = 0;
+	EncodedFrame out_frame;
+
+	while (Receive(out_frame, 0) > 0) {
+		num_frames += 1;
+		if (packet_callback_) {
+			packet_callback_(out_frame);
+		}
+	}
+
+	return num_frames;
+}
+
+void H264Encoder::Flush()
+{
+	if (!h264_encoder_.GetAVCodecContext()) {
+		return;
+	}
+
+	if (nvenc_data_ != nullptr) {
+		nvenc_info.flush(nvenc_data_);
+	}
+	else if (qsv_encoder_.IsInitialized()) {
+		qsv_encoder_.Flush();
+	}
+	else {
+		h264_encoder_.Flush();
+	}
+
+	EncodedFrame out_frame;
+	while (Receive(out_frame, 60000) > 0) {
+		if (packet_callback_) {
+			packet_callback_(out_frame);
+		}
+	}
+}
+
+int H264Encoder::Receive(EncodedFrame& out_frame, uint32_t wait_msec)
+{
+	out_frame = EncodedFrame();
+
+	if (!h264_encoder_.GetAVCodecContext()) {
+		return -1;
+	}
+
+	int frame_size = 0;
+	std::shared_ptr<std::vector<uint8_t>> out_buffer;
+
+	if (nvenc_data_ != nullptr) {
+		/* nvenc has the packet already, the slot takes its size, a large idr is not dropped */
+		int packet_size = nvenc_info.get_packet_size(nvenc_data_);
+		if (packet_size <= 0) {
+			return packet_size;
+		}
+		out_buffer = GetBitstreamBuffer((uint32_t)packet_size);
+		frame_size = nvenc_info.receive_packet(nvenc_data_, out_buffer->data(), (uint32_t)out_buffer->size());
+		if (frame_size > 0 && !nvenc_timestamps_.empty()) {
+			out_frame.timestamp = nvenc_timestamps_.front();
+			nvenc_timestamps_.pop_front();
+		}
 	}
 	else if (qsv_encoder_.IsInitialized()) {
-		frame_size = qsv_encoder_.Encode(in_buffer, in_width, in_height, out_buffer.get(), max_buffer_size);
+		/* same for qsv, the frame is synced before the slot is taken */
+		int packet_size = qsv_encoder_.GetPacketSize(wait_msec);
+		if (packet_size <= 0) {
+			return packet_size;
+		}
+		uint64_t timestamp = 0;
+		out_buffer = GetBitstreamBuffer((uint32_t)packet_size);
+		frame_size = qsv_encoder_.Receive(out_buffer->data(), (uint32_t)out_buffer->size(), &timestamp, 0);
+		out_frame.timestamp = (uint32_t)timestamp;
 	}
 	else {
-		ffmpeg::AVPacketPtr pkt_ptr = h264_encoder_.Encode(in_buffer, in_width, in_height, image_size);
-		int extra_data_size = 0;
-		uint8_t* extra_data = nullptr;
-
-		if (pkt_ptr != nullptr) {		
-			if (IsKeyFrame(pkt_ptr->data, pkt_ptr->size)) {
-				/* ʹAV_CODEC_FLAG_GLOBAL_HEADER, Ҫsps, pps */
-				extra_data = h264_encoder_.GetAVCodecContext()->extradata;
-				extra_data_size = h264_encoder_.GetAVCodecContext()->extradata_size;
-				memcpy(out_buffer.get(), extra_data, extra_data_size);
-				frame_size += extra_data_size;
+		ffmpeg::AVPacketPtr pkt_ptr = h264_encoder_.Receive();
+		if (pkt_ptr != nullptr && pkt_ptr->size > 0) {
+			auto iter = x264_timestamps_.find(pkt_ptr->pts);
+			if (iter != x264_timestamps_.end()) {
+				out_frame.timestamp = iter->second;
+				x264_timestamps_.erase(iter);
 			}
 
-			memcpy(out_buffer.get() + frame_size, pkt_ptr->data, pkt_ptr->size);
-			frame_size += pkt_ptr->size;
+			/* the packet is already refcounted, hand it out without a copy */
+			out_frame.data = std::shared_ptr<uint8_t>(pkt_ptr, pkt_ptr->data);
+			out_frame.size = pkt_ptr->size;
+			out_frame.is_key_frame = (pkt_ptr->flags & AV_PKT_FLAG_KEY) != 0;
+			if (!out_frame.is_key_frame && encoder_config_.video.intra_refresh) {
+				/* x265 flags only i frames, not the recovery points */
+				out_frame.is_key_frame = IsKeyFrame(pkt_ptr->data, pkt_ptr->size);
+			}
+			if (pkt_ptr->pts > pkt_ptr->dts) {
+				/* pts is counted in frames */
+				out_frame.composition_time = (uint32_t)((pkt_ptr->pts - pkt_ptr->dts) * 1000 / encoder_config_.video.framerate);
+			}
+			return pkt_ptr->size;
 		}
 	}
 
 	if (frame_size > 0) {
-		out_frame.resize(frame_size);
-		out_frame.assign(out_buffer.get(), out_buffer.get() + frame_size);
+		out_frame.data = std::shared_ptr<uint8_t>(out_buffer, out_buffer->data());
+		out_frame.size = frame_size;
+		out_frame.is_key_frame = IsKeyFrame(out_buffer->data(), frame_size);
 		return frame_size;
 	}
 
-	return 0;
+	return frame_size < 0 ? -1 : 0; /* a lost packet is not "no packet yet" */
 }
 
 int H264Encoder::GetSequenceParams(uint8_t* out_buffer, int out_buffer_size)
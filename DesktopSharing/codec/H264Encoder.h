@@ -4,6 +4,22 @@
 #include "NvCodec/nvenc.h"
 #include "QsvCodec/QsvEncoder.h"
 #include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+
+/* A view into the encoder's bitstream arena, the slot is not reused
+   until every copy of data has been released. */
+struct EncodedFrame
+{
+	std::shared_ptr<uint8_t> data;
+	uint32_t size = 0;
+	bool is_key_frame = false; /* idr or intra refresh recovery point */
+	uint32_t timestamp = 0;
+	uint32_t composition_time = 0; /* pts - dts in milliseconds, only with b-frames */
+};
 
 class H264Encoder
 {
@@ -13,22 +29,56 @@ public:
 	H264Encoder();
 	virtual ~H264Encoder();
 
-	void SetCodec(std::string codec);
+	using PacketCallback = std::function<void(const EncodedFrame& frame)>;
+
+	void SetCodec(std::string codec);         /* "x264", "h264_nvenc", "h264_qsv", "x265", "hevc_nvenc", "hevc_qsv", "av1" */
+	void SetAsyncDepth(uint32_t async_depth); /* frames in flight, call before Init() */
+	void SetProfile(std::string profile);     /* x264: "low-latency", "balanced", "quality" */
+	void SetIntraRefresh(bool enable);        /* refresh over a gop of frames instead of periodic idr */
+	void SetPacketCallback(const PacketCallback& callback);
 
 	bool Init(int framerate, int bitrate_kbps, int format, int width, int height);
 	void Destroy();
 
 	int Encode(uint8_t* in_buffer, uint32_t in_width, uint32_t in_height,
-			   uint32_t image_size, std::vector<uint8_t>& out_frame);
+			   uint32_t image_size, EncodedFrame& out_frame);
 
+	/* Submit() queues a frame and returns without waiting for the encoder, Poll() hands
+	   every finished frame to the packet callback with the timestamp it was submitted with. */
+	int  Submit(uint8_t* in_buffer, uint32_t in_width, uint32_t in_height,
+				uint32_t image_size, uint32_t timestamp);
+	int  Submit(ffmpeg::AVFramePtr yuv_frame, uint32_t timestamp); /* yuv420p of the encoder size, software encoders only */
+	int  Poll();
+	void Flush(); /* drain the frames still in flight, call before Destroy() */
+
+	/* (vps) sps, pps are not repeated in front of x264/x265 idr frames,
+	   consumers that need them in-band must take them from here.
+	   av1: the sequence header obu, or an av1C record. */
 	int GetSequenceParams(uint8_t* out_buffer, int out_buffer_size);
 
+	bool IsHevc() const;
+	bool IsAv1() const; /* software only, libsvtav1 or libaom-av1 */
+	bool IsSoftware() const; /* after Init(), false when nvenc or qsv took the frames */
+
 private:
 	bool IsKeyFrame(const uint8_t* data, uint32_t size);
+	int  Receive(EncodedFrame& out_frame, uint32_t wait_msec);
+	std::shared_ptr<std::vector<uint8_t>> GetBitstreamBuffer(uint32_t size);
 
 	std::string codec_;
+	uint32_t async_depth_ = 1;
+	PacketCallback packet_callback_;
 	ffmpeg::AVConfig encoder_config_;
 	void* nvenc_data_ = nullptr;
 	QsvEncoder qsv_encoder_;
 	ffmpeg::H264Encoder h264_encoder_;
+
+	std::vector<std::shared_ptr<std::vector<uint8_t>>> bitstream_buffers_;
+	static const size_t   kMaxBitstreamBuffers = 64;
+	static const uint32_t kMinBitstreamBufferSize = 256 * 1024;
+
+	/* capture timestamps of the frames in flight */
+	int64_t pts_ = 0;
+	std::map<int64_t, uint32_t> x264_timestamps_;
+	std::deque<uint32_t> nvenc_timestamps_;
 };
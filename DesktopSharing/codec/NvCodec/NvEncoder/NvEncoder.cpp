@@ -347,6 +347,12 @@ void NvEncoder::DestroyHWEncoder()
         return;
     }
 
+	if (m_bPacketLocked)
+	{
+		m_nvenc.nvEncUnlockBitstream(m_hEncoder, m_lockedBitstream.outputBitstream);
+		m_bPacketLocked = false;
+	}
+
 #if defined(_WIN32)
     for (uint32_t i = 0; i < m_vpCompletionEvent.size(); i++)
     {
@@ -479,6 +485,12 @@ void NvEncoder::SetROI(int pos_x, int pos_y, int region_width, int region_height
 }
 
 void NvEncoder::DoEncode(NV_ENC_INPUT_PTR inputBuffer, std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams)
+{
+    EncodePicture(inputBuffer, pPicParams);
+    GetEncodedPacket(m_vBitstreamOutputBuffer, vPacket, true);
+}
+
+void NvEncoder::EncodePicture(NV_ENC_INPUT_PTR inputBuffer, NV_ENC_PIC_PARAMS *pPicParams)
 {
     NV_ENC_PIC_PARAMS picParams = {};
     if (pPicParams)
@@ -506,7 +518,6 @@ void NvEncoder::DoEncode(NV_ENC_INPUT_PTR inputBuffer, std::vector<std::vector<u
     if (nvStatus == NV_ENC_SUCCESS || nvStatus == NV_ENC_ERR_NEED_MORE_INPUT)
     {
         m_iToSend++;
-        GetEncodedPacket(m_vBitstreamOutputBuffer, vPacket, true);
     }
     else
     {
@@ -529,6 +540,77 @@ void NvEncoder::EndEncode(std::vector<std::vector<uint8_t>> &vPacket)
     GetEncodedPacket(m_vBitstreamOutputBuffer, vPacket, false);
 }
 
+void NvEncoder::SubmitFrame(NV_ENC_PIC_PARAMS *pPicParams)
+{
+	if (!IsHWEncoderInitialized())
+	{
+		NVENC_THROW_ERROR("Encoder device not found", NV_ENC_ERR_NO_ENCODE_DEVICE);
+	}
+	int i = m_iToSend % m_nEncoderBuffer;
+	NV_ENC_MAP_INPUT_RESOURCE mapInputResource = { NV_ENC_MAP_INPUT_RESOURCE_VER };
+	mapInputResource.registeredResource = m_vRegisteredResources[i];
+	NVENC_API_CALL(m_nvenc.nvEncMapInputResource(m_hEncoder, &mapInputResource));
+	m_vMappedInputBuffers[i] = mapInputResource.mappedResource;
+	m_bEndOfStream = false;
+	EncodePicture(m_vMappedInputBuffers[i], pPicParams);
+}
+
+void NvEncoder::SubmitEndOfStream()
+{
+	if (!IsHWEncoderInitialized())
+	{
+		NVENC_THROW_ERROR("Encoder device not initialized", NV_ENC_ERR_ENCODER_NOT_INITIALIZED);
+	}
+
+	NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
+	picParams.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+	picParams.completionEvent = m_vpCompletionEvent[m_iToSend % m_nEncoderBuffer];
+	NVENC_API_CALL(m_nvenc.nvEncEncodePicture(m_hEncoder, &picParams));
+	m_bEndOfStream = true; // no output delay for the frames left
+}
+
+bool NvEncoder::LockPacket(const uint8_t **ppData, uint32_t *pSize)
+{
+	if (!m_bPacketLocked)
+	{
+		int iEnd = m_bEndOfStream ? m_iToSend : m_iToSend - m_nOutputDelay;
+		if (m_iGot >= iEnd)
+		{
+			return false;
+		}
+
+		WaitForCompletionEvent(m_iGot % m_nEncoderBuffer);
+		memset(&m_lockedBitstream, 0, sizeof(m_lockedBitstream));
+		m_lockedBitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
+		m_lockedBitstream.outputBitstream = m_vBitstreamOutputBuffer[m_iGot % m_nEncoderBuffer];
+		m_lockedBitstream.doNotWait = false;
+		NVENC_API_CALL(m_nvenc.nvEncLockBitstream(m_hEncoder, &m_lockedBitstream));
+		m_bPacketLocked = true;
+	}
+
+	*ppData = (const uint8_t *)m_lockedBitstream.bitstreamBufferPtr;
+	*pSize = m_lockedBitstream.bitstreamSizeInBytes;
+	return true;
+}
+
+void NvEncoder::UnlockPacket()
+{
+	if (!m_bPacketLocked)
+	{
+		return;
+	}
+
+	m_bPacketLocked = false;
+	NVENC_API_CALL(m_nvenc.nvEncUnlockBitstream(m_hEncoder, m_lockedBitstream.outputBitstream));
+
+	if (m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer])
+	{
+		NVENC_API_CALL(m_nvenc.nvEncUnmapInputResource(m_hEncoder, m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer]));
+		m_vMappedInputBuffers[m_iGot % m_nEncoderBuffer] = nullptr;
+	}
+	m_iGot++;
+}
+
 void NvEncoder::GetEncodedPacket(std::vector<NV_ENC_OUTPUT_PTR> &vOutputBuffer, std::vector<std::vector<uint8_t>> &vPacket, bool bOutputDelay)
 {
     unsigned i = 0;
@@ -134,6 +134,21 @@ public:
     */
     void EndEncode(std::vector<std::vector<uint8_t>> &vPacket);
 
+	/**
+	*  @brief  EncodeFrame() and EndEncode() without collecting the output, the
+	*  encoded data stays in the bitstream buffer until LockPacket() and
+	*  UnlockPacket(), so the caller copies it once into its own buffer.
+	*/
+	void SubmitFrame(NV_ENC_PIC_PARAMS *pPicParams = nullptr);
+	void SubmitEndOfStream();
+
+	/**
+	*  @brief  the oldest output EncodeFrame() would have returned by now,
+	*  false if none. The data is valid until UnlockPacket().
+	*/
+	bool LockPacket(const uint8_t **ppData, uint32_t *pSize);
+	void UnlockPacket();
+
     /**
     *  @brief  This function is used to query hardware encoder capabilities.
     *  Applications can call this function to query capabilities like maximum encode
@@ -328,6 +343,11 @@ private:
     */
     void DoEncode(NV_ENC_INPUT_PTR inputBuffer, std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams);
 
+	/**
+	*  @brief DoEncode() without GetEncodedPacket().
+	*/
+	void EncodePicture(NV_ENC_INPUT_PTR inputBuffer, NV_ENC_PIC_PARAMS *pPicParams);
+
     /**
     *  @brief This is a private function which is used to submit the encode
     *         commands to the NVENC hardware for ME only mode.
@@ -415,6 +435,9 @@ private:
     int32_t m_nEncoderBuffer = 0;
     int32_t m_nOutputDelay = 0;
 	bool m_forceIDR = false;
+	bool m_bEndOfStream = false;
+	bool m_bPacketLocked = false;
+	NV_ENC_LOCK_BITSTREAM m_lockedBitstream = {};
 
     std::unique_ptr<int8_t> m_qpDeltaMap;
     uint32_t m_qpDeltaMapSize = 0;
@@ -16,6 +16,8 @@ struct nvenc_config
 	uint32_t gop;
 	std::string codec;  // "h264" 
 	DXGI_FORMAT format; // DXGI_FORMAT_NV12 DXGI_FORMAT_B8G8R8A8_UNORM
+	uint32_t async_depth = 1; // frames in flight, 1: synchronous
+	bool intra_refresh = false; // no periodic idr, refresh over gop frames with recovery point sei
 };
 
 struct nvenc_info
@@ -26,6 +28,10 @@ struct nvenc_info
 	bool  (*init)(void *encoder_data, void *encoder_config);
 	int   (*encode_texture)(void *nvenc_data, ID3D11Texture2D *texture, uint8_t* out_buf, uint32_t max_buf_size);
 	int   (*encode_handle)(void *nvenc_data, HANDLE handle, int lock_key, int unlock_key, uint8_t* out_buf, uint32_t max_buf_size);
+	int   (*submit_texture)(void *nvenc_data, ID3D11Texture2D *texture);
+	int   (*get_packet_size)(void *nvenc_data); // size of the next receive_packet, 0: none
+	int   (*receive_packet)(void *nvenc_data, uint8_t* out_buf, uint32_t max_buf_size);
+	int   (*flush)(void *nvenc_data);
 	int   (*set_bitrate)(void *nvenc_data, uint32_t bitrate_bps);
 	int   (*set_framerate)(void *nvenc_data, uint32_t framerate);
 	int   (*request_idr)(void *nvenc_data);
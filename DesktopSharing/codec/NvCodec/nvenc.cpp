@@ -5,6 +5,7 @@
 #include "nvenc.h"
 #include <cstdint>
 #include <string>
+#include <deque>
 #include <dxgi.h>
 #include <d3d11.h>
 #include <dxgi1_2.h>
@@ -27,9 +28,15 @@ struct nvenc_data
 	uint32_t framerate = 0;
 	uint32_t bitrate   = 0;
 	uint32_t gop       = 0;
+	uint32_t async_depth = 1;
+	bool intra_refresh = false;
 	std::string codec;
 	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
 	NvEncoderD3D11 *nvenc = nullptr;
+
+	/* packets that had to leave the bitstream buffers before receive_packet,
+	   the others are copied from there once, into the caller's buffer */
+	std::deque<std::vector<uint8_t>> packets;
 };
 
 static bool is_supported(void)
@@ -220,6 +227,8 @@ static bool nvenc_init(void *nvenc_data, void *encoder_config)
 	enc->codec = config->codec;
 	enc->gop = config->gop;
 	enc->bitrate = config->bitrate;
+	enc->async_depth = config->async_depth > 0 ? config->async_depth : 1;
+	enc->intra_refresh = config->intra_refresh;
 
 	NV_ENC_BUFFER_FORMAT eBufferFormat = NV_ENC_BUFFER_FORMAT_NV12;
 	if (enc->format == DXGI_FORMAT_NV12) {
@@ -245,7 +254,8 @@ static bool nvenc_init(void *nvenc_data, void *encoder_config)
 		return false;
 	}
 
-	enc->nvenc = new NvEncoderD3D11(enc->d3d11_device, enc->width, enc->height, eBufferFormat);
+	/* the encoder waits for a frame only after async_depth - 1 newer frames were submitted */
+	enc->nvenc = new NvEncoderD3D11(enc->d3d11_device, enc->width, enc->height, eBufferFormat, enc->async_depth - 1);
 
 	NV_ENC_INITIALIZE_PARAMS initializeParams = { NV_ENC_INITIALIZE_PARAMS_VER };
 	NV_ENC_CONFIG encodeConfig = { NV_ENC_CONFIG_VER };
@@ -263,6 +273,36 @@ static bool nvenc_init(void *nvenc_data, void *encoder_config)
 	initializeParams.encodeConfig->rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
 	initializeParams.encodeConfig->rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
 
+	if (enc->intra_refresh) {
+		/* intra refresh is disabled unless the gop is infinite,
+		   the refresh is spread over all but the last frame of each period */
+		uint32_t period = enc->gop > 1 ? enc->gop : 2;
+		if (enc->codec == "h264") {
+			NV_ENC_CONFIG_H264& h264_config = initializeParams.encodeConfig->encodeCodecConfig.h264Config;
+			initializeParams.encodeConfig->gopLength = NVENC_INFINITE_GOPLENGTH;
+			h264_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+			h264_config.enableIntraRefresh = 1;
+			h264_config.intraRefreshPeriod = period;
+			h264_config.intraRefreshCnt = period - 1;
+			h264_config.outputRecoveryPointSEI = 1;
+		}
+		else {
+#if NVENCAPI_MAJOR_VERSION > 9 || (NVENCAPI_MAJOR_VERSION == 9 && NVENCAPI_MINOR_VERSION >= 1)
+			NV_ENC_CONFIG_HEVC& hevc_config = initializeParams.encodeConfig->encodeCodecConfig.hevcConfig;
+			initializeParams.encodeConfig->gopLength = NVENC_INFINITE_GOPLENGTH;
+			hevc_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+			hevc_config.enableIntraRefresh = 1;
+			hevc_config.intraRefreshPeriod = period;
+			hevc_config.intraRefreshCnt = period - 1;
+			hevc_config.outputRecoveryPointSEI = 1;
+#else
+			/* the recovery point sei marks where a viewer can start, older sdks
+			   cannot write it for hevc, so the stream keeps its idr frames */
+			printf("[nvenc] Warning: hevc intra refresh needs nvenc sdk 9.1, idr frames are used. \n");
+#endif
+		}
+	}
+
 	enc->nvenc->CreateEncoder(&initializeParams);
 
 	return true;
@@ -302,6 +342,128 @@ int nvenc_encode_texture(void *nvenc_data, ID3D11Texture2D *texture, uint8_t* ou
 	return frame_size;
 }
 
+int nvenc_submit_texture(void *nvenc_data, ID3D11Texture2D *texture)
+{
+	if (nvenc_data == nullptr) {
+		return -1;
+	}
+
+	struct nvenc_data *enc = (struct nvenc_data *)nvenc_data;
+
+	std::lock_guard<std::mutex> locker(enc->mutex);
+
+	if (enc->nvenc == nullptr) {
+		return -1;
+	}
+
+	/* every bitstream buffer is in use, keep the outputs not received yet */
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+	while (enc->nvenc->LockPacket(&data, &size)) {
+		if (size > 0) {
+			enc->packets.emplace_back(data, data + size);
+		}
+		enc->nvenc->UnlockPacket();
+	}
+
+	const NvEncInputFrame* input_frame = enc->nvenc->GetNextInputFrame();
+	ID3D11Texture2D *encoder_texture = reinterpret_cast<ID3D11Texture2D*>(input_frame->inputPtr);
+	enc->d3d11_context->CopyResource(encoder_texture, texture);
+	enc->nvenc->SubmitFrame();
+	return 0;
+}
+
+int nvenc_get_packet_size(void *nvenc_data)
+{
+	if (nvenc_data == nullptr) {
+		return -1;
+	}
+
+	struct nvenc_data *enc = (struct nvenc_data *)nvenc_data;
+
+	std::lock_guard<std::mutex> locker(enc->mutex);
+
+	if (!enc->packets.empty()) {
+		return (int)enc->packets.front().size();
+	}
+
+	if (enc->nvenc == nullptr) {
+		return -1;
+	}
+
+	/* the bitstream stays locked until receive_packet */
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+	while (enc->nvenc->LockPacket(&data, &size)) {
+		if (size > 0) {
+			return (int)size;
+		}
+		enc->nvenc->UnlockPacket();
+	}
+
+	return 0;
+}
+
+int nvenc_receive_packet(void *nvenc_data, uint8_t* out_buf, uint32_t out_buf_size)
+{
+	if (nvenc_data == nullptr) {
+		return -1;
+	}
+
+	struct nvenc_data *enc = (struct nvenc_data *)nvenc_data;
+
+	std::lock_guard<std::mutex> locker(enc->mutex);
+
+	int frame_size = -1;
+	if (!enc->packets.empty()) {
+		std::vector<uint8_t>& packet = enc->packets.front();
+		if (packet.size() <= out_buf_size) {
+			memcpy(out_buf, packet.data(), packet.size());
+			frame_size = (int)packet.size();
+		}
+
+		enc->packets.pop_front();
+		return frame_size;
+	}
+
+	if (enc->nvenc == nullptr) {
+		return -1;
+	}
+
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+	if (!enc->nvenc->LockPacket(&data, &size)) {
+		return 0;
+	}
+
+	if (size <= out_buf_size) {
+		memcpy(out_buf, data, size);
+		frame_size = (int)size;
+	}
+
+	enc->nvenc->UnlockPacket();
+	return frame_size;
+}
+
+int nvenc_flush(void *nvenc_data)
+{
+	if (nvenc_data == nullptr) {
+		return -1;
+	}
+
+	struct nvenc_data *enc = (struct nvenc_data *)nvenc_data;
+
+	std::lock_guard<std::mutex> locker(enc->mutex);
+
+	if (enc->nvenc == nullptr) {
+		return -1;
+	}
+
+	/* receive_packet drains the frames left */
+	enc->nvenc->SubmitEndOfStream();
+	return 0;
+}
+
 int nvenc_encode_handle(void *nvenc_data, HANDLE handle, int lock_key, int unlock_key, 
 	uint8_t* out_buf, uint32_t out_buf_size)
 {
@@ -516,6 +678,10 @@ struct nvenc_info nvenc_info = {
 	nvenc_init,
 	nvenc_encode_texture,
 	nvenc_encode_handle,
+	nvenc_submit_texture,
+	nvenc_get_packet_size,
+	nvenc_receive_packet,
+	nvenc_flush,
 	nvenc_set_bitrate,
 	nvenc_set_framerate,
 	nvenc_request_idr,
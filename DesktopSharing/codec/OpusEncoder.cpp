@@ -0,0 +1,74 @@
+#include "OpusEncoder.h"
+
+OpusEncoder::OpusEncoder()
+{
+
+}
+
+OpusEncoder::~OpusEncoder()
+{
+
+}
+
+bool OpusEncoder::Init(int samplerate, int channel, int format, int bitrate_kbps, int frame_msec)
+{
+	if (opus_encoder_.GetAVCodecContext()) {
+		return false;
+	}
+
+	ffmpeg::AVConfig encoder_config;
+	encoder_config.audio.samplerate = samplerate_ = samplerate;
+	encoder_config.audio.bitrate = bitrate_ = bitrate_kbps * 1000;
+	encoder_config.audio.channels = channel_ = channel;
+	encoder_config.audio.format = format_ = (AVSampleFormat)format;
+	encoder_config.audio.frame_msec = frame_msec_ = frame_msec;
+
+	if (!opus_encoder_.Init(encoder_config)) {
+		return false;
+	}
+
+	return true;
+}
+
+void OpusEncoder::Destroy()
+{
+	samplerate_ = 0;
+	channel_ = 0;
+	bitrate_ = 0;
+	frame_msec_ = 0;
+	format_ = AV_SAMPLE_FMT_NONE;
+	opus_encoder_.Destroy();
+}
+
+int OpusEncoder::GetFrames()
+{
+	if (!opus_encoder_.GetAVCodecContext()) {
+		return -1;
+	}
+
+	return opus_encoder_.GetFrameSamples();
+}
+
+int OpusEncoder::GetSamplerate()
+{
+	return 48000;
+}
+
+int OpusEncoder::GetChannel()
+{
+	return channel_;
+}
+
+int OpusEncoder::GetFrameMsec()
+{
+	return frame_msec_;
+}
+
+int OpusEncoder::Encode(const uint8_t* pcm, int samples, std::vector<ffmpeg::AVPacketPtr>& packets)
+{
+	if (!opus_encoder_.GetAVCodecContext()) {
+		return -1;
+	}
+
+	return opus_encoder_.Encode(pcm, samples, packets);
+}
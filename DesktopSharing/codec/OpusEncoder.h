@@ -0,0 +1,36 @@
+#pragma once
+
+#include "avcodec/opus_encoder.h"
+#include "avcodec/av_common.h"
+#include <vector>
+
+class OpusEncoder
+{
+public:
+	OpusEncoder& operator=(const OpusEncoder&) = delete;
+	OpusEncoder(const OpusEncoder&) = delete;
+	OpusEncoder();
+	virtual ~OpusEncoder();
+
+	/* frame_msec: 10 or 20 */
+	bool Init(int samplerate, int channel, int format, int bitrate_kbps, int frame_msec = 20);
+	void Destroy();
+
+	/* input samples per frame */
+	int GetFrames();
+
+	/* the rtp clock, always 48kHz */
+	int GetSamplerate();
+	int GetChannel();
+	int GetFrameMsec();
+
+	int Encode(const uint8_t* pcm, int samples, std::vector<ffmpeg::AVPacketPtr>& packets);
+
+private:
+	ffmpeg::OpusEncoder opus_encoder_;
+	int samplerate_ = 0;
+	int channel_ = 0;
+	int bitrate_ = 0;
+	int frame_msec_ = 0;
+	AVSampleFormat format_ = AV_SAMPLE_FMT_NONE;
+};
@@ -1,12 +1,14 @@
 #include "QsvEncoder.h"
 #include "common_utils.h"
+#include "mfxplugin.h"
 #include "libyuv.h"
 #include "net/log.h"
 #include <Windows.h>
 #include <versionhelpers.h>
 
 QsvEncoder::QsvEncoder()
-	: sps_buffer_(new mfxU8[1024])
+	: vps_buffer_(new mfxU8[1024])
+	, sps_buffer_(new mfxU8[1024])
 	, pps_buffer_(new mfxU8[1024])
 {
 	mfx_impl_ = MFX_IMPL_AUTO_ANY;
@@ -71,6 +73,11 @@ bool QsvEncoder::Init(QsvParams& qsv_params)
 		return false;
 	}
 
+	if (mfx_enc_params_.mfx.CodecId == MFX_CODEC_HEVC) {
+		// older runtimes ship the hevc encoder as a plugin, newer ones fail here and don't need it
+		MFXVideoUSER_Load(mfx_session_, &MFX_PLUGINID_HEVCE_HW, 1);
+	}
+
 	mfx_encoder_.reset(new MFXVideoENCODE(mfx_session_));
 
 	sts = mfx_encoder_->Query(&mfx_enc_params_, &mfx_enc_params_);
@@ -102,6 +109,7 @@ void QsvEncoder::Destroy()
 {
 	if (is_initialized_) {
 		FreeSurface();
+		FreeBuffer();
 		Release();
 		mfx_encoder_->Close();
 		is_initialized_ = false;
@@ -156,7 +164,7 @@ bool QsvEncoder::InitParams(QsvParams& qsv_params)
 	mfx_enc_params_.IOPattern = MFX_IOPATTERN_IN_VIDEO_MEMORY;
 
 	// Configuration for low latency
-	mfx_enc_params_.AsyncDepth = 1;  //1 is best for low latency
+	mfx_enc_params_.AsyncDepth = (mfxU16)(qsv_params.async_depth > 0 ? qsv_params.async_depth : 1);  //1 is best for low latency
 	mfx_enc_params_.mfx.GopRefDist = 1; //1 is best for low latency, I and P frames only
 
 	memset(&extended_coding_options_, 0, sizeof(mfxExtCodingOption));
@@ -173,6 +181,15 @@ bool QsvEncoder::InitParams(QsvParams& qsv_params)
 	extended_coding_options2_.Header.BufferSz = sizeof(mfxExtCodingOption2);
 	extended_coding_options2_.RepeatPPS = MFX_CODINGOPTION_OFF;
 
+	if (qsv_params.intra_refresh) {
+		// vertical refresh over gop frames, the i frame interval is made as long as possible
+		mfx_enc_params_.mfx.GopPicSize = 0xffff;
+		mfx_enc_params_.mfx.IdrInterval = 0;
+		extended_coding_options_.RecoveryPointSEI = MFX_CODINGOPTION_ON;
+		extended_coding_options2_.IntRefType = 1;
+		extended_coding_options2_.IntRefCycleSize = (mfxU16)(qsv_params.gop > 1 ? qsv_params.gop : 2);
+	}
+
 	extended_buffers_[0] = (mfxExtBuffer*)(&extended_coding_options_);
 	extended_buffers_[1] = (mfxExtBuffer*)(&extended_coding_options2_);
 	mfx_enc_params_.ExtParam = extended_buffers_;
@@ -234,17 +251,27 @@ bool QsvEncoder::AllocateBuffer()
 		return false;
 	}
 
-	memset(&mfx_enc_bs_, 0, sizeof(mfxBitstream));
-	mfx_enc_bs_.MaxLength = param.mfx.BufferSizeInKB * 1000;
-	bst_enc_data_.resize(mfx_enc_bs_.MaxLength);
-	mfx_enc_bs_.Data = bst_enc_data_.data();
+	// one bitstream for each frame in flight
+	tasks_.resize(mfx_enc_params_.AsyncDepth);
+	for (QsvTask& task : tasks_) {
+		memset(&task.bs, 0, sizeof(mfxBitstream));
+		task.bs.MaxLength = param.mfx.BufferSizeInKB * 1000;
+		task.data.resize(task.bs.MaxLength);
+		task.bs.Data = task.data.data();
+		task.syncp = nullptr;
+	}
+
+	task_submitted_ = 0;
+	task_synced_ = 0;
 	return true;
 }
 
 void QsvEncoder::FreeBuffer()
 {
-	memset(&mfx_enc_bs_, 0, sizeof(mfxBitstream));
-	bst_enc_data_.clear();
+	tasks_.clear();
+	ready_packets_.clear();
+	task_submitted_ = 0;
+	task_synced_ = 0;
 }
 
 bool QsvEncoder::GetVideoParam()
@@ -254,8 +281,14 @@ bool QsvEncoder::GetVideoParam()
 	opt.Header.BufferId = MFX_EXTBUFF_CODING_OPTION_SPSPPS;
 	opt.Header.BufferSz = sizeof(mfxExtCodingOptionSPSPPS);
 
-	static mfxExtBuffer *extendedBuffers[1];
+	mfxExtCodingOptionVPS vps_opt;
+	memset(&vps_opt, 0, sizeof(mfxExtCodingOptionVPS));
+	vps_opt.Header.BufferId = MFX_EXTBUFF_CODING_OPTION_VPS;
+	vps_opt.Header.BufferSz = sizeof(mfxExtCodingOptionVPS);
+
+	static mfxExtBuffer *extendedBuffers[2];
 	extendedBuffers[0] = (mfxExtBuffer *)&opt;
+	extendedBuffers[1] = (mfxExtBuffer *)&vps_opt;
 	mfx_video_params_.ExtParam = extendedBuffers;
 	mfx_video_params_.NumExtParam = 1;
 
@@ -264,11 +297,18 @@ bool QsvEncoder::GetVideoParam()
 	opt.SPSBufSize = 1024;
 	opt.PPSBufSize = 1024;
 
+	if (mfx_enc_params_.mfx.CodecId == MFX_CODEC_HEVC) {
+		vps_opt.VPSBuffer = vps_buffer_.get();
+		vps_opt.VPSBufSize = 1024;
+		mfx_video_params_.NumExtParam = 2;
+	}
+
 	mfxStatus sts = mfx_encoder_->GetVideoParam(&mfx_video_params_);
 	if (sts != MFX_ERR_NONE) {
 		return false;
 	}
 
+	vps_size_ = (mfx_video_params_.NumExtParam == 2) ? vps_opt.VPSBufSize : 0;
 	sps_size_ = opt.SPSBufSize;
 	pps_size_ = opt.PPSBufSize;
 
@@ -283,18 +323,29 @@ bool QsvEncoder::GetVideoParam()
 
 int QsvEncoder::Encode(const uint8_t* bgra_image, uint32_t width, uint32_t height,
 	uint8_t* out_buf, uint32_t out_buf_size)
+{
+	if (Submit(bgra_image, width, height) < 0) {
+		return -1;
+	}
+
+	return Receive(out_buf, out_buf_size, nullptr, 60000);
+}
+
+int QsvEncoder::Submit(const uint8_t* bgra_image, uint32_t width, uint32_t height, uint64_t timestamp)
 {
 	if (!is_initialized_) {
 		return -1;
 	}
 
-	int yuv_buf_size = width * height * 3 / 2;
-	std::shared_ptr<uint8_t> nv12_buf(new uint8_t[yuv_buf_size], std::default_delete<uint8_t[]>());
+	uint32_t yuv_buf_size = width * height * 3 / 2;
+	if (nv12_buffer_.size() < yuv_buf_size) {
+		nv12_buffer_.resize(yuv_buf_size);
+	}
 
 	int stride_y = width;
 	int stride_uv = width;// (width + 1) / 2;
-	uint8_t* data_y = nv12_buf.get();
-	uint8_t* data_uv = nv12_buf.get() + width * height;
+	uint8_t* data_y = nv12_buffer_.data();
+	uint8_t* data_uv = nv12_buffer_.data() + width * height;
 
 	int ret = libyuv::ARGBToNV12(bgra_image, width * 4, data_y, stride_y, data_uv, stride_uv, width, height);
 	if (ret != 0) {
@@ -343,7 +394,90 @@ int QsvEncoder::Encode(const uint8_t* bgra_image, uint32_t width, uint32_t heigh
 	sts = mfx_allocator_.Unlock(mfx_allocator_.pthis, mfx_surfaces_[index].Data.MemId, &(mfx_surfaces_[index].Data));
 	MSDK_CHECK_ERROR(MFX_ERR_NOT_FOUND, index, MFX_ERR_UNKNOWN);
 
-	return EncodeFrame(index, out_buf, out_buf_size);
+	// carried through to the output bitstream
+	mfx_surfaces_[index].Data.TimeStamp = timestamp;
+
+	return EncodeFrame(&mfx_surfaces_[index]) < 0 ? -1 : 0;
+}
+
+int QsvEncoder::Receive(uint8_t* out_buf, uint32_t out_buf_size, uint64_t* timestamp, uint32_t wait_msec)
+{
+	if (!is_initialized_) {
+		return -1;
+	}
+
+	if (ready_packets_.empty()) {
+		return SyncTask(wait_msec, out_buf, out_buf_size, timestamp);
+	}
+
+	int frame_size = 0;
+	std::vector<mfxU8>& packet = ready_packets_.front().first;
+	if (packet.size() <= out_buf_size) {
+		memcpy(out_buf, packet.data(), packet.size());
+		frame_size = (int)packet.size();
+		if (timestamp) {
+			*timestamp = ready_packets_.front().second;
+		}
+	}
+	else {
+		LOG("QSV packet dropped, size:%u, buffer size:%u", (uint32_t)packet.size(), out_buf_size);
+		frame_size = -1;
+	}
+
+	ready_packets_.pop_front();
+	return frame_size;
+}
+
+int QsvEncoder::GetPacketSize(uint32_t wait_msec)
+{
+	if (!is_initialized_) {
+		return -1;
+	}
+
+	if (!ready_packets_.empty()) {
+		return (int)ready_packets_.front().first.size();
+	}
+
+	while (task_synced_ != task_submitted_) {
+		QsvTask& task = tasks_[task_synced_ % tasks_.size()];
+		if (task.syncp != nullptr) {
+			mfxStatus sts = mfx_session_.SyncOperation(task.syncp, wait_msec);
+			if (sts == MFX_WRN_IN_EXECUTION) {
+				return 0;
+			}
+
+			if (sts != MFX_ERR_NONE) {
+				task_synced_++;
+				task.bs.DataOffset = 0;
+				task.bs.DataLength = 0;
+				task.syncp = nullptr;
+				return -1;
+			}
+
+			// finished, the output stays in the task until it is received
+			task.syncp = nullptr;
+		}
+
+		if (task.bs.DataLength > 0) {
+			return (int)task.bs.DataLength;
+		}
+
+		// no output for this frame
+		task_synced_++;
+		task.bs.DataOffset = 0;
+	}
+
+	return 0;
+}
+
+void QsvEncoder::Flush()
+{
+	if (!is_initialized_) {
+		return;
+	}
+
+	// drain the frames buffered inside the encoder
+	while (EncodeFrame(nullptr) > 0);
 }
 
 static void SaveFile(uint8_t* frame_data, uint32_t frame_size, bool is_h264)
@@ -370,26 +504,35 @@ static void SaveFile(uint8_t* frame_data, uint32_t frame_size, bool is_h264)
 	}
 }
 
-int QsvEncoder::EncodeFrame(int index, uint8_t* out_buf, uint32_t out_buf_size)
+int QsvEncoder::EncodeFrame(mfxFrameSurface1* surface)
 {
-	mfxSyncPoint syncp;
 	mfxStatus sts = MFX_ERR_NONE;
-	uint32_t frame_size = 0;
+
+	// every bitstream is in use, wait for the oldest one
+	if (task_submitted_ - task_synced_ >= tasks_.size()) {
+		if (SyncTask(60000, nullptr, 0, nullptr) < 0) {
+			return -1;
+		}
+	}
+
+	QsvTask& task = tasks_[task_submitted_ % tasks_.size()];
 
 	for (;;) {
 		// Encode a frame asychronously (returns immediately)
 		mfxEncodeCtrl* enc_ctrl = nullptr;
-		if (enc_ctrl_.FrameType) {
+		if (enc_ctrl_.FrameType && surface) {
 			enc_ctrl = &enc_ctrl_;
 		}
-		sts = mfx_encoder_->EncodeFrameAsync(enc_ctrl, &mfx_surfaces_[index], &mfx_enc_bs_, &syncp);
-		enc_ctrl_.FrameType = 0;
+		sts = mfx_encoder_->EncodeFrameAsync(enc_ctrl, surface, &task.bs, &task.syncp);
+		if (enc_ctrl) {
+			enc_ctrl_.FrameType = 0;
+		}
 
-		if (MFX_ERR_NONE < sts && !syncp) {  // Repeat the call if warning and no output
+		if (MFX_ERR_NONE < sts && !task.syncp) {  // Repeat the call if warning and no output
 			if (MFX_WRN_DEVICE_BUSY == sts)
 				MSDK_SLEEP(1);  // Wait if device is busy, then repeat the same call
 		}
-		else if (MFX_ERR_NONE < sts && syncp) {
+		else if (MFX_ERR_NONE < sts && task.syncp) {
 			sts = MFX_ERR_NONE;     // Ignore warnings if output is available
 			break;
 		}
@@ -402,36 +545,59 @@ int QsvEncoder::EncodeFrame(int index, uint8_t* out_buf, uint32_t out_buf_size)
 		}
 	}
 
-	if (MFX_ERR_NONE == sts) {
-		sts = mfx_session_.SyncOperation(syncp, 60000);   // Synchronize. Wait until encoded frame is ready
-		MSDK_CHECK_RESULT(sts, MFX_ERR_NONE, sts);
+	if (MFX_ERR_MORE_DATA == sts) {
+		return 0; // buffered by the encoder, no output yet
+	}
 
-		//mfx_enc_bs_.Data + mfx_enc_bs_.DataOffset, mfx_enc_bs_.DataLength
-		if (mfx_enc_bs_.DataLength > 0) {
-			//printf("encoder output frame size: %u \n", mfx_enc_bs_.DataLength);
-			if (out_buf_size >= frame_size + sps_size_ + pps_size_) {
-				//memcpy(out_buf + frame_size, sps_buffer_.get(), sps_size_);
-				//frame_size += sps_size_;
-				//memcpy(out_buf + frame_size, pps_buffer_.get(), pps_size_);
-				//frame_size += pps_size_;
+	if (MFX_ERR_NONE != sts) {
+		return -1;
+	}
 
-				if (mfx_enc_params_.mfx.CodecId == MFX_CODEC_AVC) {
-					memcpy(out_buf + frame_size, mfx_enc_bs_.Data, mfx_enc_bs_.DataLength);
-				}
-				else if (mfx_enc_params_.mfx.CodecId == MFX_CODEC_HEVC) {
-					memcpy(out_buf + frame_size, mfx_enc_bs_.Data, mfx_enc_bs_.DataLength);
-				}
+	task_submitted_++;
+	return 1;
+}
 
-				frame_size += mfx_enc_bs_.DataLength;
+int QsvEncoder::SyncTask(uint32_t wait_msec, uint8_t* out_buf, uint32_t out_buf_size, uint64_t* timestamp)
+{
+	if (task_synced_ == task_submitted_) {
+		return 0;
+	}
 
-				//SaveFile(out_buf, frame_size, mfx_enc_params_.mfx.CodecId == MFX_CODEC_AVC);			
-			}
+	QsvTask& task = tasks_[task_synced_ % tasks_.size()];
+	mfxStatus sts = MFX_ERR_NONE;
+	if (task.syncp != nullptr) { // else already synced by GetPacketSize()
+		sts = mfx_session_.SyncOperation(task.syncp, wait_msec);
+		if (sts == MFX_WRN_IN_EXECUTION) {
+			return 0;
+		}
+	}
 
-			mfx_enc_bs_.DataLength = 0;
+	task_synced_++;
+
+	int frame_size = 0;
+	if (sts == MFX_ERR_NONE && task.bs.DataLength > 0) {
+		mfxU8* data = task.bs.Data + task.bs.DataOffset;
+		if (out_buf == nullptr) {
+			// no room for another frame in flight, keep the output until it is received
+			ready_packets_.emplace_back(std::vector<mfxU8>(data, data + task.bs.DataLength), task.bs.TimeStamp);
+		}
+		else if (task.bs.DataLength <= out_buf_size) {
+			memcpy(out_buf, data, task.bs.DataLength);
+			frame_size = task.bs.DataLength;
+			if (timestamp) {
+				*timestamp = task.bs.TimeStamp;
+			}
+		}
+		else {
+			LOG("QSV packet dropped, size:%u, buffer size:%u", task.bs.DataLength, out_buf_size);
+			frame_size = -1;
 		}
 	}
 
-	return frame_size;
+	task.bs.DataOffset = 0;
+	task.bs.DataLength = 0;
+	task.syncp = nullptr;
+	return sts == MFX_ERR_NONE ? frame_size : -1;
 }
 
 void QsvEncoder::ForceIDR()
@@ -474,7 +640,9 @@ int QsvEncoder::GetSequenceParams(uint8_t* buffer, int buffer_size)
 
 	if (is_initialized_) {
 		if (sps_size_ && pps_size_) {
-			if (buffer_size >= (sps_size_ + pps_size_)) {
+			if (buffer_size >= (vps_size_ + sps_size_ + pps_size_)) {
+				memcpy(buffer + size, vps_buffer_.get(), vps_size_);
+				size += vps_size_;
 				memcpy(buffer + size, sps_buffer_.get(), sps_size_);
 				size += sps_size_;
 				memcpy(buffer + size, pps_buffer_.get(), pps_size_);
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <deque>
 #include <memory>
 
 struct QsvParams
@@ -15,6 +16,15 @@ struct QsvParams
 	uint32_t bitrate_kbps;
 	uint32_t framerate;
 	uint32_t gop;
+	uint32_t async_depth = 1; // frames in flight, 1 is best for low latency
+	bool intra_refresh = false; // no periodic idr, refresh over gop frames with recovery point sei
+};
+
+struct QsvTask
+{
+	mfxBitstream bs;
+	std::vector<mfxU8> data;
+	mfxSyncPoint syncp = nullptr;
 };
 
 class QsvEncoder
@@ -36,6 +46,13 @@ public:
 	virtual int Encode(const uint8_t* bgra_image, uint32_t width, uint32_t height,
 		uint8_t* out_buf, uint32_t out_buf_size);
 
+	/* Submit() returns as soon as the frame is queued on the device,
+	   Receive() returns 0 if the oldest frame is still in execution after wait_msec. */
+	virtual int Submit(const uint8_t* bgra_image, uint32_t width, uint32_t height, uint64_t timestamp = 0);
+	virtual int GetPacketSize(uint32_t wait_msec = 0); /* size of the next Receive() packet, 0: none yet */
+	virtual int Receive(uint8_t* out_buf, uint32_t out_buf_size, uint64_t* timestamp = nullptr, uint32_t wait_msec = 0);
+	virtual void Flush();
+
 	virtual void ForceIDR();
 	virtual void SetBitrate(uint32_t bitrate_kbps);
 
@@ -48,7 +65,8 @@ private:
 	bool AllocateBuffer();
 	void FreeBuffer();
 	bool GetVideoParam();
-	int  EncodeFrame(int index, uint8_t* out_buf, uint32_t out_buf_size);
+	int  EncodeFrame(mfxFrameSurface1* surface);
+	int  SyncTask(uint32_t wait_msec, uint8_t* out_buf, uint32_t out_buf_size, uint64_t* timestamp);
 
 	bool is_initialized_ = false;
 	bool use_d3d11_ = false;
@@ -68,12 +86,17 @@ private:
 
 	std::unique_ptr<MFXVideoENCODE> mfx_encoder_;
 
-	mfxBitstream           mfx_enc_bs_;
-	std::vector<mfxU8>     bst_enc_data_;
+	std::vector<QsvTask>   tasks_;
+	uint32_t               task_submitted_ = 0;
+	uint32_t               task_synced_ = 0;
+	std::deque<std::pair<std::vector<mfxU8>, uint64_t>> ready_packets_;
+	std::vector<uint8_t>   nv12_buffer_;
 	std::vector<mfxFrameSurface1> mfx_surfaces_;
 
+	std::unique_ptr<mfxU8> vps_buffer_; // hevc only
 	std::unique_ptr<mfxU8> sps_buffer_;
 	std::unique_ptr<mfxU8> pps_buffer_;
+	mfxU16 vps_size_ = 0;
 	mfxU16 sps_size_ = 0;
 	mfxU16 pps_size_ = 0;
 };
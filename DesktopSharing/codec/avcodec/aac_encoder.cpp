@@ -49,6 +49,16 @@ bool AACEncoder::Init(AVConfig& audio_config)
 		return false;
 	}
 
+	if (av_config_.audio.format == AV_SAMPLE_FMT_S16 || av_config_.audio.format == AV_SAMPLE_FMT_FLT) {
+		if (!AllocFrame(codec_context_->frame_size)) {
+			Destroy();
+			return false;
+		}
+
+		is_initialized_ = true;
+		return true;
+	}
+
 	audio_resampler_.reset(new Resampler());
 	if (!audio_resampler_->Init(av_config_.audio.samplerate, av_config_.audio.channels, 
 								av_config_.audio.format, av_config_.audio.samplerate, 
@@ -69,6 +79,8 @@ void AACEncoder::Destroy()
 		audio_resampler_.reset();
 	}
 
+	fltp_frame_.reset();
+
 	if (codec_context_) {
 		avcodec_close(codec_context_);
 		avcodec_free_context(&codec_context_);
@@ -79,6 +91,27 @@ void AACEncoder::Destroy()
 	is_initialized_ = false;
 }
 
+bool AACEncoder::AllocFrame(int samples)
+{
+	fltp_frame_.reset(av_frame_alloc(), [](AVFrame* ptr) {
+		av_frame_free(&ptr);
+	});
+
+	fltp_frame_->sample_rate = codec_context_->sample_rate;
+	fltp_frame_->format = AV_SAMPLE_FMT_FLTP;
+	fltp_frame_->channels = codec_context_->channels;
+	fltp_frame_->channel_layout = codec_context_->channel_layout;
+	fltp_frame_->nb_samples = samples;
+
+	if (av_frame_get_buffer(fltp_frame_.get(), 0) < 0) {
+		LOG("av_frame_get_buffer() failed.\n");
+		fltp_frame_.reset();
+		return false;
+	}
+
+	return true;
+}
+
 uint32_t AACEncoder::GetFrameSamples()
 {
 	if (is_initialized_) {
@@ -90,33 +123,36 @@ uint32_t AACEncoder::GetFrameSamples()
 
 AVPacketPtr AACEncoder::Encode(const uint8_t* pcm, int samples)
 {
-	AVFramePtr in_frame(av_frame_alloc(), [](AVFrame* ptr) {
-		av_frame_free(&ptr);
-	});
-
-	in_frame->sample_rate = codec_context_->sample_rate;
-	in_frame->format = AV_SAMPLE_FMT_FLT;
-	in_frame->channels = codec_context_->channels;
-	in_frame->channel_layout = codec_context_->channel_layout;
-	in_frame->nb_samples = samples;
-	in_frame->pts = pts_;
-	in_frame->pts = av_rescale_q(pts_, { 1, codec_context_->sample_rate }, codec_context_->time_base);
-	pts_ += in_frame->nb_samples;
-
-	if (av_frame_get_buffer(in_frame.get(), 0) < 0) {
-		LOG("av_frame_get_buffer() failed.\n");
+	if (!is_initialized_) {
 		return nullptr;
 	}
 
-	int bytes_per_sample = av_get_bytes_per_sample(av_config_.audio.format);
-	if (bytes_per_sample == 0) {
-		return nullptr;
-	}
-
-	memcpy(in_frame->data[0], pcm, bytes_per_sample * in_frame->channels * samples);
-
 	AVFramePtr fltp_frame = nullptr;
-	if (audio_resampler_->Convert(in_frame, fltp_frame) <= 0) {
+	if (fltp_frame_) {
+		/* the encoder may still hold a reference to the last frame, make_writable copies it then */
+		if (fltp_frame_->nb_samples != samples) {
+			if (!AllocFrame(samples)) {
+				return nullptr;
+			}
+		}
+		else if (av_frame_make_writable(fltp_frame_.get()) < 0) {
+			return nullptr;
+		}
+
+		if (av_config_.audio.format == AV_SAMPLE_FMT_S16) {
+			DeinterleaveS16ToFltp((const int16_t*)pcm, (float**)fltp_frame_->extended_data, 
+								  fltp_frame_->channels, samples);
+		}
+		else {
+			DeinterleaveFltToFltp((const float*)pcm, (float**)fltp_frame_->extended_data, 
+								  fltp_frame_->channels, samples);
+		}
+
+		fltp_frame_->pts = av_rescale_q(pts_, { 1, codec_context_->sample_rate }, codec_context_->time_base);
+		pts_ += samples;
+		fltp_frame = fltp_frame_;
+	}
+	else if (Resample(pcm, samples, fltp_frame) <= 0) {
 		return nullptr;
 	}
 
@@ -137,5 +173,35 @@ AVPacketPtr AACEncoder::Encode(const uint8_t* pcm, int samples)
 		return nullptr;
 	}
 
+	/* pts in samples, the encoder delay makes the first ones negative */
+	av_packet_rescale_ts(av_packet.get(), codec_context_->time_base, { 1, codec_context_->sample_rate });
 	return av_packet;
 }
+
+int AACEncoder::Resample(const uint8_t* pcm, int samples, AVFramePtr& fltp_frame)
+{
+	AVFramePtr in_frame(av_frame_alloc(), [](AVFrame* ptr) {
+		av_frame_free(&ptr);
+	});
+
+	in_frame->sample_rate = codec_context_->sample_rate;
+	in_frame->format = av_config_.audio.format;
+	in_frame->channels = codec_context_->channels;
+	in_frame->channel_layout = codec_context_->channel_layout;
+	in_frame->nb_samples = samples;
+	in_frame->pts = av_rescale_q(pts_, { 1, codec_context_->sample_rate }, codec_context_->time_base);
+	pts_ += in_frame->nb_samples;
+
+	if (av_frame_get_buffer(in_frame.get(), 0) < 0) {
+		LOG("av_frame_get_buffer() failed.\n");
+		return -1;
+	}
+
+	int bytes_per_sample = av_get_bytes_per_sample(av_config_.audio.format);
+	if (bytes_per_sample == 0) {
+		return -1;
+	}
+
+	memcpy(in_frame->data[0], pcm, bytes_per_sample * in_frame->channels * samples);
+	return audio_resampler_->Convert(in_frame, fltp_frame);
+}
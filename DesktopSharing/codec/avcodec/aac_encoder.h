@@ -19,10 +19,16 @@ public:
 
 	uint32_t GetFrameSamples();
 
+	/* interleaved pcm of the configured format, the packet pts counts samples */
 	AVPacketPtr Encode(const uint8_t *pcm, int samples);
 
 private:
+	bool AllocFrame(int samples);
+	int  Resample(const uint8_t *pcm, int samples, AVFramePtr& fltp_frame);
+
+	/* s16/flt input is deinterleaved into fltp_frame_, swresample handles the rest */
 	std::unique_ptr<Resampler> audio_resampler_;
+	AVFramePtr fltp_frame_;
 	int64_t pts_ = 0;
 };
 
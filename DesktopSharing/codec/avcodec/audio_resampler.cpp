@@ -1,6 +1,14 @@
 #include "audio_resampler.h"
 #include "av_common.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AUDIO_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_USE_NEON
+#endif
+
 using namespace ffmpeg;
 
 Resampler::Resampler()
@@ -99,4 +107,80 @@ int Resampler::Convert(AVFramePtr in_frame, AVFramePtr& out_frame)
 	return len;
 }
 
+void ffmpeg::DeinterleaveS16ToFltp(const int16_t* in, float** out, int channels, int samples)
+{
+	const float scale = 1.0f / 32768.0f;
+	int i = 0;
+
+	if (channels == 2) {
+		float* left = out[0];
+		float* right = out[1];
+
+#if defined(AUDIO_USE_SSE2)
+		const __m128 v_scale = _mm_set1_ps(scale);
+		for (; i + 4 <= samples; i += 4) {
+			/* l0 r0 l1 r1 l2 r2 l3 r3, sign extend the low and the high half of each pair */
+			__m128i lr = _mm_loadu_si128((const __m128i*)(in + i * 2));
+			__m128i l = _mm_srai_epi32(_mm_slli_epi32(lr, 16), 16);
+			__m128i r = _mm_srai_epi32(lr, 16);
+			_mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(l), v_scale));
+			_mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), v_scale));
+		}
+#elif defined(AUDIO_USE_NEON)
+		for (; i + 8 <= samples; i += 8) {
+			int16x8x2_t lr = vld2q_s16(in + i * 2);
+			vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(lr.val[0]))), scale));
+			vst1q_f32(left + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(lr.val[0]))), scale));
+			vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(lr.val[1]))), scale));
+			vst1q_f32(right + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(lr.val[1]))), scale));
+		}
+#endif
+		for (; i < samples; i++) {
+			left[i] = in[i * 2] * scale;
+			right[i] = in[i * 2 + 1] * scale;
+		}
+		return;
+	}
+
+	for (; i < samples; i++) {
+		for (int ch = 0; ch < channels; ch++) {
+			out[ch][i] = in[i * channels + ch] * scale;
+		}
+	}
+}
 
+void ffmpeg::DeinterleaveFltToFltp(const float* in, float** out, int channels, int samples)
+{
+	int i = 0;
+
+	if (channels == 2) {
+		float* left = out[0];
+		float* right = out[1];
+
+#if defined(AUDIO_USE_SSE2)
+		for (; i + 4 <= samples; i += 4) {
+			__m128 lr0 = _mm_loadu_ps(in + i * 2);
+			__m128 lr1 = _mm_loadu_ps(in + i * 2 + 4);
+			_mm_storeu_ps(left + i, _mm_shuffle_ps(lr0, lr1, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + i, _mm_shuffle_ps(lr0, lr1, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+#elif defined(AUDIO_USE_NEON)
+		for (; i + 4 <= samples; i += 4) {
+			float32x4x2_t lr = vld2q_f32(in + i * 2);
+			vst1q_f32(left + i, lr.val[0]);
+			vst1q_f32(right + i, lr.val[1]);
+		}
+#endif
+		for (; i < samples; i++) {
+			left[i] = in[i * 2];
+			right[i] = in[i * 2 + 1];
+		}
+		return;
+	}
+
+	for (; i < samples; i++) {
+		for (int ch = 0; ch < channels; ch++) {
+			out[ch][i] = in[i * channels + ch];
+		}
+	}
+}
@@ -49,6 +49,11 @@ private:
 	uint8_t* convert_buffer_ = nullptr;
 };
 
+/* same rate conversion of interleaved s16/flt to planar float without swresample,
+   sse2 or neon for stereo, out holds one plane per channel */
+void DeinterleaveS16ToFltp(const int16_t* in, float** out, int channels, int samples);
+void DeinterleaveFltToFltp(const float* in, float** out, int channels, int samples);
+
 }
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include "av_common.h"
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -21,12 +22,24 @@ namespace ffmpeg {
 
 struct VideoConfig
 {
+	std::string codec = "libx264"; // ffmpeg encoder: "libx264", "libx265", "libsvtav1", "libaom-av1"
 	uint32_t width = 1920;
 	uint32_t height = 1080;
 	uint32_t bitrate = 4000000;
 	uint32_t framerate = 25;
 	uint32_t gop = 25;
 	AVPixelFormat format = AV_PIX_FMT_BGRA;
+
+	/* x264/x265 performance profile:
+	   "low-latency": sliced threads, no lookahead, no b-frames.
+	   "balanced"   : frame threads, short lookahead.
+	   "quality"    : frame threads, long lookahead and b-frames, for archival. */
+	std::string profile = "low-latency";
+	uint32_t threads = 0; // 0: chosen by the profile from the number of cores
+
+	/* refresh a column of intra blocks per frame instead of sending an idr every gop,
+	   a recovery point sei marks the start of each refresh cycle of gop frames. */
+	bool intra_refresh = false;
 };
 
 struct AudioConfig
@@ -35,6 +48,7 @@ struct AudioConfig
 	uint32_t samplerate = 48000;
 	uint32_t bitrate = 16000 * 4;
 	AVSampleFormat format = AV_SAMPLE_FMT_S16;
+	uint32_t frame_msec = 20; // opus frame duration: 10 or 20
 };
 
 struct AVConfig
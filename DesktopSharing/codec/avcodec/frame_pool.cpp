@@ -0,0 +1,85 @@
+#include "frame_pool.h"
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+using namespace ffmpeg;
+
+FramePool::FramePool()
+{
+
+}
+
+FramePool::~FramePool()
+{
+	Destroy();
+}
+
+bool FramePool::Init(int width, int height, AVPixelFormat format)
+{
+	Destroy();
+
+	/* the same 32 bytes alignment as av_frame_get_buffer() */
+	if (av_image_fill_linesizes(linesize_, format, FFALIGN(width, 32)) < 0) {
+		return false;
+	}
+
+	uint8_t* data[4] = { nullptr };
+	int size = av_image_fill_pointers(data, format, height, nullptr, linesize_);
+	if (size <= 0) {
+		return false;
+	}
+
+	pool_ = av_buffer_pool_init(size + 32, nullptr);
+	if (pool_ == nullptr) {
+		return false;
+	}
+
+	width_ = width;
+	height_ = height;
+	format_ = format;
+	return true;
+}
+
+void FramePool::Destroy()
+{
+	if (pool_) {
+		av_buffer_pool_uninit(&pool_);
+		pool_ = nullptr;
+	}
+
+	width_ = 0;
+	height_ = 0;
+	format_ = AV_PIX_FMT_NONE;
+}
+
+AVFramePtr FramePool::GetFrame()
+{
+	if (pool_ == nullptr) {
+		return nullptr;
+	}
+
+	AVFramePtr frame(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
+	if (frame == nullptr) {
+		return nullptr;
+	}
+
+	frame->buf[0] = av_buffer_pool_get(pool_);
+	if (frame->buf[0] == nullptr) {
+		return nullptr;
+	}
+
+	frame->width = width_;
+	frame->height = height_;
+	frame->format = format_;
+	for (int i = 0; i < 4; i++) {
+		frame->linesize[i] = linesize_[i];
+	}
+
+	uint8_t* data = (uint8_t*)FFALIGN((uintptr_t)frame->buf[0]->data, 32);
+	if (av_image_fill_pointers(frame->data, format_, height_, data, frame->linesize) < 0) {
+		return nullptr;
+	}
+
+	return frame;
+}
@@ -0,0 +1,45 @@
+#ifndef FFMPEG_FRAME_POOL_H
+#define FFMPEG_FRAME_POOL_H
+
+#include <cstdint>
+#include <memory>
+#include "av_common.h"
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+namespace ffmpeg {
+
+/* Frames of one size and format on buffers of an AVBufferPool. A buffer goes
+   back to the pool when the last reference to its frame is released, the pool
+   itself is freed after its last buffer. */
+class FramePool
+{
+public:
+	FramePool& operator=(const FramePool&) = delete;
+	FramePool(const FramePool&) = delete;
+	FramePool();
+	virtual ~FramePool();
+
+	bool Init(int width, int height, AVPixelFormat format);
+	void Destroy();
+
+	AVFramePtr GetFrame();
+
+	int GetWidth() const
+	{ return width_; }
+
+	int GetHeight() const
+	{ return height_; }
+
+private:
+	AVBufferPool* pool_ = nullptr;
+	int width_ = 0;
+	int height_ = 0;
+	AVPixelFormat format_ = AV_PIX_FMT_NONE;
+	int linesize_[4] = { 0 };
+};
+
+}
+
+#endif
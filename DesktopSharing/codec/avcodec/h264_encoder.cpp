@@ -1,5 +1,8 @@
 ﻿#include "h264_encoder.h"
 #include "av_common.h"
+#include <thread>
+#include <algorithm>
+#include <cstring>
 
 #define USE_LIBYUV 0
 #if USE_LIBYUV
@@ -20,9 +23,9 @@ bool H264Encoder::Init(AVConfig& video_config)
 
 	AVCodec *codec = nullptr;
 	//codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-	codec = avcodec_find_encoder_by_name("libx264");
+	codec = avcodec_find_encoder_by_name(av_config_.video.codec.c_str());
 	if (!codec) {
-		LOG("H.264 Encoder not found.\n");
+		LOG("%s encoder not found.\n", av_config_.video.codec.c_str());
 		Destroy();
 		return false;
 	}
@@ -39,7 +42,6 @@ bool H264Encoder::Init(AVConfig& video_config)
 	codec_context_->time_base = { 1,  (int)av_config_.video.framerate };
 	codec_context_->framerate = { (int)av_config_.video.framerate, 1 };
 	codec_context_->gop_size = av_config_.video.gop;
-	codec_context_->max_b_frames = 0;
 	codec_context_->pix_fmt = AV_PIX_FMT_YUV420P;
 
 	// rc control mode: abr
@@ -52,13 +54,18 @@ bool H264Encoder::Init(AVConfig& video_config)
 
 	codec_context_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
-	if (codec->id == AV_CODEC_ID_H264) {
-		av_opt_set(codec_context_->priv_data, "preset", "ultrafast", 0); //ultrafast 
-	}
+	SetProfile(codec);
 
-	av_opt_set(codec_context_->priv_data, "tune", "zerolatency", 0);
 	av_opt_set_int(codec_context_->priv_data, "forced-idr", 1, 0);
-	av_opt_set_int(codec_context_->priv_data, "avcintra-class", -1, 0);
+
+	if (codec->id == AV_CODEC_ID_H264) {
+		av_opt_set_int(codec_context_->priv_data, "avcintra-class", -1, 0);
+
+		if (av_config_.video.intra_refresh) {
+			/* gop_size is now the refresh period, only ForceIDR() sends an idr */
+			av_opt_set_int(codec_context_->priv_data, "intra-refresh", 1, 0);
+		}
+	}
 	
 	if (avcodec_open2(codec_context_, codec, NULL) != 0) {
 		LOG("avcodec_open2() failed.\n");
@@ -72,6 +79,106 @@ bool H264Encoder::Init(AVConfig& video_config)
 	return true;
 }
 
+void H264Encoder::SetProfile(AVCodec* codec)
+{
+	uint32_t num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+	uint32_t threads = av_config_.video.threads;
+	std::string& profile = av_config_.video.profile;
+	const char* preset = "ultrafast";
+	char av1_preset[16] = { 0 };
+	int lookahead = 0;
+
+	if (profile == "quality") {
+		if (threads == 0) {
+			threads = num_cores;
+		}
+		preset = "medium";
+		lookahead = 40;
+		codec_context_->thread_type = FF_THREAD_FRAME;
+		codec_context_->max_b_frames = 3;
+	}
+	else if (profile == "balanced") {
+		if (threads == 0) {
+			threads = std::max(num_cores / 2, 1u);
+		}
+		preset = "veryfast";
+		lookahead = 10;
+		codec_context_->thread_type = FF_THREAD_FRAME;
+		codec_context_->max_b_frames = 0;
+	}
+	else {
+		if (threads == 0) {
+			/* one slice per thread, more slices only cost bits */
+			threads = std::min(num_cores, 16u);
+		}
+		profile = "low-latency";
+		codec_context_->thread_type = FF_THREAD_SLICE;
+		codec_context_->slices = threads;
+		codec_context_->max_b_frames = 0;
+		av_opt_set(codec_context_->priv_data, "tune", "zerolatency", 0);
+	}
+
+	codec_context_->thread_count = threads;
+
+	if (codec->id == AV_CODEC_ID_H264) {
+		av_opt_set(codec_context_->priv_data, "preset", preset, 0);
+		av_opt_set_int(codec_context_->priv_data, "rc-lookahead", lookahead, 0);
+	}
+	else if (codec->id == AV_CODEC_ID_HEVC) {
+		/* libx265 ignores thread_count and thread_type, x265 uses a thread pool
+		   with wavefront rows, frame threads only add latency. 0: chosen by x265 */
+		uint32_t frame_threads = (codec_context_->thread_type == FF_THREAD_FRAME) ? 0 : 1;
+		char x265_params[256] = { 0 };
+		snprintf(x265_params, sizeof(x265_params), "pools=%u:frame-threads=%u:rc-lookahead=%d:bframes=%d%s",
+			threads, frame_threads, lookahead, codec_context_->max_b_frames,
+			av_config_.video.intra_refresh ? ":intra-refresh=1" : "");
+		av_opt_set(codec_context_->priv_data, "preset", preset, 0);
+		av_opt_set(codec_context_->priv_data, "x265-params", x265_params, 0);
+	}
+	else if (codec->id == AV_CODEC_ID_AV1) {
+		/* av1 has no b-frames, the lookahead is its only delay. Screen content
+		   coding tools (palette, intra block copy) are turned on for text and ui
+		   where the linked ffmpeg can pass them. libaom-av1 is experimental in
+		   ffmpeg 4.0, avcodec_open2() refuses it otherwise. */
+		codec_context_->max_b_frames = 0;
+		codec_context_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+		if (strcmp(codec->name, "libsvtav1") == 0) {
+			int svt_preset = (profile == "quality") ? 8 : ((profile == "balanced") ? 10 : 12);
+			char svtav1_params[256] = { 0 };
+			snprintf(svtav1_params, sizeof(svtav1_params), "scm=1:lp=%u:lookahead=%d%s",
+				threads, lookahead, (profile == "low-latency") ? ":pred-struct=1" : "");
+			snprintf(av1_preset, sizeof(av1_preset), "%d", svt_preset);
+			av_opt_set_int(codec_context_->priv_data, "preset", svt_preset, 0);
+			if (av_opt_set(codec_context_->priv_data, "svtav1-params", svtav1_params, 0) < 0) {
+				LOG("%s has no svtav1-params, screen content tools are off.", codec->name);
+			}
+		}
+		else {
+			int cpu_used = (profile == "quality") ? 4 : 8;
+			snprintf(av1_preset, sizeof(av1_preset), "cpu-used=%d", cpu_used);
+			av_opt_set_int(codec_context_->priv_data, "cpu-used", cpu_used, 0);
+			av_opt_set_int(codec_context_->priv_data, "lag-in-frames", lookahead, 0);
+			av_opt_set_int(codec_context_->priv_data, "row-mt", 1, 0);
+			if (profile != "quality") {
+				av_opt_set(codec_context_->priv_data, "usage", "realtime", 0);
+			}
+			if (av_opt_set(codec_context_->priv_data, "aom-params", "tune-content=screen:enable-palette=1:enable-intrabc=1", 0) < 0) {
+				LOG("%s has no aom-params, screen content tools are off.", codec->name);
+			}
+		}
+		preset = av1_preset;
+	}
+
+	delay_frames_ = lookahead + codec_context_->max_b_frames;
+	if (codec_context_->thread_type == FF_THREAD_FRAME) {
+		delay_frames_ += threads - 1;
+	}
+
+	LOG("%s profile: %s, preset: %s, threads: %u, lookahead: %d, b-frames: %d, delay: %u frames, intra-refresh: %d.",
+		codec->name, profile.c_str(), preset, threads, lookahead, codec_context_->max_b_frames, delay_frames_,
+		av_config_.video.intra_refresh ? 1 : 0);
+}
+
 void H264Encoder::Destroy()
 {
 	if (video_converter_) {
@@ -91,13 +198,22 @@ void H264Encoder::Destroy()
 	is_initialized_ = false;
 }
 
-AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, uint64_t pts)
+AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, int64_t pts)
 {
-	if (!is_initialized_) {
+	if (Send(image, width, height, image_size, pts) < 0) {
 		return nullptr;
 	}
 
-	if (width != in_width_ || height != av_config_.video.height || !video_converter_) {
+	return Receive();
+}
+
+int H264Encoder::Send(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, int64_t pts)
+{
+	if (!is_initialized_) {
+		return -1;
+	}
+
+	if (width != in_width_ || height != in_height_ || !video_converter_) {
 		in_width_ = width;
 		in_height_ = height;
 
@@ -105,7 +221,7 @@ AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t h
 		if (!video_converter_->Init(in_width_, in_height_, (AVPixelFormat)av_config_.video.format,
 									codec_context_->width, codec_context_->height, codec_context_->pix_fmt)) {
 			video_converter_.reset();
-			return nullptr;
+			return -1;
 		}
 	}
 
@@ -114,33 +230,35 @@ AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t h
 	in_frame->height = in_height_;
 	in_frame->format = av_config_.video.format;
 	if (av_frame_get_buffer(in_frame.get(), 32) != 0) {
-		return nullptr;
+		return -1;
 	}
 
-	//int pic_size = av_image_get_buffer_size(av_config_.video.format, in_width_, in_height_, in_frame->linesize[0]);
-	//if (pic_size <= 0) {
-	//	return nullptr;
-	//}
-
 	memcpy(in_frame->data[0], image, image_size);
 
-//#if USE_LIBYUV	
-	//int result = libyuv::ARGBToI420(bgra_image, width * 4,
-	//	yuv_frame->data[0], yuv_frame->linesize[0],
-	//	yuv_frame->data[1], yuv_frame->linesize[1],
-	//	yuv_frame->data[2], yuv_frame->linesize[2],
-	//	width, height);
-
-	//if (result != 0) {
-	//	LOG("libyuv::ARGBToI420() failed.\n");
-	//	return nullptr;
-	//}
-//#else
 	AVFramePtr yuv_frame = nullptr;
 	if (video_converter_->Convert(in_frame, yuv_frame) <= 0) {
-		return nullptr;
+		return -1;
+	}
+
+	return SendFrame(yuv_frame, pts);
+}
+
+int H264Encoder::SendFrame(AVFramePtr frame, int64_t pts)
+{
+	if (!is_initialized_ || frame == nullptr) {
+		return -1;
+	}
+
+	if (frame->width != codec_context_->width || frame->height != codec_context_->height ||
+		frame->format != codec_context_->pix_fmt) {
+		return -1;
+	}
+
+	/* a new reference, the caller may share the frame with other encoders */
+	AVFramePtr yuv_frame(av_frame_clone(frame.get()), [](AVFrame* ptr) { av_frame_free(&ptr); });
+	if (yuv_frame == nullptr) {
+		return -1;
 	}
-//#endif
 
 	if (pts >= 0) {
 		yuv_frame->pts = pts;
@@ -155,8 +273,18 @@ AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t h
 		force_idr_ = false;
 	}
 
-	if (avcodec_send_frame(codec_context_, yuv_frame.get()) < 0) {
-		LOG("avcodec_send_frame() failed.\n");
+	int ret = avcodec_send_frame(codec_context_, yuv_frame.get());
+	if (ret < 0) {
+		AV_LOG(ret, "avcodec_send_frame() failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+AVPacketPtr H264Encoder::Receive()
+{
+	if (!is_initialized_) {
 		return nullptr;
 	}
 
@@ -170,13 +298,21 @@ AVPacketPtr H264Encoder::Encode(const uint8_t *image, uint32_t width, uint32_t h
 		return nullptr;
 	}
 	else if (ret < 0) {
-		LOG("avcodec_receive_packet() failed.");
+		AV_LOG(ret, "avcodec_receive_packet() failed");
 		return nullptr;
 	}
 
 	return av_packet;
 }
 
+void H264Encoder::Flush()
+{
+	if (is_initialized_) {
+		/* enter draining mode, the remaining packets are returned by Receive() */
+		avcodec_send_frame(codec_context_, nullptr);
+	}
+}
+
 void H264Encoder::ForceIDR()
 {
 	if (codec_context_) {
@@ -7,23 +7,40 @@
 
 namespace ffmpeg {
 
+/* libx264, or libx265, libsvtav1, libaom-av1 when VideoConfig::codec asks for it */
 class H264Encoder : public Encoder
 {
 public:
 	virtual bool Init(AVConfig& video_config);
 	virtual void Destroy();
 
-	virtual AVPacketPtr Encode(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, uint64_t pts = 0);
+	virtual AVPacketPtr Encode(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, int64_t pts = -1);
+
+	/* Send() queues one frame, Receive() returns the next available packet or nullptr,
+	   call it until nullptr: with frame threads several packets can be pending. */
+	virtual int Send(const uint8_t *image, uint32_t width, uint32_t height, uint32_t image_size, int64_t pts = -1);
+
+	/* a yuv420p frame of the encoder size, no conversion, the frame is not modified */
+	virtual int SendFrame(AVFramePtr frame, int64_t pts = -1);
+	virtual AVPacketPtr Receive();
+	virtual void Flush();
 
 	virtual void ForceIDR();
 	virtual void SetBitrate(uint32_t bitrate_kbps);
 
+	/* frames the encoder holds back before the first packet comes out */
+	uint32_t GetDelayFrames() const
+	{ return delay_frames_; }
+
 private:
+	void SetProfile(AVCodec* codec);
+
 	int64_t pts_ = 0;
 	std::unique_ptr<VideoConverter> video_converter_;
 	uint32_t in_width_  = 0;
 	uint32_t in_height_ = 0;
 	bool force_idr_ = false;
+	uint32_t delay_frames_ = 0;
 };
 
 }
@@ -0,0 +1,234 @@
+﻿#include "opus_encoder.h"
+#include "av_common.h"
+#include <cstring>
+
+extern "C" {
+#include <libavutil/audio_fifo.h>
+}
+
+using namespace ffmpeg;
+
+/* rtp opus always runs at 48kHz, whatever the input rate is */
+static const int OPUS_SAMPLERATE = 48000;
+
+OpusEncoder::OpusEncoder()
+{
+
+}
+
+OpusEncoder::~OpusEncoder()
+{
+	Destroy();
+}
+
+bool OpusEncoder::Init(AVConfig& audio_config)
+{
+	if (is_initialized_) {
+		return false;
+	}
+
+	av_config_ = audio_config;
+	if (av_config_.audio.frame_msec != 10 && av_config_.audio.frame_msec != 20) {
+		av_config_.audio.frame_msec = 20;
+	}
+
+	/* prefer libopus, the native encoder is experimental and celt only */
+	AVCodec *codec = avcodec_find_encoder_by_name("libopus");
+	if (!codec) {
+		codec = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+	}
+
+	if (!codec) {
+		LOG("Opus Encoder not found.\n");
+		Destroy();
+		return false;
+	}
+
+	codec_context_ = avcodec_alloc_context3(codec);
+	if (!codec_context_) {
+		LOG("avcodec_alloc_context3() failed.");
+		Destroy();
+		return false;
+	}
+
+	/* libopus takes interleaved s16/flt, keep the input format when it is supported */
+	AVSampleFormat sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+	for (const AVSampleFormat* fmt = codec->sample_fmts; fmt && *fmt != AV_SAMPLE_FMT_NONE; fmt++) {
+		if (*fmt == av_config_.audio.format) {
+			sample_fmt = *fmt;
+			break;
+		}
+	}
+
+	codec_context_->sample_rate = OPUS_SAMPLERATE;
+	codec_context_->sample_fmt = sample_fmt;
+	codec_context_->channels = av_config_.audio.channels;
+	codec_context_->channel_layout = av_get_default_channel_layout(av_config_.audio.channels);
+	codec_context_->bit_rate = av_config_.audio.bitrate;
+	codec_context_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+
+	if (strcmp(codec->name, "libopus") == 0) {
+		/* restricted low delay: celt only, 2.5ms lookahead instead of 6.5ms */
+		av_opt_set(codec_context_->priv_data, "application", "lowdelay", 0);
+		av_opt_set_double(codec_context_->priv_data, "frame_duration", av_config_.audio.frame_msec, 0);
+	}
+	else {
+		av_opt_set_double(codec_context_->priv_data, "opus_delay", av_config_.audio.frame_msec, 0);
+	}
+
+	if (avcodec_open2(codec_context_, codec, NULL) != 0) {
+		LOG("avcodec_open2() failed.\n");
+		Destroy();
+		return false;
+	}
+
+	if (av_config_.audio.samplerate != OPUS_SAMPLERATE || av_config_.audio.format != sample_fmt) {
+		audio_resampler_.reset(new Resampler());
+		if (!audio_resampler_->Init(av_config_.audio.samplerate, av_config_.audio.channels,
+									av_config_.audio.format, OPUS_SAMPLERATE,
+									av_config_.audio.channels, sample_fmt)) {
+			LOG("Audio resampler init failed.\n");
+			Destroy();
+			return false;
+		}
+	}
+
+	audio_fifo_ = av_audio_fifo_alloc(sample_fmt, codec_context_->channels, codec_context_->frame_size * 2);
+	if (!audio_fifo_) {
+		LOG("av_audio_fifo_alloc() failed.\n");
+		Destroy();
+		return false;
+	}
+
+	LOG("%s: %dms frames, %d samples, %d kbps", codec->name, av_config_.audio.frame_msec,
+		codec_context_->frame_size, (int)(codec_context_->bit_rate / 1000));
+
+	is_initialized_ = true;
+	return true;
+}
+
+void OpusEncoder::Destroy()
+{
+	if (audio_resampler_) {
+		audio_resampler_->Destroy();
+		audio_resampler_.reset();
+	}
+
+	if (audio_fifo_) {
+		av_audio_fifo_free(audio_fifo_);
+		audio_fifo_ = nullptr;
+	}
+
+	if (codec_context_) {
+		avcodec_close(codec_context_);
+		avcodec_free_context(&codec_context_);
+		codec_context_ = nullptr;
+	}
+
+	pts_ = 0;
+	is_initialized_ = false;
+}
+
+uint32_t OpusEncoder::GetFrameSamples()
+{
+	if (is_initialized_) {
+		return (uint32_t)av_rescale(codec_context_->frame_size, av_config_.audio.samplerate, OPUS_SAMPLERATE);
+	}
+
+	return 0;
+}
+
+int OpusEncoder::Encode(const uint8_t* pcm, int samples, std::vector<AVPacketPtr>& packets)
+{
+	if (!is_initialized_) {
+		return -1;
+	}
+
+	if (audio_resampler_) {
+		AVFramePtr in_frame(av_frame_alloc(), [](AVFrame* ptr) {
+			av_frame_free(&ptr);
+		});
+
+		in_frame->sample_rate = av_config_.audio.samplerate;
+		in_frame->format = av_config_.audio.format;
+		in_frame->channels = codec_context_->channels;
+		in_frame->channel_layout = codec_context_->channel_layout;
+		in_frame->nb_samples = samples;
+
+		if (av_frame_get_buffer(in_frame.get(), 0) < 0) {
+			LOG("av_frame_get_buffer() failed.\n");
+			return -1;
+		}
+
+		int bytes_per_sample = av_get_bytes_per_sample(av_config_.audio.format);
+		if (bytes_per_sample == 0) {
+			return -1;
+		}
+
+		memcpy(in_frame->data[0], pcm, bytes_per_sample * in_frame->channels * samples);
+
+		/* a rate change keeps some samples inside swr, only the returned count is valid */
+		AVFramePtr out_frame = nullptr;
+		int out_samples = audio_resampler_->Convert(in_frame, out_frame);
+		if (out_samples < 0) {
+			return -1;
+		}
+
+		if (out_samples > 0) {
+			av_audio_fifo_write(audio_fifo_, (void**)out_frame->data, out_samples);
+		}
+	}
+	else {
+		void* data[1] = { (void*)pcm };
+		av_audio_fifo_write(audio_fifo_, data, samples);
+	}
+
+	int frame_size = codec_context_->frame_size;
+	int num_packets = 0;
+
+	while (av_audio_fifo_size(audio_fifo_) >= frame_size) {
+		AVFramePtr frame(av_frame_alloc(), [](AVFrame* ptr) {
+			av_frame_free(&ptr);
+		});
+
+		frame->sample_rate = codec_context_->sample_rate;
+		frame->format = codec_context_->sample_fmt;
+		frame->channels = codec_context_->channels;
+		frame->channel_layout = codec_context_->channel_layout;
+		frame->nb_samples = frame_size;
+		frame->pts = av_rescale_q(pts_, { 1, codec_context_->sample_rate }, codec_context_->time_base);
+		pts_ += frame_size;
+
+		if (av_frame_get_buffer(frame.get(), 0) < 0) {
+			LOG("av_frame_get_buffer() failed.\n");
+			return -1;
+		}
+
+		av_audio_fifo_read(audio_fifo_, (void**)frame->data, frame_size);
+
+		if (avcodec_send_frame(codec_context_, frame.get()) != 0) {
+			return -1;
+		}
+
+		while (1) {
+			AVPacketPtr av_packet(av_packet_alloc(), [](AVPacket* ptr) {av_packet_free(&ptr);});
+			av_init_packet(av_packet.get());
+
+			int ret = avcodec_receive_packet(codec_context_, av_packet.get());
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+				break;
+			}
+			else if (ret < 0) {
+				LOG("avcodec_receive_packet() failed.");
+				return -1;
+			}
+
+			/* pts in 48kHz samples, the encoder delay makes the first ones negative */
+			av_packet_rescale_ts(av_packet.get(), codec_context_->time_base, { 1, codec_context_->sample_rate });
+			packets.push_back(av_packet);
+			num_packets++;
+		}
+	}
+
+	return num_packets;
+}
@@ -0,0 +1,39 @@
+﻿#ifndef _OPUS_ENCODER_H
+#define _OPUS_ENCODER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "av_encoder.h"
+#include "audio_resampler.h"
+
+struct AVAudioFifo;
+
+namespace ffmpeg {
+
+class OpusEncoder : public Encoder
+{
+public:
+	OpusEncoder();
+	virtual ~OpusEncoder();
+
+	virtual bool Init(AVConfig& audio_config);
+	virtual void Destroy();
+
+	/* input samples of one frame at the configured samplerate */
+	uint32_t GetFrameSamples();
+
+	/* interleaved pcm of the configured format, it is resampled to 48kHz and
+	   cut into frames of frame_msec, every finished frame is appended to packets.
+	   the packet pts counts 48kHz samples. */
+	int Encode(const uint8_t *pcm, int samples, std::vector<AVPacketPtr>& packets);
+
+private:
+	std::unique_ptr<Resampler> audio_resampler_;
+	AVAudioFifo* audio_fifo_ = nullptr;
+	int64_t pts_ = 0;
+};
+
+}
+
+#endif
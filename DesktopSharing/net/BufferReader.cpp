@@ -61,23 +61,90 @@ BufferReader::~BufferReader()
 }
 
 int BufferReader::Read(SOCKET sockfd)
-{	
-	uint32_t size = WritableBytes();
-	if(size < MAX_BYTES_PER_READ) {
-		uint32_t bufferReaderSize = (uint32_t)buffer_.size();
-		if(bufferReaderSize > MAX_BUFFER_SIZE) {
-			return 0; 
+{
+	/* drains what the socket holds, at most MAX_BYTES_PER_EVENT so that one
+	   connection does not starve the others of the scheduler */
+	uint32_t max_bytes = MAX_BYTES_PER_EVENT;
+	int total = 0;
+
+	while (total < (int)max_bytes) {
+		uint32_t size = std::min(read_size_, max_bytes - (uint32_t)total);
+		if (!Reserve(size)) {
+			break;
+		}
+
+		/* the free space is offered too, it costs nothing to recv more */
+		size = std::min(WritableBytes(), max_bytes - (uint32_t)total);
+		int bytes_read = ::recv(sockfd, beginWrite(), size, 0);
+		if (bytes_read <= 0) {
+			/* closed or would block, the next event reports what is left */
+			return (total > 0) ? total : bytes_read;
 		}
-        
-		buffer_.resize(bufferReaderSize + MAX_BYTES_PER_READ);
-	}
 
-	int bytes_read = ::recv(sockfd, beginWrite(), MAX_BYTES_PER_READ, 0);
-	if(bytes_read > 0) {
 		writer_index_ += bytes_read;
+		total += bytes_read;
+
+		if ((uint32_t)bytes_read < size) {
+			/* a short read, the socket is drained */
+			if ((uint32_t)bytes_read < read_size_ / 4 && read_size_ > MAX_BYTES_PER_READ) {
+				read_size_ /= 2;
+			}
+			break;
+		}
+
+		/* the window was filled, size the next one on what is still pending */
+		uint32_t pending = GetPendingBytes(sockfd);
+		if (pending == 0) {
+			break;
+		}
+		read_size_ = std::min(std::max(pending, read_size_ * 2), max_bytes);
+	}
+
+	return total;
+}
+
+bool BufferReader::Reserve(uint32_t size)
+{
+	if (WritableBytes() >= size) {
+		return true;
+	}
+
+	/* the consumed front is reused before the buffer grows */
+	if (reader_index_ > 0) {
+		size_t readable = ReadableBytes();
+		if (readable > 0) {
+			memmove(Begin(), Peek(), readable);
+		}
+		reader_index_ = 0;
+		writer_index_ = readable;
+		if (WritableBytes() >= size) {
+			return true;
+		}
 	}
 
-	return bytes_read;
+	size_t buffer_size = buffer_.size();
+	if (buffer_size > MAX_BUFFER_SIZE) {
+		return false;
+	}
+
+	buffer_.resize(std::max(writer_index_ + size, buffer_size * 2));
+	return true;
+}
+
+uint32_t BufferReader::GetPendingBytes(SOCKET sockfd)
+{
+#if defined(__linux) || defined(__linux__)
+	int bytes = 0;
+	if (ioctl(sockfd, FIONREAD, &bytes) < 0) {
+		return 0;
+	}
+#elif defined(WIN32) || defined(_WIN32)
+	u_long bytes = 0;
+	if (ioctlsocket(sockfd, FIONREAD, &bytes) != 0) {
+		return 0;
+	}
+#endif
+	return (uint32_t)bytes;
 }
 
 
@@ -96,12 +96,17 @@ private:
 	const char* BeginWrite() const
 	{ return Begin() + writer_index_; }
 
+	bool Reserve(uint32_t size);
+	static uint32_t GetPendingBytes(SOCKET sockfd);
+
 	std::vector<char> buffer_;
 	size_t reader_index_ = 0;
 	size_t writer_index_ = 0;
+	uint32_t read_size_ = MAX_BYTES_PER_READ;
 
 	static const char kCRLF[];
 	static const uint32_t MAX_BYTES_PER_READ = 4096;
+	static const uint32_t MAX_BYTES_PER_EVENT = 256 * 1024;
 	static const uint32_t MAX_BUFFER_SIZE = 1024 * 100000;
 };
 
@@ -4,6 +4,10 @@
 #include "BufferWriter.h"
 #include "Socket.h"
 #include "SocketUtil.h"
+#include <algorithm>
+#if defined(__linux) || defined(__linux__)
+#include <sys/uio.h>
+#endif
 
 using namespace xop;
 
@@ -66,7 +70,7 @@ bool BufferWriter::Append(std::shared_ptr<char> data, uint32_t size, uint32_t in
 	}
      
 	Packet pkt = { data, size, index };
-	buffer_.emplace(std::move(pkt));
+	buffer_.emplace_back(std::move(pkt));
 	return true;
 }
 
@@ -85,7 +89,23 @@ bool BufferWriter::Append(const char* data, uint32_t size, uint32_t index)
 	memcpy(pkt.data.get(), data, size);
 	pkt.size = size;
 	pkt.writeIndex = index;
-	buffer_.emplace(std::move(pkt));
+	buffer_.emplace_back(std::move(pkt));
+	return true;
+}
+
+bool BufferWriter::Append(const std::vector<Slice>& slices)
+{
+	/* all slices or none, a message is never cut in the middle */
+	if ((int)(buffer_.size() + slices.size()) > max_queue_length_) {
+		return false;
+	}
+
+	for (auto& slice : slices) {
+		if (slice.size > 0) {
+			Packet pkt = { slice.data, slice.size, 0 };
+			buffer_.emplace_back(std::move(pkt));
+		}
+	}
 	return true;
 }
 
@@ -96,23 +116,54 @@ int BufferWriter::Send(SOCKET sockfd, int timeout)
 	}
       
 	int ret = 0;
-	int count = 1;
+	bool more = true;
 
 	do
 	{
 		if (buffer_.empty()) {
 			return 0;
 		}
-		
-		count -= 1;
-		Packet &pkt = buffer_.front();
-		ret = ::send(sockfd, pkt.data.get() + pkt.writeIndex, pkt.size - pkt.writeIndex, 0);
+
+		/* the queued packets go out with one gather write */
+		int count = (int)std::min(buffer_.size(), (size_t)kMaxSendSlices);
+		uint32_t bytes = 0;
+
+#if defined(__linux) || defined(__linux__)
+		struct iovec iov[kMaxSendSlices];
+		for (int i = 0; i < count; i++) {
+			Packet &pkt = buffer_[i];
+			iov[i].iov_base = pkt.data.get() + pkt.writeIndex;
+			iov[i].iov_len = pkt.size - pkt.writeIndex;
+			bytes += pkt.size - pkt.writeIndex;
+		}
+		ret = ::writev(sockfd, iov, count);
+#elif defined(WIN32) || defined(_WIN32)
+		WSABUF wsa_buf[kMaxSendSlices];
+		for (int i = 0; i < count; i++) {
+			Packet &pkt = buffer_[i];
+			wsa_buf[i].buf = pkt.data.get() + pkt.writeIndex;
+			wsa_buf[i].len = pkt.size - pkt.writeIndex;
+			bytes += pkt.size - pkt.writeIndex;
+		}
+		DWORD sent = 0;
+		ret = (::WSASend(sockfd, wsa_buf, count, &sent, 0, NULL, NULL) == 0) ? (int)sent : -1;
+#endif
+
+		more = false;
 		if (ret > 0) {
-			pkt.writeIndex += ret;
-			if (pkt.size == pkt.writeIndex) {
-				count += 1;
-				buffer_.pop();
+			uint32_t written = (uint32_t)ret;
+			while (written > 0) {
+				Packet &pkt = buffer_.front();
+				uint32_t size = std::min(written, pkt.size - pkt.writeIndex);
+				pkt.writeIndex += size;
+				written -= size;
+				if (pkt.size == pkt.writeIndex) {
+					buffer_.pop_front();
+				}
 			}
+
+			/* the socket took everything, the rest of the queue may follow */
+			more = ((uint32_t)ret == bytes);
 		}
 		else if (ret < 0) {
 #if defined(__linux) || defined(__linux__)
@@ -125,7 +176,7 @@ int BufferWriter::Send(SOCKET sockfd, int timeout)
 				ret = 0;
 			}
 		}
-	} while (count > 0);
+	} while (more);
 
 	if (timeout > 0) {
 		SocketUtil::SetNonBlock(sockfd);
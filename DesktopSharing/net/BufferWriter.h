@@ -6,8 +6,9 @@
 
 #include <cstdint>
 #include <memory>
-#include <queue>
+#include <deque>
 #include <string>
+#include <vector>
 #include "Socket.h"
 
 namespace xop
@@ -23,11 +24,20 @@ void WriteUint16LE(char* p, uint16_t value);
 class BufferWriter
 {
 public:
+	struct Slice
+	{
+		std::shared_ptr<char> data;
+		uint32_t size;
+	};
+
 	BufferWriter(int capacity = kMaxQueueLength);
 	~BufferWriter() {}
 
 	bool Append(std::shared_ptr<char> data, uint32_t size, uint32_t index=0);
 	bool Append(const char* data, uint32_t size, uint32_t index=0);
+
+	/* the slices of one message, referenced and not copied, are queued or dropped together */
+	bool Append(const std::vector<Slice>& slices);
 	int Send(SOCKET sockfd, int timeout=0);
 
 	bool IsEmpty() const 
@@ -47,10 +57,11 @@ private:
 		uint32_t writeIndex;
 	} Packet;
 
-	std::queue<Packet> buffer_;  		
+	std::deque<Packet> buffer_;  		
 	int max_queue_length_ = 0;
 	 
 	static const int kMaxQueueLength = 10000;
+	static const int kMaxSendSlices = 64; // packets gathered by one send
 };
 
 }
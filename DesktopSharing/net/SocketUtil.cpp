@@ -191,3 +191,32 @@ bool SocketUtil::Connect(SOCKET sockfd, std::string ip, uint16_t port, int timeo
 	return is_connected;
 }
 
+bool SocketUtil::StartConnect(SOCKET sockfd, std::string ip, uint16_t port)
+{
+	struct sockaddr_in addr = { 0 };
+	socklen_t addrlen = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr(ip.c_str());
+
+	if (::connect(sockfd, (struct sockaddr*)&addr, addrlen) == SOCKET_ERROR) {
+#if defined(__linux) || defined(__linux__)
+		return (errno == EINPROGRESS || errno == EINTR);
+#elif defined(WIN32) || defined(_WIN32)
+		return (WSAGetLastError() == WSAEWOULDBLOCK);
+#endif
+	}
+
+	return true;
+}
+
+int SocketUtil::GetSocketError(SOCKET sockfd)
+{
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == SOCKET_ERROR) {
+		return -1;
+	}
+	return error;
+}
+
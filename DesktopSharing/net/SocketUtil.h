@@ -30,6 +30,11 @@ public:
     static int GetPeerAddr(SOCKET sockfd, struct sockaddr_in *addr);
     static void Close(SOCKET sockfd);
     static bool Connect(SOCKET sockfd, std::string ip, uint16_t port, int timeout=0);
+
+    /* connect on a non-blocking socket, true once started, the socket turns
+       writable when it completes and GetSocketError() tells how */
+    static bool StartConnect(SOCKET sockfd, std::string ip, uint16_t port);
+    static int GetSocketError(SOCKET sockfd);
 };
 
 }
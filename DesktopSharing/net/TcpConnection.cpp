@@ -54,6 +54,17 @@ void TcpConnection::Send(const char *data, uint32_t size)
 	}
 }
 
+void TcpConnection::Send(const std::vector<BufferWriter::Slice>& slices)
+{
+	if (!is_closed_) {
+		mutex_.lock();
+		write_buffer_->Append(slices);
+		mutex_.unlock();
+
+		this->HandleWrite();
+	}
+}
+
 void TcpConnection::Disconnect()
 {
 	std::lock_guard<std::mutex> lock(mutex_);
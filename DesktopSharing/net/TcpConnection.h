@@ -34,6 +34,7 @@ public:
 
 	void Send(std::shared_ptr<char> data, uint32_t size);
 	void Send(const char *data, uint32_t size);
+	void Send(const std::vector<BufferWriter::Slice>& slices);
     
 	void Disconnect();
 
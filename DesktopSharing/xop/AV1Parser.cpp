@@ -0,0 +1,284 @@
+﻿#include "AV1Parser.h"
+#include <cstring>
+
+using namespace xop;
+
+namespace
+{
+
+// msb first reader, av1 has no emulation prevention
+class BitReader
+{
+public:
+    BitReader(const uint8_t *data, uint32_t size)
+        : data_(data), size_(size)
+    {}
+
+    uint32_t ReadBits(uint32_t n)
+    {
+        uint32_t value = 0;
+        while (n--) {
+            value <<= 1;
+            if (pos_ < size_ * 8) {
+                value |= (data_[pos_ / 8] >> (7 - pos_ % 8)) & 1;
+            }
+            pos_++;
+        }
+        return value;
+    }
+
+    void SkipBits(uint32_t n)
+    { pos_ += n; }
+
+    // uvlc()
+    void SkipUvlc()
+    {
+        uint32_t leading_zeros = 0;
+        while (ReadBits(1) == 0 && leading_zeros < 32 && !IsOverflow()) {
+            leading_zeros++;
+        }
+        if (leading_zeros < 32) {
+            SkipBits(leading_zeros);
+        }
+    }
+
+    bool IsOverflow() const
+    { return pos_ > (size_t)size_ * 8; }
+
+private:
+    const uint8_t *data_;
+    uint32_t size_;
+    size_t pos_ = 0;
+};
+
+}
+
+uint32_t AV1Parser::ReadLeb128(const uint8_t *data, uint32_t size, uint32_t *value)
+{
+    uint64_t result = 0;
+
+    for (uint32_t i = 0; i < 8 && i < size; i++) {
+        result |= (uint64_t)(data[i] & 0x7f) << (i * 7);
+        if (!(data[i] & 0x80)) {
+            if (result > 0xffffffff) {
+                return 0;
+            }
+            *value = (uint32_t)result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t AV1Parser::WriteLeb128(uint32_t value, uint8_t *out_buf)
+{
+    uint32_t index = 0;
+
+    do {
+        out_buf[index] = value & 0x7f;
+        value >>= 7;
+        if (value > 0) {
+            out_buf[index] |= 0x80;
+        }
+        index++;
+    } while (value > 0);
+
+    return index;
+}
+
+uint32_t AV1Parser::GetLeb128Size(uint32_t value)
+{
+    uint32_t size = 1;
+    while (value >>= 7) {
+        size++;
+    }
+    return size;
+}
+
+bool AV1Parser::IsKeyFrame(const uint8_t *data, uint32_t size)
+{
+    bool is_key_frame = false;
+
+    ForEachObu(data, size, [&is_key_frame](const uint8_t *obu, uint32_t obu_size, uint32_t header_size) {
+        uint8_t obu_type = GetObuType(obu);
+        if (obu_type == OBU_SEQUENCE_HEADER) {
+            is_key_frame = true;
+        }
+        else if ((obu_type == OBU_FRAME || obu_type == OBU_FRAME_HEADER) && obu_size > header_size) {
+            // uncompressed_header(): show_existing_frame: 0, frame_type: KEY_FRAME(0)
+            uint8_t flags = obu[header_size];
+            is_key_frame = !(flags & 0x80) && ((flags >> 5) & 0x03) == 0;
+            return false;
+        }
+        return !is_key_frame;
+    });
+
+    return is_key_frame;
+}
+
+int AV1Parser::CreateAv1c(const uint8_t *data, uint32_t size, uint8_t *out_buf, uint32_t out_buf_size)
+{
+    if (size < 4) {
+        return -1;
+    }
+
+    // marker: 1, version: 1, already a record
+    if (data[0] == 0x81) {
+        if (out_buf_size < size) {
+            return -1;
+        }
+        memcpy(out_buf, data, size);
+        return (int)size;
+    }
+
+    const uint8_t *seq_header = nullptr;
+    uint32_t seq_header_size = 0;
+    uint32_t seq_payload_offset = 0;
+
+    ForEachObu(data, size, [&](const uint8_t *obu, uint32_t obu_size, uint32_t header_size) {
+        if (GetObuType(obu) == OBU_SEQUENCE_HEADER) {
+            seq_header = obu;
+            seq_header_size = obu_size;
+            seq_payload_offset = header_size;
+            return false;
+        }
+        return true;
+    });
+
+    if (seq_header == nullptr || out_buf_size < 4 + seq_header_size) {
+        return -1;
+    }
+
+    BitReader reader(seq_header + seq_payload_offset, seq_header_size - seq_payload_offset);
+
+    // sequence_header_obu()
+    uint32_t seq_profile = reader.ReadBits(3);
+    reader.SkipBits(1); // still_picture
+    uint32_t reduced_still_picture_header = reader.ReadBits(1);
+    uint32_t seq_level_idx_0 = 0;
+    uint32_t seq_tier_0 = 0;
+
+    if (reduced_still_picture_header) {
+        seq_level_idx_0 = reader.ReadBits(5);
+    }
+    else {
+        uint32_t decoder_model_info_present_flag = 0;
+        uint32_t buffer_delay_length_minus_1 = 0;
+
+        if (reader.ReadBits(1)) { // timing_info_present_flag
+            reader.SkipBits(64); // num_units_in_display_tick, time_scale
+            if (reader.ReadBits(1)) { // equal_picture_interval
+                reader.SkipUvlc(); // num_ticks_per_picture_minus_1
+            }
+            decoder_model_info_present_flag = reader.ReadBits(1);
+            if (decoder_model_info_present_flag) {
+                buffer_delay_length_minus_1 = reader.ReadBits(5);
+                reader.SkipBits(32 + 5 + 5);
+            }
+        }
+
+        uint32_t initial_display_delay_present_flag = reader.ReadBits(1);
+        uint32_t operating_points_cnt_minus_1 = reader.ReadBits(5);
+        for (uint32_t i = 0; i <= operating_points_cnt_minus_1; i++) {
+            reader.SkipBits(12); // operating_point_idc
+            uint32_t seq_level_idx = reader.ReadBits(5);
+            uint32_t seq_tier = (seq_level_idx > 7) ? reader.ReadBits(1) : 0;
+            if (decoder_model_info_present_flag && reader.ReadBits(1)) {
+                // decoder_buffer_delay, encoder_buffer_delay, low_delay_mode_flag
+                reader.SkipBits(2 * (buffer_delay_length_minus_1 + 1) + 1);
+            }
+            if (initial_display_delay_present_flag && reader.ReadBits(1)) {
+                reader.SkipBits(4);
+            }
+            if (i == 0) {
+                seq_level_idx_0 = seq_level_idx;
+                seq_tier_0 = seq_tier;
+            }
+        }
+    }
+
+    uint32_t frame_width_bits_minus_1 = reader.ReadBits(4);
+    uint32_t frame_height_bits_minus_1 = reader.ReadBits(4);
+    reader.SkipBits(frame_width_bits_minus_1 + 1 + frame_height_bits_minus_1 + 1);
+    if (!reduced_still_picture_header && reader.ReadBits(1)) { // frame_id_numbers_present_flag
+        reader.SkipBits(4 + 3);
+    }
+    // use_128x128_superblock, enable_filter_intra, enable_intra_edge_filter
+    reader.SkipBits(3);
+    if (!reduced_still_picture_header) {
+        // enable_interintra_compound, enable_masked_compound, enable_warped_motion, enable_dual_filter
+        reader.SkipBits(4);
+        uint32_t enable_order_hint = reader.ReadBits(1);
+        if (enable_order_hint) {
+            reader.SkipBits(2); // enable_jnt_comp, enable_ref_frame_mvs
+        }
+        uint32_t seq_force_screen_content_tools = 2; // SELECT_SCREEN_CONTENT_TOOLS
+        if (!reader.ReadBits(1)) { // seq_choose_screen_content_tools
+            seq_force_screen_content_tools = reader.ReadBits(1);
+        }
+        if (seq_force_screen_content_tools > 0 && !reader.ReadBits(1)) { // seq_choose_integer_mv
+            reader.SkipBits(1); // seq_force_integer_mv
+        }
+        if (enable_order_hint) {
+            reader.SkipBits(3); // order_hint_bits_minus_1
+        }
+    }
+    // enable_superres, enable_cdef, enable_restoration
+    reader.SkipBits(3);
+
+    // color_config()
+    uint32_t high_bitdepth = reader.ReadBits(1);
+    uint32_t twelve_bit = 0;
+    if (seq_profile == 2 && high_bitdepth) {
+        twelve_bit = reader.ReadBits(1);
+    }
+    uint32_t mono_chrome = (seq_profile == 1) ? 0 : reader.ReadBits(1);
+    uint32_t color_primaries = 2, transfer_characteristics = 2, matrix_coefficients = 2;
+    if (reader.ReadBits(1)) { // color_description_present_flag
+        color_primaries = reader.ReadBits(8);
+        transfer_characteristics = reader.ReadBits(8);
+        matrix_coefficients = reader.ReadBits(8);
+    }
+
+    uint32_t subsampling_x = 1, subsampling_y = 1, chroma_sample_position = 0;
+    if (mono_chrome) {
+        reader.SkipBits(1); // color_range
+    }
+    else if (color_primaries == 1 && transfer_characteristics == 13 && matrix_coefficients == 0) {
+        subsampling_x = subsampling_y = 0; // srgb
+    }
+    else {
+        reader.SkipBits(1); // color_range
+        if (seq_profile == 1) {
+            subsampling_x = subsampling_y = 0;
+        }
+        else if (seq_profile == 2) {
+            subsampling_x = 1;
+            subsampling_y = 0;
+            if (twelve_bit) {
+                subsampling_x = reader.ReadBits(1);
+                subsampling_y = subsampling_x ? reader.ReadBits(1) : 0;
+            }
+        }
+        if (subsampling_x && subsampling_y) {
+            chroma_sample_position = reader.ReadBits(2);
+        }
+    }
+
+    if (reader.IsOverflow()) {
+        return -1;
+    }
+
+    uint32_t index = 0;
+    out_buf[index++] = 0x81; // marker, version
+    out_buf[index++] = (uint8_t)((seq_profile << 5) | (seq_level_idx_0 & 0x1f));
+    out_buf[index++] = (uint8_t)((seq_tier_0 << 7) | (high_bitdepth << 6) | (twelve_bit << 5) | (mono_chrome << 4)
+                                 | (subsampling_x << 3) | (subsampling_y << 2) | (chroma_sample_position & 0x03));
+    out_buf[index++] = 0x00; // initial_presentation_delay_present: 0
+    // configOBUs
+    memcpy(out_buf + index, seq_header, seq_header_size);
+    index += seq_header_size;
+
+    return (int)index;
+}
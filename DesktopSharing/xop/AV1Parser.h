@@ -0,0 +1,90 @@
+﻿#ifndef XOP_AV1_PARSER_H
+#define XOP_AV1_PARSER_H
+
+#include <cstdint>
+
+namespace xop
+{
+
+class AV1Parser
+{
+public:
+    enum ObuType
+    {
+        OBU_SEQUENCE_HEADER        = 1,
+        OBU_TEMPORAL_DELIMITER     = 2,
+        OBU_FRAME_HEADER           = 3,
+        OBU_TILE_GROUP             = 4,
+        OBU_METADATA               = 5,
+        OBU_FRAME                  = 6,
+        OBU_REDUNDANT_FRAME_HEADER = 7,
+        OBU_TILE_LIST              = 8,
+        OBU_PADDING                = 15,
+    };
+
+    static uint8_t GetObuType(const uint8_t *obu)
+    { return (obu[0] >> 3) & 0x0f; }
+
+    /* leb128() of the av1 spec, returns the bytes read, 0 if it is truncated or too long */
+    static uint32_t ReadLeb128(const uint8_t *data, uint32_t size, uint32_t *value);
+
+    /* returns the bytes written, at most 5 */
+    static uint32_t WriteLeb128(uint32_t value, uint8_t *out_buf);
+
+    static uint32_t GetLeb128Size(uint32_t value);
+
+    /* A temporal unit a decoder can start from: a sequence header or a key frame. */
+    static bool IsKeyFrame(const uint8_t *data, uint32_t size);
+
+    /* AV1CodecConfigurationRecord (av1-isobmff) from a sequence header obu,
+       returns the record size or -1. An av1C record as input is copied as is. */
+    static int CreateAv1c(const uint8_t *data, uint32_t size, uint8_t *out_buf, uint32_t out_buf_size);
+
+    /* fn(obu, obu_size, header_size) for each obu of a temporal unit in the low overhead
+       bitstream format, obu_size includes the header and its obu_size field, the payload
+       starts at obu + header_size. Stops when fn returns false, returns false if the
+       unit is malformed. */
+    template <typename Fn>
+    static bool ForEachObu(const uint8_t *data, uint32_t size, Fn fn)
+    {
+        uint32_t pos = 0;
+
+        while (pos < size) {
+            const uint8_t *obu = data + pos;
+            uint32_t header_size = (obu[0] & 0x04) ? 2 : 1; // obu_extension_flag
+            uint32_t payload_size = 0;
+
+            if (!(obu[0] & 0x02)) { // obu_has_size_field: 0, the obu fills the rest
+                if (header_size > size - pos) {
+                    return false;
+                }
+                payload_size = size - pos - header_size;
+            }
+            else {
+                if (header_size >= size - pos) {
+                    return false;
+                }
+                uint32_t leb128_size = ReadLeb128(obu + header_size, size - pos - header_size, &payload_size);
+                if (leb128_size == 0) {
+                    return false;
+                }
+                header_size += leb128_size;
+                if (payload_size > size - pos - header_size) {
+                    return false;
+                }
+            }
+
+            if (!fn(obu, header_size + payload_size, header_size)) {
+                break;
+            }
+
+            pos += header_size + payload_size;
+        }
+
+        return true;
+    }
+};
+
+}
+
+#endif
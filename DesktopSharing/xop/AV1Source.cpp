@@ -0,0 +1,149 @@
+﻿#if defined(WIN32) || defined(_WIN32) 
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#endif
+
+#include "AV1Source.h"
+#include "AV1Parser.h"
+#include <cstdio>
+#include <chrono>
+#if defined(__linux) || defined(__linux__) 
+#include <sys/time.h>
+#endif
+
+using namespace xop;
+using namespace std;
+
+AV1Source::AV1Source(uint32_t framerate)
+	: framerate_(framerate)
+{
+	payload_    = 96;
+	media_type_ = AV1;
+	clock_rate_ = 90000;
+}
+
+AV1Source* AV1Source::CreateNew(uint32_t framerate)
+{
+	return new AV1Source(framerate);
+}
+
+AV1Source::~AV1Source()
+{
+	
+}
+
+string AV1Source::GetMediaDescription(uint16_t port)
+{
+	char buf[100] = {0};
+	sprintf(buf, "m=video %hu RTP/AVP 96", port);
+	return string(buf);
+}
+	
+string AV1Source::GetAttribute()
+{
+	return string("a=rtpmap:96 AV1/90000");
+}
+
+bool AV1Source::HandleFrame(MediaChannelId channelId, AVFrame frame)
+{
+	uint8_t *frame_buf  = frame.buffer.get();
+	uint32_t frame_size = frame.size;
+
+	if (frame.timestamp == 0) {
+		frame.timestamp = GetTimestamp();
+	}
+
+	/* aggregation header: Z: continues the last obu of the previous packet,
+	   Y: the last obu continues in the next packet, W: 0, every obu element
+	   is prefixed with its leb128 size, N: first packet of a coded video sequence */
+	uint8_t aggregation_header = AV1Parser::IsKeyFrame(frame_buf, frame_size) ? 0x08 : 0x00;
+
+	RtpPacket rtp_pkt;
+	uint8_t *payload = rtp_pkt.data.get() + 4 + RTP_HEADER_SIZE;
+	uint32_t index = 1;
+
+	auto send_packet = [&](bool last) {
+		rtp_pkt.type = frame.type;
+		rtp_pkt.timestamp = frame.timestamp;
+		rtp_pkt.size = 4 + RTP_HEADER_SIZE + index;
+		rtp_pkt.last = last ? 1 : 0;
+		payload[0] = aggregation_header;
+
+		bool ret = true;
+		if (send_frame_callback_) {
+			ret = send_frame_callback_(channelId, rtp_pkt);
+		}
+
+		rtp_pkt = RtpPacket();
+		payload = rtp_pkt.data.get() + 4 + RTP_HEADER_SIZE;
+		index = 1;
+		aggregation_header = 0;
+		return ret;
+	};
+
+	bool ret = true;
+	bool is_valid = AV1Parser::ForEachObu(frame_buf, frame_size, [&](const uint8_t *obu, uint32_t obu_size, uint32_t header_size) {
+		uint8_t obu_type = AV1Parser::GetObuType(obu);
+		if (obu_type == AV1Parser::OBU_TEMPORAL_DELIMITER || obu_type == AV1Parser::OBU_TILE_LIST
+			|| obu_type == AV1Parser::OBU_PADDING) {
+			return true;
+		}
+
+		/* the obu element is sent without its obu_size field */
+		uint8_t obu_header[2] = { (uint8_t)(obu[0] & ~0x02), obu[1] };
+		uint32_t obu_header_size = (obu[0] & 0x04) ? 2 : 1;
+		const uint8_t *obu_payload = obu + header_size;
+		uint32_t obu_payload_size = obu_size - header_size;
+		uint32_t element_size = obu_header_size + obu_payload_size;
+		uint32_t element_pos = 0;
+
+		while (element_pos < element_size) {
+			uint32_t space = MAX_RTP_PAYLOAD_SIZE - index;
+			if (space < 2 + obu_header_size) {
+				if (!send_packet(false)) {
+					ret = false;
+					return false;
+				}
+				continue;
+			}
+
+			uint32_t fragment_size = element_size - element_pos;
+			if (fragment_size + AV1Parser::GetLeb128Size(fragment_size) > space) {
+				fragment_size = space - AV1Parser::GetLeb128Size(space);
+			}
+
+			index += AV1Parser::WriteLeb128(fragment_size, payload + index);
+			for (uint32_t i = 0; i < fragment_size; i++, element_pos++) {
+				payload[index++] = (element_pos < obu_header_size) ? obu_header[element_pos]
+					: obu_payload[element_pos - obu_header_size];
+			}
+
+			if (element_pos < element_size) {
+				aggregation_header |= 0x40; // Y
+				if (!send_packet(false)) {
+					ret = false;
+					return false;
+				}
+				aggregation_header |= 0x80; // Z
+			}
+		}
+		return true;
+	});
+
+	if (!ret) {
+		return false;
+	}
+
+	if (index > 1) {
+		return send_packet(true);
+	}
+
+	return is_valid;
+}
+
+uint32_t AV1Source::GetTimestamp()
+{
+	auto time_point = chrono::time_point_cast<chrono::microseconds>(chrono::steady_clock::now());
+	return (uint32_t)((time_point.time_since_epoch().count() + 500) / 1000 * 90);
+}
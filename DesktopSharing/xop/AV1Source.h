@@ -0,0 +1,40 @@
+﻿#ifndef XOP_AV1_SOURCE_H
+#define XOP_AV1_SOURCE_H
+
+#include "MediaSource.h"
+#include "rtp.h"
+
+namespace xop
+{
+
+/* RTP payload format for AV1 (AOMedia), a frame is a whole temporal unit
+   in the low overhead bitstream format. */
+class AV1Source : public MediaSource
+{
+public:
+	static AV1Source* CreateNew(uint32_t framerate=25);
+	~AV1Source();
+
+	void Setframerate(uint32_t framerate)
+	{ framerate_ = framerate; }
+
+	uint32_t GetFramerate() const 
+	{ return framerate_; }
+
+	virtual std::string GetMediaDescription(uint16_t port=0); 
+
+	virtual std::string GetAttribute(); 
+
+	bool HandleFrame(MediaChannelId channelId, AVFrame frame);
+
+	static uint32_t GetTimestamp();
+	 
+private:
+	AV1Source(uint32_t framerate);
+
+	uint32_t framerate_ = 25;
+};
+	
+}
+
+#endif
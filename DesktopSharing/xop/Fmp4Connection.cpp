@@ -0,0 +1,220 @@
+#include "Fmp4Connection.h"
+#include "RtmpServer.h"
+#include "WebSocket.h"
+#include "net/Logger.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace xop;
+
+Fmp4Connection::Fmp4Connection(std::shared_ptr<RtmpServer> rtmp_server, TaskScheduler* scheduler, SOCKET sockfd)
+	: TcpConnection(scheduler, sockfd)
+	, rtmp_server_(rtmp_server)
+	, task_scheduler_(scheduler)
+{
+	this->SetReadCallback([this](std::shared_ptr<TcpConnection> conn, xop::BufferReader& buffer) {
+		return this->OnRead(buffer);
+	});
+
+	this->SetCloseCallback([this](std::shared_ptr<TcpConnection> conn) {
+		this->OnClose();
+	});
+}
+
+Fmp4Connection::~Fmp4Connection()
+{
+
+}
+
+bool Fmp4Connection::OnRead(BufferReader& buffer)
+{
+	if (!stream_path_.empty()) {
+		if (is_websocket_) {
+			return OnWebSocketRead(buffer);
+		}
+
+		buffer.RetrieveAll();
+		return true;
+	}
+
+	const char* last_crlf_crlf = buffer.FindLastCrlfCrlf();
+	if (last_crlf_crlf == nullptr) {
+		return (buffer.ReadableBytes() >= 4096) ? false : true;
+	}
+
+	std::string buf(buffer.Peek(), last_crlf_crlf - buffer.Peek());
+	buffer.RetrieveUntil(last_crlf_crlf + 4);
+
+	/* GET <stream path>.mp4[?query] HTTP/1.1 */
+	auto pos1 = buf.find("GET ");
+	auto pos2 = buf.find(' ', pos1 + 4);
+	if (pos1 == std::string::npos || pos2 == std::string::npos) {
+		return false;
+	}
+
+	std::string uri = buf.substr(pos1 + 4, pos2 - pos1 - 4);
+	uri = uri.substr(0, uri.find('?'));
+	if (uri.size() <= 4 || uri.compare(uri.size() - 4, 4, ".mp4") != 0) {
+		std::string http_header = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+		this->Send(http_header.c_str(), (uint32_t)http_header.size());
+		return false;
+	}
+
+	/* header names are case insensitive */
+	std::string headers = buf;
+	std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+
+	std::string websocket_key;
+	auto key_pos = headers.find("sec-websocket-key:");
+	if (key_pos != std::string::npos && headers.find("upgrade: websocket") != std::string::npos) {
+		key_pos = buf.find_first_not_of(' ', key_pos + 18);
+		auto key_end = buf.find("\r\n", key_pos);
+		websocket_key = buf.substr(key_pos, key_end - key_pos);
+		websocket_key = websocket_key.substr(0, websocket_key.find_last_not_of(' ') + 1);
+	}
+
+	auto rtmp_server = rtmp_server_.lock();
+	if (rtmp_server == nullptr) {
+		return false;
+	}
+
+	stream_path_ = uri.substr(0, uri.size() - 4);
+
+	std::string http_header;
+	if (!websocket_key.empty()) {
+		is_websocket_ = true;
+		http_header = "HTTP/1.1 101 Switching Protocols\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Accept: " + WebSocket::GetAcceptKey(websocket_key) + "\r\n\r\n";
+	}
+	else {
+		http_header = "HTTP/1.1 200 OK\r\n"
+			"Content-Type: video/mp4\r\n"
+			"Transfer-Encoding: chunked\r\n"
+			"Cache-Control: no-cache\r\n"
+			"Access-Control-Allow-Origin: *\r\n\r\n";
+	}
+	this->Send(http_header.c_str(), (uint32_t)http_header.size());
+
+	/* the viewer holds the session until it closes */
+	auto session = rtmp_server->AcquireSession(stream_path_);
+	has_session_ = true;
+	if (session != nullptr) {
+		session->AddFmp4Client(std::dynamic_pointer_cast<Fmp4Connection>(shared_from_this()));
+	}
+
+	return true;
+}
+
+bool Fmp4Connection::OnWebSocketRead(BufferReader& buffer)
+{
+	while (buffer.ReadableBytes() > 0) {
+		uint8_t opcode = 0;
+		std::string payload;
+		int size = WebSocket::ParseFrame((const uint8_t*)buffer.Peek(), buffer.ReadableBytes(), opcode, payload);
+		if (size < 0) {
+			return false;
+		}
+		else if (size == 0) {
+			break;
+		}
+		buffer.Retrieve(size);
+
+		if (opcode == WebSocket::kClose) {
+			uint8_t header[WebSocket::kMaxFrameHeaderSize];
+			uint32_t header_size = WebSocket::WriteFrameHeader(header, WebSocket::kClose, 0);
+			this->Send((const char*)header, header_size);
+			return false;
+		}
+		else if (opcode == WebSocket::kPing) {
+			uint8_t header[WebSocket::kMaxFrameHeaderSize];
+			uint32_t header_size = WebSocket::WriteFrameHeader(header, WebSocket::kPong, payload.size());
+			this->Send((const char*)header, header_size);
+			if (!payload.empty()) {
+				this->Send(payload.c_str(), (uint32_t)payload.size());
+			}
+		}
+	}
+
+	return true;
+}
+
+void Fmp4Connection::OnClose()
+{
+	auto rtmp_server = rtmp_server_.lock();
+	if (rtmp_server != nullptr && has_session_) {
+		auto session = rtmp_server->FindSession(stream_path_);
+		if (session != nullptr) {
+			auto conn = std::dynamic_pointer_cast<Fmp4Connection>(shared_from_this());
+			task_scheduler_->AddTimer([session, conn] {
+				session->RemoveFmp4Client(conn);
+				return false;
+			}, 1);
+		}
+
+		rtmp_server->ReleaseSession(stream_path_);
+		has_session_ = false;
+	}
+}
+
+bool Fmp4Connection::PlayGopCache(const Fmp4Buffer& init, std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos)
+{
+	if (init.size == 0) {
+		return false;
+	}
+
+	/* the range starts on a key fragment */
+	std::vector<GopCache::FramePtr> frames;
+	if (!gop_cache->Read(start_pos, end_pos, frames)) {
+		return false;
+	}
+
+	init_segment_ = init.data;
+	is_playing_ = true;
+	SendData(init.data, init.size);
+
+	for (auto& frame : frames) {
+		SendData(frame->data, frame->size);
+	}
+
+	return true;
+}
+
+bool Fmp4Connection::PlayFragment(const Fmp4Buffer& init, const Fmp4Buffer& fragment, bool key_frame)
+{
+	if (init.size == 0 || fragment.size == 0) {
+		return false;
+	}
+
+	if (init.data != init_segment_) {
+		if (!key_frame) {
+			return false;
+		}
+
+		init_segment_ = init.data;
+		is_playing_ = true;
+		SendData(init.data, init.size);
+	}
+
+	SendData(fragment.data, fragment.size);
+	return true;
+}
+
+void Fmp4Connection::SendData(std::shared_ptr<char> data, uint32_t size)
+{
+	/* framing only, the muxed bytes are shared with the other viewers */
+	if (is_websocket_) {
+		uint8_t header[WebSocket::kMaxFrameHeaderSize];
+		uint32_t header_size = WebSocket::WriteFrameHeader(header, WebSocket::kBinary, size);
+		this->Send((const char*)header, header_size);
+		this->Send(data, size);
+	}
+	else {
+		char header[16] = { 0 };
+		int header_size = snprintf(header, sizeof(header), "%x\r\n", size);
+		this->Send(header, (uint32_t)header_size);
+		this->Send(data, size);
+		this->Send("\r\n", 2);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef XOP_FMP4_CONNECTION_H
+#define XOP_FMP4_CONNECTION_H
+
+#include "net/EventLoop.h"
+#include "net/TcpConnection.h"
+#include "Fmp4Muxer.h"
+#include "GopCache.h"
+
+namespace xop
+{
+
+class RtmpServer;
+
+/* fragmented mp4 live stream of an rtmp session for mse players,
+   GET <stream path>.mp4 over http chunked transfer or a websocket.
+   the fragments are muxed once by the session, sent here as they are. */
+class Fmp4Connection : public TcpConnection
+{
+public:
+	Fmp4Connection(std::shared_ptr<RtmpServer> rtmp_server, TaskScheduler* taskScheduler, SOCKET sockfd);
+	virtual ~Fmp4Connection();
+
+	bool IsPlaying() const
+	{ return is_playing_; }
+
+	bool IsWebSocket() const
+	{ return is_websocket_; }
+
+	/* on the connection's own thread, from its subscriber shard. the init segment
+	   goes out (again) before the first key fragment following a change. */
+	bool PlayGopCache(const Fmp4Buffer& init, std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos);
+	bool PlayFragment(const Fmp4Buffer& init, const Fmp4Buffer& fragment, bool key_frame);
+
+private:
+	bool OnRead(BufferReader& buffer);
+	bool OnWebSocketRead(BufferReader& buffer);
+	void OnClose();
+
+	void SendData(std::shared_ptr<char> data, uint32_t size);
+
+	std::weak_ptr<RtmpServer> rtmp_server_;
+	TaskScheduler* task_scheduler_ = nullptr;
+	std::string stream_path_;
+	bool has_session_ = false;
+
+	bool is_websocket_ = false;
+	bool is_playing_ = false;
+	bool has_key_frame_ = false;
+	std::shared_ptr<char> init_segment_;
+};
+
+}
+
+#endif
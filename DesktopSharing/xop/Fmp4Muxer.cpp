@@ -0,0 +1,520 @@
+#include "Fmp4Muxer.h"
+#include "H264Parser.h"
+#include <cstring>
+#include <string>
+#include "rtmp.h"
+
+using namespace xop;
+
+namespace
+{
+
+void Write8(std::vector<uint8_t>& buf, uint8_t value)
+{
+	buf.push_back(value);
+}
+
+void Write16(std::vector<uint8_t>& buf, uint16_t value)
+{
+	buf.push_back(value >> 8);
+	buf.push_back(value & 0xff);
+}
+
+void Write24(std::vector<uint8_t>& buf, uint32_t value)
+{
+	buf.push_back((value >> 16) & 0xff);
+	buf.push_back((value >> 8) & 0xff);
+	buf.push_back(value & 0xff);
+}
+
+void Write32(std::vector<uint8_t>& buf, uint32_t value)
+{
+	buf.push_back(value >> 24);
+	buf.push_back((value >> 16) & 0xff);
+	buf.push_back((value >> 8) & 0xff);
+	buf.push_back(value & 0xff);
+}
+
+void Write64(std::vector<uint8_t>& buf, uint64_t value)
+{
+	Write32(buf, (uint32_t)(value >> 32));
+	Write32(buf, (uint32_t)(value & 0xffffffff));
+}
+
+void WriteBytes(std::vector<uint8_t>& buf, const uint8_t* data, uint32_t size)
+{
+	buf.insert(buf.end(), data, data + size);
+}
+
+void WriteZero(std::vector<uint8_t>& buf, uint32_t size)
+{
+	buf.insert(buf.end(), size, 0);
+}
+
+void Patch32(std::vector<uint8_t>& buf, size_t pos, uint32_t value)
+{
+	buf[pos] = value >> 24;
+	buf[pos + 1] = (value >> 16) & 0xff;
+	buf[pos + 2] = (value >> 8) & 0xff;
+	buf[pos + 3] = value & 0xff;
+}
+
+/* returns the position of the size field, patched by EndBox() */
+size_t BeginBox(std::vector<uint8_t>& buf, const char* type)
+{
+	size_t pos = buf.size();
+	Write32(buf, 0);
+	WriteBytes(buf, (const uint8_t*)type, 4);
+	return pos;
+}
+
+size_t BeginFullBox(std::vector<uint8_t>& buf, const char* type, uint8_t version, uint32_t flags)
+{
+	size_t pos = BeginBox(buf, type);
+	Write8(buf, version);
+	Write24(buf, flags);
+	return pos;
+}
+
+void EndBox(std::vector<uint8_t>& buf, size_t pos)
+{
+	Patch32(buf, pos, (uint32_t)(buf.size() - pos));
+}
+
+void WriteMatrix(std::vector<uint8_t>& buf)
+{
+	static const uint32_t matrix[9] = {
+		0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+	};
+
+	for (uint32_t value : matrix) {
+		Write32(buf, value);
+	}
+}
+
+Fmp4Buffer MakeBuffer(const std::vector<uint8_t>& buf)
+{
+	Fmp4Buffer buffer;
+	buffer.data.reset(new char[buf.size()], std::default_delete<char[]>());
+	buffer.size = (uint32_t)buf.size();
+	memcpy(buffer.data.get(), buf.data(), buf.size());
+	return buffer;
+}
+
+}
+
+Fmp4Muxer::Fmp4Muxer()
+{
+
+}
+
+Fmp4Muxer::~Fmp4Muxer()
+{
+
+}
+
+bool Fmp4Muxer::SetAvcSequenceHeader(const uint8_t* payload, uint32_t size)
+{
+	/* 0x17 00 cts(3), then the AVCDecoderConfigurationRecord */
+	if (size < 5 + 8 || (payload[0] & 0x0f) != RTMP_CODEC_ID_H264 || payload[1] != 0) {
+		return false;
+	}
+
+	const uint8_t* avcc = payload + 5;
+	uint32_t avcc_size = size - 5;
+	uint32_t sps_count = avcc[5] & 0x1f;
+	uint32_t sps_size = (avcc[6] << 8) | avcc[7];
+	if (sps_count == 0 || 8 + sps_size > avcc_size) {
+		return false;
+	}
+
+	uint32_t width = 0, height = 0;
+	if (!H264Parser::ParseSpsResolution(avcc + 8, sps_size, width, height)) {
+		return false;
+	}
+
+	avc_config_.assign(avcc, avcc + avcc_size);
+	width_ = width;
+	height_ = height;
+	init_segment_ = Fmp4Buffer();
+	return true;
+}
+
+bool Fmp4Muxer::SetAacSequenceHeader(const uint8_t* payload, uint32_t size)
+{
+	static const uint32_t samplerates[13] = {
+		96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+	};
+
+	/* 0xaf 00, then the AudioSpecificConfig */
+	if (size < 4 || ((payload[0] >> 4) & 0x0f) != RTMP_CODEC_ID_AAC || payload[1] != 0) {
+		return false;
+	}
+
+	const uint8_t* config = payload + 2;
+	uint32_t samplerate_index = ((config[0] & 0x07) << 1) | (config[1] >> 7);
+	uint32_t channels = (config[1] >> 3) & 0x0f;
+	if (samplerate_index >= 13 || channels == 0) {
+		return false;
+	}
+
+	aac_config_.assign(config, payload + size);
+	samplerate_ = samplerates[samplerate_index];
+	channels_ = channels;
+	has_audio_dts_ = false;
+	init_segment_ = Fmp4Buffer();
+	return true;
+}
+
+Fmp4Buffer Fmp4Muxer::GetInitSegment()
+{
+	if (init_segment_.size > 0 || (!HasVideo() && !HasAudio())) {
+		return init_segment_;
+	}
+
+	std::vector<uint8_t> buf;
+	buf.reserve(1024);
+
+	size_t ftyp = BeginBox(buf, "ftyp");
+	WriteBytes(buf, (const uint8_t*)"iso6", 4);
+	Write32(buf, 0);
+	WriteBytes(buf, (const uint8_t*)"iso6cmfcisommp41", 16);
+	EndBox(buf, ftyp);
+
+	size_t moov = BeginBox(buf, "moov");
+
+	size_t mvhd = BeginFullBox(buf, "mvhd", 0, 0);
+	Write32(buf, 0);          // creation time
+	Write32(buf, 0);          // modification time
+	Write32(buf, 1000);       // timescale
+	Write32(buf, 0);          // duration
+	Write32(buf, 0x00010000); // rate
+	Write16(buf, 0x0100);     // volume
+	WriteZero(buf, 10);
+	WriteMatrix(buf);
+	WriteZero(buf, 24);
+	Write32(buf, kAudioTrackId + 1);
+	EndBox(buf, mvhd);
+
+	for (int i = 0; i < 2; i++) {
+		bool is_video = (i == 0);
+		if ((is_video && !HasVideo()) || (!is_video && !HasAudio())) {
+			continue;
+		}
+
+		size_t trak = BeginBox(buf, "trak");
+
+		size_t tkhd = BeginFullBox(buf, "tkhd", 0, 0x000003); // enabled, in movie
+		Write32(buf, 0);
+		Write32(buf, 0);
+		Write32(buf, is_video ? kVideoTrackId : kAudioTrackId);
+		Write32(buf, 0);
+		Write32(buf, 0);          // duration
+		WriteZero(buf, 8);
+		Write16(buf, 0);          // layer
+		Write16(buf, 0);          // alternate group
+		Write16(buf, is_video ? 0 : 0x0100);
+		Write16(buf, 0);
+		WriteMatrix(buf);
+		Write32(buf, is_video ? (width_ << 16) : 0);
+		Write32(buf, is_video ? (height_ << 16) : 0);
+		EndBox(buf, tkhd);
+
+		size_t mdia = BeginBox(buf, "mdia");
+
+		size_t mdhd = BeginFullBox(buf, "mdhd", 0, 0);
+		Write32(buf, 0);
+		Write32(buf, 0);
+		Write32(buf, is_video ? kVideoTimescale : samplerate_);
+		Write32(buf, 0);
+		Write16(buf, 0x55c4);     // und
+		Write16(buf, 0);
+		EndBox(buf, mdhd);
+
+		size_t hdlr = BeginFullBox(buf, "hdlr", 0, 0);
+		Write32(buf, 0);
+		WriteBytes(buf, (const uint8_t*)(is_video ? "vide" : "soun"), 4);
+		WriteZero(buf, 12);
+		const char* name = is_video ? "VideoHandler" : "SoundHandler";
+		WriteBytes(buf, (const uint8_t*)name, (uint32_t)strlen(name) + 1);
+		EndBox(buf, hdlr);
+
+		size_t minf = BeginBox(buf, "minf");
+		if (is_video) {
+			size_t vmhd = BeginFullBox(buf, "vmhd", 0, 1);
+			WriteZero(buf, 8);
+			EndBox(buf, vmhd);
+		}
+		else {
+			size_t smhd = BeginFullBox(buf, "smhd", 0, 0);
+			WriteZero(buf, 4);
+			EndBox(buf, smhd);
+		}
+
+		size_t dinf = BeginBox(buf, "dinf");
+		size_t dref = BeginFullBox(buf, "dref", 0, 0);
+		Write32(buf, 1);
+		size_t url = BeginFullBox(buf, "url ", 0, 1); // media in the same file
+		EndBox(buf, url);
+		EndBox(buf, dref);
+		EndBox(buf, dinf);
+
+		size_t stbl = BeginBox(buf, "stbl");
+		size_t stsd = BeginFullBox(buf, "stsd", 0, 0);
+		Write32(buf, 1);
+		if (is_video) {
+			size_t avc1 = BeginBox(buf, "avc1");
+			WriteZero(buf, 6);
+			Write16(buf, 1);          // data reference index
+			WriteZero(buf, 16);
+			Write16(buf, (uint16_t)width_);
+			Write16(buf, (uint16_t)height_);
+			Write32(buf, 0x00480000); // 72 dpi
+			Write32(buf, 0x00480000);
+			Write32(buf, 0);
+			Write16(buf, 1);          // frame count
+			WriteZero(buf, 32);       // compressor name
+			Write16(buf, 0x0018);     // depth
+			Write16(buf, 0xffff);
+			size_t avcc = BeginBox(buf, "avcC");
+			WriteBytes(buf, avc_config_.data(), (uint32_t)avc_config_.size());
+			EndBox(buf, avcc);
+			EndBox(buf, avc1);
+		}
+		else {
+			size_t mp4a = BeginBox(buf, "mp4a");
+			WriteZero(buf, 6);
+			Write16(buf, 1);
+			WriteZero(buf, 8);
+			Write16(buf, (uint16_t)channels_);
+			Write16(buf, 16);         // sample size
+			WriteZero(buf, 4);
+			Write32(buf, samplerate_ << 16);
+
+			uint8_t config_size = (uint8_t)aac_config_.size();
+			size_t esds = BeginFullBox(buf, "esds", 0, 0);
+			Write8(buf, 0x03);        // ES_Descriptor
+			Write8(buf, 23 + config_size);
+			Write16(buf, kAudioTrackId);
+			Write8(buf, 0);
+			Write8(buf, 0x04);        // DecoderConfigDescriptor
+			Write8(buf, 15 + config_size);
+			Write8(buf, 0x40);        // mpeg-4 audio
+			Write8(buf, 0x15);        // audio stream
+			Write24(buf, 0);
+			Write32(buf, 0);
+			Write32(buf, 0);
+			Write8(buf, 0x05);        // DecoderSpecificInfo
+			Write8(buf, config_size);
+			WriteBytes(buf, aac_config_.data(), config_size);
+			Write8(buf, 0x06);        // SLConfigDescriptor
+			Write8(buf, 1);
+			Write8(buf, 0x02);
+			EndBox(buf, esds);
+			EndBox(buf, mp4a);
+		}
+		EndBox(buf, stsd);
+
+		/* empty sample tables, the samples are in the fragments */
+		const char* tables[3] = { "stts", "stsc", "stco" };
+		for (const char* table : tables) {
+			size_t box = BeginFullBox(buf, table, 0, 0);
+			Write32(buf, 0);
+			EndBox(buf, box);
+		}
+		size_t stsz = BeginFullBox(buf, "stsz", 0, 0);
+		Write32(buf, 0);
+		Write32(buf, 0);
+		EndBox(buf, stsz);
+		EndBox(buf, stbl);
+
+		EndBox(buf, minf);
+		EndBox(buf, mdia);
+		EndBox(buf, trak);
+	}
+
+	size_t mvex = BeginBox(buf, "mvex");
+	for (uint32_t track_id = kVideoTrackId; track_id <= kAudioTrackId; track_id++) {
+		if ((track_id == kVideoTrackId && !HasVideo()) || (track_id == kAudioTrackId && !HasAudio())) {
+			continue;
+		}
+
+		size_t trex = BeginFullBox(buf, "trex", 0, 0);
+		Write32(buf, track_id);
+		Write32(buf, 1);          // sample description index
+		Write32(buf, 0);
+		Write32(buf, 0);
+		Write32(buf, 0);
+		EndBox(buf, trex);
+	}
+	EndBox(buf, mvex);
+
+	EndBox(buf, moov);
+
+	init_segment_ = MakeBuffer(buf);
+	return init_segment_;
+}
+
+bool Fmp4Muxer::AddVideo(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t size)
+{
+	const uint8_t* data = (const uint8_t*)payload.get();
+	if (!HasVideo() || size <= 5 || (data[0] & 0x0f) != RTMP_CODEC_ID_H264 || data[1] != 1) {
+		return false;
+	}
+
+	int32_t cts = (data[2] << 16) | (data[3] << 8) | data[4];
+	if (cts & 0x800000) {
+		cts -= 0x1000000;
+	}
+
+	Sample sample;
+	sample.payload = payload;
+	sample.offset = 5;
+	sample.size = size - 5;
+	sample.dts = timestamp * (kVideoTimescale / 1000);
+	sample.cts = cts * (int32_t)(kVideoTimescale / 1000);
+	sample.key_frame = IsVideoKeyFrame(data, size);
+
+	if (!video_samples_.empty() && sample.dts > video_samples_.back().dts) {
+		video_samples_.back().duration = (uint32_t)(sample.dts - video_samples_.back().dts);
+		last_video_duration_ = video_samples_.back().duration;
+	}
+
+	video_samples_.push_back(sample);
+	return true;
+}
+
+bool Fmp4Muxer::AddAudio(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t size)
+{
+	const uint8_t* data = (const uint8_t*)payload.get();
+	if (!HasAudio() || size <= 2 || ((data[0] >> 4) & 0x0f) != RTMP_CODEC_ID_AAC || data[1] != 1) {
+		return false;
+	}
+
+	/* aac frames are 1024 samples, the rtmp timestamp in msec is only used
+	   to resync when the counted time drifts away more than 100ms */
+	uint64_t dts = timestamp * samplerate_ / 1000;
+	uint64_t drift = (dts > next_audio_dts_) ? (dts - next_audio_dts_) : (next_audio_dts_ - dts);
+	if (!has_audio_dts_ || drift > samplerate_ / 10) {
+		next_audio_dts_ = dts;
+		has_audio_dts_ = true;
+	}
+
+	Sample sample;
+	sample.payload = payload;
+	sample.offset = 2;
+	sample.size = size - 2;
+	sample.dts = next_audio_dts_;
+	sample.duration = 1024;
+	sample.key_frame = true;
+	next_audio_dts_ += 1024;
+
+	audio_samples_.push_back(sample);
+	return true;
+}
+
+void Fmp4Muxer::WriteTraf(std::vector<uint8_t>& buf, uint32_t track_id, const std::vector<Sample>& samples,
+	bool is_video, size_t& data_offset_pos)
+{
+	size_t traf = BeginBox(buf, "traf");
+
+	size_t tfhd = BeginFullBox(buf, "tfhd", 0, 0x020000); // default base is moof
+	Write32(buf, track_id);
+	EndBox(buf, tfhd);
+
+	size_t tfdt = BeginFullBox(buf, "tfdt", 1, 0);
+	Write64(buf, samples.front().dts);
+	EndBox(buf, tfdt);
+
+	/* data offset, duration, size, flags and composition offset (signed, version 1) */
+	uint32_t flags = is_video ? 0x000f01 : 0x000301;
+	size_t trun = BeginFullBox(buf, "trun", is_video ? 1 : 0, flags);
+	Write32(buf, (uint32_t)samples.size());
+	data_offset_pos = buf.size();
+	Write32(buf, 0);
+	for (const Sample& sample : samples) {
+		Write32(buf, sample.duration);
+		Write32(buf, sample.size);
+		if (is_video) {
+			Write32(buf, sample.key_frame ? 0x02000000 : 0x01010000);
+			Write32(buf, (uint32_t)sample.cts);
+		}
+	}
+	EndBox(buf, trun);
+
+	EndBox(buf, traf);
+}
+
+Fmp4Buffer Fmp4Muxer::Flush()
+{
+	if (!HasSamples()) {
+		return Fmp4Buffer();
+	}
+
+	/* the next sample is not known yet, the last one lasts as long as the one before */
+	if (!video_samples_.empty()) {
+		video_samples_.back().duration = last_video_duration_;
+	}
+
+	uint32_t video_bytes = 0, audio_bytes = 0;
+	for (const Sample& sample : video_samples_) {
+		video_bytes += sample.size;
+	}
+	for (const Sample& sample : audio_samples_) {
+		audio_bytes += sample.size;
+	}
+
+	std::vector<uint8_t> buf;
+	buf.reserve(256 + (video_samples_.size() + audio_samples_.size()) * 16 + video_bytes + audio_bytes);
+
+	size_t moof = BeginBox(buf, "moof");
+	size_t mfhd = BeginFullBox(buf, "mfhd", 0, 0);
+	Write32(buf, ++sequence_number_);
+	EndBox(buf, mfhd);
+
+	size_t video_offset_pos = 0, audio_offset_pos = 0;
+	if (!video_samples_.empty()) {
+		WriteTraf(buf, kVideoTrackId, video_samples_, true, video_offset_pos);
+	}
+	if (!audio_samples_.empty()) {
+		WriteTraf(buf, kAudioTrackId, audio_samples_, false, audio_offset_pos);
+	}
+	EndBox(buf, moof);
+
+	/* sample data offsets are relative to the start of the moof */
+	uint32_t moof_size = (uint32_t)buf.size();
+	if (video_offset_pos > 0) {
+		Patch32(buf, video_offset_pos, moof_size + 8);
+	}
+	if (audio_offset_pos > 0) {
+		Patch32(buf, audio_offset_pos, moof_size + 8 + video_bytes);
+	}
+
+	Write32(buf, 8 + video_bytes + audio_bytes);
+	WriteBytes(buf, (const uint8_t*)"mdat", 4);
+	for (const Sample& sample : video_samples_) {
+		WriteBytes(buf, (const uint8_t*)sample.payload.get() + sample.offset, sample.size);
+	}
+	for (const Sample& sample : audio_samples_) {
+		WriteBytes(buf, (const uint8_t*)sample.payload.get() + sample.offset, sample.size);
+	}
+
+	video_samples_.clear();
+	audio_samples_.clear();
+	return MakeBuffer(buf);
+}
+
+void Fmp4Muxer::Reset()
+{
+	avc_config_.clear();
+	aac_config_.clear();
+	width_ = 0;
+	height_ = 0;
+	init_segment_ = Fmp4Buffer();
+	video_samples_.clear();
+	audio_samples_.clear();
+	sequence_number_ = 0;
+	last_video_duration_ = 3600;
+	next_audio_dts_ = 0;
+	has_audio_dts_ = false;
+}
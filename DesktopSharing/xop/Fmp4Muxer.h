@@ -0,0 +1,89 @@
+#ifndef XOP_FMP4_MUXER_H
+#define XOP_FMP4_MUXER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xop
+{
+
+/* muxed bytes, shared by every viewer and handed to TcpConnection::Send() as is */
+struct Fmp4Buffer
+{
+	std::shared_ptr<char> data;
+	uint32_t size = 0;
+};
+
+/* fragmented mp4 (cmaf) from the flv tag bodies of an rtmp stream, avc and aac.
+   the init segment comes from the sequence headers, each Flush() writes one
+   moof/mdat fragment of the samples added since the last one. */
+class Fmp4Muxer
+{
+public:
+	Fmp4Muxer();
+	virtual ~Fmp4Muxer();
+
+	/* flv tag bodies, 0x17 00 ... and 0xaf 00 ... */
+	bool SetAvcSequenceHeader(const uint8_t* payload, uint32_t size);
+	bool SetAacSequenceHeader(const uint8_t* payload, uint32_t size);
+
+	bool HasVideo() const
+	{ return !avc_config_.empty(); }
+
+	bool HasAudio() const
+	{ return !aac_config_.empty(); }
+
+	/* ftyp + moov, empty without an avc sequence header */
+	Fmp4Buffer GetInitSegment();
+
+	/* false for tags that are not muxed: sequence headers, other codecs */
+	bool AddVideo(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t size);
+	bool AddAudio(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t size);
+
+	bool HasSamples() const
+	{ return !video_samples_.empty() || !audio_samples_.empty(); }
+
+	/* moof + mdat of the pending samples, empty if there are none */
+	Fmp4Buffer Flush();
+
+	void Reset();
+
+	static const uint32_t kVideoTrackId = 1;
+	static const uint32_t kAudioTrackId = 2;
+	static const uint32_t kVideoTimescale = 90000;
+
+private:
+	struct Sample
+	{
+		std::shared_ptr<char> payload;
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		uint64_t dts = 0;      // track timescale
+		int32_t  cts = 0;      // track timescale
+		uint32_t duration = 0; // track timescale
+		bool key_frame = false;
+	};
+
+	void WriteTraf(std::vector<uint8_t>& buf, uint32_t track_id, const std::vector<Sample>& samples,
+		bool is_video, size_t& data_offset_pos);
+
+	std::vector<uint8_t> avc_config_;
+	std::vector<uint8_t> aac_config_;
+	uint32_t width_ = 0;
+	uint32_t height_ = 0;
+	uint32_t samplerate_ = 44100;
+	uint32_t channels_ = 2;
+	Fmp4Buffer init_segment_;
+
+	std::vector<Sample> video_samples_;
+	std::vector<Sample> audio_samples_;
+	uint32_t sequence_number_ = 0;
+	uint32_t last_video_duration_ = 3600;
+	uint64_t next_audio_dts_ = 0;
+	bool has_audio_dts_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#include "Fmp4Server.h"
+#include "RtmpServer.h"
+#include "net/SocketUtil.h"
+#include "net/Logger.h"
+
+using namespace xop;
+
+Fmp4Server::Fmp4Server(xop::EventLoop* event_loop)
+	: TcpServer(event_loop)
+{
+
+}
+
+Fmp4Server::~Fmp4Server()
+{
+
+}
+
+void Fmp4Server::Attach(std::shared_ptr<RtmpServer> rtmp_server)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	rtmp_server_ = rtmp_server;
+}
+
+TcpConnection::Ptr Fmp4Server::OnConnect(SOCKET sockfd)
+{
+	auto rtmp_server = rtmp_server_.lock();
+	if (rtmp_server) {
+		return std::make_shared<Fmp4Connection>(rtmp_server, event_loop_->GetTaskScheduler().get(), sockfd);
+	}
+	return nullptr;
+}
@@ -0,0 +1,32 @@
+#ifndef XOP_FMP4_SERVER_H
+#define XOP_FMP4_SERVER_H
+
+#include "net/TcpServer.h"
+#include "Fmp4Connection.h"
+#include <mutex>
+
+namespace xop
+{
+class RtmpServer;
+
+/* fragmented mp4 of the streams published to an rtmp server,
+   http://ip:port/<stream path>.mp4 or ws://ip:port/<stream path>.mp4 */
+class Fmp4Server : public TcpServer
+{
+public:
+	Fmp4Server(xop::EventLoop* event_loop);
+	~Fmp4Server();
+
+	void Attach(std::shared_ptr<RtmpServer> rtmp_server);
+
+private:
+	TcpConnection::Ptr OnConnect(SOCKET sockfd);
+
+	std::mutex mutex_;
+	std::weak_ptr<RtmpServer> rtmp_server_;
+};
+
+}
+
+
+#endif
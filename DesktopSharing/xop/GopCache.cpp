@@ -0,0 +1,136 @@
+#include "GopCache.h"
+
+using namespace xop;
+
+GopCache::GopCache(uint32_t max_frames, uint32_t max_bytes)
+	: max_bytes_(max_bytes)
+	, write_pos_(0)
+	, oldest_key_pos_(kNoPos)
+	, latest_key_pos_(kNoPos)
+{
+	uint32_t capacity = 64;
+	while (capacity < max_frames && capacity < (1u << 20)) {
+		capacity <<= 1;
+	}
+
+	frames_.resize(capacity);
+	mask_ = capacity - 1;
+}
+
+GopCache::~GopCache()
+{
+
+}
+
+bool GopCache::Push(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size, bool key_frame)
+{
+	uint64_t pos = write_pos_.load(std::memory_order_relaxed);
+
+	if (key_frame) {
+		/* a new gop, drop the oldest one of the two */
+		if (key_frames_.size() >= 2) {
+			uint64_t second_gop_pos = key_frames_[1]; /* Evict() pops the first one */
+			while (tail_pos_ < second_gop_pos) {
+				Evict();
+			}
+		}
+		key_frames_.push_back(pos);
+	}
+	else if (key_frames_.empty()) {
+		return false;
+	}
+
+	while (tail_pos_ < pos && (pos - tail_pos_ > mask_ || (max_bytes_ > 0 && bytes_ + size > max_bytes_))) {
+		Evict();
+	}
+
+	if (key_frames_.empty()) {
+		/* the key frame of the gop is gone, nothing to start from until the next one */
+		for (; tail_pos_ < pos; tail_pos_++) {
+			std::atomic_store(&frames_[tail_pos_ & mask_], FramePtr());
+		}
+		bytes_ = 0;
+		return false;
+	}
+
+	std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+	frame->type = type;
+	frame->timestamp = timestamp;
+	frame->size = size;
+	frame->pos = pos;
+	frame->data = data; /* the chunk parser allocates a new payload for each message */
+
+	std::atomic_store(&frames_[pos & mask_], FramePtr(frame));
+	bytes_ += size;
+
+	if (key_frame) {
+		latest_key_pos_.store(pos, std::memory_order_release);
+	}
+	oldest_key_pos_.store(key_frames_.front(), std::memory_order_release);
+	write_pos_.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+void GopCache::Evict()
+{
+	/* readers holding the frame keep it, the ring lets go of the payload now */
+	FramePtr frame = std::atomic_load(&frames_[tail_pos_ & mask_]);
+	if (frame != nullptr && frame->pos == tail_pos_) {
+		bytes_ -= frame->size;
+		std::atomic_store(&frames_[tail_pos_ & mask_], FramePtr());
+	}
+
+	tail_pos_ += 1;
+	while (!key_frames_.empty() && key_frames_.front() < tail_pos_) {
+		key_frames_.pop_front();
+	}
+
+	if (key_frames_.empty()) {
+		oldest_key_pos_.store(kNoPos, std::memory_order_release);
+		latest_key_pos_.store(kNoPos, std::memory_order_release);
+	}
+	else {
+		oldest_key_pos_.store(key_frames_.front(), std::memory_order_release);
+	}
+}
+
+void GopCache::Clear()
+{
+	/* positions keep growing, so a range taken before the clear never meets new frames */
+	uint64_t pos = write_pos_.load(std::memory_order_relaxed);
+	for (; tail_pos_ < pos; tail_pos_++) {
+		std::atomic_store(&frames_[tail_pos_ & mask_], FramePtr());
+	}
+
+	bytes_ = 0;
+	key_frames_.clear();
+	oldest_key_pos_.store(kNoPos, std::memory_order_release);
+	latest_key_pos_.store(kNoPos, std::memory_order_release);
+}
+
+uint64_t GopCache::GetStartPos(bool fast_start) const
+{
+	if (fast_start) {
+		return latest_key_pos_.load(std::memory_order_acquire);
+	}
+
+	return oldest_key_pos_.load(std::memory_order_acquire);
+}
+
+bool GopCache::Read(uint64_t start_pos, uint64_t end_pos, std::vector<FramePtr>& frames) const
+{
+	if (start_pos == kNoPos || start_pos >= end_pos || end_pos - start_pos > mask_ + 1) {
+		return false;
+	}
+
+	frames.reserve(frames.size() + (size_t)(end_pos - start_pos));
+	for (uint64_t pos = start_pos; pos < end_pos; pos++) {
+		FramePtr frame = std::atomic_load(&frames_[pos & mask_]);
+		if (frame == nullptr || frame->pos != pos) {
+			return false;
+		}
+		frames.push_back(frame);
+	}
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef XOP_GOP_CACHE_H
+#define XOP_GOP_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+namespace xop
+{
+
+/* the last two gops of a stream, for players that join late.
+   one writer (the publisher, under the session mutex) pushes refcounted frames
+   into a ring, any number of readers copy a range of it on their own thread. */
+class GopCache
+{
+public:
+	struct Frame
+	{
+		uint8_t  type = 0;
+		uint64_t timestamp = 0;
+		uint32_t size = 0;
+		uint64_t pos = 0;
+		std::shared_ptr<char> data = nullptr;
+	};
+	using FramePtr = std::shared_ptr<const Frame>;
+
+	static const uint64_t kNoPos = UINT64_MAX;
+
+	GopCache(uint32_t max_frames, uint32_t max_bytes);
+	GopCache& operator=(const GopCache&) = delete;
+	GopCache(const GopCache&) = delete;
+	virtual ~GopCache();
+
+	uint32_t GetMaxFrames() const
+	{ return mask_ + 1; }
+
+	uint32_t GetMaxBytes() const
+	{ return max_bytes_; }
+
+	/* writer */
+	bool Push(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size, bool key_frame);
+	void Clear();
+
+	/* readers, a new player gets the frames in [GetStartPos(), GetEndPos()) */
+	uint64_t GetStartPos(bool fast_start) const;
+	uint64_t GetEndPos() const
+	{ return write_pos_.load(std::memory_order_acquire); }
+
+	/* false if the writer has overwritten a frame of the range in the meantime */
+	bool Read(uint64_t start_pos, uint64_t end_pos, std::vector<FramePtr>& frames) const;
+
+private:
+	void Evict();
+
+	std::vector<FramePtr> frames_;
+	uint32_t mask_ = 0;
+	uint32_t max_bytes_ = 0;
+
+	/* writer only */
+	uint64_t tail_pos_ = 0;
+	uint64_t bytes_ = 0;
+	std::deque<uint64_t> key_frames_;
+
+	std::atomic<uint64_t> write_pos_;
+	std::atomic<uint64_t> oldest_key_pos_;
+	std::atomic<uint64_t> latest_key_pos_;
+};
+
+}
+
+#endif
@@ -1,72 +1,314 @@
 ﻿#include "H264Parser.h"
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XOP_NAL_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define XOP_NAL_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using namespace xop;
 
+#if defined(XOP_NAL_SCAN_SSE2)
+static inline uint32_t CountTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
 Nal H264Parser::findNal(const uint8_t *data, uint32_t size)
 {
     Nal nal(nullptr, nullptr);
 
-    if(size < 5)
-    {
+    uint32_t pos = FindStartCode(data, size, 0);
+    if (pos >= size) {
         return nal;
     }
 
-    nal.second = const_cast<uint8_t*>(data) + (size-1);
+    uint32_t begin = pos + 3;
+    uint32_t end = FindStartCode(data, size, begin);
+    while (end > begin && data[end - 1] == 0) { // trailing zero of 00 00 00 01
+        end--;
+    }
+
+    if (end > begin) {
+        nal.first = const_cast<uint8_t*>(data) + begin;
+        nal.second = const_cast<uint8_t*>(data) + (end - 1);
+    }
+
+    return nal;
+}
+
+uint32_t H264Parser::FindStartCode(const uint8_t *data, uint32_t size, uint32_t offset)
+{
+    uint32_t i = offset;
+
+    // 16 positions at a time, 00 00 01 found by comparing the buffer at +0, +1 and +2
+#if defined(XOP_NAL_SCAN_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 18 <= size; i += 16) {
+        __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), zero);
+        __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 1)), zero);
+        __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 2)), one);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+        if (mask != 0) {
+            return i + CountTrailingZeros(mask);
+        }
+    }
+#elif defined(XOP_NAL_SCAN_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    for (; i + 18 <= size; i += 16) {
+        uint8x16_t b0 = vceqq_u8(vld1q_u8(data + i), zero);
+        uint8x16_t b1 = vceqq_u8(vld1q_u8(data + i + 1), zero);
+        uint8x16_t b2 = vceqq_u8(vld1q_u8(data + i + 2), one);
+        uint64x2_t mask = vreinterpretq_u64_u8(vandq_u8(vandq_u8(b0, b1), b2));
+        if ((vgetq_lane_u64(mask, 0) | vgetq_lane_u64(mask, 1)) != 0) {
+            break; // in these 16 bytes, located below
+        }
+    }
+#endif
+
+    for (; i + 3 <= size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            return i;
+        }
+    }
 
-    uint32_t startCode = 0;
+    return size;
+}
+
+bool H264Parser::IsRandomAccessNal(const uint8_t *nal, uint32_t size)
+{
+    if (size < 1) {
+        return false;
+    }
+
+    uint8_t type = nal[0] & 0x1f;
+    if (type == 5 || type == 7) { // idr or sps
+        return true;
+    }
+
+    if (type == 6) {
+        return IsRecoveryPointSei(nal, size);
+    }
+
+    return false;
+}
+
+bool H264Parser::IsRandomAccess(const uint8_t *data, uint32_t size)
+{
+    bool is_random_access = false;
+
+    ForEachNal(data, size, [&is_random_access](const uint8_t *nal, uint32_t nal_size) {
+        is_random_access = IsRandomAccessNal(nal, nal_size);
+        return !is_random_access;
+    });
+
+    return is_random_access;
+}
+
+bool H264Parser::IsAvcRandomAccess(const uint8_t *data, uint32_t size)
+{
     uint32_t pos = 0;
-    uint8_t prefix[3] = {0};
-    memcpy(prefix, data, 3);
-    size -= 3;
-    data += 2;
-
-    while(size--)
-    {
-        if ((prefix[pos % 3] == 0) && (prefix[(pos + 1) % 3] == 0) && (prefix[(pos + 2) % 3] == 1))
-        {
-            if(nal.first == nullptr) // 00 00 01 
-            {
-                nal.first = const_cast<uint8_t*>(data) + 1;
-                startCode = 3;
+
+    while (pos + 4 < size) {
+        uint32_t nal_size = (data[pos] << 24) | (data[pos + 1] << 16) | (data[pos + 2] << 8) | data[pos + 3];
+        pos += 4;
+        if (nal_size > size - pos) {
+            break;
+        }
+
+        if (IsRandomAccessNal(data + pos, nal_size)) {
+            return true;
+        }
+        pos += nal_size;
+    }
+
+    return false;
+}
+
+bool H264Parser::IsRecoveryPointSei(const uint8_t *sei, uint32_t size)
+{
+    uint32_t pos = 1; // nal header
+    uint32_t zeros = 0;
+
+    // next rbsp byte, emulation prevention bytes removed, -1 at the end
+    auto read_byte = [&]() -> int {
+        while (pos < size) {
+            uint8_t value = sei[pos++];
+            if (zeros >= 2 && value == 3) {
+                zeros = 0;
+                continue;
+            }
+            zeros = (value == 0) ? zeros + 1 : 0;
+            return value;
+        }
+        return -1;
+    };
+
+    // sei messages until rbsp_trailing_bits
+    while (pos < size && sei[pos] != 0x80) {
+        int value = 0;
+        uint32_t payload_type = 0;
+        uint32_t payload_size = 0;
+
+        while ((value = read_byte()) == 0xff) {
+            payload_type += 255;
+        }
+        if (value < 0) {
+            return false;
+        }
+        payload_type += value;
+
+        while ((value = read_byte()) == 0xff) {
+            payload_size += 255;
+        }
+        if (value < 0) {
+            return false;
+        }
+        payload_size += value;
+
+        if (payload_type == 6) {
+            return true;
+        }
+
+        while (payload_size-- > 0) {
+            if (read_byte() < 0) {
+                return false;
             }
-            else if(startCode == 3)
-            {
-                nal.second = const_cast<uint8_t*>(data) - 3;
-                break;
-            }               
-        }
-        else if ((prefix[pos % 3] == 0) && (prefix[(pos + 1) % 3] == 0) && (prefix[(pos + 2) % 3] == 0))
-        {
-            if (*(data+1) == 0x01) // 00 00 00 01 
-            {              
-                if(nal.first == nullptr)
-                {
-                    if(size >= 1)
-                    {
-                        nal.first = const_cast<uint8_t*>(data) + 2;
-                    }                       
-                    else
-                    {
-                        break;  
-                    }                  
-                    startCode = 4;
+        }
+    }
+
+    return false;
+}
+
+bool H264Parser::ParseSpsResolution(const uint8_t *sps, uint32_t size, uint32_t& width, uint32_t& height)
+{
+    // rbsp without the emulation prevention bytes
+    uint8_t rbsp[256] = { 0 };
+    uint32_t rbsp_size = 0;
+    uint32_t zeros = 0;
+    for (uint32_t i = 1; i < size && rbsp_size < sizeof(rbsp); i++) {
+        if (zeros >= 2 && sps[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (sps[i] == 0) ? zeros + 1 : 0;
+        rbsp[rbsp_size++] = sps[i];
+    }
+
+    uint32_t bit = 0;
+    bool error = false;
+    auto read_bits = [&](uint32_t n) -> uint32_t {
+        uint32_t value = 0;
+        while (n-- > 0) {
+            if (bit >= rbsp_size * 8) {
+                error = true;
+                return 0;
+            }
+            value = (value << 1) | ((rbsp[bit / 8] >> (7 - bit % 8)) & 1);
+            bit++;
+        }
+        return value;
+    };
+    auto read_ue = [&]() -> uint32_t {
+        uint32_t leading_zeros = 0;
+        while (read_bits(1) == 0 && !error && leading_zeros < 32) {
+            leading_zeros++;
+        }
+        return (leading_zeros >= 32) ? 0 : ((1u << leading_zeros) - 1 + read_bits(leading_zeros));
+    };
+    auto read_se = [&]() -> int32_t {
+        uint32_t value = read_ue();
+        return (value & 1) ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+    };
+
+    uint32_t profile_idc = read_bits(8);
+    read_bits(16); // constraint flags, level_idc
+    read_ue();     // seq_parameter_set_id
+
+    uint32_t chroma_format_idc = 1;
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 ||
+        profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118 ||
+        profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134 ||
+        profile_idc == 135) {
+        chroma_format_idc = read_ue();
+        if (chroma_format_idc == 3) {
+            read_bits(1); // separate_colour_plane_flag
+        }
+        read_ue();     // bit_depth_luma_minus8
+        read_ue();     // bit_depth_chroma_minus8
+        read_bits(1);  // qpprime_y_zero_transform_bypass_flag
+        if (read_bits(1)) { // seq_scaling_matrix_present_flag
+            for (int i = 0; i < ((chroma_format_idc != 3) ? 8 : 12); i++) {
+                if (!read_bits(1)) {
+                    continue;
+                }
+                int last_scale = 8, next_scale = 8;
+                for (int j = 0; j < (i < 6 ? 16 : 64); j++) {
+                    if (next_scale != 0) {
+                        next_scale = (last_scale + read_se() + 256) % 256;
+                    }
+                    last_scale = (next_scale == 0) ? last_scale : next_scale;
                 }
-                else if(startCode == 4)
-                {
-                    nal.second = const_cast<uint8_t*>(data) - 3;
-                    break;
-                }                    
             }
         }
+    }
 
-        prefix[(pos++) % 3] = *(++data);
+    read_ue(); // log2_max_frame_num_minus4
+    uint32_t pic_order_cnt_type = read_ue();
+    if (pic_order_cnt_type == 0) {
+        read_ue(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (pic_order_cnt_type == 1) {
+        read_bits(1);
+        read_se();
+        read_se();
+        uint32_t num_ref_frames_in_poc_cycle = read_ue();
+        for (uint32_t i = 0; i < num_ref_frames_in_poc_cycle && !error; i++) {
+            read_se();
+        }
     }
-        
-    if(nal.first == nullptr)
-        nal.second = nullptr;
 
-    return nal;
-}
+    read_ue();     // max_num_ref_frames
+    read_bits(1);  // gaps_in_frame_num_value_allowed_flag
+    uint32_t pic_width_in_mbs = read_ue() + 1;
+    uint32_t pic_height_in_map_units = read_ue() + 1;
+    uint32_t frame_mbs_only_flag = read_bits(1);
+    if (!frame_mbs_only_flag) {
+        read_bits(1); // mb_adaptive_frame_field_flag
+    }
+    read_bits(1);  // direct_8x8_inference_flag
 
+    uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    if (read_bits(1)) {
+        crop_left = read_ue();
+        crop_right = read_ue();
+        crop_top = read_ue();
+        crop_bottom = read_ue();
+    }
 
+    if (error) {
+        return false;
+    }
+
+    uint32_t crop_unit_x = (chroma_format_idc == 0 || chroma_format_idc == 3) ? 1 : 2;
+    uint32_t crop_unit_y = ((chroma_format_idc == 1) ? 2 : 1) * (2 - frame_mbs_only_flag);
+    width = pic_width_in_mbs * 16 - (crop_left + crop_right) * crop_unit_x;
+    height = (2 - frame_mbs_only_flag) * pic_height_in_map_units * 16 - (crop_top + crop_bottom) * crop_unit_y;
+    return true;
+}
@@ -12,10 +12,56 @@ typedef std::pair<uint8_t*, uint8_t*> Nal; // <nal begin, nal end>
 class H264Parser
 {
 public:    
+    /* the first nal after a start code, <first byte, last byte> */
     static Nal findNal(const uint8_t *data, uint32_t size);
+
+    /* An access unit a decoder can start from: idr, sps, or a recovery point sei
+       written in front of each intra refresh cycle. The first nal may come without
+       its start code. */
+    static bool IsRandomAccess(const uint8_t *data, uint32_t size);
+
+    /* The same for avcc payloads, nals prefixed with a 4 bytes length. */
+    static bool IsAvcRandomAccess(const uint8_t *data, uint32_t size);
+
+    /* sei nal (header included) carrying a recovery point message, payload type 6 */
+    static bool IsRecoveryPointSei(const uint8_t *sei, uint32_t size);
+
+    /* coded picture size of an sps nal (header included), cropping applied */
+    static bool ParseSpsResolution(const uint8_t *sps, uint32_t size, uint32_t& width, uint32_t& height);
+
+    /* position of the next 00 00 01 from offset, size if there is none.
+       Scans 16 bytes at a time with sse2 or neon where the target has them. */
+    static uint32_t FindStartCode(const uint8_t *data, uint32_t size, uint32_t offset);
+
+    /* fn(nal, nal_size) for each nal of an annex-b buffer, start codes removed,
+       the first nal may come without its start code. Stops when fn returns false. */
+    template <typename Fn>
+    static void ForEachNal(const uint8_t *data, uint32_t size, Fn fn)
+    {
+        uint32_t begin = 0;
+        uint32_t pos = FindStartCode(data, size, 0);
+
+        while (begin < size) {
+            uint32_t end = pos;
+            while (end > begin && data[end - 1] == 0) { // trailing zero of 00 00 00 01
+                end--;
+            }
+
+            if (end > begin && !fn(data + begin, end - begin)) {
+                break;
+            }
+
+            if (pos >= size) {
+                break;
+            }
+
+            begin = pos + 3;
+            pos = FindStartCode(data, size, begin);
+        }
+    }
         
 private:
-  
+    static bool IsRandomAccessNal(const uint8_t *nal, uint32_t size);
 };
     
 }
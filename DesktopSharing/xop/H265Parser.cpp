@@ -0,0 +1,213 @@
+﻿#include "H265Parser.h"
+#include "H264Parser.h"
+#include <cstring>
+#include <vector>
+
+using namespace xop;
+
+namespace
+{
+
+// msb first reader over the rbsp, emulation prevention bytes removed
+class BitReader
+{
+public:
+    BitReader(const uint8_t *data, uint32_t size)
+    {
+        rbsp_.reserve(size);
+        uint32_t zeros = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            if (zeros >= 2 && data[i] == 3) {
+                zeros = 0;
+                continue;
+            }
+            zeros = (data[i] == 0) ? zeros + 1 : 0;
+            rbsp_.push_back(data[i]);
+        }
+    }
+
+    uint32_t ReadBits(uint32_t n)
+    {
+        uint32_t value = 0;
+        while (n--) {
+            value <<= 1;
+            if (pos_ < rbsp_.size() * 8) {
+                value |= (rbsp_[pos_ / 8] >> (7 - pos_ % 8)) & 1;
+            }
+            pos_++;
+        }
+        return value;
+    }
+
+    void SkipBits(uint32_t n)
+    { pos_ += n; }
+
+    uint32_t ReadUe()
+    {
+        uint32_t leading_zeros = 0;
+        while (ReadBits(1) == 0 && leading_zeros < 32) {
+            leading_zeros++;
+        }
+        return ((1u << leading_zeros) - 1) + ReadBits(leading_zeros);
+    }
+
+    bool IsOverflow() const
+    { return pos_ > rbsp_.size() * 8; }
+
+    const uint8_t* Data() const
+    { return rbsp_.data(); }
+
+private:
+    std::vector<uint8_t> rbsp_;
+    size_t pos_ = 0;
+};
+
+}
+
+bool H265Parser::IsRandomAccessNal(const uint8_t *nal, uint32_t size)
+{
+    if (size < 2) {
+        return false;
+    }
+
+    uint8_t type = (nal[0] >> 1) & 0x3f;
+    if ((type >= 16 && type <= 21) || type == 32 || type == 33) { // irap, vps, sps
+        return true;
+    }
+
+    if (type == 39) {
+        // prefix sei, the message syntax is the one of h.264 after the 2 bytes header
+        return H264Parser::IsRecoveryPointSei(nal + 1, size - 1);
+    }
+
+    return false;
+}
+
+bool H265Parser::IsRandomAccess(const uint8_t *data, uint32_t size)
+{
+    bool is_random_access = false;
+
+    H264Parser::ForEachNal(data, size, [&is_random_access](const uint8_t *nal, uint32_t nal_size) {
+        is_random_access = IsRandomAccessNal(nal, nal_size);
+        return !is_random_access;
+    });
+
+    return is_random_access;
+}
+
+bool H265Parser::IsHvccRandomAccess(const uint8_t *data, uint32_t size)
+{
+    uint32_t pos = 0;
+
+    while (pos + 4 < size) {
+        uint32_t nal_size = (data[pos] << 24) | (data[pos + 1] << 16) | (data[pos + 2] << 8) | data[pos + 3];
+        pos += 4;
+        if (nal_size > size - pos) {
+            break;
+        }
+
+        if (IsRandomAccessNal(data + pos, nal_size)) {
+            return true;
+        }
+        pos += nal_size;
+    }
+
+    return false;
+}
+
+int H265Parser::CreateHvcc(const uint8_t *vps, uint32_t vps_size,
+                           const uint8_t *sps, uint32_t sps_size,
+                           const uint8_t *pps, uint32_t pps_size,
+                           uint8_t *out_buf, uint32_t out_buf_size)
+{
+    if (vps_size < 2 || sps_size < 15 || pps_size < 2) {
+        return -1;
+    }
+
+    if (out_buf_size < 23 + 3 * 5 + vps_size + sps_size + pps_size) {
+        return -1;
+    }
+
+    BitReader reader(sps + 2, sps_size - 2);
+
+    // seq_parameter_set_rbsp()
+    reader.SkipBits(4); // sps_video_parameter_set_id
+    uint32_t max_sub_layers_minus1 = reader.ReadBits(3);
+    uint32_t temporal_id_nesting_flag = reader.ReadBits(1);
+
+    // profile_tier_level(1, sps_max_sub_layers_minus1), general part: 12 bytes
+    uint8_t general_profile[12] = { 0 };
+    for (int i = 0; i < 12; i++) {
+        general_profile[i] = (uint8_t)reader.ReadBits(8);
+    }
+
+    uint32_t sub_layer_profile_present = 0;
+    uint32_t sub_layer_level_present = 0;
+    for (uint32_t i = 0; i < max_sub_layers_minus1; i++) {
+        sub_layer_profile_present |= reader.ReadBits(1) << i;
+        sub_layer_level_present |= reader.ReadBits(1) << i;
+    }
+    if (max_sub_layers_minus1 > 0) {
+        reader.SkipBits(2 * (8 - max_sub_layers_minus1)); // reserved_zero_2bits
+    }
+    for (uint32_t i = 0; i < max_sub_layers_minus1; i++) {
+        if (sub_layer_profile_present & (1 << i)) {
+            reader.SkipBits(88);
+        }
+        if (sub_layer_level_present & (1 << i)) {
+            reader.SkipBits(8);
+        }
+    }
+
+    reader.ReadUe(); // sps_seq_parameter_set_id
+    uint32_t chroma_format_idc = reader.ReadUe();
+    if (chroma_format_idc == 3) {
+        reader.SkipBits(1); // separate_colour_plane_flag
+    }
+    reader.ReadUe(); // pic_width_in_luma_samples
+    reader.ReadUe(); // pic_height_in_luma_samples
+    if (reader.ReadBits(1)) { // conformance_window_flag
+        reader.ReadUe();
+        reader.ReadUe();
+        reader.ReadUe();
+        reader.ReadUe();
+    }
+    uint32_t bit_depth_luma_minus8 = reader.ReadUe();
+    uint32_t bit_depth_chroma_minus8 = reader.ReadUe();
+
+    if (reader.IsOverflow()) {
+        return -1;
+    }
+
+    uint32_t index = 0;
+    out_buf[index++] = 0x01; // configurationVersion
+    // general_profile_space, tier_flag, profile_idc, profile_compatibility_flags,
+    // constraint_indicator_flags, level_idc
+    memcpy(out_buf + index, general_profile, 12);
+    index += 12;
+    out_buf[index++] = 0xf0; // min_spatial_segmentation_idc: 0
+    out_buf[index++] = 0x00;
+    out_buf[index++] = 0xfc; // parallelismType: unknown
+    out_buf[index++] = 0xfc | (chroma_format_idc & 0x03);
+    out_buf[index++] = 0xf8 | (bit_depth_luma_minus8 & 0x07);
+    out_buf[index++] = 0xf8 | (bit_depth_chroma_minus8 & 0x07);
+    out_buf[index++] = 0x00; // avgFrameRate
+    out_buf[index++] = 0x00;
+    // constantFrameRate: 0, numTemporalLayers, temporalIdNested, lengthSizeMinusOne: 3
+    out_buf[index++] = (uint8_t)(((max_sub_layers_minus1 + 1) & 0x07) << 3 | (temporal_id_nesting_flag << 2) | 0x03);
+    out_buf[index++] = 3; // numOfArrays
+
+    const uint8_t *nals[3] = { vps, sps, pps };
+    uint32_t nal_sizes[3] = { vps_size, sps_size, pps_size };
+    for (int i = 0; i < 3; i++) {
+        out_buf[index++] = 0x80 | ((nals[i][0] >> 1) & 0x3f); // array_completeness, NAL_unit_type
+        out_buf[index++] = 0x00; // numNalus: 1
+        out_buf[index++] = 0x01;
+        out_buf[index++] = (nal_sizes[i] >> 8) & 0xff;
+        out_buf[index++] = nal_sizes[i] & 0xff;
+        memcpy(out_buf + index, nals[i], nal_sizes[i]);
+        index += nal_sizes[i];
+    }
+
+    return (int)index;
+}
@@ -0,0 +1,32 @@
+﻿#ifndef XOP_H265_PARSER_H
+#define XOP_H265_PARSER_H
+
+#include <cstdint>
+
+namespace xop
+{
+
+class H265Parser
+{
+public:
+    /* An access unit a decoder can start from: irap (bla, idr, cra), vps, sps,
+       or a recovery point prefix sei. The first nal may come without its start code. */
+    static bool IsRandomAccess(const uint8_t *data, uint32_t size);
+
+    /* The same for hvcc payloads, nals prefixed with a 4 bytes length. */
+    static bool IsHvccRandomAccess(const uint8_t *data, uint32_t size);
+
+    /* HEVCDecoderConfigurationRecord (ISO/IEC 14496-15) from vps, sps, pps nals
+       without start code, returns the record size or -1. */
+    static int CreateHvcc(const uint8_t *vps, uint32_t vps_size,
+                          const uint8_t *sps, uint32_t sps_size,
+                          const uint8_t *pps, uint32_t pps_size,
+                          uint8_t *out_buf, uint32_t out_buf_size);
+
+private:
+    static bool IsRandomAccessNal(const uint8_t *nal, uint32_t size);
+};
+
+}
+
+#endif
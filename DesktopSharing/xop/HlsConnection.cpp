@@ -0,0 +1,280 @@
+#include "HlsConnection.h"
+#include "RtmpServer.h"
+#include "net/Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace xop;
+
+HlsConnection::HlsConnection(std::shared_ptr<RtmpServer> rtmp_server, TaskScheduler* scheduler, SOCKET sockfd,
+	uint32_t part_msec, uint32_t segment_msec)
+	: TcpConnection(scheduler, sockfd)
+	, rtmp_server_(rtmp_server)
+	, task_scheduler_(scheduler)
+	, part_msec_(part_msec)
+	, segment_msec_(segment_msec)
+{
+	this->SetReadCallback([this](std::shared_ptr<TcpConnection> conn, xop::BufferReader& buffer) {
+		return this->OnRead(buffer);
+	});
+
+	this->SetCloseCallback([this](std::shared_ptr<TcpConnection> conn) {
+		this->OnClose();
+	});
+}
+
+HlsConnection::~HlsConnection()
+{
+
+}
+
+bool HlsConnection::OnRead(BufferReader& buffer)
+{
+	static const char kCrlfCrlf[] = "\r\n\r\n";
+
+	/* a blocked request keeps the ones behind it in the buffer */
+	while (!is_blocked_ && buffer.ReadableBytes() > 0) {
+		const char* begin = buffer.Peek();
+		const char* end = begin + buffer.ReadableBytes();
+		const char* crlf_crlf = std::search(begin, end, kCrlfCrlf, kCrlfCrlf + 4);
+		if (crlf_crlf == end) {
+			return (buffer.ReadableBytes() >= 4096) ? false : true;
+		}
+
+		std::string request_line(begin, std::find(begin, crlf_crlf, '\r'));
+		buffer.RetrieveUntil(crlf_crlf + 4);
+
+		/* GET <stream path>/<file>[?query] HTTP/1.1 */
+		auto pos1 = request_line.find(' ');
+		auto pos2 = request_line.find(' ', pos1 + 1);
+		if (pos1 == std::string::npos || pos2 == std::string::npos) {
+			return false;
+		}
+
+		if (request_line.compare(0, pos1, "GET") != 0) {
+			SendError("405 Method Not Allowed");
+			continue;
+		}
+
+		std::string uri = request_line.substr(pos1 + 1, pos2 - pos1 - 1);
+		auto query_pos = uri.find('?');
+		query_ = (query_pos != std::string::npos) ? uri.substr(query_pos + 1) : "";
+		uri = uri.substr(0, query_pos);
+
+		auto slash_pos = uri.find_last_of('/');
+		if (slash_pos == std::string::npos || slash_pos == 0) {
+			SendError("404 Not Found");
+			continue;
+		}
+
+		stream_path_ = uri.substr(0, slash_pos);
+		file_ = uri.substr(slash_pos + 1);
+		HandleRequest(true);
+	}
+
+	return true;
+}
+
+void HlsConnection::OnClose()
+{
+	if (is_blocked_) {
+		is_blocked_ = false;
+		task_scheduler_->RemoveTimer(timer_id_);
+		CancelWait();
+	}
+}
+
+bool HlsConnection::HandleRequest(bool can_block)
+{
+	auto rtmp_server = rtmp_server_.lock();
+	auto session = (rtmp_server != nullptr) ? rtmp_server->FindSession(stream_path_) : nullptr;
+	if (session == nullptr) {
+		SendError("404 Not Found");
+		return true;
+	}
+
+	auto segmenter = session->GetHlsSegmenter(part_msec_, segment_msec_);
+
+	uint32_t msn = 0, part = 0;
+
+	if (file_.size() > 5 && file_.compare(file_.size() - 5, 5, ".m3u8") == 0) {
+		bool has_msn = GetQueryValue(query_, "_HLS_msn", msn);
+		bool has_part = GetQueryValue(query_, "_HLS_part", part);
+
+		if (has_msn && can_block) {
+			/* blocking playlist reload */
+			if (msn > segmenter->GetNextMsn() + 2) {
+				SendError("400 Bad Request");
+				return true;
+			}
+
+			if (!segmenter->IsReady(msn, has_part ? (int)part : -1)) {
+				Block(segmenter, msn, has_part ? (int)part : -1);
+				return false;
+			}
+		}
+
+		std::string playlist = segmenter->GetPlaylist();
+		if (playlist.empty()) {
+			/* the publisher has not sent its first part yet */
+			if (can_block) {
+				Block(segmenter, segmenter->GetNextMsn(), 0);
+				return false;
+			}
+			SendError("404 Not Found");
+			return true;
+		}
+
+		SendHeader("200 OK", "application/vnd.apple.mpegurl", "no-cache", (uint32_t)playlist.size());
+		this->Send(playlist.c_str(), (uint32_t)playlist.size());
+		return true;
+	}
+	else if (file_ == "init.mp4") {
+		Fmp4Buffer init = segmenter->GetInit();
+		if (init.size == 0) {
+			SendError("404 Not Found");
+			return true;
+		}
+
+		SendHeader("200 OK", "video/mp4", "no-cache", init.size);
+		this->Send(init.data, init.size);
+		return true;
+	}
+
+	char name[64] = { 0 };
+	if (sscanf(file_.c_str(), "seg%u.%u.m4s", &msn, &part) == 2) {
+		snprintf(name, sizeof(name), "seg%u.%u.m4s", msn, part);
+		if (file_ == name) {
+			Fmp4Buffer buffer;
+			if (segmenter->GetPart(msn, part, buffer)) {
+				SendHeader("200 OK", "video/mp4", "max-age=60", buffer.size);
+				this->Send(buffer.data, buffer.size);
+				return true;
+			}
+
+			/* the part of the preload hint, sent as soon as it is written */
+			uint32_t next_msn = segmenter->GetNextMsn();
+			if (can_block && msn >= next_msn && msn <= next_msn + 1) {
+				Block(segmenter, msn, (int)part);
+				return false;
+			}
+		}
+	}
+	else if (sscanf(file_.c_str(), "seg%u.m4s", &msn) == 1) {
+		snprintf(name, sizeof(name), "seg%u.m4s", msn);
+		std::vector<Fmp4Buffer> parts;
+		if (file_ == name && segmenter->GetSegment(msn, parts)) {
+			uint32_t size = 0;
+			for (auto& buffer : parts) {
+				size += buffer.size;
+			}
+
+			SendHeader("200 OK", "video/mp4", "max-age=60", size);
+			for (auto& buffer : parts) {
+				this->Send(buffer.data, buffer.size);
+			}
+			return true;
+		}
+	}
+
+	SendError("404 Not Found");
+	return true;
+}
+
+void HlsConnection::Block(std::shared_ptr<HlsSegmenter> segmenter, uint32_t msn, int part)
+{
+	is_blocked_ = true;
+	uint32_t request_id = ++request_id_;
+	std::weak_ptr<HlsConnection> weak_conn = std::dynamic_pointer_cast<HlsConnection>(shared_from_this());
+
+	/* unanswered after three target durations, the player gets a 503 */
+	timer_id_ = task_scheduler_->AddTimer([weak_conn, request_id] {
+		auto conn = weak_conn.lock();
+		if (conn != nullptr) {
+			conn->OnReady(request_id, true);
+		}
+		return false;
+	}, segment_msec_ * 3);
+
+	/* called from the publisher thread, the answer goes out on ours */
+	wait_segmenter_ = segmenter;
+	wait_id_ = segmenter->Wait(msn, part, [weak_conn, request_id] {
+		auto conn = weak_conn.lock();
+		if (conn != nullptr) {
+			conn->GetTaskScheduler()->AddTriggerEvent([conn, request_id] {
+				conn->OnReady(request_id, false);
+			});
+		}
+	});
+}
+
+void HlsConnection::OnReady(uint32_t request_id, bool timeout)
+{
+	if (!is_blocked_ || request_id != request_id_ || this->IsClosed()) {
+		return;
+	}
+
+	is_blocked_ = false;
+	if (timeout) {
+		CancelWait();
+		SendError("503 Service Unavailable");
+	}
+	else {
+		task_scheduler_->RemoveTimer(timer_id_);
+		HandleRequest(false);
+	}
+
+	/* requests that came in while this one was blocked */
+	if (read_buffer_->ReadableBytes() > 0 && !OnRead(*read_buffer_)) {
+		this->Disconnect();
+	}
+}
+
+void HlsConnection::CancelWait()
+{
+	/* the segmenter would keep a waiter that timed out until its segment came */
+	auto segmenter = wait_segmenter_.lock();
+	if (segmenter != nullptr && wait_id_ != 0) {
+		segmenter->Cancel(wait_id_);
+	}
+
+	wait_segmenter_.reset();
+	wait_id_ = 0;
+}
+
+void HlsConnection::SendHeader(const char* status, const char* content_type, const char* cache_control, uint32_t content_length)
+{
+	char header[512] = { 0 };
+	int size = snprintf(header, sizeof(header),
+		"HTTP/1.1 %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %u\r\n"
+		"Cache-Control: %s\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Connection: keep-alive\r\n\r\n",
+		status, content_type, content_length, cache_control);
+
+	this->Send(header, (uint32_t)size);
+}
+
+void HlsConnection::SendError(const char* status)
+{
+	SendHeader(status, "text/plain", "no-cache", 0);
+}
+
+bool HlsConnection::GetQueryValue(const std::string& query, const char* key, uint32_t& value)
+{
+	std::string name = std::string(key) + "=";
+
+	size_t pos = 0;
+	while ((pos = query.find(name, pos)) != std::string::npos) {
+		if (pos == 0 || query[pos - 1] == '&') {
+			value = (uint32_t)strtoul(query.c_str() + pos + name.size(), nullptr, 10);
+			return true;
+		}
+		pos += name.size();
+	}
+
+	return false;
+}
@@ -0,0 +1,58 @@
+#ifndef XOP_HLS_CONNECTION_H
+#define XOP_HLS_CONNECTION_H
+
+#include "net/EventLoop.h"
+#include "net/TcpConnection.h"
+#include "HlsSegmenter.h"
+#include <string>
+#include <vector>
+
+namespace xop
+{
+
+class RtmpServer;
+
+/* http/1.1 keep-alive connection of a low-latency hls player:
+   GET <stream path>/index.m3u8, init.mp4, seg<msn>.m4s and seg<msn>.<part>.m4s */
+class HlsConnection : public TcpConnection
+{
+public:
+	HlsConnection(std::shared_ptr<RtmpServer> rtmp_server, TaskScheduler* taskScheduler, SOCKET sockfd,
+		uint32_t part_msec, uint32_t segment_msec);
+	virtual ~HlsConnection();
+
+private:
+	bool OnRead(BufferReader& buffer);
+	void OnClose();
+
+	/* false when the request is blocked until the segmenter has what it asks for */
+	bool HandleRequest(bool can_block);
+	void Block(std::shared_ptr<HlsSegmenter> segmenter, uint32_t msn, int part);
+	void OnReady(uint32_t request_id, bool timeout);
+	void CancelWait();
+
+	void SendHeader(const char* status, const char* content_type, const char* cache_control, uint32_t content_length);
+	void SendError(const char* status);
+
+	static bool GetQueryValue(const std::string& query, const char* key, uint32_t& value);
+
+	std::weak_ptr<RtmpServer> rtmp_server_;
+	TaskScheduler* task_scheduler_ = nullptr;
+	uint32_t part_msec_ = 0;
+	uint32_t segment_msec_ = 0;
+
+	/* the request being answered */
+	std::string stream_path_;
+	std::string file_;
+	std::string query_;
+
+	bool is_blocked_ = false;
+	uint32_t request_id_ = 0;
+	TimerId timer_id_ = 0;
+	std::weak_ptr<HlsSegmenter> wait_segmenter_;
+	uint32_t wait_id_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,318 @@
+#include "HlsSegmenter.h"
+#include <algorithm>
+#include <cstdio>
+#include "rtmp.h"
+
+using namespace xop;
+
+HlsSegmenter::HlsSegmenter(uint32_t part_msec, uint32_t segment_msec, uint32_t max_segments)
+	: part_msec_(part_msec > 0 ? part_msec : 250)
+	, segment_msec_(segment_msec > part_msec_ ? segment_msec : part_msec_ * 4)
+	, max_segments_(max_segments > 3 ? max_segments : 3)
+	, target_duration_((segment_msec_ + 999) / 1000)
+{
+
+}
+
+HlsSegmenter::~HlsSegmenter()
+{
+
+}
+
+void HlsSegmenter::AddFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
+{
+	std::list<Waiter> ready;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		const uint8_t* payload = (const uint8_t*)data.get();
+		if (payload == nullptr || size == 0) {
+			return;
+		}
+
+		if (type == RTMP_AVC_SEQUENCE_HEADER) {
+			muxer_.SetAvcSequenceHeader(payload, size);
+			return;
+		}
+		else if (type == RTMP_AAC_SEQUENCE_HEADER) {
+			muxer_.SetAacSequenceHeader(payload, size);
+			return;
+		}
+		else if (type == RTMP_VIDEO) {
+			bool key_frame = IsVideoKeyFrame(payload, size);
+
+			if (!has_key_frame_) {
+				/* the first segment starts on a key frame */
+				if (!key_frame || !muxer_.HasVideo()) {
+					return;
+				}
+
+				Segment segment;
+				segment.msn = next_msn_++;
+				segments_.push_back(segment);
+				has_key_frame_ = true;
+				part_independent_ = true;
+				part_start_ts_ = timestamp;
+			}
+			else {
+				if (timestamp > last_video_ts_) {
+					video_interval_ = (uint32_t)(timestamp - last_video_ts_);
+				}
+
+				uint32_t part_elapsed = (timestamp > part_start_ts_) ? (uint32_t)(timestamp - part_start_ts_) : 0;
+				uint32_t segment_elapsed = segments_.back().duration + part_elapsed;
+
+				/* close the part (or the segment, on a key frame) before the frame
+				   that would take it over its target duration. A gop longer than
+				   the target duration is cut without a key frame. */
+				bool over_target = segment_elapsed + video_interval_ > target_duration_ * 1000;
+				if ((key_frame && segment_elapsed + video_interval_ > segment_msec_) ||
+					(over_target && muxer_.HasSamples())) {
+					ClosePart(timestamp, true);
+					part_independent_ = key_frame;
+				}
+				else if (part_elapsed + video_interval_ > part_msec_ && muxer_.HasSamples()) {
+					ClosePart(timestamp, false);
+					part_independent_ = key_frame;
+				}
+			}
+
+			muxer_.AddVideo(timestamp, data, size);
+			last_video_ts_ = timestamp;
+		}
+		else if (type == RTMP_AUDIO) {
+			if (has_key_frame_) {
+				muxer_.AddAudio(timestamp, data, size);
+			}
+			return;
+		}
+
+		for (auto iter = waiters_.begin(); iter != waiters_.end(); ) {
+			if (IsReadyLocked(iter->msn, iter->part)) {
+				ready.splice(ready.end(), waiters_, iter++);
+			}
+			else {
+				iter++;
+			}
+		}
+	}
+
+	for (auto& waiter : ready) {
+		waiter.callback();
+	}
+}
+
+void HlsSegmenter::ClosePart(uint64_t timestamp, bool close_segment)
+{
+	Segment& segment = segments_.back();
+
+	Part part;
+	part.buffer = muxer_.Flush();
+	part.duration = (timestamp > part_start_ts_) ? (uint32_t)(timestamp - part_start_ts_) : 0;
+	part.independent = part_independent_;
+	segment.duration += part.duration;
+	segment.parts.push_back(part);
+	part_start_ts_ = timestamp;
+
+	if (close_segment) {
+		segment.complete = true;
+
+		Segment next;
+		next.msn = next_msn_++;
+		segments_.push_back(next);
+
+		while (segments_.size() > max_segments_ + 1) {
+			segments_.pop_front();
+		}
+	}
+
+	UpdatePlaylist();
+}
+
+void HlsSegmenter::UpdatePlaylist()
+{
+	char line[256] = { 0 };
+
+	std::string playlist;
+	playlist.reserve(4096);
+	playlist += "#EXTM3U\n#EXT-X-VERSION:6\n";
+	snprintf(line, sizeof(line), "#EXT-X-TARGETDURATION:%u\n", target_duration_);
+	playlist += line;
+	snprintf(line, sizeof(line), "#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_msec_ / 1000.0);
+	playlist += line;
+	snprintf(line, sizeof(line), "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n", part_msec_ * 3 / 1000.0);
+	playlist += line;
+	snprintf(line, sizeof(line), "#EXT-X-MEDIA-SEQUENCE:%u\n", segments_.front().msn);
+	playlist += line;
+	playlist += "#EXT-X-MAP:URI=\"init.mp4\"\n";
+
+	/* parts are only listed for the last segments, close to the live edge */
+	size_t first_part_segment = (segments_.size() > 3) ? segments_.size() - 3 : 0;
+
+	for (size_t i = 0; i < segments_.size(); i++) {
+		const Segment& segment = segments_[i];
+
+		if (i >= first_part_segment) {
+			for (size_t n = 0; n < segment.parts.size(); n++) {
+				const Part& part = segment.parts[n];
+				snprintf(line, sizeof(line), "#EXT-X-PART:DURATION=%.3f,URI=\"seg%u.%u.m4s\"%s\n",
+					part.duration / 1000.0, segment.msn, (uint32_t)n, part.independent ? ",INDEPENDENT=YES" : "");
+				playlist += line;
+			}
+		}
+
+		if (segment.complete) {
+			snprintf(line, sizeof(line), "#EXTINF:%.3f,\nseg%u.m4s\n", segment.duration / 1000.0, segment.msn);
+			playlist += line;
+		}
+	}
+
+	const Segment& current = segments_.back();
+	snprintf(line, sizeof(line), "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"seg%u.%u.m4s\"\n",
+		current.msn, (uint32_t)current.parts.size());
+	playlist += line;
+
+	playlist_.swap(playlist);
+}
+
+void HlsSegmenter::Reset()
+{
+	std::list<Waiter> waiters;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		/* msn keeps going up, players reloading the playlist see new segments */
+		muxer_.Reset();
+		segments_.clear();
+		has_key_frame_ = false;
+		part_independent_ = false;
+		part_start_ts_ = 0;
+		last_video_ts_ = 0;
+		video_interval_ = 0;
+		playlist_.clear();
+		waiters.swap(waiters_);
+	}
+
+	/* blocked requests are answered with what is left, nothing */
+	for (auto& waiter : waiters) {
+		waiter.callback();
+	}
+}
+
+std::string HlsSegmenter::GetPlaylist()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return playlist_;
+}
+
+Fmp4Buffer HlsSegmenter::GetInit()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return muxer_.GetInitSegment();
+}
+
+bool HlsSegmenter::GetSegment(uint32_t msn, std::vector<Fmp4Buffer>& parts)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Segment* segment = FindSegment(msn);
+	if (segment == nullptr || !segment->complete) {
+		return false;
+	}
+
+	for (auto& part : segment->parts) {
+		parts.push_back(part.buffer);
+	}
+	return true;
+}
+
+bool HlsSegmenter::GetPart(uint32_t msn, uint32_t part, Fmp4Buffer& buffer)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Segment* segment = FindSegment(msn);
+	if (segment == nullptr || part >= segment->parts.size()) {
+		return false;
+	}
+
+	buffer = segment->parts[part].buffer;
+	return true;
+}
+
+bool HlsSegmenter::IsReady(uint32_t msn, int part)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return IsReadyLocked(msn, part);
+}
+
+uint32_t HlsSegmenter::GetNextMsn()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return segments_.empty() ? next_msn_ : segments_.back().msn;
+}
+
+uint32_t HlsSegmenter::Wait(uint32_t msn, int part, std::function<void()> callback)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!IsReadyLocked(msn, part)) {
+			Waiter waiter;
+			waiter.id = ++next_waiter_id_;
+			if (waiter.id == 0) {
+				waiter.id = ++next_waiter_id_;
+			}
+			waiter.msn = msn;
+			waiter.part = part;
+			waiter.callback = callback;
+			waiters_.push_back(waiter);
+			return waiter.id;
+		}
+	}
+
+	callback();
+	return 0;
+}
+
+void HlsSegmenter::Cancel(uint32_t waiter_id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	waiters_.remove_if([waiter_id](const Waiter& waiter) {
+		return waiter.id == waiter_id;
+	});
+}
+
+bool HlsSegmenter::IsReadyLocked(uint32_t msn, int part)
+{
+	if (segments_.empty()) {
+		return false;
+	}
+
+	if (msn < segments_.front().msn) {
+		return true;
+	}
+
+	Segment* segment = FindSegment(msn);
+	if (segment == nullptr) {
+		return false;
+	}
+
+	if (part < 0) {
+		return segment->complete;
+	}
+
+	return segment->complete || (int)segment->parts.size() > part;
+}
+
+HlsSegmenter::Segment* HlsSegmenter::FindSegment(uint32_t msn)
+{
+	if (segments_.empty() || msn < segments_.front().msn) {
+		return nullptr;
+	}
+
+	uint32_t index = msn - segments_.front().msn;
+	if (index >= segments_.size()) {
+		return nullptr;
+	}
+
+	return &segments_[index];
+}
@@ -0,0 +1,101 @@
+#ifndef XOP_HLS_SEGMENTER_H
+#define XOP_HLS_SEGMENTER_H
+
+#include "Fmp4Muxer.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xop
+{
+
+/* low-latency hls of one rtmp session, muxed once and shared by every viewer.
+   segments start on key frames and are made of parts of about part_msec, a
+   segment is served as the concatenation of its parts. */
+class HlsSegmenter
+{
+public:
+	HlsSegmenter(uint32_t part_msec = 250, uint32_t segment_msec = 2000, uint32_t max_segments = 6);
+	virtual ~HlsSegmenter();
+
+	/* fed by the session for every frame of the publisher, sequence headers included */
+	void AddFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
+	void Reset();
+
+	std::string GetPlaylist();
+	Fmp4Buffer GetInit();
+	bool GetSegment(uint32_t msn, std::vector<Fmp4Buffer>& parts);
+	bool GetPart(uint32_t msn, uint32_t part, Fmp4Buffer& buffer);
+
+	/* the playlist has segment msn complete, or its part when part >= 0 */
+	bool IsReady(uint32_t msn, int part);
+
+	/* msn of the segment being written, blocking requests further than
+	   two segments ahead are rejected */
+	uint32_t GetNextMsn();
+
+	/* callback once IsReady(msn, part), from the publisher thread. Returns the
+	   id for Cancel(), 0 when the callback was called right away. */
+	uint32_t Wait(uint32_t msn, int part, std::function<void()> callback);
+	void Cancel(uint32_t waiter_id);
+
+	uint32_t GetPartDuration() const
+	{ return part_msec_; }
+
+private:
+	struct Part
+	{
+		Fmp4Buffer buffer;
+		uint32_t duration = 0; // msec
+		bool independent = false;
+	};
+
+	struct Segment
+	{
+		uint32_t msn = 0;
+		uint32_t duration = 0; // msec
+		bool complete = false;
+		std::vector<Part> parts;
+	};
+
+	struct Waiter
+	{
+		uint32_t id = 0;
+		uint32_t msn = 0;
+		int part = -1;
+		std::function<void()> callback;
+	};
+
+	void ClosePart(uint64_t timestamp, bool close_segment);
+	void UpdatePlaylist();
+	bool IsReadyLocked(uint32_t msn, int part);
+	Segment* FindSegment(uint32_t msn);
+
+	std::mutex mutex_;
+	uint32_t part_msec_;
+	uint32_t segment_msec_;
+	uint32_t max_segments_;
+
+	Fmp4Muxer muxer_;
+	std::deque<Segment> segments_; // the last one is being written
+	uint32_t next_msn_ = 0;
+	uint32_t target_duration_ = 0; // sec, fixed, EXT-X-TARGETDURATION must not change
+	bool has_key_frame_ = false;
+	bool part_independent_ = false;
+	uint64_t part_start_ts_ = 0;
+	uint64_t last_video_ts_ = 0;
+	uint32_t video_interval_ = 0;
+
+	std::string playlist_;
+	std::list<Waiter> waiters_;
+	uint32_t next_waiter_id_ = 0;
+};
+
+}
+
+#endif
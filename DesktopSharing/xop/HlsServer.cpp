@@ -0,0 +1,33 @@
+#include "HlsServer.h"
+#include "RtmpServer.h"
+#include "net/SocketUtil.h"
+#include "net/Logger.h"
+
+using namespace xop;
+
+HlsServer::HlsServer(xop::EventLoop* event_loop)
+	: TcpServer(event_loop)
+{
+
+}
+
+HlsServer::~HlsServer()
+{
+
+}
+
+void HlsServer::Attach(std::shared_ptr<RtmpServer> rtmp_server)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	rtmp_server_ = rtmp_server;
+}
+
+TcpConnection::Ptr HlsServer::OnConnect(SOCKET sockfd)
+{
+	auto rtmp_server = rtmp_server_.lock();
+	if (rtmp_server) {
+		return std::make_shared<HlsConnection>(rtmp_server, event_loop_->GetTaskScheduler().get(), sockfd,
+			part_msec_, segment_msec_);
+	}
+	return nullptr;
+}
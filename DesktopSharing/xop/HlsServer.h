@@ -0,0 +1,41 @@
+#ifndef XOP_HLS_SERVER_H
+#define XOP_HLS_SERVER_H
+
+#include "net/TcpServer.h"
+#include "HlsConnection.h"
+#include <mutex>
+
+namespace xop
+{
+class RtmpServer;
+
+/* low-latency hls of the streams published to an rtmp server,
+   http://ip:port/<stream path>/index.m3u8 */
+class HlsServer : public TcpServer
+{
+public:
+	HlsServer(xop::EventLoop* event_loop);
+	~HlsServer();
+
+	void Attach(std::shared_ptr<RtmpServer> rtmp_server);
+
+	/* used by a session the first time it is played */
+	void SetPartDuration(uint32_t msec)
+	{ part_msec_ = msec; }
+
+	void SetSegmentDuration(uint32_t msec)
+	{ segment_msec_ = msec; }
+
+private:
+	TcpConnection::Ptr OnConnect(SOCKET sockfd);
+
+	std::mutex mutex_;
+	std::weak_ptr<RtmpServer> rtmp_server_;
+	uint32_t part_msec_ = 250;
+	uint32_t segment_msec_ = 2000;
+};
+
+}
+
+
+#endif
@@ -25,6 +25,11 @@ HttpFlvConnection::~HttpFlvConnection()
 
 bool HttpFlvConnection::OnRead(BufferReader& buffer)
 {
+	if (has_session_) {
+		buffer.RetrieveAll();
+		return true;
+	}
+
 	if (buffer.FindLastCrlfCrlf() == nullptr) {
 		return (buffer.ReadableBytes() >= 4096) ? false : true;
 	}
@@ -55,7 +60,9 @@ bool HttpFlvConnection::OnRead(BufferReader& buffer)
 		std::string http_header = "HTTP/1.1 200 OK\r\nContent-Type: video/x-flv\r\n\r\n";
 		this->Send(http_header.c_str(), (uint32_t)http_header.size());
 
-		auto session = rtmp_server->GetSession(stream_path_);
+		/* the viewer holds the session until it closes */
+		auto session = rtmp_server->AcquireSession(stream_path_);
+		has_session_ = true;
 		if (session != nullptr) {
 			session->AddHttpClient(std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this()));
 		}
@@ -70,8 +77,8 @@ bool HttpFlvConnection::OnRead(BufferReader& buffer)
 void HttpFlvConnection::OnClose()
 {
 	auto rtmp_server = rtmp_server_.lock();
-	if (rtmp_server != nullptr) {
-		auto session = rtmp_server->GetSession(stream_path_);
+	if (rtmp_server != nullptr && has_session_) {
+		auto session = rtmp_server->FindSession(stream_path_);
 		if (session != nullptr) {
 			auto conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
 			task_scheduler_->AddTimer([session, conn] {
@@ -79,66 +86,108 @@ void HttpFlvConnection::OnClose()
 				return false;
 			}, 1);
 		}
+
+		rtmp_server->ReleaseSession(stream_path_);
+		has_session_ = false;
 	}
 }
 
 
-bool HttpFlvConnection::SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
-{	 
+bool HttpFlvConnection::PrepareMediaData(uint8_t type, std::shared_ptr<char> payload, uint32_t payload_size)
+{
 	if (payload_size == 0) {
 		return false;
 	}
 
 	is_playing_ = true;
 
+	/* the sequence headers go out with the flv header before the first key frame */
 	if (type == RTMP_AVC_SEQUENCE_HEADER) {
 		avc_sequence_header_ = payload;
 		avc_sequence_header_size_ = payload_size;
-		return true;
+		return false;
 	}
 	else if (type == RTMP_AAC_SEQUENCE_HEADER) {
 		aac_sequence_header_ = payload;
 		aac_sequence_header_size_ = payload_size;
-		return true;
+		return false;
+	}
+
+	return true;
+}
+
+bool HttpFlvConnection::SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+{	 
+	if (!PrepareMediaData(type, payload, payload_size)) {
+		return payload_size > 0;
 	}
 
 	auto conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
 	task_scheduler_->AddTriggerEvent([conn, type, timestamp, payload, payload_size] {		
-		if (type == RTMP_VIDEO) {
-			if (!conn->has_key_frame_) {
-				uint8_t frame_type = (payload.get()[0] >> 4) & 0x0f;
-				uint8_t codec_id = payload.get()[0] & 0x0f;
-				if (frame_type == 1 && codec_id == RTMP_CODEC_ID_H264) {
-					conn->has_key_frame_ = true;
-				}
-				else {
-					return ;
-				}
-			}
+		conn->SendFrame(type, timestamp, payload, payload_size);
+	});
 
-			if (!conn->has_flv_header_) {
-				conn->SendFlvHeader();
-				conn->SendFlvTag(conn->FLV_TAG_TYPE_VIDEO, 0, conn->avc_sequence_header_, conn->avc_sequence_header_size_);
-				conn->SendFlvTag(conn->FLV_TAG_TYPE_AUDIO, 0, conn->aac_sequence_header_, conn->aac_sequence_header_size_);
-			}
+	return true;
+}
 
-			conn->SendFlvTag(conn->FLV_TAG_TYPE_VIDEO, timestamp, payload, payload_size);
-		}
-		else if (type == RTMP_AUDIO) {
-			if (!conn->has_key_frame_ && conn->avc_sequence_header_size_>0) {
+bool HttpFlvConnection::PlayMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+	std::shared_ptr<char> flv_tag)
+{
+	if (!PrepareMediaData(type, payload, payload_size)) {
+		return payload_size > 0;
+	}
+
+	SendFrame(type, timestamp, payload, payload_size, flv_tag);
+	return true;
+}
+
+bool HttpFlvConnection::PlayGopCache(std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos)
+{
+	std::vector<GopCache::FramePtr> frames;
+	if (!gop_cache->Read(start_pos, end_pos, frames)) {
+		return false;
+	}
+
+	for (auto& frame : frames) {
+		SendFrame(frame->type, frame->timestamp, frame->data, frame->size);
+	}
+
+	return true;
+}
+
+void HttpFlvConnection::SendFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+	std::shared_ptr<char> flv_tag)
+{
+	if (type == RTMP_VIDEO) {
+		if (!has_key_frame_) {
+			if (IsVideoKeyFrame((uint8_t*)payload.get(), payload_size)) {
+				has_key_frame_ = true;
+			}
+			else {
 				return ;
 			}
+		}
 
-			if (!conn->has_flv_header_) {
-				conn->SendFlvHeader();
-				conn->SendFlvTag(conn->FLV_TAG_TYPE_AUDIO, 0, conn->aac_sequence_header_, conn->aac_sequence_header_size_);
-			}
+		if (!has_flv_header_) {
+			SendFlvHeader();
+			SendFlvTag(FLV_TAG_TYPE_VIDEO, 0, avc_sequence_header_, avc_sequence_header_size_);
+			SendFlvTag(FLV_TAG_TYPE_AUDIO, 0, aac_sequence_header_, aac_sequence_header_size_);
+		}
 
-			conn->SendFlvTag(conn->FLV_TAG_TYPE_AUDIO, timestamp, payload, payload_size);
+		SendFlvTag(FLV_TAG_TYPE_VIDEO, timestamp, payload, payload_size, flv_tag);
+	}
+	else if (type == RTMP_AUDIO) {
+		if (!has_key_frame_ && avc_sequence_header_size_>0) {
+			return ;
 		}
-	});
 
-	return true;
+		if (!has_flv_header_) {
+			SendFlvHeader();
+			SendFlvTag(FLV_TAG_TYPE_AUDIO, 0, aac_sequence_header_, aac_sequence_header_size_);
+		}
+
+		SendFlvTag(FLV_TAG_TYPE_AUDIO, timestamp, payload, payload_size, flv_tag);
+	}
 }
 
 void HttpFlvConnection::SendFlvHeader()
@@ -160,12 +209,19 @@ void HttpFlvConnection::SendFlvHeader()
 	has_flv_header_ = true;
 }
 
-int HttpFlvConnection::SendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+int HttpFlvConnection::SendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+	std::shared_ptr<char> flv_tag)
 {
 	if (payload_size == 0) {
 		return -1;
 	}
 
+	/* shared by every viewer, appended without a copy */
+	if (flv_tag != nullptr) {
+		this->Send(flv_tag, payload_size + 15);
+		return 0;
+	}
+
 	char tag_header[11] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 	char previous_tag_size[4] = { 0x0, 0x0, 0x0, 0x0 };
 
@@ -179,8 +235,26 @@ int HttpFlvConnection::SendFlvTag(uint8_t type, uint64_t timestamp, std::shared_
 	WriteUint32BE(previous_tag_size, payload_size + 11);
 
 	this->Send(tag_header, 11);
-	this->Send(payload.get(), payload_size);
+	this->Send(payload, payload_size);
 	this->Send(previous_tag_size, 4);
 
 	return 0;
+}
+
+std::shared_ptr<char> HttpFlvConnection::BuildFlvTag(uint8_t type, uint64_t timestamp, const char* payload, uint32_t payload_size)
+{
+	std::shared_ptr<char> flv_tag(new char[payload_size + 15], std::default_delete<char[]>());
+	char* tag_header = flv_tag.get();
+
+	tag_header[0] = type;
+	WriteUint24BE(tag_header + 1, payload_size);
+	tag_header[4] = (timestamp >> 16) & 0xff;
+	tag_header[5] = (timestamp >> 8) & 0xff;
+	tag_header[6] = timestamp & 0xff;
+	tag_header[7] = (timestamp >> 24) & 0xff;
+	tag_header[8] = tag_header[9] = tag_header[10] = 0; // stream id
+
+	memcpy(tag_header + 11, payload, payload_size);
+	WriteUint32BE(tag_header + 11 + payload_size, payload_size + 11);
+	return flv_tag;
 }
\ No newline at end of file
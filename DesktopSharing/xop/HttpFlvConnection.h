@@ -3,6 +3,7 @@
 
 #include "net/EventLoop.h"
 #include "net/TcpConnection.h"
+#include "GopCache.h"
 
 namespace xop
 {
@@ -23,8 +24,14 @@ public:
 
 	bool SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
 
-	void ResetKeyFrame()
-	{ has_key_frame_ = false; }
+	/* on the connection's own thread, its subscriber shard sends without another task.
+	   flv_tag is the frame as a complete tag, built once by the session for all viewers. */
+	bool PlayMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+		std::shared_ptr<char> flv_tag = nullptr);
+	bool PlayGopCache(std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos);
+
+	/* tag header, payload and previous tag size, payload_size + 15 bytes */
+	static std::shared_ptr<char> BuildFlvTag(uint8_t type, uint64_t timestamp, const char* payload, uint32_t payload_size);
 
 private:
 	friend class RtmpSession;
@@ -32,12 +39,17 @@ private:
 	bool OnRead(BufferReader& buffer);
 	void OnClose();
 	
+	bool PrepareMediaData(uint8_t type, std::shared_ptr<char> payload, uint32_t payload_size);
+	void SendFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+		std::shared_ptr<char> flv_tag = nullptr);
 	void SendFlvHeader();
-	int  SendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
+	int  SendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size,
+		std::shared_ptr<char> flv_tag = nullptr);
 
 	std::weak_ptr<RtmpServer> rtmp_server_;
 	TaskScheduler* task_scheduler_ = nullptr;
 	std::string stream_path_;
+	bool has_session_ = false;
 
 	std::shared_ptr<char> avc_sequence_header_;
 	std::shared_ptr<char> aac_sequence_header_;
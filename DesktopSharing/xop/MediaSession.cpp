@@ -100,12 +100,14 @@ bool MediaSession::AddSource(MediaChannelId channel_id, MediaSource* source)
 		});
 
 	media_sources_[channel_id].reset(source);
+	UpdateSdp();
 	return true;
 }
 
 bool MediaSession::RemoveSource(MediaChannelId channel_id)
 {
 	media_sources_[channel_id] = nullptr;
+	UpdateSdp();
 	return true;
 }
 
@@ -125,12 +127,17 @@ bool MediaSession::StartMulticast()
 	multicast_port_[channel_1] = htons(rd() & 0xfffe);
 
 	is_multicast_ = true;
+	UpdateSdp();
 	return true;
 }
 
 std::string MediaSession::GetSdpMessage(std::string ip, std::string session_name)
 {
-	if (sdp_ != "") {
+	std::lock_guard<std::mutex> lock(sdp_mutex_);
+
+	/* built once per version, the o= line carries the address it was asked for */
+	uint32_t version = sdp_version_;
+	if (sdp_ != "" && sdp_cache_version_ == version && sdp_ip_ == ip && sdp_session_name_ == session_name) {
 		return sdp_;
 	}
     
@@ -138,54 +145,46 @@ std::string MediaSession::GetSdpMessage(std::string ip, std::string session_name
 		return "";
 	}
 
-	char buf[2048] = {0};
+	if (sdp_session_id_ == 0) {
+		sdp_session_id_ = (long)std::time(NULL);
+	}
 
-	snprintf(buf, sizeof(buf),
-			"v=0\r\n"
-			"o=- 9%ld 1 IN IP4 %s\r\n"
-			"t=0 0\r\n"
-			"a=control:*\r\n" ,
-			(long)std::time(NULL), ip.c_str()); 
+	/* a std::string, a large sdp (many tracks, long fmtp lines) is not cut */
+	std::string sdp;
+	sdp.reserve(1024);
+	sdp += "v=0\r\n";
+	sdp += "o=- 9" + std::to_string(sdp_session_id_) + " " + std::to_string(version) + " IN IP4 " + ip + "\r\n";
+	sdp += "t=0 0\r\n";
+	sdp += "a=control:*\r\n";
 
 	if(session_name != "") {
-		snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf), 
-				"s=%s\r\n",
-				session_name.c_str());
+		sdp += "s=" + session_name + "\r\n";
 	}
     
 	if(is_multicast_) {
-		snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf),
-				"a=type:broadcast\r\n"
-				"a=rtcp-unicast: reflection\r\n");
+		sdp += "a=type:broadcast\r\n"
+		       "a=rtcp-unicast: reflection\r\n";
 	}
 		
 	for (uint32_t chn=0; chn<media_sources_.size(); chn++) {
 		if(media_sources_[chn]) {	
 			if(is_multicast_) {
-				snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf), 
-						"%s\r\n",
-						media_sources_[chn]->GetMediaDescription(multicast_port_[chn]).c_str()); 
-                     
-				snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf), 
-						"c=IN IP4 %s/255\r\n",
-						multicast_ip_.c_str()); 
+				sdp += media_sources_[chn]->GetMediaDescription(multicast_port_[chn]) + "\r\n";
+				sdp += "c=IN IP4 " + multicast_ip_ + "/255\r\n";
 			}
 			else {
-				snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf), 
-						"%s\r\n",
-						media_sources_[chn]->GetMediaDescription(0).c_str());
+				sdp += media_sources_[chn]->GetMediaDescription(0) + "\r\n";
 			}
             
-			snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf), 
-					"%s\r\n",
-					media_sources_[chn]->GetAttribute().c_str());
-                     
-			snprintf(buf+strlen(buf), sizeof(buf)-strlen(buf),											
-					"a=control:track%d\r\n", chn);	
+			sdp += media_sources_[chn]->GetAttribute() + "\r\n";
+			sdp += "a=control:track" + std::to_string(chn) + "\r\n";
 		}
 	}
 
-	sdp_ = buf;
+	sdp_ = sdp;
+	sdp_cache_version_ = version;
+	sdp_ip_ = ip;
+	sdp_session_name_ = session_name;
 	return sdp_;
 }
 
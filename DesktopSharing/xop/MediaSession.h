@@ -15,8 +15,10 @@
 #include "media.h"
 #include "H264Source.h"
 #include "H265Source.h"
+#include "AV1Source.h"
 #include "G711ASource.h"
 #include "AACSource.h"
+#include "OpusSource.h"
 #include "MediaSource.h"
 #include "net/Socket.h"
 #include "net/RingBuffer.h"
@@ -52,6 +54,10 @@ public:
 
 	std::string GetSdpMessage(std::string ip, std::string session_name ="");
 
+	/* the next DESCRIBE gets a new sdp, for sources whose description changed */
+	void UpdateSdp()
+	{ sdp_version_++; }
+
 	MediaSource* GetMediaSource(MediaChannelId channel_id);
 
 	bool HandleFrame(MediaChannelId channel_id, AVFrame frame);
@@ -87,6 +93,12 @@ private:
 	MediaSessionId session_id_ = 0;
 	std::string suffix_;
 	std::string sdp_;
+	std::string sdp_ip_;
+	std::string sdp_session_name_;
+	uint32_t sdp_cache_version_ = 0;
+	long sdp_session_id_ = 0;
+	std::atomic_uint sdp_version_{ 1 };
+	std::mutex sdp_mutex_;
 
 	std::vector<std::unique_ptr<MediaSource>> media_sources_;
 	std::vector<RingBuffer<AVFrame>> buffer_;
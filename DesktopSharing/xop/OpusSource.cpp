@@ -0,0 +1,76 @@
+﻿#if defined(WIN32) || defined(_WIN32) 
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#endif
+#include "OpusSource.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+using namespace xop;
+using namespace std;
+
+OpusSource::OpusSource(uint32_t channels, uint32_t frame_msec)
+	: channels_(channels)
+	, frame_msec_(frame_msec)
+{
+	payload_    = 111;
+	media_type_ = OPUS;
+	clock_rate_ = 48000;
+}
+
+OpusSource* OpusSource::CreateNew(uint32_t channels, uint32_t frame_msec)
+{
+	return new OpusSource(channels, frame_msec);
+}
+
+OpusSource::~OpusSource()
+{
+
+}
+
+string OpusSource::GetMediaDescription(uint16_t port)
+{
+	char buf[100] = { 0 };
+	sprintf(buf, "m=audio %hu RTP/AVP 111", port);
+	return string(buf);
+}
+
+string OpusSource::GetAttribute()
+{
+	/* the rtpmap always says 2 channels, stereo tells the receiver what is sent */
+	char buf[200] = { 0 };
+	sprintf(buf, "a=rtpmap:111 opus/48000/2\r\n"
+				 "a=fmtp:111 minptime=10;stereo=%d;sprop-stereo=%d\r\n"
+				 "a=ptime:%u",
+				 channels_ == 2 ? 1 : 0, channels_ == 2 ? 1 : 0, frame_msec_);
+	return string(buf);
+}
+
+bool OpusSource::HandleFrame(MediaChannelId channel_id, AVFrame frame)
+{
+	if (frame.size > MAX_RTP_PAYLOAD_SIZE) {
+		return false;
+	}
+
+	RtpPacket rtp_pkt;
+	rtp_pkt.type = frame.type;
+	rtp_pkt.timestamp = frame.timestamp;
+	rtp_pkt.size = frame.size + 4 + RTP_HEADER_SIZE;
+	rtp_pkt.last = 1;
+
+	memcpy(rtp_pkt.data.get() + 4 + RTP_HEADER_SIZE, frame.buffer.get(), frame.size);
+
+	if (send_frame_callback_) {
+		send_frame_callback_(channel_id, rtp_pkt);
+	}
+
+	return true;
+}
+
+uint32_t OpusSource::GetTimestamp()
+{
+	auto time_point = chrono::time_point_cast<chrono::microseconds>(chrono::steady_clock::now());
+	return (uint32_t)((time_point.time_since_epoch().count() + 500) / 1000 * 48);
+}
@@ -0,0 +1,41 @@
+﻿#ifndef XOP_OPUS_SOURCE_H
+#define XOP_OPUS_SOURCE_H
+
+#include "MediaSource.h"
+#include "rtp.h"
+
+namespace xop
+{
+
+/* RTP payload format for Opus (RFC 7587), one opus packet per rtp packet,
+   the clock is always 48kHz. */
+class OpusSource : public MediaSource
+{
+public:
+	static OpusSource* CreateNew(uint32_t channels=2, uint32_t frame_msec=20);
+	virtual ~OpusSource();
+
+	uint32_t GetChannels() const
+	{ return channels_; }
+
+	uint32_t GetFrameMsec() const
+	{ return frame_msec_; }
+
+	virtual std::string GetMediaDescription(uint16_t port=0);
+
+	virtual std::string GetAttribute();
+
+	bool HandleFrame(MediaChannelId channel_id, AVFrame frame);
+
+	static uint32_t GetTimestamp();
+
+private:
+	OpusSource(uint32_t channels, uint32_t frame_msec);
+
+	uint32_t channels_ = 2;
+	uint32_t frame_msec_ = 20;
+};
+
+}
+
+#endif
@@ -1,12 +1,12 @@
 #include "RtmpChunk.h"
 #include "rtmp.h"
+#include "net/MemoryManager.h"
 
 using namespace xop;
 
 RtmpChunk::RtmpChunk()
 {
 	state_ = PARSE_HEADER;
-	chunk_stream_id_ = -1;
 	stream_id_ = kDefaultStreamId;
 }
 
@@ -17,37 +17,76 @@ RtmpChunk::~RtmpChunk()
 
 int RtmpChunk::Parse(BufferReader& in_buffer, RtmpMessage& out_rtmp_msg)
 {
-	int ret = 0;
+	int bytes_used = 0;
 
-	if (!in_buffer.ReadableBytes()) {
-		return 0;
+	/* a message may also have been completed by CommitBody() */
+	while (!PopMessage(out_rtmp_msg) && in_buffer.ReadableBytes() > 0) {
+		int ret = (state_ == PARSE_HEADER) ? ParseChunkHeader(in_buffer) : ParseChunkBody(in_buffer);
+		if (ret < 0) {
+			return -1;
+		}
+		else if (ret == 0) {
+			break;
+		}
+		bytes_used += ret;
 	}
 
-	if (state_ == PARSE_HEADER) {
-		ret = ParseChunkHeader(in_buffer);
+	return bytes_used;
+}
+
+bool RtmpChunk::PopMessage(RtmpMessage& out_rtmp_msg)
+{
+	RtmpMessage* rtmp_msg = current_msg_;
+	if (rtmp_msg == nullptr || rtmp_msg->length == 0 || rtmp_msg->index < rtmp_msg->length) {
+		return false;
 	}
-	else if (state_ == PARSE_BODY)
-	{
-		ret = ParseChunkBody(in_buffer);
-		if (ret > 0 && chunk_stream_id_ >= 0) {
-			auto& rtmp_msg = rtmp_messages_[chunk_stream_id_];
-
-			if (rtmp_msg.index == rtmp_msg.length) {
-				if (rtmp_msg.timestamp >= 0xffffff) {
-					rtmp_msg._timestamp += rtmp_msg.extend_timestamp;
-				}
-				else {
-					rtmp_msg._timestamp += rtmp_msg.timestamp;
-				}
-
-				out_rtmp_msg = rtmp_msg;
-				chunk_stream_id_ = -1;
-				rtmp_msg.Clear();
-			}
-		}
+
+	if (rtmp_msg->timestamp >= 0xffffff) {
+		rtmp_msg->_timestamp += rtmp_msg->extend_timestamp;
+	}
+	else {
+		rtmp_msg->_timestamp += rtmp_msg->timestamp;
 	}
 
-	return ret;
+	/* the header fields are copied, the payload is moved out */
+	out_rtmp_msg.timestamp = rtmp_msg->timestamp;
+	out_rtmp_msg.length = rtmp_msg->length;
+	out_rtmp_msg.type_id = rtmp_msg->type_id;
+	out_rtmp_msg.stream_id = rtmp_msg->stream_id;
+	out_rtmp_msg.extend_timestamp = rtmp_msg->extend_timestamp;
+	out_rtmp_msg._timestamp = rtmp_msg->_timestamp;
+	out_rtmp_msg.codecId = rtmp_msg->codecId;
+	out_rtmp_msg.csid = rtmp_msg->csid;
+	out_rtmp_msg.index = rtmp_msg->index;
+	out_rtmp_msg.payload = std::move(rtmp_msg->payload);
+
+	rtmp_msg->Clear();
+	current_msg_ = nullptr;
+	state_ = PARSE_HEADER;
+	return true;
+}
+
+uint32_t RtmpChunk::GetPendingBody(char** data)
+{
+	if (state_ != PARSE_BODY || current_msg_ == nullptr || chunk_remaining_ == 0) {
+		return 0;
+	}
+
+	*data = current_msg_->payload.get() + current_msg_->index;
+	return chunk_remaining_;
+}
+
+void RtmpChunk::CommitBody(uint32_t size)
+{
+	if (state_ != PARSE_BODY || current_msg_ == nullptr || size > chunk_remaining_) {
+		return;
+	}
+
+	current_msg_->index += size;
+	chunk_remaining_ -= size;
+	if (chunk_remaining_ == 0) {
+		state_ = PARSE_HEADER;
+	}
 }
 
 int RtmpChunk::ParseChunkHeader(BufferReader& buffer)
@@ -92,14 +131,14 @@ int RtmpChunk::ParseChunkHeader(BufferReader& buffer)
 	bytes_used += header_len;
 
 	auto& rtmp_msg = rtmp_messages_[csid];
-	chunk_stream_id_ = rtmp_msg.csid = csid;
+	rtmp_msg.csid = csid;
 
 	if (fmt == RTMP_CHUNK_TYPE_0 || fmt == RTMP_CHUNK_TYPE_1) {
 		uint32_t length = ReadUint24BE((char*)header.length);
-		if (rtmp_msg.length != length || !rtmp_msg.payload) {
-			rtmp_msg.length = length;
-			rtmp_msg.payload.reset(new char[rtmp_msg.length], std::default_delete<char[]>());
+		if (rtmp_msg.length != length) {
+			rtmp_msg.payload = nullptr;
 		}
+		rtmp_msg.length = length;
 		rtmp_msg.index = 0;
 		rtmp_msg.type_id = header.type_id;
 	}
@@ -136,42 +175,46 @@ int RtmpChunk::ParseChunkHeader(BufferReader& buffer)
 		}
 	}
 
-	state_ = PARSE_BODY;
+	/* the payload of a new message comes from the pool, it is handed out
+	   as is once complete and released by its last user */
+	if (rtmp_msg.index == 0 && rtmp_msg.payload == nullptr && rtmp_msg.length > 0) {
+		rtmp_msg.payload.reset((char*)xop::Alloc(rtmp_msg.length), xop::Free);
+	}
+
 	buffer.Retrieve(bytes_used);
+
+	if (rtmp_msg.length == 0) { // nothing to hand out
+		rtmp_msg.Clear();
+		return bytes_used;
+	}
+
+	current_msg_ = &rtmp_msg;
+	chunk_remaining_ = std::min(in_chunk_size_, rtmp_msg.length - rtmp_msg.index);
+	if (chunk_remaining_ == 0) {
+		return -1;
+	}
+	state_ = PARSE_BODY;
 	return bytes_used;
 }
 
 int RtmpChunk::ParseChunkBody(BufferReader& buffer)
 {
-	uint32_t bytes_used = 0;
-	uint8_t* buf = (uint8_t*)buffer.Peek();
-	uint32_t buf_size = buffer.ReadableBytes();
-
-	if (chunk_stream_id_ < 0) {
+	if (current_msg_ == nullptr || current_msg_->payload == nullptr) {
 		return -1;
 	}
 
-	auto& rtmp_msg = rtmp_messages_[chunk_stream_id_];
-	uint32_t chunk_size = rtmp_msg.length - rtmp_msg.index;
-
-	if (chunk_size > in_chunk_size_) {
-		chunk_size = in_chunk_size_;
-	}
-
-	if (buf_size < (chunk_size + bytes_used)) {
-		return 0;
-	}
-
-	if (rtmp_msg.index + chunk_size > rtmp_msg.length) {
+	RtmpMessage& rtmp_msg = *current_msg_;
+	if (rtmp_msg.index + chunk_remaining_ > rtmp_msg.length) {
 		return -1;
 	}
 
-	memcpy(rtmp_msg.payload.get() + rtmp_msg.index, buf + bytes_used, chunk_size);
-	bytes_used += chunk_size;
-	rtmp_msg.index += chunk_size;
+	/* what has arrived of the chunk, the read buffer never holds a whole large chunk */
+	uint32_t bytes_used = std::min(chunk_remaining_, buffer.ReadableBytes());
+	memcpy(rtmp_msg.payload.get() + rtmp_msg.index, buffer.Peek(), bytes_used);
+	rtmp_msg.index += bytes_used;
+	chunk_remaining_ -= bytes_used;
 
-	if (rtmp_msg.index >= rtmp_msg.length || 
-		rtmp_msg.index%in_chunk_size_ == 0) {
+	if (chunk_remaining_ == 0) {
 		state_ = PARSE_HEADER;
 	}
 
@@ -226,42 +269,38 @@ int RtmpChunk::CreateMessageHeader(uint8_t fmt, RtmpMessage& rtmp_msg, char* buf
 	return len;
 }
 
+int RtmpChunk::CreateChunkHeader(uint32_t csid, RtmpMessage& rtmp_msg, uint32_t payload_offset, char* buf)
+{
+	int len = 0;
+
+	/* the first chunk carries the message header, the others only continue it */
+	uint8_t fmt = (payload_offset == 0) ? 0 : 3;
+	len += CreateBasicHeader(fmt, csid, buf + len);
+	len += CreateMessageHeader(fmt, rtmp_msg, buf + len);
+	if (rtmp_msg._timestamp >= 0xffffff) {
+		WriteUint32BE(buf + len, (uint32_t)rtmp_msg._timestamp);
+		len += 4;
+	}
+
+	return len;
+}
+
 int RtmpChunk::CreateChunk(uint32_t csid, RtmpMessage& rtmp_msg, char* buf, uint32_t buf_size)
 {
 	uint32_t buf_offset = 0, payload_offset = 0;
-	uint32_t capacity = rtmp_msg.length + rtmp_msg.length / out_chunk_size_ * 5;
+	uint32_t capacity = rtmp_msg.length + (rtmp_msg.length / out_chunk_size_ + 1) * kMaxChunkHeaderSize;
 	if (buf_size < capacity) {
 		return -1;
 	}
 
-	buf_offset += CreateBasicHeader(0, csid, buf + buf_offset); //first chunk
-	buf_offset += CreateMessageHeader(0, rtmp_msg, buf + buf_offset);
-	if (rtmp_msg._timestamp >= 0xffffff) {
-		WriteUint32BE((char*)buf + buf_offset, (uint32_t)rtmp_msg._timestamp);
-		buf_offset += 4;
-	}
-
-	while (rtmp_msg.length > 0)
+	do
 	{
-		if (rtmp_msg.length > out_chunk_size_) {
-			memcpy(buf + buf_offset, rtmp_msg.payload.get() + payload_offset, out_chunk_size_);
-			payload_offset += out_chunk_size_;
-			buf_offset += out_chunk_size_;
-			rtmp_msg.length -= out_chunk_size_;
-
-			buf_offset += CreateBasicHeader(3, csid, buf + buf_offset);
-			if (rtmp_msg._timestamp >= 0xffffff) {
-				WriteUint32BE(buf + buf_offset, (uint32_t)rtmp_msg._timestamp);
-				buf_offset += 4;
-			}
-		}
-		else {
-			memcpy(buf + buf_offset, rtmp_msg.payload.get() + payload_offset, rtmp_msg.length);
-			buf_offset += rtmp_msg.length;
-			rtmp_msg.length = 0;
-			break;
-		}
-	}
+		uint32_t chunk_size = std::min(out_chunk_size_, rtmp_msg.length - payload_offset);
+		buf_offset += CreateChunkHeader(csid, rtmp_msg, payload_offset, buf + buf_offset);
+		memcpy(buf + buf_offset, rtmp_msg.payload.get() + payload_offset, chunk_size);
+		buf_offset += chunk_size;
+		payload_offset += chunk_size;
+	} while (payload_offset < rtmp_msg.length);
 
 	return buf_offset;
 }
\ No newline at end of file
@@ -21,18 +21,37 @@ public:
 	RtmpChunk();
 	virtual ~RtmpChunk();
 
+	/* parses the chunks of in_buffer until a message is complete or the buffer
+	   is drained, returns the bytes used or -1 */
 	int Parse(BufferReader& in_buffer, RtmpMessage& out_rtmp_msg);
 
+	/* the rest of the chunk body being received, for a recv straight into the
+	   message payload, and the bytes that recv got */
+	uint32_t GetPendingBody(char** data);
+	void CommitBody(uint32_t size);
+
 	int CreateChunk(uint32_t csid, RtmpMessage& rtmp_msg, char* buf, uint32_t buf_size);
 
+	/* the header of the chunk that carries the payload from payload_offset on,
+	   buf has room for kMaxChunkHeaderSize bytes */
+	int CreateChunkHeader(uint32_t csid, RtmpMessage& rtmp_msg, uint32_t payload_offset, char* buf);
+
 	void SetInChunkSize(uint32_t in_chunk_size)
 	{ in_chunk_size_ = in_chunk_size; }
 
 	void SetOutChunkSize(uint32_t out_chunk_size)
 	{ out_chunk_size_ = out_chunk_size; }
 
+	uint32_t GetOutChunkSize() const
+	{ return out_chunk_size_; }
+
 	void Clear() 
-	{ rtmp_messages_.clear(); }
+	{ 
+		rtmp_messages_.clear(); 
+		current_msg_ = nullptr;
+		chunk_remaining_ = 0;
+		state_ = PARSE_HEADER;
+	}
 
 	int GetStreamId() const
 	{ return stream_id_; }
@@ -40,16 +59,22 @@ public:
 private:
 	int ParseChunkHeader(BufferReader& buffer);
 	int ParseChunkBody(BufferReader& buffer);
+	bool PopMessage(RtmpMessage& out_rtmp_msg);
 	int CreateBasicHeader(uint8_t fmt, uint32_t csid, char* buf);
 	int CreateMessageHeader(uint8_t fmt, RtmpMessage& rtmp_msg, char* buf);
 
 	State state_;
-	int chunk_stream_id_ = 0;
+	RtmpMessage* current_msg_ = nullptr; // nodes of rtmp_messages_ do not move
+	uint32_t chunk_remaining_ = 0;
 	int stream_id_ = 0;
 	uint32_t in_chunk_size_ = 128;
 	uint32_t out_chunk_size_ = 128;
 	std::map<int, RtmpMessage> rtmp_messages_;
 
+public:
+	static const uint32_t kMaxChunkHeaderSize = 18; // basic 3, message 11, extended timestamp 4
+
+private:
 	const int kDefaultStreamId = 1;
 	const int kChunkMessageHeaderLen[4] = { 11, 7, 3, 0 };
 };
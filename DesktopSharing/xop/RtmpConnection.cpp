@@ -2,11 +2,61 @@
 #include "RtmpServer.h"
 #include "RtmpPublisher.h"
 #include "RtmpClient.h"
+#include "H264Parser.h"
+#include "H265Parser.h"
 #include "net/Logger.h"
 #include <random>
 
 using namespace xop;
 
+/* the replies that do not depend on the connection are encoded once */
+struct AmfCommand
+{
+	std::shared_ptr<char> data;
+	uint32_t size;
+};
+
+static AmfCommand EncodeOnStatus(const char* level, const char* code, const char* description)
+{
+	AmfObjects objects;
+	AmfEncoder encoder;
+	encoder.encodeString("onStatus", 8);
+	encoder.encodeNumber(0);
+	encoder.encodeObjects(objects);
+	objects["level"] = AmfObject(std::string(level));
+	objects["code"] = AmfObject(std::string(code));
+	objects["description"] = AmfObject(std::string(description));
+	encoder.encodeObjects(objects);
+	return { encoder.data(), encoder.size() };
+}
+
+static AmfCommand EncodeConnectResult()
+{
+	/* the properties and information objects, the transaction id is written per request */
+	AmfObjects objects;
+	AmfEncoder encoder;
+	objects["fmsVer"] = AmfObject(std::string("FMS/4,5,0,297"));
+	objects["capabilities"] = AmfObject(255.0);
+	objects["mode"] = AmfObject(1.0);
+	encoder.encodeObjects(objects);
+	objects.clear();
+	objects["level"] = AmfObject(std::string("status"));
+	objects["code"] = AmfObject(std::string("NetConnection.Connect.Success"));
+	objects["description"] = AmfObject(std::string("Connection succeeded."));
+	objects["objectEncoding"] = AmfObject(0.0);
+	encoder.encodeObjects(objects);
+	return { encoder.data(), encoder.size() };
+}
+
+static AmfCommand EncodeSampleAccess()
+{
+	AmfEncoder encoder;
+	encoder.encodeString("|RtmpSampleAccess", 17);
+	encoder.encodeBoolean(true);
+	encoder.encodeBoolean(true);
+	return { encoder.data(), encoder.size() };
+}
+
 RtmpConnection::RtmpConnection(std::shared_ptr<RtmpServer> rtmp_server, TaskScheduler *task_scheduler, SOCKET sockfd)
 	: RtmpConnection(task_scheduler, sockfd, rtmp_server.get())
 {
@@ -41,6 +91,8 @@ RtmpConnection::RtmpConnection(TaskScheduler *task_scheduler, SOCKET sockfd, Rtm
 	peer_bandwidth_ = rtmp->GetPeerBandwidth();
 	acknowledgement_size_ = rtmp->GetAcknowledgementSize();
 	max_gop_cache_len_ = rtmp->GetGopCacheLen();
+	max_gop_cache_bytes_ = rtmp->GetGopCacheBytes();
+	gop_fast_start_ = rtmp->IsGopFastStart();
 	max_chunk_size_ = rtmp->GetChunkSize();
 	stream_path_ = rtmp->GetStreamPath();
 	stream_name_ = rtmp->GetStreamName();
@@ -94,6 +146,31 @@ bool RtmpConnection::OnRead(BufferReader& buffer)
 	return ret;
 }
 
+void RtmpConnection::HandleRead()
+{
+	/* nothing buffered and a large chunk body pending (high bitrate publishers
+	   with a big chunk size), it is received straight into the message payload */
+	char* body = nullptr;
+	uint32_t body_size = 0;
+	if (!is_closed_ && handshake_->IsCompleted() && read_buffer_->ReadableBytes() == 0) {
+		body_size = rtmp_chunk_->GetPendingBody(&body);
+	}
+
+	if (body_size >= kDirectReadSize) {
+		int bytes_read = ::recv(this->GetSocket(), body, body_size, 0);
+		if (bytes_read > 0) {
+			rtmp_chunk_->CommitBody(bytes_read);
+			if (!HandleChunk(*read_buffer_)) {
+				this->HandleClose();
+			}
+			return;
+		}
+	}
+
+	/* closed or would block, the read buffer path handles it */
+	TcpConnection::HandleRead();
+}
+
 void RtmpConnection::OnClose()
 {
 	if (connection_mode_ == RTMP_SERVER) {
@@ -101,32 +178,33 @@ void RtmpConnection::OnClose()
 	}
 	else if (connection_mode_ == RTMP_PUBLISHER) {
 		this->DeleteStream();
+
+		auto publisher = rtmp_publisher_.lock();
+		if (publisher) {
+			publisher->OnDisconnect(this);
+		}
 	}
 }
 
 bool RtmpConnection::HandleChunk(BufferReader& buffer)
 {
-	int ret = -1;
-	
-	do
+	/* Parse() stops at each complete message, a chunk size change applies to the next one */
+	while (true)
 	{
 		RtmpMessage rtmp_msg;
-		ret = rtmp_chunk_->Parse(buffer, rtmp_msg);
-		if (ret >= 0) {
-			if (rtmp_msg.IsCompleted()) {
-				if (!HandleMessage(rtmp_msg)) {
-					return false;
-				}
-			}
+		int ret = rtmp_chunk_->Parse(buffer, rtmp_msg);
+		if (ret < 0) {
+			return false;
+		}
 
-			if (ret == 0) {
-				break;
-			}
+		if (!rtmp_msg.IsCompleted()) {
+			break;
 		}
-		else if (ret < 0) {
+
+		if (!HandleMessage(rtmp_msg)) {
 			return false;
 		}
-	} while (buffer.ReadableBytes() > 0);
+	}
 
 	return true;
 }
@@ -149,11 +227,19 @@ bool RtmpConnection::HandleMessage(RtmpMessage& rtmp_msg)
             ret = HandleNotify(rtmp_msg);
             break;
         case RTMP_FLEX_MESSAGE:
-			LOG_INFO("unsupported rtmp flex message.\n");
-			ret = false;
+            /* an AMF0 command behind a format byte */
+            ret = HandleInvoke(rtmp_msg);
             break;            
         case RTMP_SET_CHUNK_SIZE:           
-			rtmp_chunk_->SetInChunkSize(ReadUint32BE(rtmp_msg.payload.get()));
+            {
+                /* the top bit is reserved, 0 would never finish a chunk */
+                uint32_t in_chunk_size = (rtmp_msg.length >= 4) ? ReadUint32BE(rtmp_msg.payload.get()) : 0;
+                if (in_chunk_size == 0 || in_chunk_size > 0x7fffffff) {
+                    ret = false;
+                    break;
+                }
+                rtmp_chunk_->SetInChunkSize(in_chunk_size);
+            }
             break;
 		case RTMP_BANDWIDTH_SIZE:
 			break;
@@ -183,9 +269,16 @@ bool RtmpConnection::HandleInvoke(RtmpMessage& rtmp_msg)
 {   
     bool ret  = true;
     amf_decoder_.reset();
+
+	const char* payload = rtmp_msg.payload.get();
+	int length = (int)rtmp_msg.length;
+	if (rtmp_msg.type_id == RTMP_FLEX_MESSAGE && length > 0) {
+		payload += 1;
+		length -= 1;
+	}
   
-	int bytes_used = amf_decoder_.decode((const char *)rtmp_msg.payload.get(), rtmp_msg.length, 1);
-	if (bytes_used < 0) {
+	int bytes_used = amf_decoder_.decode(payload, length, 1);
+	if (bytes_used <= 0) {
 		return false;
 	}
 
@@ -193,7 +286,7 @@ bool RtmpConnection::HandleInvoke(RtmpMessage& rtmp_msg)
 	//LOG_INFO("[Method] %s\n", method.c_str());
 
 	if (connection_mode_ == RTMP_PUBLISHER || connection_mode_ == RTMP_CLIENT) {
-		bytes_used += amf_decoder_.decode(rtmp_msg.payload.get() + bytes_used, rtmp_msg.length - bytes_used);
+		bytes_used += amf_decoder_.decode(payload + bytes_used, length - bytes_used);
 		if (method == "_result") {
 			ret = HandleResult(rtmp_msg);
 		}
@@ -203,7 +296,7 @@ bool RtmpConnection::HandleInvoke(RtmpMessage& rtmp_msg)
 	}
 	else if (connection_mode_ == RTMP_SERVER) {
 		if(rtmp_msg.stream_id == 0) {
-			bytes_used += amf_decoder_.decode(rtmp_msg.payload.get()+bytes_used, rtmp_msg.length-bytes_used);
+			bytes_used += amf_decoder_.decode(payload + bytes_used, length - bytes_used);
 			if(method == "connect") {            
 				ret = HandleConnect();
 			}
@@ -212,12 +305,12 @@ bool RtmpConnection::HandleInvoke(RtmpMessage& rtmp_msg)
 			}
 		}
 		else if(rtmp_msg.stream_id == stream_id_) {
-			bytes_used += amf_decoder_.decode((const char *)rtmp_msg.payload.get()+bytes_used, rtmp_msg.length-bytes_used, 3);
+			bytes_used += amf_decoder_.decode(payload + bytes_used, length - bytes_used, 3);
 			stream_name_ = amf_decoder_.getString();
 			stream_path_ = "/" + app_ + "/" + stream_name_;
         
-			if((int)rtmp_msg.length > bytes_used) {
-				bytes_used += amf_decoder_.decode((const char *)rtmp_msg.payload.get()+bytes_used, rtmp_msg.length-bytes_used);                      
+			if(length > bytes_used) {
+				bytes_used += amf_decoder_.decode(payload + bytes_used, length - bytes_used);
 			}
               
 			if(method == "publish") {            
@@ -266,7 +359,7 @@ bool RtmpConnection::HandleNotify(RtmpMessage& rtmp_msg)
 				return false;
 			}
 
-            auto session = server->GetSession(stream_path_);
+            auto session = server->FindSession(session_path_);
             if(session) {
 				session->SetMetaData(meta_data_);
 				session->SendMetaData(meta_data_);
@@ -299,18 +392,32 @@ bool RtmpConnection::HandleVideo(RtmpMessage& rtmp_msg)
 			return false;
 		}
 
-		auto session = server->GetSession(stream_path_);
+		auto session = server->FindSession(session_path_);
 		if (session == nullptr) {
 			return false;
 		}
 
-		if (frame_type == 1 && codec_id == RTMP_CODEC_ID_H264) {
-			if (payload[1] == 0) {
-				avc_sequence_header_size_ = length;
-				avc_sequence_header_.reset(new char[length], std::default_delete<char[]>());
-				memcpy(avc_sequence_header_.get(), rtmp_msg.payload.get(), length);
-				session->SetAvcSequenceHeader(avc_sequence_header_, avc_sequence_header_size_);
-				type = RTMP_AVC_SEQUENCE_HEADER;
+		if (IsVideoSequenceHeader(payload, length)) {
+			avc_sequence_header_size_ = length;
+			avc_sequence_header_.reset(new char[length], std::default_delete<char[]>());
+			memcpy(avc_sequence_header_.get(), rtmp_msg.payload.get(), length);
+			session->SetAvcSequenceHeader(avc_sequence_header_, avc_sequence_header_size_);
+			type = RTMP_AVC_SEQUENCE_HEADER;
+		}
+		else if (payload[0] & RTMP_VIDEO_EX_HEADER) {
+			/* enhanced rtmp, only hevc coded frames are inspected */
+			uint32_t offset = GetVideoDataOffset(payload, length);
+			if (((payload[0] >> 4) & 0x07) == 2 && offset > 0 && ReadUint32BE((char*)payload + 1) == RTMP_FOURCC_HEVC) {
+				if (H265Parser::IsHvccRandomAccess(payload + offset, length - offset)) {
+					payload[0] = (payload[0] & 0x8f) | (1 << 4);
+				}
+			}
+		}
+		else if (length > 5 && frame_type == 2 && codec_id == RTMP_CODEC_ID_H264 && payload[1] == 1) {
+			/* intra refresh streams have no idr after the first one, mark recovery points
+			   as key frames so the gop cache and new players can start from them */
+			if (H264Parser::IsAvcRandomAccess(payload + 5, length - 5)) {
+				payload[0] = (1 << 4) | codec_id;
 			}
 		}
 
@@ -344,7 +451,7 @@ bool RtmpConnection::HandleAudio(RtmpMessage& rtmp_msg)
 			return false;
 		}
 
-		auto session = server->GetSession(stream_path_);
+		auto session = server->FindSession(session_path_);
 		if (session == nullptr) {
 			return false;
 		}
@@ -482,21 +589,12 @@ bool RtmpConnection::HandleConnect()
     SetPeerBandwidth();   
     SetChunkSize();
 
-    AmfObjects objects;    
+    static const AmfCommand kConnectResult = EncodeConnectResult();
+
     amf_encoder_.reset();
     amf_encoder_.encodeString("_result", 7);
     amf_encoder_.encodeNumber(amf_decoder_.getNumber());
-
-    objects["fmsVer"] = AmfObject(std::string("FMS/4,5,0,297"));
-    objects["capabilities"] = AmfObject(255.0);
-    objects["mode"] = AmfObject(1.0);
-    amf_encoder_.encodeObjects(objects);
-    objects.clear();
-    objects["level"] = AmfObject(std::string("status"));
-    objects["code"] = AmfObject(std::string("NetConnection.Connect.Success"));
-    objects["description"] = AmfObject(std::string("Connection succeeded."));
-    objects["objectEncoding"] = AmfObject(0.0);
-    amf_encoder_.encodeObjects(objects);  
+    amf_encoder_.encodeBytes(kConnectResult.data.get(), kConnectResult.size);
 
     SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, amf_encoder_.data(), amf_encoder_.size());
     return true;
@@ -527,38 +625,29 @@ bool RtmpConnection::HandlePublish()
 		return false;
 	}
 
-    AmfObjects objects; 
-    amf_encoder_.reset();
-    amf_encoder_.encodeString("onStatus", 8);
-    amf_encoder_.encodeNumber(0);
-    amf_encoder_.encodeObjects(objects);
+    static const AmfCommand kBadName = EncodeOnStatus("error", "NetStream.Publish.BadName", "Stream already publishing.");
+    static const AmfCommand kBadConnection = EncodeOnStatus("error", "NetStream.Publish.BadConnection", "Connection already publishing.");
+    static const AmfCommand kPublishStart = EncodeOnStatus("status", "NetStream.Publish.Start", "Start publising.");
 
+    const AmfCommand* status = nullptr;
     bool is_error = false;
 
     if(server->HasPublisher(stream_path_)) {
 		is_error = true;
-        objects["level"] = AmfObject(std::string("error"));
-        objects["code"] = AmfObject(std::string("NetStream.Publish.BadName"));
-        objects["description"] = AmfObject(std::string("Stream already publishing."));
+        status = &kBadName;
     }
     else if(connection_state_ == START_PUBLISH) {
 		is_error = true;
-        objects["level"] = AmfObject(std::string("error"));
-        objects["code"] = AmfObject(std::string("NetStream.Publish.BadConnection"));
-        objects["description"] = AmfObject(std::string("Connection already publishing."));
+        status = &kBadConnection;
     }
     /* else if(0)  {
         // 认证处理 
     } */
     else {
-        objects["level"] = AmfObject(std::string("status"));
-        objects["code"] = AmfObject(std::string("NetStream.Publish.Start"));
-        objects["description"] = AmfObject(std::string("Start publising."));
-		server->AddSession(stream_path_);
+        status = &kPublishStart;
     }
 
-    amf_encoder_.encodeObjects(objects);     
-    SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, amf_encoder_.data(), amf_encoder_.size());
+    SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, status->data, status->size);
 
     if(is_error) {
         // Close ?
@@ -568,9 +657,10 @@ bool RtmpConnection::HandlePublish()
 		is_publishing_ = true;
     }
 
-    auto session = server->GetSession(stream_path_);
+    /* a rejected publisher is not attached to the stream */
+    auto session = is_error ? nullptr : AcquireSession(server);
     if(session) {
-		session->SetGopCache(max_gop_cache_len_);
+		session->SetGopCache(max_gop_cache_len_, max_gop_cache_bytes_, gop_fast_start_);
 		session->AddRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
     }        
 
@@ -586,43 +676,25 @@ bool RtmpConnection::HandlePlay()
 		return false;
 	}
 
-    AmfObjects objects; 
-    amf_encoder_.reset(); 
-    amf_encoder_.encodeString("onStatus", 8);
-    amf_encoder_.encodeNumber(0);
-    amf_encoder_.encodeObjects(objects);
-    objects["level"] = AmfObject(std::string("status"));
-    objects["code"] = AmfObject(std::string("NetStream.Play.Reset"));
-    objects["description"] = AmfObject(std::string("Resetting and playing stream."));
-    amf_encoder_.encodeObjects(objects);   
-    if(!SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, amf_encoder_.data(), amf_encoder_.size())) {
+    static const AmfCommand kPlayReset = EncodeOnStatus("status", "NetStream.Play.Reset", "Resetting and playing stream.");
+    static const AmfCommand kPlayStart = EncodeOnStatus("status", "NetStream.Play.Start", "Started playing.");
+    static const AmfCommand kSampleAccess = EncodeSampleAccess();
+
+    if(!SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, kPlayReset.data, kPlayReset.size)) {
         return false;
     }
 
-    objects.clear(); 
-    amf_encoder_.reset(); 
-    amf_encoder_.encodeString("onStatus", 8);
-    amf_encoder_.encodeNumber(0);    
-    amf_encoder_.encodeObjects(objects);
-    objects["level"] = AmfObject(std::string("status"));
-    objects["code"] = AmfObject(std::string("NetStream.Play.Start"));
-    objects["description"] = AmfObject(std::string("Started playing."));   
-    amf_encoder_.encodeObjects(objects);
-    if(!SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, amf_encoder_.data(), amf_encoder_.size())) {
+    if(!SendInvokeMessage(RTMP_CHUNK_INVOKE_ID, kPlayStart.data, kPlayStart.size)) {
         return false;
     }
 
-    amf_encoder_.reset(); 
-    amf_encoder_.encodeString("|RtmpSampleAccess", 17);
-    amf_encoder_.encodeBoolean(true);
-    amf_encoder_.encodeBoolean(true);
-    if(!this->SendNotifyMessage(RTMP_CHUNK_DATA_ID, amf_encoder_.data(), amf_encoder_.size())) {
+    if(!this->SendNotifyMessage(RTMP_CHUNK_DATA_ID, kSampleAccess.data, kSampleAccess.size)) {
         return false;
     }
              
     connection_state_ = START_PLAY; 
     
-    auto session = server->GetSession(stream_path_);
+    auto session = AcquireSession(server);
     if(session) {
 		session->AddRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
     }  
@@ -644,16 +716,9 @@ bool RtmpConnection::HandleDeleteStream()
 		return false;
 	}
 
-    if(stream_path_ != "") {
-        auto session = server->GetSession(stream_path_);
-        if(session != nullptr) {   
-			auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
-			task_scheduler_->AddTimer([session, conn] {
-				session->RemoveRtmpClient(conn);
-				return false;
-			}, 1);
-        }  
+    ReleaseSession(server);
 
+    if(stream_path_ != "") {
 		is_playing_ = false;
 		is_publishing_ = false;
 		has_key_frame_ = false;
@@ -663,6 +728,38 @@ bool RtmpConnection::HandleDeleteStream()
 	return true;
 }
 
+RtmpSession::Ptr RtmpConnection::AcquireSession(std::shared_ptr<RtmpServer> server)
+{
+	/* one reference per connection, taken on the path it publishes or plays,
+	   later stream commands overwrite stream_path_ */
+	if (session_path_ == stream_path_) {
+		return server->FindSession(session_path_);
+	}
+
+	ReleaseSession(server);
+	session_path_ = stream_path_;
+	return server->AcquireSession(session_path_);
+}
+
+void RtmpConnection::ReleaseSession(std::shared_ptr<RtmpServer> server)
+{
+	if (session_path_ == "") {
+		return;
+	}
+
+	auto session = server->FindSession(session_path_);
+	if (session != nullptr) {
+		auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
+		task_scheduler_->AddTimer([session, conn] {
+			session->RemoveRtmpClient(conn);
+			return false;
+		}, 1);
+	}
+
+	server->ReleaseSession(session_path_);
+	session_path_.clear();
+}
+
 bool RtmpConnection::HandleResult(RtmpMessage& rtmp_msg)
 {
 	bool ret = false;
@@ -705,6 +802,11 @@ bool RtmpConnection::HandleOnStatus(RtmpMessage& rtmp_msg)
 			if (connection_mode_ == RTMP_PUBLISHER) {
 				if (status_ == "NetStream.Publish.Start") {
 					is_publishing_ = true;					
+
+					auto publisher = rtmp_publisher_.lock();
+					if (publisher) {
+						publisher->OnPublishStart(this);
+					}
 				}		
 				else if(status_ == "NetStream.publish.Unauthorized"
 						|| status_ == "NetStream.Publish.BadConnection" /*"Connection already publishing"*/
@@ -836,12 +938,10 @@ bool RtmpConnection::SendNotifyMessage(uint32_t csid, std::shared_ptr<char> payl
 
 bool RtmpConnection::IsKeyFrame(std::shared_ptr<char> payload, uint32_t payload_size)
 {
-	uint8_t frame_type = (payload.get()[0] >> 4) & 0x0f;
-	uint8_t codec_id = payload.get()[0] & 0x0f;
-	return (frame_type == 1 && codec_id == RTMP_CODEC_ID_H264);
+	return IsVideoKeyFrame((uint8_t*)payload.get(), payload_size);
 }
 
-bool RtmpConnection::SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+bool RtmpConnection::PrepareMediaData(uint8_t type, std::shared_ptr<char> payload, uint32_t payload_size)
 {
     if(this->IsClosed()) {
         return false;
@@ -862,36 +962,79 @@ bool RtmpConnection::SendMediaData(uint8_t type, uint64_t timestamp, std::shared
 		aac_sequence_header_size_ = payload_size;
 	}
 
+	return true;
+}
+
+bool RtmpConnection::SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+{
+	if (!PrepareMediaData(type, payload, payload_size)) {
+		return false;
+	}
+
 	auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
 	task_scheduler_->AddTriggerEvent([conn, type, timestamp, payload, payload_size] {
-		if (!conn->has_key_frame_ && conn->avc_sequence_header_size_ > 0
-			&& (type != RTMP_AVC_SEQUENCE_HEADER)
-			&& (type != RTMP_AAC_SEQUENCE_HEADER)) {
-			if (conn->IsKeyFrame(payload, payload_size)) {
-				conn->has_key_frame_ = true;
-			}
-			else {
-				return ;
-			}
-		}
+		conn->SendFrame(type, timestamp, payload, payload_size);
+	});
+   
+    return true;
+}
 
-		RtmpMessage rtmp_msg;
-		rtmp_msg._timestamp = timestamp;
-		rtmp_msg.stream_id = conn->stream_id_;
-		rtmp_msg.payload = payload;
-		rtmp_msg.length = payload_size;
+bool RtmpConnection::PlayMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+{
+	if (!PrepareMediaData(type, payload, payload_size)) {
+		return false;
+	}
 
-		if (type == RTMP_VIDEO || type == RTMP_AVC_SEQUENCE_HEADER) {
-			rtmp_msg.type_id = RTMP_VIDEO;
-			conn->SendRtmpChunks(RTMP_CHUNK_VIDEO_ID, rtmp_msg);
+	SendFrame(type, timestamp, payload, payload_size);
+	return true;
+}
+
+bool RtmpConnection::PlayGopCache(std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos)
+{
+	if (this->IsClosed()) {
+		return false;
+	}
+
+	std::vector<GopCache::FramePtr> frames;
+	if (!gop_cache->Read(start_pos, end_pos, frames)) {
+		/* overwritten, the player waits for the next key frame */
+		return false;
+	}
+
+	for (auto& frame : frames) {
+		SendFrame(frame->type, frame->timestamp, frame->data, frame->size);
+	}
+
+	return true;
+}
+
+void RtmpConnection::SendFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
+{
+	if (!has_key_frame_ && avc_sequence_header_size_ > 0
+		&& (type != RTMP_AVC_SEQUENCE_HEADER)
+		&& (type != RTMP_AAC_SEQUENCE_HEADER)) {
+		if (IsKeyFrame(payload, payload_size)) {
+			has_key_frame_ = true;
 		}
-		else if (type == RTMP_AUDIO || type == RTMP_AAC_SEQUENCE_HEADER) {
-			rtmp_msg.type_id = RTMP_AUDIO;
-			conn->SendRtmpChunks(RTMP_CHUNK_AUDIO_ID, rtmp_msg);
+		else {
+			return ;
 		}
-	});
-   
-    return true;
+	}
+
+	RtmpMessage rtmp_msg;
+	rtmp_msg._timestamp = timestamp;
+	rtmp_msg.stream_id = stream_id_;
+	rtmp_msg.payload = payload;
+	rtmp_msg.length = payload_size;
+
+	if (type == RTMP_VIDEO || type == RTMP_AVC_SEQUENCE_HEADER) {
+		rtmp_msg.type_id = RTMP_VIDEO;
+		SendRtmpChunks(RTMP_CHUNK_VIDEO_ID, rtmp_msg);
+	}
+	else if (type == RTMP_AUDIO || type == RTMP_AAC_SEQUENCE_HEADER) {
+		rtmp_msg.type_id = RTMP_AUDIO;
+		SendRtmpChunks(RTMP_CHUNK_AUDIO_ID, rtmp_msg);
+	}
 }
 
 bool RtmpConnection::SendVideoData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size)
@@ -935,8 +1078,32 @@ bool RtmpConnection::SendAudioData(uint64_t timestamp, std::shared_ptr<char> pay
 
 void RtmpConnection::SendRtmpChunks(uint32_t csid, RtmpMessage& rtmp_msg)
 {    
-    uint32_t capacity = rtmp_msg.length + rtmp_msg.length/ max_chunk_size_ *5 + 1024;
-    std::shared_ptr<char> buffer(new char[capacity], std::default_delete<char[]>());
+	uint32_t chunk_size = rtmp_chunk_->GetOutChunkSize();
+	uint32_t chunk_count = (rtmp_msg.length + chunk_size - 1) / chunk_size;
+
+	/* media payloads are shared and never written again, the chunks point into
+	   them and only the headers are built here */
+	if ((rtmp_msg.type_id == RTMP_VIDEO || rtmp_msg.type_id == RTMP_AUDIO) &&
+		rtmp_msg.length >= kMinGatherSize && chunk_count <= kMaxGatherChunks) {
+		std::shared_ptr<char> headers(new char[chunk_count * RtmpChunk::kMaxChunkHeaderSize], std::default_delete<char[]>());
+		std::vector<BufferWriter::Slice> slices;
+		slices.reserve(chunk_count * 2);
+
+		char* header = headers.get();
+		for (uint32_t offset = 0; offset < rtmp_msg.length; offset += chunk_size) {
+			int header_size = rtmp_chunk_->CreateChunkHeader(csid, rtmp_msg, offset, header);
+			slices.push_back({ std::shared_ptr<char>(headers, header), (uint32_t)header_size });
+			slices.push_back({ std::shared_ptr<char>(rtmp_msg.payload, rtmp_msg.payload.get() + offset),
+				std::min(chunk_size, rtmp_msg.length - offset) });
+			header += header_size;
+		}
+
+		this->Send(slices);
+		return;
+	}
+
+	uint32_t capacity = rtmp_msg.length + (chunk_count + 1) * RtmpChunk::kMaxChunkHeaderSize;
+	std::shared_ptr<char> buffer(new char[capacity], std::default_delete<char[]>());
 
 	int size = rtmp_chunk_->CreateChunk(csid, rtmp_msg, buffer.get(), capacity);
 	if (size > 0) {
@@ -7,12 +7,14 @@
 #include "rtmp.h"
 #include "RtmpChunk.h"
 #include "RtmpHandshake.h"
+#include "GopCache.h"
 #include <vector>
 
 namespace xop
 {
 
 class RtmpServer;
+class RtmpSession;
 class RtmpPublisher;
 class RtmpClient;
 
@@ -85,6 +87,7 @@ private:
 
     bool OnRead(BufferReader& buffer);
     void OnClose();
+	virtual void HandleRead();
 
     bool HandleChunk(BufferReader& buffer);
     bool HandleMessage(RtmpMessage& rtmp_msg);
@@ -106,6 +109,8 @@ private:
     bool HandlePlay();
     bool HandlePlay2();
     bool HandleDeleteStream();
+	std::shared_ptr<RtmpSession> AcquireSession(std::shared_ptr<RtmpServer> server);
+	void ReleaseSession(std::shared_ptr<RtmpServer> server);
 	bool HandleResult(RtmpMessage& rtmp_msg);
 	bool HandleOnStatus(RtmpMessage& rtmp_msg);
 
@@ -119,6 +124,12 @@ private:
     bool SendMetaData(AmfObjects metaData);
 	bool IsKeyFrame(std::shared_ptr<char> payload, uint32_t payload_size);
     bool SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
+
+	/* on the connection's own thread, its subscriber shard sends without another task */
+	bool PlayMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
+	bool PlayGopCache(std::shared_ptr<GopCache> gop_cache, uint64_t start_pos, uint64_t end_pos);
+	bool PrepareMediaData(uint8_t type, std::shared_ptr<char> payload, uint32_t payload_size);
+	void SendFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
 	bool SendVideoData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
 	bool SendAudioData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payload_size);
     void SendRtmpChunks(uint32_t csid, RtmpMessage& rtmp_msg);
@@ -137,13 +148,16 @@ private:
 
 	uint32_t peer_bandwidth_ = 5000000;
 	uint32_t acknowledgement_size_ = 5000000;
-	uint32_t max_chunk_size_ = 128;
+	uint32_t max_chunk_size_ = RTMP_DEFAULT_CHUNK_SIZE;
 	uint32_t max_gop_cache_len_ = 0;
+	uint32_t max_gop_cache_bytes_ = 0;
+	bool gop_fast_start_ = false;
 	uint32_t stream_id_ = 0;
 	uint32_t number_ = 0;
 	std::string app_;
 	std::string stream_name_;
 	std::string stream_path_;
+	std::string session_path_;
 	std::string status_;
 
 	AmfObjects meta_data_;
@@ -158,6 +172,10 @@ private:
 	uint32_t avc_sequence_header_size_ = 0;
 	uint32_t aac_sequence_header_size_ = 0;
 	PlayCallback play_cb_;
+
+	static const uint32_t kDirectReadSize = 4096; // the read buffer grows by as much
+	static const uint32_t kMinGatherSize = 4096;  // smaller messages are cheaper to copy
+	static const uint32_t kMaxGatherChunks = 32;
 };
       
 }
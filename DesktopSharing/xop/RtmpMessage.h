@@ -30,14 +30,13 @@ struct RtmpMessage
 	uint32_t index = 0;
 	std::shared_ptr<char> payload = nullptr;
 
+	/* the payload has been handed out, the next message gets a new one on its first chunk */
 	void Clear()
 	{
 		index = 0;
 		timestamp = 0;
 		extend_timestamp = 0;
-		if (length > 0) {
-			payload.reset(new char[length], std::default_delete<char[]>());
-		}
+		payload = nullptr;
 	}
 
 	bool IsCompleted() const 
@@ -1,6 +1,12 @@
 #include "RtmpPublisher.h"
+#include "H264Parser.h"
+#include "H265Parser.h"
+#include "AV1Parser.h"
 #include "net/Logger.h"
 #include "net/log.h"
+#include "net/SocketUtil.h"
+#include <algorithm>
+#include <chrono>
 
 using namespace xop;
 
@@ -12,7 +18,8 @@ RtmpPublisher::RtmpPublisher(xop::EventLoop* event_loop)
 
 RtmpPublisher::~RtmpPublisher()
 {
-
+	std::lock_guard<std::mutex> lock(mutex_);
+	CloseConnection();
 }
 
 std::shared_ptr<RtmpPublisher> RtmpPublisher::Create(xop::EventLoop* event_loop)
@@ -100,22 +107,74 @@ int RtmpPublisher::SetMediaInfo(MediaInfo media_info)
 			media_info_.video_codec_id = 0;
 		}
 	}
+	else if (media_info_.video_codec_id == RTMP_CODEC_ID_H265) {
+		uint32_t max_size = 5 + 64 + media_info_.vps_size + media_info_.sps_size + media_info_.pps_size;
+		avc_sequence_header_.reset(new char[max_size], std::default_delete<char[]>());
+		uint8_t *data = (uint8_t *)avc_sequence_header_.get();
+
+		// enhanced rtmp: 1:keyframe, sequence start, FourCC
+		data[0] = RTMP_VIDEO_EX_HEADER | (1 << 4) | RTMP_PACKET_TYPE_SEQUENCE_START;
+		data[1] = (RTMP_FOURCC_HEVC >> 24) & 0xff;
+		data[2] = (RTMP_FOURCC_HEVC >> 16) & 0xff;
+		data[3] = (RTMP_FOURCC_HEVC >> 8) & 0xff;
+		data[4] = RTMP_FOURCC_HEVC & 0xff;
+
+		// HEVCDecoderConfigurationRecord
+		int size = -1;
+		if (media_info_.vps_size > 0 && media_info_.sps_size > 0 && media_info_.pps_size > 0) {
+			size = H265Parser::CreateHvcc(media_info_.vps.get(), media_info_.vps_size,
+										  media_info_.sps.get(), media_info_.sps_size,
+										  media_info_.pps.get(), media_info_.pps_size,
+										  data + 5, max_size - 5);
+		}
+
+		if (size > 0) {
+			avc_sequence_header_size_ = 5 + size;
+		}
+		else {
+			avc_sequence_header_.reset();
+			media_info_.video_codec_id = 0;
+		}
+	}
+	else if (media_info_.video_codec_id == RTMP_CODEC_ID_AV1) {
+		uint32_t max_size = 5 + 4 + media_info_.sps_size;
+		avc_sequence_header_.reset(new char[max_size], std::default_delete<char[]>());
+		uint8_t *data = (uint8_t *)avc_sequence_header_.get();
+
+		// enhanced rtmp: 1:keyframe, sequence start, FourCC
+		data[0] = RTMP_VIDEO_EX_HEADER | (1 << 4) | RTMP_PACKET_TYPE_SEQUENCE_START;
+		data[1] = (RTMP_FOURCC_AV1 >> 24) & 0xff;
+		data[2] = (RTMP_FOURCC_AV1 >> 16) & 0xff;
+		data[3] = (RTMP_FOURCC_AV1 >> 8) & 0xff;
+		data[4] = RTMP_FOURCC_AV1 & 0xff;
+
+		// AV1CodecConfigurationRecord
+		int size = -1;
+		if (media_info_.sps_size > 0) {
+			size = AV1Parser::CreateAv1c(media_info_.sps.get(), media_info_.sps_size, data + 5, max_size - 5);
+		}
+
+		if (size > 0) {
+			avc_sequence_header_size_ = 5 + size;
+		}
+		else {
+			avc_sequence_header_.reset();
+			media_info_.video_codec_id = 0;
+		}
+	}
 
 	return 0;
 }
 
 int RtmpPublisher::OpenUrl(std::string url, int msec, std::string& status)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-	
-	static xop::Timestamp timestamp;
+	std::unique_lock<std::mutex> lock(mutex_);
+
 	int timeout = msec;
 	if (timeout <= 0) {
 		timeout = 10000;
 	}
 
-	timestamp.Reset();
-
 	if (this->ParseRtmpUrl(url) != 0) {
 		LOG_INFO("[RtmpPublisher] rtmp url(%s) was illegal.\n", url.c_str());
 		return -1;
@@ -123,70 +182,267 @@ int RtmpPublisher::OpenUrl(std::string url, int msec, std::string& status)
 
 	//LOG_INFO("[RtmpPublisher] ip:%s, port:%hu, stream path:%s\n", ip_.c_str(), port_, stream_path_.c_str());
 
-	if (rtmp_conn_ != nullptr)
-	{		
-		std::shared_ptr<RtmpConnection> rtmpConn = rtmp_conn_;
-		SOCKET sockfd = rtmpConn->GetSocket();
-		task_scheduler_->AddTriggerEvent([sockfd, rtmpConn]() {
-			rtmpConn->Disconnect();
-		});
-		rtmp_conn_ = nullptr;
+	CloseConnection();
+
+	task_scheduler_ = event_loop_->GetTaskScheduler().get();
+	connect_timeout_ = (uint32_t)timeout;
+	state_ = kConnecting;
+
+	uint32_t connect_id = ++connect_id_;
+	std::weak_ptr<RtmpPublisher> weak_publisher = shared_from_this();
+	task_scheduler_->AddTriggerEvent([weak_publisher, connect_id]() {
+		auto publisher = weak_publisher.lock();
+		if (publisher) {
+			publisher->StartConnect(connect_id);
+		}
+	});
+
+	/* the connect runs on the event loop, mutex_ is released while waiting
+	   and the pushing threads drop their frames meanwhile */
+	state_cv_.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
+		return state_ != kConnecting;
+	});
+
+	status = (rtmp_conn_ != nullptr) ? rtmp_conn_->GetStatus() : "";
+	if (state_ != kPublishing) {
+		CloseConnection();
+		return -1;
+	}
+
+	reconnect_ = true;
+	return 0;
+}
+
+void RtmpPublisher::Close()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	CloseConnection();
+}
+
+bool RtmpPublisher::IsConnected()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return (state_ == kPublishing);
+}
+
+bool RtmpPublisher::IsReconnecting()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return (reconnect_ && state_ != kPublishing);
+}
+
+void RtmpPublisher::StartConnect(uint32_t connect_id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (connect_id != connect_id_) {
+		return;
 	}
 
+	state_ = kConnecting;
+	std::weak_ptr<RtmpPublisher> weak_publisher = shared_from_this();
+	TaskScheduler* task_scheduler = task_scheduler_;
+
+	/* for the whole attempt, up to the publish answer. timers run under the
+	   timer queue lock, what adds timers again runs as a trigger event */
+	task_scheduler_->AddTimer([task_scheduler, weak_publisher, connect_id] {
+		task_scheduler->AddTriggerEvent([weak_publisher, connect_id]() {
+			auto publisher = weak_publisher.lock();
+			if (publisher) {
+				publisher->OnConnectTimeout(connect_id);
+			}
+		});
+		return false;
+	}, connect_timeout_);
+
 	TcpSocket tcp_socket;
-	tcp_socket.Create();
-	if (!tcp_socket.Connect(ip_, port_, timeout))
-	{
+	SOCKET sockfd = tcp_socket.Create();
+	if (sockfd == INVALID_SOCKET) {
+		Retry();
+		return;
+	}
+
+	SocketUtil::SetNonBlock(sockfd);
+	if (!SocketUtil::StartConnect(sockfd, ip_, port_)) {
+		LOG_INFO("[RtmpPublisher] connect to %s:%hu failed.\n", ip_.c_str(), port_);
 		tcp_socket.Close();
-		return -1;
+		Retry();
+		return;
 	}
 
-	task_scheduler_ = event_loop_->GetTaskScheduler().get();
-	rtmp_conn_.reset(new RtmpConnection(shared_from_this(), task_scheduler_, tcp_socket.GetSocket()));
-	task_scheduler_->AddTriggerEvent([this]() {
-		rtmp_conn_->Handshake();
-	});
+	/* writable once connected or failed, select reports a refused connect
+	   in the exception set on windows */
+	auto on_connect = [weak_publisher, connect_id] {
+		auto publisher = weak_publisher.lock();
+		if (publisher) {
+			publisher->OnConnect(connect_id);
+		}
+	};
+
+	connect_channel_.reset(new Channel(sockfd));
+	connect_channel_->SetWriteCallback(on_connect);
+	connect_channel_->SetCloseCallback(on_connect);
+	connect_channel_->SetErrorCallback(on_connect);
+	connect_channel_->EnableWriting();
+	task_scheduler_->UpdateChannel(connect_channel_);
+}
+
+void RtmpPublisher::OnConnect(uint32_t connect_id)
+{
+	std::shared_ptr<RtmpConnection> rtmp_conn;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (connect_id != connect_id_ || connect_channel_ == nullptr) {
+			return;
+		}
+
+		SOCKET sockfd = connect_channel_->GetSocket();
+		bool is_connected = (SocketUtil::GetSocketError(sockfd) == 0);
+		ReleaseConnectChannel(!is_connected);
 
-	timeout -= (int)timestamp.Elapsed();
-	if (timeout < 0) {
-		timeout = 1000;
+		if (!is_connected) {
+			LOG_INFO("[RtmpPublisher] connect to %s:%hu failed.\n", ip_.c_str(), port_);
+			Retry();
+			return;
+		}
+
+		rtmp_conn_.reset(new RtmpConnection(shared_from_this(), task_scheduler_, sockfd));
+		rtmp_conn = rtmp_conn_;
 	}
 
-	do
-	{
-		xop::Timer::Sleep(100);
-		timeout -= 100;	
-	} while (!rtmp_conn_->IsClosed() && !rtmp_conn_->IsPublishing() && timeout>0);
-	
-	status = rtmp_conn_->GetStatus();
-	if (!rtmp_conn_->IsPublishing()) {
-		std::shared_ptr<RtmpConnection> rtmpConn = rtmp_conn_;
-		SOCKET sockfd = rtmpConn->GetSocket();
-		task_scheduler_->AddTriggerEvent([sockfd, rtmpConn]() {
-			rtmpConn->Disconnect();
+	/* a send error closes the connection and calls back into OnDisconnect() */
+	rtmp_conn->Handshake();
+}
+
+void RtmpPublisher::OnConnectTimeout(uint32_t connect_id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (connect_id != connect_id_ || state_ != kConnecting) {
+		return;
+	}
+
+	LOG_INFO("[RtmpPublisher] publish to %s:%hu timed out.\n", ip_.c_str(), port_);
+	ReleaseConnectChannel(true);
+	if (rtmp_conn_ != nullptr) {
+		std::shared_ptr<RtmpConnection> rtmp_conn = rtmp_conn_;
+		task_scheduler_->AddTriggerEvent([rtmp_conn]() {
+			rtmp_conn->Disconnect();
 		});
 		rtmp_conn_ = nullptr;
-		return -1;
 	}
 
+	Retry();
+}
+
+void RtmpPublisher::OnPublishStart(RtmpConnection* conn)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (conn != rtmp_conn_.get() || state_ != kConnecting) {
+		return;
+	}
+
+	if (reconnect_) {
+		LOG_INFO("[RtmpPublisher] republished to %s:%hu.\n", ip_.c_str(), port_);
+	}
+
+	state_ = kPublishing;
+	retry_msec_ = kMinRetryMsec;
+
+	/* a new stream for the server, it starts with the sequence headers at the next key frame */
 	video_timestamp_ = 0;
 	audio_timestamp_ = 0;
 	has_key_frame_ = true;
-	if (media_info_.video_codec_id == RTMP_CODEC_ID_H264) {
+	if (media_info_.video_codec_id == RTMP_CODEC_ID_H264 ||
+		media_info_.video_codec_id == RTMP_CODEC_ID_H265 ||
+		media_info_.video_codec_id == RTMP_CODEC_ID_AV1) {
 		has_key_frame_ = false;
 	}
 
-	return 0;
+	state_cv_.notify_all();
 }
 
-void RtmpPublisher::Close()
+void RtmpPublisher::OnDisconnect(RtmpConnection* conn)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
+	if (conn != rtmp_conn_.get() || (state_ != kConnecting && state_ != kPublishing)) {
+		return;
+	}
+
+	if (state_ == kPublishing) {
+		LOG_INFO("[RtmpPublisher] connection to %s:%hu lost.\n", ip_.c_str(), port_);
+	}
+
+	/* conn is in its close callback, rtmp_conn_ keeps it until the next attempt */
+	Retry();
+}
+
+void RtmpPublisher::Retry()
+{
+	if (!reconnect_) {
+		state_ = kClosed;
+		state_cv_.notify_all();
+		return;
+	}
+
+	state_ = kWaitingRetry;
+	uint32_t connect_id = ++connect_id_;
+	std::weak_ptr<RtmpPublisher> weak_publisher = shared_from_this();
+	TaskScheduler* task_scheduler = task_scheduler_;
+	task_scheduler_->AddTimer([task_scheduler, weak_publisher, connect_id] {
+		task_scheduler->AddTriggerEvent([weak_publisher, connect_id]() {
+			auto publisher = weak_publisher.lock();
+			if (publisher) {
+				publisher->StartConnect(connect_id);
+			}
+		});
+		return false;
+	}, retry_msec_);
+
+	LOG_INFO("[RtmpPublisher] reconnect to %s:%hu in %u ms.\n", ip_.c_str(), port_, retry_msec_);
+	retry_msec_ = std::min(retry_msec_ * 2, (uint32_t)kMaxRetryMsec);
+}
+
+void RtmpPublisher::ReleaseConnectChannel(bool close_socket)
+{
+	if (connect_channel_ == nullptr) {
+		return;
+	}
+
+	std::shared_ptr<Channel> channel = connect_channel_;
+	connect_channel_ = nullptr;
+	channel->DisableWriting();
+	task_scheduler_->UpdateChannel(channel);
+
+	/* the event loop may be in the channel's callback, it goes on the next turn */
+	task_scheduler_->AddTriggerEvent([channel, close_socket]() {
+		if (close_socket) {
+			SocketUtil::Close(channel->GetSocket());
+		}
+	});
+}
+
+void RtmpPublisher::CloseConnection()
+{
+	/* pending connects, timeouts and retries see another id and stop */
+	connect_id_ += 1;
+	state_ = kClosed;
+	reconnect_ = false;
+	retry_msec_ = kMinRetryMsec;
+	state_cv_.notify_all();
+
+	if (task_scheduler_ == nullptr) {
+		return;
+	}
+
+	ReleaseConnectChannel(true);
+
 	if (rtmp_conn_ != nullptr) {		
 		std::shared_ptr<RtmpConnection> rtmp_conn = rtmp_conn_;
-		SOCKET sockfd = rtmp_conn->GetSocket();
-		task_scheduler_->AddTriggerEvent([sockfd, rtmp_conn]() {
+		task_scheduler_->AddTriggerEvent([rtmp_conn]() {
 			rtmp_conn->Disconnect();
 		});
 		rtmp_conn_ = nullptr;
@@ -196,48 +452,98 @@ void RtmpPublisher::Close()
 	}
 }
 
-bool RtmpPublisher::IsConnected()
+bool RtmpPublisher::IsKeyFrame(uint8_t *data, uint32_t size)
 {
-	std::lock_guard<std::mutex> lock(mutex_);
-
-	if (rtmp_conn_ != nullptr) {
-		return (!rtmp_conn_->IsClosed());
+	/* sps_pps_idr, idr, or the recovery point of an intra refresh cycle,
+	   sent as a flv key frame so that the server can start viewers there */
+	if (media_info_.video_codec_id == RTMP_CODEC_ID_H265) {
+		return H265Parser::IsRandomAccess(data, size);
 	}
-	return false;
+	else if (media_info_.video_codec_id == RTMP_CODEC_ID_AV1) {
+		return AV1Parser::IsKeyFrame(data, size);
+	}
+
+	return H264Parser::IsRandomAccess(data, size);
 }
 
-bool RtmpPublisher::IsKeyFrame(uint8_t *data, uint32_t size)
+uint32_t RtmpPublisher::WriteNalUnits(uint8_t *data, uint32_t size, uint8_t *out_buf)
 {
-	int startCode = 0;
-	if (data[0] == 0 && data[1] == 0 && data[2] == 1) {
-		startCode = 3;
-	}
-	else if (data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1) {
-		startCode = 4;
-	}
+	uint32_t index = 0;
+
+	// annex-b to 4 bytes length prefixed nals
+	H264Parser::ForEachNal(data, size, [out_buf, &index](const uint8_t *nal, uint32_t nal_size) {
+		out_buf[index++] = (nal_size >> 24) & 0xff;
+		out_buf[index++] = (nal_size >> 16) & 0xff;
+		out_buf[index++] = (nal_size >> 8) & 0xff;
+		out_buf[index++] = (nal_size) & 0xff;
+		memcpy(out_buf + index, nal, nal_size);
+		index += nal_size;
+		return true;
+	});
+
+	return index;
+}
 
-	int type = data[startCode] & 0x1f;
-	if (type == 5 || type == 7)  {  // sps_pps_idr or idr 
+uint32_t RtmpPublisher::WriteObus(uint8_t *data, uint32_t size, uint8_t *out_buf)
+{
+	uint32_t index = 0;
+
+	// low overhead obus as in an mp4 sample, without temporal delimiters
+	AV1Parser::ForEachObu(data, size, [out_buf, &index](const uint8_t *obu, uint32_t obu_size, uint32_t) {
+		uint8_t obu_type = AV1Parser::GetObuType(obu);
+		if (obu_type != AV1Parser::OBU_TEMPORAL_DELIMITER && obu_type != AV1Parser::OBU_TILE_LIST
+			&& obu_type != AV1Parser::OBU_PADDING) {
+			memcpy(out_buf + index, obu, obu_size);
+			index += obu_size;
+		}
 		return true;
-	}
-	
-	return false;
+	});
+
+	return index;
+}
+
+int64_t RtmpPublisher::GetCaptureMsec(uint32_t capture_timestamp)
+{
+	/* signed delta, audio and video arrive slightly out of capture order */
+	capture_clock_ += (int32_t)(capture_timestamp - capture_timestamp_);
+	capture_timestamp_ = capture_timestamp;
+	return capture_clock_ / 90;
 }
 
-int RtmpPublisher::PushVideoFrame(uint8_t *data, uint32_t size)
+int RtmpPublisher::PushVideoFrame(uint8_t *data, uint32_t size, uint32_t composition_time)
+{
+	return PushVideo(data, size, composition_time, -1);
+}
+
+int RtmpPublisher::PushVideoFrame(uint8_t *data, uint32_t size, uint32_t composition_time, uint32_t capture_timestamp)
+{
+	return PushVideo(data, size, composition_time, capture_timestamp);
+}
+
+int RtmpPublisher::PushVideo(uint8_t *data, uint32_t size, uint32_t composition_time, int64_t capture_timestamp)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	if (rtmp_conn_ == nullptr || rtmp_conn_->IsClosed() || size <= 5) {
+	if (state_ != kPublishing || size <= 5) {
 		return -1;
 	}
 
-	if (media_info_.video_codec_id == RTMP_CODEC_ID_H264)
+	if (media_info_.video_codec_id == RTMP_CODEC_ID_H264 ||
+		media_info_.video_codec_id == RTMP_CODEC_ID_H265 ||
+		media_info_.video_codec_id == RTMP_CODEC_ID_AV1)
 	{
+		bool is_key_frame = this->IsKeyFrame(data, size);
+
 		if (!has_key_frame_) {
-			if (this->IsKeyFrame(data, size)) {
+			if (is_key_frame) {
 				has_key_frame_ = true;
 				timestamp_.Reset();
+				video_timestamp_ = 0;
+				audio_timestamp_ = 0;
+				if (capture_timestamp >= 0) {
+					capture_timestamp_ = (uint32_t)capture_timestamp - composition_time * 90;
+					capture_clock_ = 0;
+				}
 				//task_scheduler_->addTriggerEvent([=]() {
 					rtmp_conn_->SendVideoData(0, avc_sequence_header_, avc_sequence_header_size_);
 					rtmp_conn_->SendAudioData(0, aac_sequence_header_, aac_sequence_header_size_);
@@ -249,33 +555,51 @@ int RtmpPublisher::PushVideoFrame(uint8_t *data, uint32_t size)
 		}
 
 		uint64_t timestamp = timestamp_.Elapsed();
-		//uint64_t timestamp_delta = 0;
-		//if (timestamp < video_timestamp_)
-		//{
-		//	timestamp = video_timestamp_;
-		//}
-		//timestamp_delta = timestamp - video_timestamp_;
-		//video_timestamp_ = timestamp;
+		if (capture_timestamp >= 0) {
+			// dts = pts - cts, kept monotonic
+			int64_t msec = GetCaptureMsec((uint32_t)capture_timestamp - composition_time * 90);
+			timestamp = (msec > (int64_t)video_timestamp_) ? (uint64_t)msec : video_timestamp_;
+			video_timestamp_ = timestamp;
+		}
 
 		std::shared_ptr<char> payload(new char[size + 4096], std::default_delete<char[]>());
 		uint32_t payload_size = 0;
 
 		uint8_t *buffer = (uint8_t *)payload.get();
 		uint32_t index = 0;
-		buffer[index++] = this->IsKeyFrame(data, size) ? 0x17: 0x27;
-		buffer[index++] = 1;
 
-		buffer[index++] = 0;
-		buffer[index++] = 0;
-		buffer[index++] = 0;
+		if (media_info_.video_codec_id == RTMP_CODEC_ID_AV1) {
+			// enhanced rtmp: av1 coded frames carry no composition time
+			buffer[index++] = RTMP_VIDEO_EX_HEADER | ((is_key_frame ? 1 : 2) << 4) | RTMP_PACKET_TYPE_CODED_FRAMES;
+			buffer[index++] = (RTMP_FOURCC_AV1 >> 24) & 0xff;
+			buffer[index++] = (RTMP_FOURCC_AV1 >> 16) & 0xff;
+			buffer[index++] = (RTMP_FOURCC_AV1 >> 8) & 0xff;
+			buffer[index++] = RTMP_FOURCC_AV1 & 0xff;
+
+			index += WriteObus(data, size, buffer + index);
+		}
+		else {
+			if (media_info_.video_codec_id == RTMP_CODEC_ID_H265) {
+				// enhanced rtmp: coded frames with composition time
+				buffer[index++] = RTMP_VIDEO_EX_HEADER | ((is_key_frame ? 1 : 2) << 4) | RTMP_PACKET_TYPE_CODED_FRAMES;
+				buffer[index++] = (RTMP_FOURCC_HEVC >> 24) & 0xff;
+				buffer[index++] = (RTMP_FOURCC_HEVC >> 16) & 0xff;
+				buffer[index++] = (RTMP_FOURCC_HEVC >> 8) & 0xff;
+				buffer[index++] = RTMP_FOURCC_HEVC & 0xff;
+			}
+			else {
+				buffer[index++] = is_key_frame ? 0x17 : 0x27;
+				buffer[index++] = 1;
+			}
+
+			// composition time offset, pts = dts + cts
+			buffer[index++] = (composition_time >> 16) & 0xff;
+			buffer[index++] = (composition_time >> 8) & 0xff;
+			buffer[index++] = composition_time & 0xff;
 
-		buffer[index++] = (size >> 24) & 0xff;
-		buffer[index++] = (size >> 16) & 0xff;
-		buffer[index++] = (size >> 8) & 0xff;
-		buffer[index++] = (size) & 0xff;
+			index += WriteNalUnits(data, size, buffer + index);
+		}
 
-		memcpy(buffer + index, data, size);
-		index += size;
 		payload_size = index;
 		//task_scheduler_->addTriggerEvent([=]() {
 			rtmp_conn_->SendVideoData(timestamp, payload, payload_size);
@@ -286,22 +610,32 @@ int RtmpPublisher::PushVideoFrame(uint8_t *data, uint32_t size)
 }
 
 int RtmpPublisher::PushAudioFrame(uint8_t *data, uint32_t size)
+{
+	return PushAudio(data, size, -1);
+}
+
+int RtmpPublisher::PushAudioFrame(uint8_t *data, uint32_t size, uint32_t capture_timestamp)
+{
+	return PushAudio(data, size, capture_timestamp);
+}
+
+int RtmpPublisher::PushAudio(uint8_t *data, uint32_t size, int64_t capture_timestamp)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 
-	if (rtmp_conn_ == nullptr || rtmp_conn_->IsClosed() || size <= 0) {
+	if (state_ != kPublishing || size <= 0) {
 		return -1;
 	}
 
 	if (has_key_frame_ && media_info_.audio_codec_id == RTMP_CODEC_ID_AAC) {
 		uint64_t timestamp = timestamp_.Elapsed();
-		//uint64_t timestamp_delta = 0;
-		//if (timestamp < audio_timestamp_)
-		//{
-		//	timestamp = audio_timestamp_;
-		//}
-		//timestamp_delta = timestamp - audio_timestamp_;
-		//audio_timestamp_ = timestamp;
+		if (capture_timestamp >= 0) {
+			int64_t msec = GetCaptureMsec((uint32_t)capture_timestamp);
+			if (msec < (int64_t)audio_timestamp_) {
+				return 0; // captured before the first key frame
+			}
+			timestamp = audio_timestamp_ = (uint64_t)msec;
+		}
 		
 		uint32_t payload_size = size + 2;
 		std::shared_ptr<char> payload(new char[size + 2], std::default_delete<char[]>());
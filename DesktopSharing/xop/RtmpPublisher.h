@@ -3,6 +3,7 @@
 
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include "RtmpConnection.h"
 #include "net/EventLoop.h"
 #include "net/Timestamp.h"
@@ -18,27 +19,70 @@ public:
 
 	int SetMediaInfo(MediaInfo media_info);
 
+	/* waits up to msec for the stream to be published, once it was the publisher
+	   reconnects on its own when the connection drops, until Close() */
 	int  OpenUrl(std::string url, int msec, std::string& status);
 	void Close();
 
 	bool IsConnected();
+	bool IsReconnecting();
 
-	int PushVideoFrame(uint8_t *data, uint32_t size); /* (sps pps)idr frame or p frame */
+	int PushVideoFrame(uint8_t *data, uint32_t size, uint32_t composition_time = 0); /* annex-b: (vps sps pps)idr frame or p frame */
 	int PushAudioFrame(uint8_t *data, uint32_t size);
 
+	/* The same with the capture time on a 90kHz clock shared by audio and video (pts for video),
+	   the flv timestamps follow the capture and not the time of the call, so the encoder delays
+	   do not shift audio against video. Use one form for both streams. */
+	int PushVideoFrame(uint8_t *data, uint32_t size, uint32_t composition_time, uint32_t capture_timestamp);
+	int PushAudioFrame(uint8_t *data, uint32_t size, uint32_t capture_timestamp);
+
 private:
 	friend class RtmpConnection;
 
+	enum State
+	{
+		kClosed,
+		kConnecting,   /* tcp connect, handshake, connect, createStream and publish */
+		kPublishing,
+		kWaitingRetry,
+	};
+
 	RtmpPublisher(xop::EventLoop *event_loop);
+
+	/* called on the event loop, they take mutex_ */
+	void StartConnect(uint32_t connect_id);
+	void OnConnect(uint32_t connect_id);
+	void OnConnectTimeout(uint32_t connect_id);
+	void OnPublishStart(RtmpConnection* conn);
+	void OnDisconnect(RtmpConnection* conn);
+
+	/* with mutex_ held */
+	void Retry();
+	void ReleaseConnectChannel(bool close_socket);
+	void CloseConnection();
+
 	bool IsKeyFrame(uint8_t* data, uint32_t size);
+	uint32_t WriteNalUnits(uint8_t* data, uint32_t size, uint8_t* out_buf);
+	uint32_t WriteObus(uint8_t* data, uint32_t size, uint8_t* out_buf);
+	int PushVideo(uint8_t *data, uint32_t size, uint32_t composition_time, int64_t capture_timestamp);
+	int PushAudio(uint8_t *data, uint32_t size, int64_t capture_timestamp);
+	int64_t GetCaptureMsec(uint32_t capture_timestamp);
 
 	xop::EventLoop *event_loop_ = nullptr;
 	TaskScheduler *task_scheduler_ = nullptr;
 	std::mutex mutex_;
+	std::condition_variable state_cv_;
 	std::shared_ptr<RtmpConnection> rtmp_conn_;
 
+	State state_ = kClosed;
+	uint32_t connect_id_ = 0;   /* callbacks of an older attempt see another id */
+	uint32_t connect_timeout_ = 10000;
+	uint32_t retry_msec_ = kMinRetryMsec;
+	bool reconnect_ = false;
+	std::shared_ptr<Channel> connect_channel_;
+
 	MediaInfo media_info_;
-	std::shared_ptr<char> avc_sequence_header_;
+	std::shared_ptr<char> avc_sequence_header_; // avc or hevc
 	std::shared_ptr<char> aac_sequence_header_;
 	uint32_t avc_sequence_header_size_ = 0;
 	uint32_t aac_sequence_header_size_ = 0;
@@ -47,6 +91,11 @@ private:
 	xop::Timestamp timestamp_;
 	uint64_t video_timestamp_ = 0;
 	uint64_t audio_timestamp_ = 0;
+	uint32_t capture_timestamp_ = 0; /* 90kHz, last one seen */
+	int64_t  capture_clock_ = 0;     /* 90kHz since the first key frame, unwrapped */
+
+	static const uint32_t kMinRetryMsec = 500;
+	static const uint32_t kMaxRetryMsec = 8000;
 
 	const uint32_t kSamplingFrequency[16] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0};
 };
@@ -9,18 +9,7 @@ RtmpServer::RtmpServer(EventLoop* event_loop)
 	: TcpServer(event_loop)
 	, event_loop_(event_loop)
 {
-	event_loop_->AddTimer([this] {
-		std::lock_guard<std::mutex> lock(mutex_);
-		for (auto iter = rtmp_sessions_.begin(); iter != rtmp_sessions_.end(); ) {
-			if (iter->second->GetClients() == 0) {
-				rtmp_sessions_.erase(iter++);
-			}
-			else {
-				iter++;
-			}
-		}
-		return true;
-	}, 30000);
+
 }
 
 RtmpServer::~RtmpServer()
@@ -39,39 +28,58 @@ TcpConnection::Ptr RtmpServer::OnConnect(SOCKET sockfd)
     return std::make_shared<RtmpConnection>(shared_from_this(), event_loop_->GetTaskScheduler().get(), sockfd);
 }
 
-void RtmpServer::AddSession(std::string stream_path)
+RtmpServer::SessionShard& RtmpServer::GetShard(const std::string& stream_path)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if(rtmp_sessions_.find(stream_path) == rtmp_sessions_.end()) {
-        rtmp_sessions_[stream_path] = std::make_shared<RtmpSession>();
-    }
+	return session_shards_[std::hash<std::string>()(stream_path) % kSessionShards];
 }
 
-void RtmpServer::RemoveSession(std::string stream_path)
+RtmpSession::Ptr RtmpServer::AcquireSession(const std::string& stream_path)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    rtmp_sessions_.erase(stream_path);
+	SessionShard& shard = GetShard(stream_path);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	SessionEntry& entry = shard.sessions[stream_path];
+	if (entry.session == nullptr) {
+		entry.session = std::make_shared<RtmpSession>();
+	}
+
+	entry.refs += 1;
+	return entry.session;
 }
 
-bool RtmpServer::HasSession(std::string stream_path)
+void RtmpServer::ReleaseSession(const std::string& stream_path)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return (rtmp_sessions_.find(stream_path) != rtmp_sessions_.end());
+	SessionShard& shard = GetShard(stream_path);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto iter = shard.sessions.find(stream_path);
+	if (iter != shard.sessions.end()) {
+		if (iter->second.refs <= 1) {
+			/* the clients still queued for removal keep the session object alive */
+			shard.sessions.erase(iter);
+		}
+		else {
+			iter->second.refs -= 1;
+		}
+	}
 }
 
-RtmpSession::Ptr RtmpServer::GetSession(std::string stream_path)
+RtmpSession::Ptr RtmpServer::FindSession(const std::string& stream_path)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if(rtmp_sessions_.find(stream_path) == rtmp_sessions_.end()) {
-        rtmp_sessions_[stream_path] = std::make_shared<RtmpSession>();        
-    }
-    
-    return rtmp_sessions_[stream_path];
+	SessionShard& shard = GetShard(stream_path);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto iter = shard.sessions.find(stream_path);
+	if (iter != shard.sessions.end()) {
+		return iter->second.session;
+	}
+
+	return nullptr;
 }
 
-bool RtmpServer::HasPublisher(std::string stream_path)
+bool RtmpServer::HasPublisher(const std::string& stream_path)
 {
-    auto session = GetSession(stream_path);
+    auto session = FindSession(stream_path);
     if(session == nullptr) {
        return false;
     }
@@ -19,20 +19,42 @@ public:
 private:
 	friend class RtmpConnection;
 	friend class HttpFlvConnection;
+	friend class HlsConnection;
+	friend class Fmp4Connection;
 
 	RtmpServer(xop::EventLoop *event_loop);
-	void AddSession(std::string stream_path);
-	void RemoveSession(std::string stream_path);
 
-	RtmpSession::Ptr GetSession(std::string stream_path);
-	bool HasSession(std::string stream_path);
-	bool HasPublisher(std::string stream_path);
+	/* publishers and viewers hold a reference on the session they are attached to,
+	   the session leaves the registry with the last one */
+	RtmpSession::Ptr AcquireSession(const std::string& stream_path);
+	void ReleaseSession(const std::string& stream_path);
+
+	/* lookups do not create sessions */
+	RtmpSession::Ptr FindSession(const std::string& stream_path);
+	bool HasPublisher(const std::string& stream_path);
 
     virtual TcpConnection::Ptr OnConnect(SOCKET sockfd);
+
+	struct SessionEntry
+	{
+		RtmpSession::Ptr session;
+		uint32_t refs = 0;
+	};
+
+	/* streams are spread over shards, publishers and viewers of different
+	   streams do not contend on one lock */
+	struct SessionShard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, SessionEntry> sessions;
+	};
+
+	SessionShard& GetShard(const std::string& stream_path);
     
 	xop::EventLoop *event_loop_;
-    std::mutex mutex_;
-    std::unordered_map<std::string, RtmpSession::Ptr> rtmp_sessions_; 
+
+	static const int kSessionShards = 16;
+	SessionShard session_shards_[kSessionShards];
 }; 
     
 }
@@ -1,6 +1,7 @@
 #include "RtmpSession.h"
 #include "RtmpConnection.h"
 #include "HttpFlvConnection.h"
+#include "Fmp4Connection.h"
 
 using namespace xop;
 
@@ -18,161 +19,277 @@ void RtmpSession::SendMetaData(AmfObjects& metaData)
 { 
     std::lock_guard<std::mutex> lock(mutex_);    
     
-	for (auto iter = rtmp_clients_.begin(); iter != rtmp_clients_.end(); ) {
-        auto conn = iter->second.lock(); 
-        if (conn == nullptr) {
-			rtmp_clients_.erase(iter++);
-        }
-        else {	
-            if(conn->IsPlayer()) {               
-				conn->SendMetaData(metaData);
-            }
-			iter++;
-        }
-    }
+	for (auto& iter : shards_) {
+		auto shard = iter.second;
+		shard->task_scheduler->AddTriggerEvent([shard, metaData]() mutable {
+			shard->SendMetaData(metaData);
+		});
+	}
 } 
 
 void RtmpSession::SendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
 {
+	std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+	frame->type = type;
+	frame->timestamp = timestamp;
+	frame->size = size;
+	frame->data = data;
+
     std::lock_guard<std::mutex> lock(mutex_);    
 
-	if (this->max_gop_cache_len_ > 0) {
+	/* new players get [start_pos, end_pos) from the cache, then the current frame */
+	if (gop_cache_ != nullptr) {
+		frame->gop_end_pos = gop_cache_->GetEndPos();
 		this->SaveGop(type, timestamp, data, size);
+		frame->gop_start_pos = gop_cache_->GetStartPos(gop_fast_start_);
+		frame->gop_cache = gop_cache_;
+	}
+
+	if (hls_segmenter_ != nullptr) {
+		hls_segmenter_->AddFrame(type, timestamp, data, size);
+	}
+
+	if (fmp4_muxer_ != nullptr) {
+		this->MuxFmp4(*frame);
 	}
 
-    for (auto iter = rtmp_clients_.begin(); iter != rtmp_clients_.end(); )
+	if (http_clients_ > 0 && (type == RTMP_VIDEO || type == RTMP_AUDIO)) {
+		frame->flv_tag = HttpFlvConnection::BuildFlvTag(type, timestamp, data.get(), size);
+	}
+
+	if (header_ == nullptr) {
+		std::shared_ptr<Header> header = std::make_shared<Header>();
+		header->meta_data = meta_data_;
+		header->avc_sequence_header = avc_sequence_header_;
+		header->avc_sequence_header_size = avc_sequence_header_size_;
+		header->aac_sequence_header = aac_sequence_header_;
+		header->aac_sequence_header_size = aac_sequence_header_size_;
+		if (fmp4_muxer_ != nullptr) {
+			header->fmp4_init = fmp4_muxer_->GetInitSegment();
+		}
+		header_ = header;
+	}
+	frame->header = header_;
+
+	/* one task per reactor, whatever the number of clients */
+	std::shared_ptr<const Frame> shared_frame = frame;
+	for (auto& iter : shards_) {
+		auto shard = iter.second;
+		shard->task_scheduler->AddTriggerEvent([shard, shared_frame] {
+			shard->SendMediaData(*shared_frame);
+		});
+	}
+}
+
+void RtmpSession::MuxFmp4(Frame& frame)
+{
+	const uint8_t* payload = (const uint8_t*)frame.data.get();
+
+	if (frame.type == RTMP_AVC_SEQUENCE_HEADER) {
+		fmp4_muxer_->SetAvcSequenceHeader(payload, frame.size);
+	}
+	else if (frame.type == RTMP_AAC_SEQUENCE_HEADER) {
+		fmp4_muxer_->SetAacSequenceHeader(payload, frame.size);
+	}
+	else if (frame.type == RTMP_AUDIO) {
+		/* goes out with the next video frame */
+		fmp4_muxer_->AddAudio(frame.timestamp, frame.data, frame.size);
+	}
+	else if (frame.type == RTMP_VIDEO) {
+		if (fmp4_muxer_->AddVideo(frame.timestamp, frame.data, frame.size)) {
+			frame.fmp4_fragment = fmp4_muxer_->Flush();
+			frame.fmp4_key_frame = IsVideoKeyFrame(payload, frame.size);
+
+			/* players joining late start from the latest key fragment */
+			frame.fmp4_end_pos = fmp4_cache_->GetEndPos();
+			fmp4_cache_->Push(RTMP_VIDEO, frame.timestamp, frame.fmp4_fragment.data,
+				frame.fmp4_fragment.size, frame.fmp4_key_frame);
+			frame.fmp4_start_pos = fmp4_cache_->GetStartPos(true);
+			frame.fmp4_cache = fmp4_cache_;
+		}
+	}
+}
+
+void RtmpSession::Shard::SendMetaData(AmfObjects& metaData)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto iter = rtmp_clients.begin(); iter != rtmp_clients.end(); ) {
+		auto conn = iter->second.lock();
+		if (conn == nullptr) {
+			rtmp_clients.erase(iter++);
+		}
+		else {
+			if (conn->IsPlayer()) {
+				conn->SendMetaData(metaData);
+			}
+			iter++;
+		}
+	}
+}
+
+void RtmpSession::Shard::SendMediaData(const Frame& frame)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const Header& header = *frame.header;
+	bool has_gop = (frame.gop_cache != nullptr && frame.gop_start_pos < frame.gop_end_pos);
+
+    for (auto iter = rtmp_clients.begin(); iter != rtmp_clients.end(); )
     {
         auto conn = iter->second.lock(); 
         if (conn == nullptr) {
-			rtmp_clients_.erase(iter++);
+			rtmp_clients.erase(iter++);
         }
         else {	
             if(conn->IsPlayer()) {   
 				if (!conn->IsPlaying()) {
-					conn->SendMetaData(meta_data_);
-					conn->SendMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, this->avc_sequence_header_, this->avc_sequence_header_size_);
-					conn->SendMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, this->aac_sequence_header_, this->aac_sequence_header_size_);
+					conn->SendMetaData(header.meta_data);
+					conn->PlayMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, header.avc_sequence_header, header.avc_sequence_header_size);
+					conn->PlayMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, header.aac_sequence_header, header.aac_sequence_header_size);
 					
-					if (gop_cache_.size() > 0) {						
-						auto gop = gop_cache_.begin()->second;
-						for (auto iter : *gop) {
-							if (iter->type == RTMP_VIDEO) {								
-								conn->SendVideoData(iter->timestamp, iter->data, iter->size);
-							}
-							else if (iter->type == RTMP_AUDIO) {
-								conn->SendAudioData(iter->timestamp, iter->data, iter->size);
-							}
-						}
+					if (has_gop) {
+						conn->PlayGopCache(frame.gop_cache, frame.gop_start_pos, frame.gop_end_pos);
 					}
 				}
-				conn->SendMediaData(type, timestamp, data, size);
+				conn->PlayMediaData(frame.type, frame.timestamp, frame.data, frame.size);
             }
 			iter++;
         }
     }
 
-	for (auto iter = http_clients_.begin(); iter != http_clients_.end(); )
+	for (auto iter = http_clients.begin(); iter != http_clients.end(); )
 	{
 		auto conn = iter->second.lock();
 		if (conn == nullptr) { // conn disconect 
-			http_clients_.erase(iter++);
+			http_clients.erase(iter++);
 		}
 		else {
 			if (!conn->IsPlaying()) {
-				conn->SendMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, avc_sequence_header_, avc_sequence_header_size_);
-				conn->SendMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, aac_sequence_header_, aac_sequence_header_size_);
-
-				if (gop_cache_.size() > 0) {
-					auto gop = gop_cache_.begin()->second;
-					for (auto iter : *gop) {
-						if (iter->type == RTMP_VIDEO) {
-							conn->SendMediaData(RTMP_VIDEO, iter->timestamp, iter->data, iter->size);
-						}
-						else if (iter->type == RTMP_AUDIO) {
-							conn->SendMediaData(RTMP_AUDIO, iter->timestamp, iter->data, iter->size);
-						}
-					}
+				conn->PlayMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, header.avc_sequence_header, header.avc_sequence_header_size);
+				conn->PlayMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, header.aac_sequence_header, header.aac_sequence_header_size);
 
-					conn->ResetKeyFrame();
+				if (has_gop) {
+					conn->PlayGopCache(frame.gop_cache, frame.gop_start_pos, frame.gop_end_pos);
 				}
 			}
 
-			conn->SendMediaData(type, timestamp, data, size);
+			conn->PlayMediaData(frame.type, frame.timestamp, frame.data, frame.size, frame.flv_tag);
 			iter++;
 		}
 	}
 
-	return;
+	if (frame.fmp4_fragment.size == 0) {
+		return;
+	}
+
+	bool has_fmp4_gop = (frame.fmp4_cache != nullptr && frame.fmp4_start_pos < frame.fmp4_end_pos);
+
+	for (auto iter = fmp4_clients.begin(); iter != fmp4_clients.end(); )
+	{
+		auto conn = iter->second.lock();
+		if (conn == nullptr) {
+			fmp4_clients.erase(iter++);
+		}
+		else {
+			if (!conn->IsPlaying() && has_fmp4_gop) {
+				conn->PlayGopCache(header.fmp4_init, frame.fmp4_cache, frame.fmp4_start_pos, frame.fmp4_end_pos);
+			}
+
+			conn->PlayFragment(header.fmp4_init, frame.fmp4_fragment, frame.fmp4_key_frame);
+			iter++;
+		}
+	}
 }
 
-void RtmpSession::SaveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
+std::shared_ptr<RtmpSession::Shard> RtmpSession::GetShard(TaskScheduler* task_scheduler)
 {
-	uint8_t *payload = (uint8_t *)data.get();
-	uint8_t frame_type = 0;
-	uint8_t codec_id = 0;
-	std::shared_ptr<AVFrame> av_frame = nullptr;
-	std::shared_ptr<std::list<AVFramePtr>> gop = nullptr;
-	if (gop_cache_.size() > 0) {
-		gop = gop_cache_[gop_index_];
+	auto& shard = shards_[task_scheduler];
+	if (shard == nullptr) {
+		shard = std::make_shared<Shard>();
+		shard->task_scheduler = task_scheduler;
 	}
 
+	return shard;
+}
+
+void RtmpSession::SetGopCache(uint32_t cacheLen, uint32_t cacheBytes, bool fastStart)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	gop_fast_start_ = fastStart;
+	if (cacheLen == 0) {
+		gop_cache_.reset();
+	}
+	else if (gop_cache_ == nullptr || gop_cache_->GetMaxFrames() < cacheLen || gop_cache_->GetMaxBytes() != cacheBytes) {
+		/* players still reading the old cache keep it alive */
+		gop_cache_.reset(new GopCache(cacheLen, cacheBytes));
+	}
+}
+
+bool RtmpSession::SaveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
+{
+	uint8_t *payload = (uint8_t *)data.get();
+
 	if (type == RTMP_VIDEO) {
-		frame_type = (payload[0] >> 4) & 0x0f;
-		codec_id = payload[0] & 0x0f;
-		if (frame_type == 1 && codec_id == RTMP_CODEC_ID_H264) {
-			if (payload[1] == 1) {
-				if (max_gop_cache_len_ > 0) {
-					if (gop_cache_.size() == 2) {
-						gop_cache_.erase(gop_cache_.begin());
-					}
-					gop_index_ += 1;
-					gop.reset(new std::list<AVFramePtr>);
-					gop_cache_[gop_index_] = gop;
-					av_frame.reset(new AVFrame);
-				}
-			}
-		}
-		else if (codec_id == RTMP_CODEC_ID_H264 && gop != nullptr) {
-			if (max_gop_cache_len_ > 0 && gop->size() >= 1 && gop->size() < max_gop_cache_len_) {
-				av_frame.reset(new AVFrame);
-			}
-		}
+		/* idr, or an intra refresh recovery point marked as key frame by the connection */
+		return gop_cache_->Push(type, timestamp, data, size, IsVideoKeyFrame(payload, size));
 	}
-	else if (type == RTMP_AUDIO && gop != nullptr) {
+	else if (type == RTMP_AUDIO) {
 		uint8_t sound_format = (payload[0] >> 4) & 0x0f;
 		//uint8_t sound_size = (payload[0] >> 1) & 0x01;
 		//uint8_t sound_rate = (payload[0] >> 2) & 0x03;
 
-		if (sound_format == RTMP_CODEC_ID_AAC) {
-			if (max_gop_cache_len_ > 0 && gop->size() >= 2 && gop->size() < max_gop_cache_len_) {
-				if (timestamp > 0) {
-					av_frame.reset(new AVFrame);
-				}
-			}
+		if (sound_format == RTMP_CODEC_ID_AAC && timestamp > 0) {
+			return gop_cache_->Push(type, timestamp, data, size, false);
 		}
 	}
 
-	if (av_frame != nullptr && gop != nullptr) {
-		av_frame->type = type;
-		av_frame->timestamp = timestamp;		
-		av_frame->size = size;
-		av_frame->data.reset(new char[size], std::default_delete<char[]>());
-		memcpy(av_frame->data.get(), data.get(), size);
-		gop->push_back(av_frame);
+	return false;
+}
+
+std::shared_ptr<HlsSegmenter> RtmpSession::GetHlsSegmenter(uint32_t partMsec, uint32_t segmentMsec)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (hls_segmenter_ == nullptr) {
+		hls_segmenter_.reset(new HlsSegmenter(partMsec, segmentMsec));
+		if (avc_sequence_header_ != nullptr) {
+			hls_segmenter_->AddFrame(RTMP_AVC_SEQUENCE_HEADER, 0, avc_sequence_header_, avc_sequence_header_size_);
+		}
+		if (aac_sequence_header_ != nullptr) {
+			hls_segmenter_->AddFrame(RTMP_AAC_SEQUENCE_HEADER, 0, aac_sequence_header_, aac_sequence_header_size_);
+		}
 	}
+
+	return hls_segmenter_;
 }
 
 void RtmpSession::AddRtmpClient(std::shared_ptr<RtmpConnection> conn)
 {
     std::lock_guard<std::mutex> lock(mutex_);   
-	rtmp_clients_[conn->GetSocket()] = conn;
+	auto shard = GetShard(conn->GetTaskScheduler());
+	{
+		std::lock_guard<std::mutex> shard_lock(shard->mutex);
+		shard->rtmp_clients[conn->GetSocket()] = conn;
+	}
+
     if(conn->IsPublisher()) {
 		avc_sequence_header_ = nullptr;
 		aac_sequence_header_ = nullptr;
 		avc_sequence_header_size_ = 0;
 		aac_sequence_header_size_ = 0;
-		gop_cache_.clear();
-		gop_index_ = 0;		
+		header_ = nullptr;
+		if (gop_cache_ != nullptr) {
+			gop_cache_->Clear();
+		}
+		if (hls_segmenter_ != nullptr) {
+			hls_segmenter_->Reset();
+		}
+		if (fmp4_muxer_ != nullptr) {
+			fmp4_muxer_->Reset();
+			fmp4_cache_->Clear();
+		}
         has_publisher_ = true;
 		publisher_ = conn;
     }
@@ -187,33 +304,72 @@ void RtmpSession::RemoveRtmpClient(std::shared_ptr<RtmpConnection> conn)
 		aac_sequence_header_ = nullptr;
 		avc_sequence_header_size_ = 0;
 		aac_sequence_header_size_ = 0;
-		gop_cache_.clear();
-		gop_index_ = 0;
+		header_ = nullptr;
+		if (gop_cache_ != nullptr) {
+			gop_cache_->Clear();
+		}
+		if (hls_segmenter_ != nullptr) {
+			hls_segmenter_->Reset();
+		}
+		if (fmp4_muxer_ != nullptr) {
+			fmp4_muxer_->Reset();
+			fmp4_cache_->Clear();
+		}
         has_publisher_ = false;
     }
-	rtmp_clients_.erase(conn->GetSocket());
+
+	auto shard = GetShard(conn->GetTaskScheduler());
+	std::lock_guard<std::mutex> shard_lock(shard->mutex);
+	shard->rtmp_clients.erase(conn->GetSocket());
 }
 
 void RtmpSession::AddHttpClient(std::shared_ptr<HttpFlvConnection> conn)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
-	http_clients_[conn->GetSocket()] = conn;
+	auto shard = GetShard(conn->GetTaskScheduler());
+	std::lock_guard<std::mutex> shard_lock(shard->mutex);
+	if (shard->http_clients.emplace(conn->GetSocket(), conn).second) {
+		http_clients_ += 1;
+	}
 }
 
 void RtmpSession::RemoveHttpClient(std::shared_ptr<HttpFlvConnection> conn)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
-	http_clients_.erase(conn->GetSocket());
+	auto shard = GetShard(conn->GetTaskScheduler());
+	std::lock_guard<std::mutex> shard_lock(shard->mutex);
+	if (shard->http_clients.erase(conn->GetSocket()) > 0) {
+		http_clients_ -= 1;
+	}
 }
 
-void AddHttpClient(std::shared_ptr<RtmpConnection> conn)
+void RtmpSession::AddFmp4Client(std::shared_ptr<Fmp4Connection> conn)
 {
+	std::lock_guard<std::mutex> lock(mutex_);
 
+	if (fmp4_muxer_ == nullptr) {
+		fmp4_muxer_.reset(new Fmp4Muxer());
+		fmp4_cache_.reset(new GopCache(1024, 0));
+		if (avc_sequence_header_ != nullptr) {
+			fmp4_muxer_->SetAvcSequenceHeader((uint8_t*)avc_sequence_header_.get(), avc_sequence_header_size_);
+		}
+		if (aac_sequence_header_ != nullptr) {
+			fmp4_muxer_->SetAacSequenceHeader((uint8_t*)aac_sequence_header_.get(), aac_sequence_header_size_);
+		}
+		header_ = nullptr;
+	}
+
+	auto shard = GetShard(conn->GetTaskScheduler());
+	std::lock_guard<std::mutex> shard_lock(shard->mutex);
+	shard->fmp4_clients[conn->GetSocket()] = conn;
 }
 
-void RemoveHttpClient(std::shared_ptr<RtmpConnection> conn)
+void RtmpSession::RemoveFmp4Client(std::shared_ptr<Fmp4Connection> conn)
 {
-
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto shard = GetShard(conn->GetTaskScheduler());
+	std::lock_guard<std::mutex> shard_lock(shard->mutex);
+	shard->fmp4_clients.erase(conn->GetSocket());
 }
 
 int RtmpSession::GetClients()
@@ -221,17 +377,28 @@ int RtmpSession::GetClients()
     std::lock_guard<std::mutex> lock(mutex_);
 
 	int clients = 0;
-	for (auto iter : rtmp_clients_) {
-		auto conn = iter.second.lock();
-		if (conn != nullptr)  {
-			clients += 1;
+	for (auto& shard : shards_) {
+		std::lock_guard<std::mutex> shard_lock(shard.second->mutex);
+
+		for (auto iter : shard.second->rtmp_clients) {
+			auto conn = iter.second.lock();
+			if (conn != nullptr)  {
+				clients += 1;
+			}
 		}
-	}
 
-	for (auto iter : http_clients_) {
-		auto conn = iter.second.lock();
-		if (conn != nullptr) {
-			clients += 1;
+		for (auto iter : shard.second->http_clients) {
+			auto conn = iter.second.lock();
+			if (conn != nullptr) {
+				clients += 1;
+			}
+		}
+
+		for (auto iter : shard.second->fmp4_clients) {
+			auto conn = iter.second.lock();
+			if (conn != nullptr) {
+				clients += 1;
+			}
 		}
 	}
 
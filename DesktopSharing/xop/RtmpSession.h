@@ -3,15 +3,21 @@
 
 #include "net/Socket.h"
 #include "amf.h"
+#include "GopCache.h"
+#include "HlsSegmenter.h"
+#include "Fmp4Muxer.h"
 #include <memory>
 #include <mutex>
 #include <list>
+#include <unordered_map>
 
 namespace xop
 {
     
 class RtmpConnection;
 class HttpFlvConnection;
+class Fmp4Connection;
+class TaskScheduler;
 
 class RtmpSession
 {
@@ -25,6 +31,7 @@ public:
 	{
 		std::lock_guard<std::mutex> lock(mutex_);
 		meta_data_ = metaData;
+		header_ = nullptr;
 	}
 
 	void SetAvcSequenceHeader(std::shared_ptr<char> avcSequenceHeader, uint32_t avcSequenceHeaderSize)
@@ -32,6 +39,7 @@ public:
 		std::lock_guard<std::mutex> lock(mutex_);
 		avc_sequence_header_ = avcSequenceHeader;
 		avc_sequence_header_size_ = avcSequenceHeaderSize;
+		header_ = nullptr;
 	}
 
 	void SetAacSequenceHeader(std::shared_ptr<char> aacSequenceHeader, uint32_t aacSequenceHeaderSize)
@@ -39,6 +47,7 @@ public:
 		std::lock_guard<std::mutex> lock(mutex_);
 		aac_sequence_header_ = aacSequenceHeader;
 		aac_sequence_header_size_ = aacSequenceHeaderSize;
+		header_ = nullptr;
 	}
 
 	AmfObjects GetMetaData()
@@ -51,6 +60,8 @@ public:
 	void RemoveRtmpClient(std::shared_ptr<RtmpConnection> conn);
 	void AddHttpClient(std::shared_ptr<HttpFlvConnection> conn);
 	void RemoveHttpClient(std::shared_ptr<HttpFlvConnection> conn);
+	void AddFmp4Client(std::shared_ptr<Fmp4Connection> conn);
+	void RemoveFmp4Client(std::shared_ptr<Fmp4Connection> conn);
 	int  GetClients();
 	
 	void SendMetaData(AmfObjects& metaData);
@@ -58,40 +69,86 @@ public:
 
 	std::shared_ptr<RtmpConnection> GetPublisher();
 
-	void SetGopCache(uint32_t cacheLen)
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		max_gop_cache_len_ = cacheLen;
-	}
+	void SetGopCache(uint32_t cacheLen, uint32_t cacheBytes = 0, bool fastStart = false);
 
-	void SaveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
+	bool SaveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
+
+	/* created by the first hls player, then fed with every frame */
+	std::shared_ptr<HlsSegmenter> GetHlsSegmenter(uint32_t partMsec, uint32_t segmentMsec);
 
 private:        
+	/* what a new player gets before the first frame, rebuilt when it changes */
+	struct Header
+	{
+		AmfObjects meta_data;
+		std::shared_ptr<char> avc_sequence_header;
+		std::shared_ptr<char> aac_sequence_header;
+		uint32_t avc_sequence_header_size = 0;
+		uint32_t aac_sequence_header_size = 0;
+		Fmp4Buffer fmp4_init;
+	};
+
+	/* one frame of the publisher, posted once to every shard */
+	struct Frame
+	{
+		uint8_t  type = 0;
+		uint64_t timestamp = 0;
+		uint32_t size = 0;
+		std::shared_ptr<char> data;
+		std::shared_ptr<const Header> header;
+		std::shared_ptr<GopCache> gop_cache;
+		uint64_t gop_start_pos = GopCache::kNoPos;
+		uint64_t gop_end_pos = 0;
+
+		/* the frame as an flv tag, built once for the http-flv players */
+		std::shared_ptr<char> flv_tag;
+
+		/* muxed once for the fmp4 players, with the fragments a new one starts from */
+		Fmp4Buffer fmp4_fragment;
+		bool fmp4_key_frame = false;
+		std::shared_ptr<GopCache> fmp4_cache;
+		uint64_t fmp4_start_pos = GopCache::kNoPos;
+		uint64_t fmp4_end_pos = 0;
+	};
+
+	/* the clients of one TaskScheduler, the fan-out runs on its thread, the mutex
+	   is only shared with add/remove of its clients and GetClients() */
+	struct Shard
+	{
+		TaskScheduler* task_scheduler = nullptr;
+		std::mutex mutex;
+		std::unordered_map<SOCKET, std::weak_ptr<RtmpConnection>> rtmp_clients;
+		std::unordered_map<SOCKET, std::weak_ptr<HttpFlvConnection>> http_clients;
+		std::unordered_map<SOCKET, std::weak_ptr<Fmp4Connection>> fmp4_clients;
+
+		void SendMetaData(AmfObjects& metaData);
+		void SendMediaData(const Frame& frame);
+	};
+
+	std::shared_ptr<Shard> GetShard(TaskScheduler* task_scheduler);
+	void MuxFmp4(Frame& frame);
 
     std::mutex mutex_;
     AmfObjects meta_data_;
     bool has_publisher_ = false;
 	std::weak_ptr<RtmpConnection> publisher_;
-    std::unordered_map<SOCKET, std::weak_ptr<RtmpConnection>> rtmp_clients_;
-	std::unordered_map<SOCKET, std::weak_ptr<HttpFlvConnection>> http_clients_;
+	std::unordered_map<TaskScheduler*, std::shared_ptr<Shard>> shards_;
+	uint32_t http_clients_ = 0;
 
 	std::shared_ptr<char> avc_sequence_header_;
 	std::shared_ptr<char> aac_sequence_header_;
 	uint32_t avc_sequence_header_size_ = 0;
 	uint32_t aac_sequence_header_size_ = 0;
-	uint64_t gop_index_ = 0;
-	uint32_t max_gop_cache_len_ = 0;
+	std::shared_ptr<const Header> header_;
 
-	struct AVFrame {
-		uint8_t  type = 0;
-		uint64_t timestamp = 0;
-		uint32_t size = 0;
-		std::shared_ptr<char> data = nullptr;
-	};
-	typedef std::shared_ptr<AVFrame> AVFramePtr;
-	std::map<uint64_t, std::shared_ptr<std::list<AVFramePtr>>> gop_cache_;
-};
+	bool gop_fast_start_ = false;
+	std::shared_ptr<GopCache> gop_cache_;
+	std::shared_ptr<HlsSegmenter> hls_segmenter_;
 
+	/* created by the first fmp4 player, one fragment per video frame */
+	std::shared_ptr<Fmp4Muxer> fmp4_muxer_;
+	std::shared_ptr<GopCache> fmp4_cache_;
+};
 }
 
 #endif
@@ -6,6 +6,7 @@
 #include "MediaSession.h"
 #include "MediaSource.h"
 #include "net/SocketUtil.h"
+#include "net/MemoryManager.h"
 
 #define USER_AGENT "-_-"
 #define RTSP_DEBUG 0
@@ -109,7 +110,12 @@ bool RtspConnection::HandleRtspRequest(BufferReader& buffer)
 	}
 #endif
 
-	if (rtsp_request_->ParseRequest(&buffer)) {
+	/* pipelined requests are answered in order */
+	while (buffer.ReadableBytes() > 0) {
+		if (!rtsp_request_->ParseRequest(&buffer)) {
+			return false;
+		}
+
 		RtspRequest::Method method = rtsp_request_->GetMethod();
 		if(method == RtspRequest::RTCP) {
 			HandleRtcp(buffer);
@@ -118,7 +124,7 @@ bool RtspConnection::HandleRtspRequest(BufferReader& buffer)
 		else if(!rtsp_request_->GotAll()) {
 			return true;
 		}
-        
+
 		switch (method)
 		{
 		case RtspRequest::OPTIONS:
@@ -143,12 +149,7 @@ bool RtspConnection::HandleRtspRequest(BufferReader& buffer)
 			break;
 		}
 
-		if (rtsp_request_->GotAll()) {
-			rtsp_request_->Reset();
-		}
-	}
-	else {
-		return false;
+		rtsp_request_->Reset();
 	}
 
 	return true;
@@ -203,6 +204,12 @@ void RtspConnection::SendRtspMessage(std::shared_ptr<char> buf, uint32_t size)
 	return;
 }
 
+std::shared_ptr<char> RtspConnection::AllocMessage(uint32_t size)
+{
+	/* messages come from the memory pools, a burst of handshakes does not hit the heap */
+	return std::shared_ptr<char>((char*)xop::Alloc(size), xop::Free);
+}
+
 void RtspConnection::HandleRtcp(BufferReader& buffer)
 {    
 	char *peek = buffer.Peek();
@@ -224,7 +231,7 @@ void RtspConnection::HandleRtcp(SOCKET sockfd)
 
 void RtspConnection::HandleCmdOption()
 {
-	std::shared_ptr<char> res(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> res = AllocMessage(2048);
 	int size = rtsp_request_->BuildOptionRes(res.get(), 2048);
 	this->SendRtspMessage(res, size);	
 }
@@ -240,7 +247,7 @@ void RtspConnection::HandleCmdDescribe()
 	}
 
 	int size = 0;
-	std::shared_ptr<char> res(new char[4096], std::default_delete<char[]>());
+	std::shared_ptr<char> res;
 	MediaSession::Ptr media_session = nullptr;
 
 	auto rtsp = rtsp_.lock();
@@ -249,7 +256,8 @@ void RtspConnection::HandleCmdDescribe()
 	}
 	
 	if(!rtsp || !media_session) {
-		size = rtsp_request_->BuildNotFoundRes(res.get(), 4096);
+		res = AllocMessage(1024);
+		size = rtsp_request_->BuildNotFoundRes(res.get(), 1024);
 	}
 	else {
 		session_id_ = media_session->GetMediaSessionId();
@@ -265,10 +273,14 @@ void RtspConnection::HandleCmdDescribe()
 
 		std::string sdp = media_session->GetSdpMessage(SocketUtil::GetSocketIp(this->GetSocket()), rtsp->GetVersion());
 		if(sdp == "") {
-			size = rtsp_request_->BuildServerErrorRes(res.get(), 4096);
+			res = AllocMessage(1024);
+			size = rtsp_request_->BuildServerErrorRes(res.get(), 1024);
 		}
 		else {
-			size = rtsp_request_->BuildDescribeRes(res.get(), 4096, sdp.c_str());		
+			/* sized on the sdp, the headers take less than 256 bytes */
+			uint32_t buf_size = (uint32_t)sdp.size() + 256;
+			res = AllocMessage(buf_size);
+			size = rtsp_request_->BuildDescribeRes(res.get(), buf_size, sdp.c_str());
 		}
 	}
 
@@ -283,7 +295,7 @@ void RtspConnection::HandleCmdSetup()
 	}
 
 	int size = 0;
-	std::shared_ptr<char> res(new char[4096], std::default_delete<char[]>());
+	std::shared_ptr<char> res = AllocMessage(4096);
 	MediaChannelId channel_id = rtsp_request_->GetChannelId();
 	MediaSession::Ptr media_session = nullptr;
 
@@ -375,7 +387,7 @@ void RtspConnection::HandleCmdPlay()
 	rtp_conn_->Play();
 
 	uint16_t session_id = rtp_conn_->GetRtpSessionId();
-	std::shared_ptr<char> res(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> res = AllocMessage(2048);
 
 	int size = rtsp_request_->BuildPlayRes(res.get(), 2048, nullptr, session_id);
 	SendRtspMessage(res, size);
@@ -390,7 +402,7 @@ void RtspConnection::HandleCmdTeardown()
 	rtp_conn_->Teardown();
 
 	uint16_t session_id = rtp_conn_->GetRtpSessionId();
-	std::shared_ptr<char> res(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> res = AllocMessage(2048);
 	int size = rtsp_request_->BuildTeardownRes(res.get(), 2048, session_id);
 	SendRtspMessage(res, size);
 
@@ -404,7 +416,7 @@ void RtspConnection::HandleCmdGetParamter()
 	}
 
 	uint16_t session_id = rtp_conn_->GetRtpSessionId();
-	std::shared_ptr<char> res(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> res = AllocMessage(2048);
 	int size = rtsp_request_->BuildGetParamterRes(res.get(), 2048, session_id);
 	SendRtspMessage(res, size);
 }
@@ -420,7 +432,7 @@ bool RtspConnection::HandleAuthentication()
 			has_auth_ = true;
 		}
 		else {
-			std::shared_ptr<char> res(new char[4096], std::default_delete<char[]>());
+			std::shared_ptr<char> res = AllocMessage(4096);
 			_nonce = auth_info_->GetNonce();
 			int size = rtsp_request_->BuildUnauthorizedRes(res.get(), 4096, auth_info_->GetRealm().c_str(), _nonce.c_str());
 			SendRtspMessage(res, size);
@@ -447,7 +459,7 @@ void RtspConnection::SendOptions(ConnectionMode mode)
 	rtsp_response_->SetUserAgent(USER_AGENT);
 	rtsp_response_->SetRtspUrl(rtsp->GetRtspUrl().c_str());
 
-	std::shared_ptr<char> req(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> req = AllocMessage(2048);
 	int size = rtsp_response_->BuildOptionReq(req.get(), 2048);
 	SendRtspMessage(req, size);
 }
@@ -484,14 +496,16 @@ void RtspConnection::SendAnnounce()
 		return;
 	}
 
-	std::shared_ptr<char> req(new char[4096], std::default_delete<char[]>());
-	int size = rtsp_response_->BuildAnnounceReq(req.get(), 4096, sdp.c_str());
+	/* sized on the sdp, as the describe response, the headers carry the url too */
+	uint32_t buf_size = (uint32_t)sdp.size() + 1024;
+	std::shared_ptr<char> req = AllocMessage(buf_size);
+	int size = rtsp_response_->BuildAnnounceReq(req.get(), buf_size, sdp.c_str());
 	SendRtspMessage(req, size);
 }
 
 void RtspConnection::SendDescribe()
 {
-	std::shared_ptr<char> req(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> req = AllocMessage(2048);
 	int size = rtsp_response_->BuildDescribeReq(req.get(), 2048);
 	SendRtspMessage(req, size);
 }
@@ -499,7 +513,7 @@ void RtspConnection::SendDescribe()
 void RtspConnection::SendSetup()
 {
 	int size = 0;
-	std::shared_ptr<char> buf(new char[2048], std::default_delete<char[]>());
+	std::shared_ptr<char> buf = AllocMessage(2048);
 	MediaSession::Ptr media_session = nullptr;
 
 	auto rtsp = rtsp_.lock();
@@ -95,6 +95,7 @@ private:
 	bool HandleRtspResponse(BufferReader& buffer);
 
 	void SendRtspMessage(std::shared_ptr<char> buf, uint32_t size);
+	static std::shared_ptr<char> AllocMessage(uint32_t size);
 
 	void HandleCmdOption();
 	void HandleCmdDescribe();
@@ -9,547 +9,496 @@
 
 #include "RtspMessage.h"
 #include "media.h"
+#include <algorithm>
+#include <cctype>
 
 using namespace std;
 using namespace xop;
 
-bool RtspRequest::ParseRequest(BufferReader *buffer)
+static bool EqualsNoCase(const char* begin, const char* end, const char* str)
 {
-	if(buffer->Peek()[0] == '$') {
-		method_ = RTCP;
-		return true;
+	size_t len = strlen(str);
+	if ((size_t)(end - begin) != len) {
+		return false;
 	}
-    
-	bool ret = true;
-	while(1) {
-		if(state_ == kParseRequestLine) {
-			const char* firstCrlf = buffer->FindFirstCrlf();
-			if(firstCrlf != nullptr)
-			{
-				ret = ParseRequestLine(buffer->Peek(), firstCrlf);
-				buffer->RetrieveUntil(firstCrlf + 2);
-			}
 
-			if (state_ == kParseHeadersLine) {
-				continue;
-			}             
-			else {
-				break;
-			}           
-		}
-		else if(state_ == kParseHeadersLine) {
-			const char* lastCrlf = buffer->FindLastCrlf();
-			if(lastCrlf != nullptr) {
-				ret = ParseHeadersLine(buffer->Peek(), lastCrlf);
-				buffer->RetrieveUntil(lastCrlf + 2);
-			}
-			break;
-		}
-		else if(state_ == kGotAll) {
-			buffer->RetrieveAll();
-			return true;
+	for (size_t i = 0; i < len; i++) {
+		if (tolower((unsigned char)begin[i]) != tolower((unsigned char)str[i])) {
+			return false;
 		}
 	}
-
-	return ret;
+	return true;
 }
 
-bool RtspRequest::ParseRequestLine(const char* begin, const char* end)
+static const char* SkipSpace(const char* begin, const char* end)
 {
-	string message(begin, end);
-	char method[64] = {0};
-	char url[512] = {0};
-	char version[64] = {0};
-
-	if(sscanf(message.c_str(), "%s %s %s", method, url, version) != 3) {
-		return true; 
+	while (begin < end && (*begin == ' ' || *begin == '\t')) {
+		begin++;
 	}
+	return begin;
+}
 
-	string method_str(method);
-	if(method_str == "OPTIONS") {
-		method_ = OPTIONS;
-	}
-	else if(method_str == "DESCRIBE") {
-		method_ = DESCRIBE;
-	}
-	else if(method_str == "SETUP") {
-		method_ = SETUP;
-	}
-	else if(method_str == "PLAY") {
-		method_ = PLAY;
-	}
-	else if(method_str == "TEARDOWN") {
-		method_ = TEARDOWN;
-	}
-	else if(method_str == "GET_PARAMETER") {
-		method_ = GET_PARAMETER;
-	}
-	else {
-		method_ = NONE;
-		return false;
+/* parses a decimal number at begin, returns the first byte after it or nullptr */
+static const char* ParseNumber(const char* begin, const char* end, uint32_t& value)
+{
+	const char* p = begin;
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9' && p - begin < 10) {
+		value = value * 10 + (*p - '0');
+		p++;
 	}
+	return (p == begin) ? nullptr : p;
+}
 
-	if(strncmp(url, "rtsp://", 7) != 0) {
+/* "a-b", a single "a" gives b = a + 1 */
+static bool ParseRange(const char* begin, const char* end, uint16_t& first, uint16_t& second)
+{
+	uint32_t a = 0, b = 0;
+	const char* p = ParseNumber(begin, end, a);
+	if (p == nullptr || a > 0xffff) {
 		return false;
 	}
 
-	// parse url
-	uint16_t port = 0;
-	char ip[64] = {0};
-	char suffix[64] = {0};
-
-	if(sscanf(url+7, "%[^:]:%hu/%s", ip, &port, suffix) == 3) {
-
-	}
-	else if(sscanf(url+7, "%[^/]/%s", ip, suffix) == 2) {
-		port = 554;
+	if (p < end && *p == '-') {
+		if (ParseNumber(p + 1, end, b) == nullptr || b > 0xffff) {
+			return false;
+		}
 	}
 	else {
-		return false;
+		b = a + 1;
 	}
 
-	request_line_param_.emplace("url", make_pair(string(url), 0));
-	request_line_param_.emplace("url_ip", make_pair(string(ip), 0));
-	request_line_param_.emplace("url_port", make_pair("", (uint32_t)port));
-	request_line_param_.emplace("url_suffix", make_pair(string(suffix), 0));
-	request_line_param_.emplace("version", make_pair(string(version), 0));
-	request_line_param_.emplace("method", make_pair(move(method_str), 0));
-
-	state_ = kParseHeadersLine;
+	first = (uint16_t)a;
+	second = (uint16_t)b;
 	return true;
 }
 
-bool RtspRequest::ParseHeadersLine(const char* begin, const char* end)
+bool RtspRequest::ParseRequest(BufferReader *buffer)
 {
-	string message(begin, end);
-	if(!ParseCSeq(message)) {
-		if (header_line_param_.find("cseq") == header_line_param_.end()) {
-			return false;
-		} 
+	if (buffer->ReadableBytes() == 0) {
+		return true;
 	}
 
-	if (method_ == DESCRIBE || method_ == SETUP || method_ == PLAY) {
-		ParseAuthorization(message);
+	if(state_ == kParseRequestLine && buffer->Peek()[0] == '$') {
+		method_ = RTCP;
+		return true;
 	}
 
-	if(method_ == OPTIONS) {
-		state_ = kGotAll;
+	if (state_ == kGotAll) {
+		buffer->RetrieveAll();
 		return true;
 	}
 
-	if(method_ == DESCRIBE) {
-		if(ParseAccept(message)) {
-			state_ = kGotAll;
+	const char* begin = buffer->Peek();
+	const char* end = begin + buffer->ReadableBytes();
+
+	if (state_ == kParseRequestLine) {
+		/* the bytes scanned by the previous calls are not searched again */
+		static const char kCrlfCrlf[] = "\r\n\r\n";
+		const char* header_end = std::search(begin + scan_offset_, end, kCrlfCrlf, kCrlfCrlf + 4);
+		if (header_end == end) {
+			if (buffer->ReadableBytes() > kMaxHeaderSize) {
+				return false;
+			}
+			scan_offset_ = (buffer->ReadableBytes() > 3) ? buffer->ReadableBytes() - 3 : 0;
+			return true;
 		}
-		return true;
-	}
 
-	if(method_ == SETUP) {
-		if(ParseTransport(message)) {
-			ParseMediaChannel(message);
-			state_ = kGotAll;
+		/* request line and header lines, in one pass */
+		const char* line = begin;
+		const char* line_end = std::find(line, header_end, '\r');
+		if (!ParseRequestLine(line, line_end)) {
+			return false;
 		}
 
-		return true;
-	}
+		while (line_end < header_end) {
+			line = line_end + 2;
+			line_end = std::find(line, header_end, '\r');
+			if (!ParseHeadersLine(line, line_end)) {
+				return false;
+			}
+		}
 
-	if(method_ == PLAY) {
-		if(ParseSessionId(message)) {
-			state_ = kGotAll;
+		if (!has_cseq_) {
+			return false;
 		}
-		return true;
-	}
 
-	if(method_ == TEARDOWN) {
-		state_ = kGotAll;
-		return true;
+		buffer->Retrieve(header_end + 4 - begin);
+		scan_offset_ = 0;
+		state_ = (content_length_ > 0) ? kParseBody : kGotAll;
 	}
 
-	if(method_ == GET_PARAMETER) {
-		state_ = kGotAll;
-		return true;
+	if (state_ == kParseBody) {
+		/* bodies are not used by the server, they are only skipped */
+		uint32_t size = std::min(content_length_, buffer->ReadableBytes());
+		buffer->Retrieve(size);
+		content_length_ -= size;
+		if (content_length_ == 0) {
+			state_ = kGotAll;
+		}
 	}
 
 	return true;
 }
 
-bool RtspRequest::ParseCSeq(std::string& message)
+bool RtspRequest::ParseRequestLine(const char* begin, const char* end)
 {
-	std::size_t pos = message.find("CSeq");
-	if (pos != std::string::npos) {
-		uint32_t cseq = 0;
-		sscanf(message.c_str()+pos, "%*[^:]: %u", &cseq);
-		header_line_param_.emplace("cseq", make_pair("", cseq));
-		return true;
+	/* <method> rtsp://<ip>[:<port>]/<suffix> RTSP/1.0 */
+	const char* method_end = std::find(begin, end, ' ');
+	const char* url = SkipSpace(method_end, end);
+	const char* url_end = std::find(url, end, ' ');
+	if (method_end == end || url == url_end) {
+		return false;
 	}
 
-	return false;
-}
+	method_ = NONE;
+	for (int i = OPTIONS; i <= GET_PARAMETER; i++) {
+		size_t len = strlen(MethodToString[i]);
+		if ((size_t)(method_end - begin) == len && memcmp(begin, MethodToString[i], len) == 0) {
+			method_ = (Method)i;
+			break;
+		}
+	}
 
-bool RtspRequest::ParseAccept(std::string& message)
-{
-	if ((message.rfind("Accept")==std::string::npos)
-		|| (message.rfind("sdp")==std::string::npos)) {
+	if (method_ == NONE || url_end - url <= 7 || !EqualsNoCase(url, url + 7, "rtsp://")) {
 		return false;
 	}
 
-	return true;
-}
-
-bool RtspRequest::ParseTransport(std::string& message)
-{
-	std::size_t pos = message.find("Transport");
-	if(pos != std::string::npos) {
-		if((pos=message.find("RTP/AVP/TCP")) != std::string::npos) {
-			transport_ = RTP_OVER_TCP;
-			uint16_t rtpChannel = 0, rtcpChannel = 0;
-			if (sscanf(message.c_str() + pos, "%*[^;];%*[^;];%*[^=]=%hu-%hu", &rtpChannel, &rtcpChannel) != 2) {
-				return false;
-			}
-			header_line_param_.emplace("rtp_channel", make_pair("", rtpChannel));
-			header_line_param_.emplace("rtcp_channel", make_pair("", rtcpChannel));
-		}
-		else if((pos=message.find("RTP/AVP")) != std::string::npos) {
-			uint16_t rtp_port = 0, rtcpPort = 0;
-			if(((message.find("unicast", pos)) != std::string::npos)) {
-				transport_ = RTP_OVER_UDP;
-				if(sscanf(message.c_str()+pos, "%*[^;];%*[^;];%*[^=]=%hu-%hu",
-						&rtp_port, &rtcpPort) != 2)
-				{
-					return false;
-				}
-
-			}
-			else if((message.find("multicast", pos)) != std::string::npos) {
-				transport_ = RTP_OVER_MULTICAST;
-			}
-			else {
-				return false;
-			}
+	const char* host = url + 7;
+	const char* host_end = std::find(host, url_end, '/');
+	if (host_end == host || url_end - host_end <= 1) {
+		return false;
+	}
 
-			header_line_param_.emplace("rtp_port", make_pair("", rtp_port));
-			header_line_param_.emplace("rtcp_port", make_pair("", rtcpPort));
-		}
-		else {
+	uint32_t port = 554;
+	const char* port_begin = std::find(host, host_end, ':');
+	if (port_begin != host_end) {
+		if (ParseNumber(port_begin + 1, host_end, port) != host_end || port > 0xffff) {
 			return false;
 		}
-
-		return true;
 	}
 
-	return false;
+	url_.assign(url, url_end);
+	url_ip_.assign(host, port_begin);
+	url_port_ = (uint16_t)port;
+	url_suffix_.assign(host_end + 1, url_end);
+
+	channel_id_ = (url_.find("track1") != std::string::npos) ? channel_1 : channel_0;
+	state_ = kParseHeadersLine;
+	return true;
 }
 
-bool RtspRequest::ParseSessionId(std::string& message)
+bool RtspRequest::ParseHeadersLine(const char* begin, const char* end)
 {
-	std::size_t pos = message.find("Session");
-	if (pos != std::string::npos) {
-		uint32_t session_id = 0;
-		if (sscanf(message.c_str() + pos, "%*[^:]: %u", &session_id) != 1) {
-			return false;
-		}        
+	const char* colon = std::find(begin, end, ':');
+	if (colon == end) {
 		return true;
 	}
 
-	return false;
-}
-
-bool RtspRequest::ParseMediaChannel(std::string& message)
-{
-	channel_id_ = channel_0;
-
-	auto iter = request_line_param_.find("url");
-	if(iter != request_line_param_.end()) {
-		std::size_t pos = iter->second.first.find("track1");
-		if (pos != std::string::npos) {
-			channel_id_ = channel_1;
-		}       
+	const char* name_end = colon;
+	while (name_end > begin && (name_end[-1] == ' ' || name_end[-1] == '\t')) {
+		name_end--;
 	}
 
-	return true;
-}
+	const char* value = SkipSpace(colon + 1, end);
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+		end--;
+	}
 
-bool RtspRequest::ParseAuthorization(std::string& message)
-{	
-	std::size_t pos = message.find("Authorization");
-	if (pos != std::string::npos) {
-		if ((pos = message.find("response=")) != std::string::npos) {
-			auth_response_ = message.substr(pos + 10, 32);
-			if (auth_response_.size() == 32) {
-				return true;
+	/* the names the server needs have distinct lengths,
+	   the length selects the candidate and one compare confirms it */
+	switch (name_end - begin)
+	{
+	case 4:
+		if (EqualsNoCase(begin, name_end, "CSeq")) {
+			uint32_t cseq = 0;
+			has_cseq_ = (ParseNumber(value, end, cseq) != nullptr);
+			cseq_ = cseq;
+		}
+		break;
+	case 9:
+		if (EqualsNoCase(begin, name_end, "Transport")) {
+			ParseTransport(value, end);
+		}
+		break;
+	case 13:
+		if (EqualsNoCase(begin, name_end, "Authorization")) {
+			ParseAuthorization(value, end);
+		}
+		break;
+	case 14:
+		if (EqualsNoCase(begin, name_end, "Content-Length")) {
+			uint32_t length = 0;
+			if (ParseNumber(value, end, length) == nullptr || length > kMaxHeaderSize) {
+				return false;
 			}
+			content_length_ = length;
 		}
+		break;
+	default:
+		break;
 	}
 
-	auth_response_.clear();
-	return false;
+	return true;
 }
 
-uint32_t RtspRequest::GetCSeq() const
+void RtspRequest::ParseTransport(const char* begin, const char* end)
 {
-	uint32_t cseq = 0;
-	auto iter = header_line_param_.find("cseq");
-	if(iter != header_line_param_.end()) {
-		cseq = iter->second.second;
+	/* RTP/AVP[/UDP|/TCP];unicast|multicast;client_port=a-b|interleaved=a-b;... */
+	const char* param_end = std::find(begin, end, ';');
+	bool is_tcp = false;
+	if (EqualsNoCase(begin, param_end, "RTP/AVP/TCP")) {
+		is_tcp = true;
 	}
-
-	return cseq;
-}
-
-std::string RtspRequest::GetIp() const
-{
-	auto iter = request_line_param_.find("url_ip");
-	if(iter != request_line_param_.end()) {
-		return iter->second.first;
+	else if (!EqualsNoCase(begin, param_end, "RTP/AVP") && !EqualsNoCase(begin, param_end, "RTP/AVP/UDP")) {
+		return;
 	}
 
-	return "";
-}
+	bool is_multicast = false;
+	bool has_range = false;
+	uint16_t first = 0, second = 0;
 
-std::string RtspRequest::GetRtspUrl() const
-{
-	auto iter = request_line_param_.find("url");
-	if(iter != request_line_param_.end()) {
-		return iter->second.first;
+	while (param_end < end) {
+		const char* param = param_end + 1;
+		param_end = std::find(param, end, ';');
+		const char* equal = std::find(param, param_end, '=');
+
+		if (EqualsNoCase(param, param_end, "multicast")) {
+			is_multicast = true;
+		}
+		else if (is_tcp && EqualsNoCase(param, equal, "interleaved")) {
+			has_range = (equal != param_end) && ParseRange(equal + 1, param_end, first, second);
+		}
+		else if (!is_tcp && EqualsNoCase(param, equal, "client_port")) {
+			has_range = (equal != param_end) && ParseRange(equal + 1, param_end, first, second);
+		}
 	}
 
-	return "";
+	/* an incomplete transport stays unset and is answered as unsupported */
+	if (is_tcp) {
+		if (has_range && first <= 0xff && second <= 0xff) {
+			transport_ = RTP_OVER_TCP;
+			rtp_channel_ = (uint8_t)first;
+			rtcp_channel_ = (uint8_t)second;
+		}
+	}
+	else if (is_multicast) {
+		transport_ = RTP_OVER_MULTICAST;
+	}
+	else if (has_range) {
+		transport_ = RTP_OVER_UDP;
+		rtp_port_ = first;
+		rtcp_port_ = second;
+	}
 }
 
-std::string RtspRequest::GetRtspUrlSuffix() const
+void RtspRequest::ParseAuthorization(const char* begin, const char* end)
 {
-	auto iter = request_line_param_.find("url_suffix");
-	if(iter != request_line_param_.end()) {
-		return iter->second.first;
+	/* Digest ..., response="<32 hex digits>" */
+	static const char kResponse[] = "response=\"";
+	const char* pos = std::search(begin, end, kResponse, kResponse + sizeof(kResponse) - 1);
+	if (pos == end || end - pos < (ptrdiff_t)(sizeof(kResponse) - 1 + 32)) {
+		auth_response_.clear();
+		return;
 	}
 
-	return "";
+	auth_response_.assign(pos + sizeof(kResponse) - 1, 32);
 }
 
-std::string RtspRequest::GetAuthResponse() const
+void RtspRequest::Reset()
 {
-	return auth_response_;
+	/* the strings keep their capacity, the next request reuses it */
+	state_ = kParseRequestLine;
+	method_ = NONE;
+	channel_id_ = channel_0;
+	transport_ = (TransportMode)0;
+	has_cseq_ = false;
+	cseq_ = 0;
+	rtp_channel_ = 0;
+	rtcp_channel_ = 0;
+	rtp_port_ = 0;
+	rtcp_port_ = 0;
+	url_port_ = 0;
+	content_length_ = 0;
+	scan_offset_ = 0;
+	url_.clear();
+	url_ip_.clear();
+	url_suffix_.clear();
+	auth_response_.clear();
 }
 
-uint8_t RtspRequest::GetRtpChannel() const
+/* writes a response into the caller's buffer: the fixed parts are copied
+   with their known length, numbers are formatted in place */
+class ResponseWriter
 {
-	auto iter = header_line_param_.find("rtp_channel");
-	if(iter != header_line_param_.end()) {
-		return iter->second.second;
-	}
+public:
+	ResponseWriter(const char* buf, int buf_size)
+		: buf_((char*)buf)
+		, capacity_(buf_size > 0 ? (uint32_t)buf_size - 1 : 0)
+	{ }
 
-	return 0;
-}
+	template<size_t N>
+	ResponseWriter& operator<<(const char (&str)[N])
+	{ return Append(str, N - 1); }
 
-uint8_t RtspRequest::GetRtcpChannel() const
-{
-	auto iter = header_line_param_.find("rtcp_channel");
-	if(iter != header_line_param_.end()) {
-		return iter->second.second;
-	}
+	ResponseWriter& operator<<(const std::string& str)
+	{ return Append(str.c_str(), str.size()); }
 
-	return 0;
-}
+	ResponseWriter& operator<<(uint32_t value)
+	{
+		char digits[10];
+		uint32_t n = 0;
+		do {
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
 
-uint16_t RtspRequest::GetRtpPort() const
-{
-	auto iter = header_line_param_.find("rtp_port");
-	if(iter != header_line_param_.end()) {
-		return iter->second.second;
+		while (n > 0 && size_ < capacity_) {
+			buf_[size_++] = digits[--n];
+		}
+		return *this;
 	}
 
-	return 0;
-}
+	ResponseWriter& Append(const char* str, size_t len)
+	{
+		len = std::min(len, (size_t)(capacity_ - size_));
+		memcpy(buf_ + size_, str, len);
+		size_ += (uint32_t)len;
+		return *this;
+	}
 
-uint16_t RtspRequest::GetRtcpPort() const
-{
-	auto iter = header_line_param_.find("rtcp_port");
-	if(iter != header_line_param_.end()) {
-		return iter->second.second;
+	ResponseWriter& AppendString(const char* str)
+	{ return Append(str, strlen(str)); }
+
+	int Finish()
+	{
+		if (buf_ != nullptr && capacity_ > 0) {
+			buf_[size_] = '\0';
+		}
+		return (int)size_;
 	}
 
-	return 0;
-}
+private:
+	char* buf_ = nullptr;
+	uint32_t capacity_ = 0;
+	uint32_t size_ = 0;
+};
+
+static const char kStatusOk[] = "RTSP/1.0 200 OK\r\nCSeq: ";
 
 int RtspRequest::BuildOptionRes(const char* buf, int buf_size)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %u\r\n"
-			"Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY\r\n"
-			"\r\n",
-			this->GetCSeq());
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nPublic: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildDescribeRes(const char* buf, int buf_size, const char* sdp)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %u\r\n"
-			"Content-Length: %d\r\n"
-			"Content-Type: application/sdp\r\n"
-			"\r\n"
-			"%s",
-			this->GetCSeq(), 
-			(int)strlen(sdp), 
-			sdp);
+	size_t sdp_size = strlen(sdp);
 
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nContent-Length: " << (uint32_t)sdp_size
+		<< "\r\nContent-Type: application/sdp\r\n\r\n";
+	writer.Append(sdp, sdp_size);
+	return writer.Finish();
 }
 
 int RtspRequest::BuildSetupMulticastRes(const char* buf, int buf_size, const char* multicast_ip, uint16_t port, uint32_t session_id)
-{	
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %u\r\n"
-			"Transport: RTP/AVP;multicast;destination=%s;source=%s;port=%u-0;ttl=255\r\n"
-			"Session: %u\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			multicast_ip,
-			this->GetIp().c_str(),
-			port,
-			session_id);
-
-	return (int)strlen(buf);
+{
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nTransport: RTP/AVP;multicast;destination=";
+	writer.AppendString(multicast_ip);
+	writer << ";source=" << url_ip_ << ";port=" << (uint32_t)port << "-0;ttl=255"
+		<< "\r\nSession: " << session_id << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildSetupUdpRes(const char* buf, int buf_size, uint16_t rtp_chn, uint16_t rtcp_chn, uint32_t session_id)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %u\r\n"
-			"Transport: RTP/AVP;unicast;client_port=%hu-%hu;server_port=%hu-%hu\r\n"
-			"Session: %u\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			this->GetRtpPort(),
-			this->GetRtcpPort(),
-			rtp_chn, 
-			rtcp_chn,
-			session_id);
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nTransport: RTP/AVP;unicast;client_port=" << (uint32_t)this->GetRtpPort() << "-" << (uint32_t)this->GetRtcpPort()
+		<< ";server_port=" << (uint32_t)rtp_chn << "-" << (uint32_t)rtcp_chn
+		<< "\r\nSession: " << session_id << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildSetupTcpRes(const char* buf, int buf_size, uint16_t rtp_chn, uint16_t rtcp_chn, uint32_t session_id)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %u\r\n"
-			"Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n"
-			"Session: %u\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			rtp_chn, rtcp_chn,
-			session_id);
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nTransport: RTP/AVP/TCP;unicast;interleaved=" << (uint32_t)rtp_chn << "-" << (uint32_t)rtcp_chn
+		<< "\r\nSession: " << session_id << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildPlayRes(const char* buf, int buf_size, const char* rtpInfo, uint32_t session_id)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %d\r\n"
-			"Range: npt=0.000-\r\n"
-			"Session: %u; timeout=60\r\n",
-			this->GetCSeq(),
-			session_id);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nRange: npt=0.000-"
+		<< "\r\nSession: " << session_id << "; timeout=60\r\n";
 
 	if (rtpInfo != nullptr) {
-		snprintf((char*)buf + strlen(buf), buf_size - strlen(buf), "%s\r\n", rtpInfo);
+		writer.AppendString(rtpInfo);
+		writer << "\r\n";
 	}
 
-	snprintf((char*)buf + strlen(buf), buf_size - strlen(buf), "\r\n");
-	return (int)strlen(buf);
+	writer << "\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildTeardownRes(const char* buf, int buf_size, uint32_t session_id)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %d\r\n"
-			"Session: %u\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			session_id);
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nSession: " << session_id << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildGetParamterRes(const char* buf, int buf_size, uint32_t session_id)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 200 OK\r\n"
-			"CSeq: %d\r\n"
-			"Session: %u\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			session_id);
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << kStatusOk << this->GetCSeq()
+		<< "\r\nSession: " << session_id << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildNotFoundRes(const char* buf, int buf_size)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 404 Stream Not Found\r\n"
-			"CSeq: %u\r\n"
-			"\r\n",
-			this->GetCSeq());
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << "RTSP/1.0 404 Stream Not Found\r\nCSeq: " << this->GetCSeq() << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildServerErrorRes(const char* buf, int buf_size)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 500 Internal Server Error\r\n"
-			"CSeq: %u\r\n"
-			"\r\n",
-			this->GetCSeq());
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << "RTSP/1.0 500 Internal Server Error\r\nCSeq: " << this->GetCSeq() << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildUnsupportedRes(const char* buf, int buf_size)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 461 Unsupported transport\r\n"
-			"CSeq: %d\r\n"
-			"\r\n",
-			this->GetCSeq());
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << "RTSP/1.0 461 Unsupported transport\r\nCSeq: " << this->GetCSeq() << "\r\n\r\n";
+	return writer.Finish();
 }
 
 int RtspRequest::BuildUnauthorizedRes(const char* buf, int buf_size, const char* realm, const char* nonce)
 {
-	memset((void*)buf, 0, buf_size);
-	snprintf((char*)buf, buf_size,
-			"RTSP/1.0 401 Unauthorized\r\n"
-			"CSeq: %d\r\n"
-			"WWW-Authenticate: Digest realm=\"%s\", nonce=\"%s\"\r\n"
-			"\r\n",
-			this->GetCSeq(),
-			realm,
-			nonce);
-
-	return (int)strlen(buf);
+	ResponseWriter writer(buf, buf_size);
+	writer << "RTSP/1.0 401 Unauthorized\r\nCSeq: " << this->GetCSeq()
+		<< "\r\nWWW-Authenticate: Digest realm=\"";
+	writer.AppendString(realm);
+	writer << "\", nonce=\"";
+	writer.AppendString(nonce);
+	writer << "\"\r\n\r\n";
+	return writer.Finish();
 }
 
 bool RtspResponse::ParseResponse(xop::BufferReader *buffer)
@@ -34,7 +34,7 @@ public:
 	{
 		kParseRequestLine,
 		kParseHeadersLine,
-		//kParseBody,	
+		kParseBody,
 		kGotAll,
 	};
 
@@ -43,25 +43,25 @@ public:
 	bool GotAll() const
 	{ return state_ == kGotAll; }
 
-	void Reset()
-	{
-		state_ = kParseRequestLine;
-		request_line_param_.clear();
-		header_line_param_.clear();
-	}
+	void Reset();
 
 	Method GetMethod() const
 	{ return method_; }
 
-	uint32_t GetCSeq() const;
+	uint32_t GetCSeq() const
+	{ return cseq_; }
 
-	std::string GetRtspUrl() const;
+	std::string GetRtspUrl() const
+	{ return url_; }
 
-	std::string GetRtspUrlSuffix() const;
+	std::string GetRtspUrlSuffix() const
+	{ return url_suffix_; }
 
-	std::string GetIp() const;
+	std::string GetIp() const
+	{ return url_ip_; }
 
-	std::string GetAuthResponse() const;
+	std::string GetAuthResponse() const
+	{ return auth_response_; }
 
 	TransportMode GetTransportMode() const
 	{ return transport_; }
@@ -69,10 +69,17 @@ public:
 	MediaChannelId GetChannelId() const
 	{ return channel_id_; }
 
-	uint8_t  GetRtpChannel() const;
-	uint8_t  GetRtcpChannel() const;
-	uint16_t GetRtpPort() const;
-	uint16_t GetRtcpPort() const;
+	uint8_t GetRtpChannel() const
+	{ return rtp_channel_; }
+
+	uint8_t GetRtcpChannel() const
+	{ return rtcp_channel_; }
+
+	uint16_t GetRtpPort() const
+	{ return rtp_port_; }
+
+	uint16_t GetRtcpPort() const
+	{ return rtcp_port_; }
 
 	int BuildOptionRes(const char* buf, int buf_size);
 	int BuildDescribeRes(const char* buf, int buf_size, const char* sdp);
@@ -90,21 +97,29 @@ public:
 private:
 	bool ParseRequestLine(const char* begin, const char* end);
 	bool ParseHeadersLine(const char* begin, const char* end);
-	bool ParseCSeq(std::string& message);
-	bool ParseAccept(std::string& message);
-	bool ParseTransport(std::string& message);
-	bool ParseSessionId(std::string& message);
-	bool ParseMediaChannel(std::string& message);
-	bool ParseAuthorization(std::string& message);
+	void ParseTransport(const char* begin, const char* end);
+	void ParseAuthorization(const char* begin, const char* end);
 
-	Method method_;
-	MediaChannelId channel_id_;
-	TransportMode transport_;
+	Method method_ = NONE;
+	MediaChannelId channel_id_ = channel_0;
+	TransportMode transport_ = (TransportMode)0;
+	bool has_cseq_ = false;
+	uint32_t cseq_ = 0;
+	uint8_t rtp_channel_ = 0;
+	uint8_t rtcp_channel_ = 0;
+	uint16_t rtp_port_ = 0;
+	uint16_t rtcp_port_ = 0;
+	uint16_t url_port_ = 0;
+	uint32_t content_length_ = 0;
+	uint32_t scan_offset_ = 0;
+	std::string url_;
+	std::string url_ip_;
+	std::string url_suffix_;
 	std::string auth_response_;
-	std::unordered_map<std::string, std::pair<std::string, uint32_t>> request_line_param_;
-	std::unordered_map<std::string, std::pair<std::string, uint32_t>> header_line_param_;
 
 	RtspRequestParseState state_ = kParseRequestLine;
+
+	static const uint32_t kMaxHeaderSize = 8192;
 };
 
 class RtspResponse
@@ -0,0 +1,182 @@
+#include "WebSocket.h"
+#include <cstring>
+
+using namespace xop;
+
+namespace
+{
+
+uint32_t RotateLeft(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+std::string Sha1(const std::string& data)
+{
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+	std::string message = data;
+	uint64_t bit_size = (uint64_t)data.size() * 8;
+	message += (char)0x80;
+	while (message.size() % 64 != 56) {
+		message += (char)0x00;
+	}
+	for (int i = 7; i >= 0; i--) {
+		message += (char)((bit_size >> (i * 8)) & 0xff);
+	}
+
+	for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+		uint32_t w[80];
+		const uint8_t* p = (const uint8_t*)message.data() + chunk;
+		for (int i = 0; i < 16; i++) {
+			w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+		}
+		for (int i = 16; i < 80; i++) {
+			w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; i++) {
+			uint32_t f = 0, k = 0;
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			}
+			else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			}
+			else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			}
+			else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+
+			uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = RotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	std::string digest;
+	for (int i = 0; i < 5; i++) {
+		for (int j = 3; j >= 0; j--) {
+			digest += (char)((h[i] >> (j * 8)) & 0xff);
+		}
+	}
+	return digest;
+}
+
+std::string Base64Encode(const std::string& data)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	std::string out;
+	const uint8_t* p = (const uint8_t*)data.data();
+	size_t size = data.size();
+
+	for (size_t i = 0; i < size; i += 3) {
+		uint32_t value = p[i] << 16;
+		if (i + 1 < size) {
+			value |= p[i + 1] << 8;
+		}
+		if (i + 2 < size) {
+			value |= p[i + 2];
+		}
+
+		out += table[(value >> 18) & 0x3f];
+		out += table[(value >> 12) & 0x3f];
+		out += (i + 1 < size) ? table[(value >> 6) & 0x3f] : '=';
+		out += (i + 2 < size) ? table[value & 0x3f] : '=';
+	}
+	return out;
+}
+
+}
+
+std::string WebSocket::GetAcceptKey(const std::string& key)
+{
+	return Base64Encode(Sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+}
+
+uint32_t WebSocket::WriteFrameHeader(uint8_t* header, uint8_t opcode, uint64_t payload_size)
+{
+	header[0] = 0x80 | (opcode & 0x0f); // fin
+
+	if (payload_size < 126) {
+		header[1] = (uint8_t)payload_size;
+		return 2;
+	}
+	else if (payload_size <= 0xffff) {
+		header[1] = 126;
+		header[2] = (uint8_t)(payload_size >> 8);
+		header[3] = (uint8_t)(payload_size & 0xff);
+		return 4;
+	}
+
+	header[1] = 127;
+	for (int i = 0; i < 8; i++) {
+		header[2 + i] = (uint8_t)((payload_size >> ((7 - i) * 8)) & 0xff);
+	}
+	return 10;
+}
+
+int WebSocket::ParseFrame(const uint8_t* data, uint32_t size, uint8_t& opcode, std::string& payload)
+{
+	if (size < 2) {
+		return 0;
+	}
+
+	opcode = data[0] & 0x0f;
+	bool masked = (data[1] & 0x80) != 0;
+	uint64_t payload_size = data[1] & 0x7f;
+	uint32_t header_size = 2;
+
+	if (payload_size == 126) {
+		if (size < 4) {
+			return 0;
+		}
+		payload_size = (data[2] << 8) | data[3];
+		header_size = 4;
+	}
+	else if (payload_size == 127) {
+		if (size < 10) {
+			return 0;
+		}
+		payload_size = 0;
+		for (int i = 0; i < 8; i++) {
+			payload_size = (payload_size << 8) | data[2 + i];
+		}
+		header_size = 10;
+	}
+
+	/* client frames are masked, and nothing we expect is large */
+	if (!masked || payload_size > 65536) {
+		return -1;
+	}
+
+	const uint8_t* mask = data + header_size;
+	header_size += 4;
+	if (size < header_size + payload_size) {
+		return 0;
+	}
+
+	payload.resize((size_t)payload_size);
+	for (uint32_t i = 0; i < payload_size; i++) {
+		payload[i] = (char)(data[header_size + i] ^ mask[i % 4]);
+	}
+
+	return (int)(header_size + payload_size);
+}
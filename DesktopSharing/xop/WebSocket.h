@@ -0,0 +1,39 @@
+#ifndef XOP_WEB_SOCKET_H
+#define XOP_WEB_SOCKET_H
+
+#include <cstdint>
+#include <string>
+
+namespace xop
+{
+
+/* the bits of rfc 6455 a server pushing media needs: the handshake,
+   unfragmented frame headers and client frames (masked) */
+class WebSocket
+{
+public:
+	enum Opcode
+	{
+		kContinuation = 0x0,
+		kText         = 0x1,
+		kBinary       = 0x2,
+		kClose        = 0x8,
+		kPing         = 0x9,
+		kPong         = 0xa,
+	};
+
+	static const uint32_t kMaxFrameHeaderSize = 10;
+
+	/* Sec-WebSocket-Accept of a Sec-WebSocket-Key */
+	static std::string GetAcceptKey(const std::string& key);
+
+	/* header of a final unmasked server frame, returns its size */
+	static uint32_t WriteFrameHeader(uint8_t* header, uint8_t opcode, uint64_t payload_size);
+
+	/* one client frame, returns the bytes used, 0 if it is incomplete, -1 on error */
+	static int ParseFrame(const uint8_t* data, uint32_t size, uint8_t& opcode, std::string& payload);
+};
+
+}
+
+#endif
@@ -4,50 +4,15 @@
 
 using namespace xop;
 
+const AmfObject AmfDecoder::kEmptyObject;
+
 int AmfDecoder::decode(const char *data, int size, int n)
 {
     int bytes_used = 0; 
     while (size > bytes_used)
     {
-        int ret = 0;
-        char type = data[bytes_used];
-        bytes_used += 1;     
-
-        switch (type)
-        {	
-        case AMF0_NUMBER:
-            m_obj.type = AMF_NUMBER;     
-            ret = decodeNumber(data + bytes_used, size - bytes_used, m_obj.amf_number);
-            break;
-
-        case AMF0_BOOLEAN:
-            m_obj.type = AMF_BOOLEAN;
-            ret = decodeBoolean(data + bytes_used, size - bytes_used, m_obj.amf_boolean);
-            break;
-
-        case AMF0_STRING:
-            m_obj.type = AMF_STRING;
-            ret = decodeString(data + bytes_used, size - bytes_used, m_obj.amf_string);	
-            break;
-
-        case AMF0_OBJECT:   
-            ret = decodeObject(data + bytes_used, size - bytes_used, m_objs);
-            break;
-            
-        case AMF0_OBJECT_END:              
-            break;
-
-        case AMF0_ECMA_ARRAY:
-            ret = decodeObject(data + bytes_used + 4, size - bytes_used - 4, m_objs);
-            break;
-            
-        case AMF0_NULL:
-            break;
-            
-        default:   
-            break;
-        }                    
-        
+        /* a malformed or truncated value ends the decoding, what was decoded before it is kept */
+        int ret = decodeValue(data + bytes_used, size - bytes_used, m_obj, &m_objs, 0);
         if(ret < 0) {
             break;
         }
@@ -62,10 +27,102 @@ int AmfDecoder::decode(const char *data, int size, int n)
 	return bytes_used;
 }
 
+int AmfDecoder::decodeValue(const char *data, int size, AmfObject& obj, AmfObjects* objs, int depth)
+{
+    if (size < 1 || depth > kMaxDepth) {
+        return -1;
+    }
+
+    int ret = 0;
+    const char* value = data + 1;
+    int value_size = size - 1;
+
+    switch ((uint8_t)data[0])
+    {
+    case AMF0_NUMBER:
+        obj.type = AMF_NUMBER;
+        ret = decodeNumber(value, value_size, obj.amf_number);
+        break;
+
+    case AMF0_BOOLEAN:
+        obj.type = AMF_BOOLEAN;
+        ret = decodeBoolean(value, value_size, obj.amf_boolean);
+        break;
+
+    case AMF0_STRING:
+        obj.type = AMF_STRING;
+        ret = decodeString(value, value_size, obj.amf_string);
+        break;
+
+    case AMF0_LONG_STRING:
+    case AMF0_XML_DOC:
+        obj.type = AMF_STRING;
+        ret = decodeLongString(value, value_size, obj.amf_string);
+        break;
+
+    case AMF0_OBJECT:
+        ret = decodeObject(value, value_size, objs, depth);
+        break;
+
+    case AMF0_TYPED_OBJECT:
+        /* class name, then the properties as an anonymous object */
+        if (value_size < 2 || 2 + decodeInt16(value, value_size) > value_size) {
+            return -1;
+        }
+        {
+            int name_size = 2 + decodeInt16(value, value_size);
+            ret = decodeObject(value + name_size, value_size - name_size, objs, depth);
+            ret = (ret < 0) ? -1 : name_size + ret;
+        }
+        break;
+
+    case AMF0_ECMA_ARRAY:
+        /* the count is only a hint, the properties end with an object end marker */
+        if (value_size < 4) {
+            return -1;
+        }
+        ret = decodeObject(value + 4, value_size - 4, objs, depth);
+        ret = (ret < 0) ? -1 : ret + 4;
+        break;
+
+    case AMF0_STRICT_ARRAY:
+        ret = skipStrictArray(value, value_size, depth);
+        break;
+
+    case AMF0_DATE:
+        ret = (value_size < 10) ? -1 : 10;
+        break;
+
+    case AMF0_REFERENCE:
+        ret = (value_size < 2) ? -1 : 2;
+        break;
+
+    case AMF0_NULL:
+    case AMF0_UNDEFINED:
+    case AMF0_UNSUPPORTED:
+    case AMF0_OBJECT_END:
+        break;
+
+    case AMF0_AVMPLUS:
+        ret = decodeAmf3(value, value_size, obj);
+        break;
+
+    default:
+        /* movieclip and recordset are reserved */
+        return -1;
+    }
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    return 1 + ret;
+}
+
 int AmfDecoder::decodeNumber(const char *data, int size, double& amf_number)
 {
 	if (size < 8) {
-		return 0;
+		return -1;
 	}
     
     char *ci = (char*)data;
@@ -85,7 +142,7 @@ int AmfDecoder::decodeNumber(const char *data, int size, double& amf_number)
 int AmfDecoder::decodeString(const char *data, int size, std::string& amf_string)
 {
     if (size < 2) {
-        return 0;
+        return -1;
     }
 
     int bytes_used = 0;
@@ -95,43 +152,211 @@ int AmfDecoder::decodeString(const char *data, int size, std::string& amf_string
         return -1;
     }
 
-    amf_string = std::string(&data[bytes_used], 0, strSize);
+    /* assign() keeps the capacity of the string, decoders reused per message do not allocate */
+    amf_string.assign(&data[bytes_used], strSize);
     bytes_used += strSize;
     return bytes_used;
 }
 
-int AmfDecoder::decodeObject(const char *data, int size, AmfObjects& amf_objs)
+int AmfDecoder::decodeLongString(const char *data, int size, std::string& amf_string)
+{
+    if (size < 4) {
+        return -1;
+    }
+
+    uint32_t strSize = decodeInt32(data, size);
+    if (strSize > (uint32_t)(size - 4)) {
+        return -1;
+    }
+
+    amf_string.assign(&data[4], strSize);
+    return 4 + (int)strSize;
+}
+
+int AmfDecoder::decodeObject(const char *data, int size, AmfObjects* amf_objs, int depth)
 {
-    amf_objs.clear();
+    if (amf_objs != nullptr) {
+        amf_objs->clear();
+    }
+
+    AmfObject value;
     int bytes_used = 0;
-    while (size > 0)
+    while (true)
     {
-        int strLen = decodeInt16(data+ bytes_used, size);
-        size -= 2;
-        if (size < strLen) {
-            return bytes_used;
+        if (size - bytes_used < 3) {
+            return -1;
         }
 
-        std::string key(data+bytes_used+2, 0, strLen);
-        size -= strLen;
+        int strLen = decodeInt16(data + bytes_used, size - bytes_used);
+        if (strLen == 0 && data[bytes_used + 2] == AMF0_OBJECT_END) {
+            return bytes_used + 3;
+        }
 
-        AmfDecoder dec;
-        int ret = dec.decode(data+bytes_used+2+strLen, size, 1);		
-        bytes_used += 2 + strLen + ret;
-        if (ret <= 1) {
-            break; 
+        bytes_used += 2;
+        if (size - bytes_used < strLen) {
+            return -1;
         }
-        
-        amf_objs.emplace(key, dec.getObject());
+
+        const char* key = data + bytes_used;
+        bytes_used += strLen;
+
+        /* nested objects and arrays are walked but not kept */
+        const char* marker = data + bytes_used;
+        value.amf_string.clear();
+        value.amf_number = 0;
+        value.amf_boolean = false;
+        int ret = decodeValue(marker, size - bytes_used, value, nullptr, depth + 1);
+        if (ret < 0) {
+            return -1;
+        }
+        bytes_used += ret;
+
+        if (amf_objs != nullptr && isScalar(marker)) {
+            amf_objs->emplace(std::string(key, strLen), value);
+        }
+    }
+}
+
+int AmfDecoder::skipStrictArray(const char *data, int size, int depth)
+{
+    if (size < 4) {
+        return -1;
+    }
+
+    uint32_t count = decodeInt32(data, size);
+    int bytes_used = 4;
+
+    AmfObject value;
+    for (uint32_t i = 0; i < count; i++) {
+        int ret = decodeValue(data + bytes_used, size - bytes_used, value, nullptr, depth + 1);
+        if (ret < 0) {
+            return -1;
+        }
+        bytes_used += ret;
     }
 
     return bytes_used;
 }
 
+int AmfDecoder::decodeAmf3(const char *data, int size, AmfObject& obj)
+{
+    if (size < 1) {
+        return -1;
+    }
+
+    uint32_t value = 0;
+    int ret = 0;
+
+    switch ((uint8_t)data[0])
+    {
+    case AMF3_UNDEFINED:
+    case AMF3_NULL:
+        break;
+
+    case AMF3_FALSE:
+    case AMF3_TRUE:
+        obj.type = AMF_BOOLEAN;
+        obj.amf_boolean = (data[0] == AMF3_TRUE);
+        break;
+
+    case AMF3_INTEGER:
+        ret = decodeU29(data + 1, size - 1, value);
+        if (ret > 0) {
+            /* 29 bit signed integer */
+            obj.type = AMF_NUMBER;
+            obj.amf_number = (value & 0x10000000) ? (double)((int32_t)value - 0x20000000) : (double)value;
+        }
+        break;
+
+    case AMF3_DOUBLE:
+        obj.type = AMF_NUMBER;
+        ret = decodeNumber(data + 1, size - 1, obj.amf_number);
+        break;
+
+    case AMF3_STRING:
+    case AMF3_XML_DOC:
+    case AMF3_XML:
+    case AMF3_BYTE_ARRAY:
+        ret = decodeU29(data + 1, size - 1, value);
+        if (ret < 0) {
+            return -1;
+        }
+
+        obj.type = AMF_STRING;
+        obj.amf_string.clear();
+        if (value & 1) {
+            /* inline value, references to earlier ones are not resolved */
+            if ((value >> 1) > (uint32_t)(size - 1 - ret)) {
+                return -1;
+            }
+            obj.amf_string.assign(data + 1 + ret, value >> 1);
+            ret += value >> 1;
+        }
+        break;
+
+    case AMF3_DATE:
+        ret = decodeU29(data + 1, size - 1, value);
+        if (ret > 0 && (value & 1)) {
+            ret = (size - 1 - ret < 8) ? -1 : ret + 8;
+        }
+        break;
+
+    default:
+        /* arrays and objects need the traits and reference tables, they are not supported */
+        return -1;
+    }
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    return 1 + ret;
+}
+
+int AmfDecoder::decodeU29(const char *data, int size, uint32_t& value)
+{
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i >= size) {
+            return -1;
+        }
+
+        uint8_t byte = (uint8_t)data[i];
+        if (i == 3) {
+            value = (value << 8) | byte;
+            return 4;
+        }
+
+        value = (value << 7) | (byte & 0x7f);
+        if ((byte & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+bool AmfDecoder::isScalar(const char *marker)
+{
+    switch ((uint8_t)marker[0])
+    {
+    case AMF0_NUMBER:
+    case AMF0_BOOLEAN:
+    case AMF0_STRING:
+    case AMF0_LONG_STRING:
+    case AMF0_XML_DOC:
+        return true;
+    case AMF0_AVMPLUS:
+        return (uint8_t)marker[1] >= AMF3_FALSE && (uint8_t)marker[1] <= AMF3_STRING;
+    default:
+        return false;
+    }
+}
+
 int AmfDecoder::decodeBoolean(const char *data, int size, bool& amf_boolean)
 {
     if (size < 1) {
-        return 0;
+        return -1;
     }
 
     amf_boolean = (data[0] != 0);
@@ -170,48 +395,34 @@ AmfEncoder::~AmfEncoder()
 
 void AmfEncoder::encodeInt8(int8_t value)
 {
-    if((m_size - m_index) < 1) {
-        this->realloc(m_size + 1024);
-    }
-
+    reserve(1);
     m_data.get()[m_index++] = value;
 }
 
 void AmfEncoder::encodeInt16(int16_t value)
 {
-    if((m_size - m_index) < 2) {
-        this->realloc(m_size + 1024);
-    }
-
+    reserve(2);
     WriteUint16BE(m_data.get()+m_index, value);
     m_index += 2; 
 }
 
 void AmfEncoder::encodeInt24(int32_t value)
 {
-    if((m_size - m_index) < 3) {
-        this->realloc(m_size + 1024);
-    }
-
+    reserve(3);
     WriteUint24BE(m_data.get()+m_index, value);
     m_index += 3; 
 }
 
 void AmfEncoder::encodeInt32(int32_t value)
 {
-    if((m_size - m_index) < 4) {
-        this->realloc(m_size + 1024);
-    }
-
+    reserve(4);
     WriteUint32BE(m_data.get()+m_index, value);
     m_index += 4; 
 }
 
 void AmfEncoder::encodeString(const char *str, int len, bool isObject)
 {
-    if((int)(m_size - m_index) < (len + 1 + 2 + 2)) {
-        this->realloc(m_size + len + 5);
-    }
+    reserve(len + 5);
       
     if (len < 65536) {
         if(isObject) {
@@ -232,9 +443,7 @@ void AmfEncoder::encodeString(const char *str, int len, bool isObject)
 
 void AmfEncoder::encodeNumber(double value)
 {
-    if((m_size - m_index) < 9) {
-        this->realloc(m_size + 1024);
-    }
+    reserve(9);
 
     m_data.get()[m_index++] = AMF0_NUMBER;	
 
@@ -252,10 +461,7 @@ void AmfEncoder::encodeNumber(double value)
 
 void AmfEncoder::encodeBoolean(int value)
 {
-    if((m_size - m_index) < 2) {
-        this->realloc(m_size + 1024);
-    }
-
+    reserve(2);
     m_data.get()[m_index++] = AMF0_BOOLEAN;
     m_data.get()[m_index++] = value ? 0x01 : 0x00;
 }
@@ -268,35 +474,26 @@ void AmfEncoder::encodeObjects(AmfObjects& objs)
     }
 
     encodeInt8(AMF0_OBJECT);
-
-    for(auto iter : objs) {     
-        encodeString(iter.first.c_str(), (int)iter.first.size(), false);
-        switch(iter.second.type)
-		{
-            case AMF_NUMBER:
-                encodeNumber(iter.second.amf_number);
-                break;
-            case AMF_STRING:
-                encodeString(iter.second.amf_string.c_str(), (int)iter.second.amf_string.size());
-                break;
-            case AMF_BOOLEAN:
-                encodeBoolean(iter.second.amf_boolean);
-                break;
-            default:
-                break;
-        }
-    }
-
-    encodeString("", 0, false);
-    encodeInt8(AMF0_OBJECT_END);
+    encodeProperties(objs);
 }
 
 void AmfEncoder::encodeECMA(AmfObjects& objs)
 {
     encodeInt8(AMF0_ECMA_ARRAY);
-    encodeInt32(0);
-    
-    for(auto iter : objs) {     
+    encodeInt32((int32_t)objs.size());
+    encodeProperties(objs);
+}
+
+void AmfEncoder::encodeBytes(const char* data, uint32_t size)
+{
+    reserve(size);
+    memcpy(m_data.get() + m_index, data, size);
+    m_index += size;
+}
+
+void AmfEncoder::encodeProperties(AmfObjects& objs)
+{
+    for(auto& iter : objs) {     
         encodeString(iter.first.c_str(), (int)iter.first.size(), false);
         switch(iter.second.type)
         {
@@ -318,6 +515,16 @@ void AmfEncoder::encodeECMA(AmfObjects& objs)
     encodeInt8(AMF0_OBJECT_END);
 }
 
+void AmfEncoder::reserve(uint32_t size)
+{
+    if (m_size - m_index >= size) {
+        return;
+    }
+
+    /* doubles, a large metadata object does not copy the buffer once per kilobyte */
+    realloc(std::max(m_size * 2, m_index + size));
+}
+
 void AmfEncoder::realloc(uint32_t size)
 {
     if(size <= m_size) {
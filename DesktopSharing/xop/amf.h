@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #include <memory>
 #include <map>
 #include <unordered_map>
@@ -61,11 +62,11 @@ typedef enum
 
 struct AmfObject
 {  
-	AmfObjectType type;
+	AmfObjectType type = AMF_NUMBER;
 
 	std::string amf_string;
-	double amf_number;
-	bool amf_boolean;    
+	double amf_number = 0;
+	bool amf_boolean = false;    
 
 	AmfObject()
 	{
@@ -100,35 +101,47 @@ public:
         m_objs.clear();
     }
 
-    std::string getString() const
+    const std::string& getString() const
     { return m_obj.amf_string; }
 
     double getNumber() const
     { return m_obj.amf_number; }
 
-    bool hasObject(std::string key) const
+    bool hasObject(const std::string& key) const
     { return (m_objs.find(key) != m_objs.end()); }
 
-    AmfObject getObject(std::string key) 
-    { return m_objs[key]; }
+    const AmfObject& getObject(const std::string& key) const
+    {
+        auto iter = m_objs.find(key);
+        return (iter != m_objs.end()) ? iter->second : kEmptyObject;
+    }
 
-    AmfObject getObject() 
+    const AmfObject& getObject() const
     { return m_obj; }
 
-    AmfObjects getObjects() 
+    const AmfObjects& getObjects() const
     { return m_objs; }
     
 private:    
+    static int decodeValue(const char *data, int size, AmfObject& obj, AmfObjects* objs, int depth);
     static int decodeBoolean(const char *data, int size, bool& amf_boolean);
     static int decodeNumber(const char *data, int size, double& amf_number);
     static int decodeString(const char *data, int size, std::string& amf_string);
-    static int decodeObject(const char *data, int size, AmfObjects& amf_objs);
+    static int decodeLongString(const char *data, int size, std::string& amf_string);
+    static int decodeObject(const char *data, int size, AmfObjects* amf_objs, int depth);
+    static int skipStrictArray(const char *data, int size, int depth);
+    static int decodeAmf3(const char *data, int size, AmfObject& obj);
+    static int decodeU29(const char *data, int size, uint32_t& value);
+    static bool isScalar(const char *marker);
     static uint16_t decodeInt16(const char *data, int size);
     static uint32_t decodeInt24(const char *data, int size);
     static uint32_t decodeInt32(const char *data, int size);
 
     AmfObject m_obj;
     AmfObjects m_objs;    
+
+    static const AmfObject kEmptyObject;
+    static const int kMaxDepth = 32;
 };
 
 class AmfEncoder
@@ -157,12 +170,16 @@ public:
 	void encodeBoolean(int value);
 	void encodeObjects(AmfObjects& objs);
 	void encodeECMA(AmfObjects& objs);
+	/* values encoded beforehand by another encoder */
+	void encodeBytes(const char* data, uint32_t size);
      
 private:
 	void encodeInt8(int8_t value);
 	void encodeInt16(int16_t value);
 	void encodeInt24(int32_t value);
 	void encodeInt32(int32_t value); 
+	void encodeProperties(AmfObjects& objs);
+	void reserve(uint32_t size);
 	void realloc(uint32_t size);
 
 	std::shared_ptr<char> m_data;    
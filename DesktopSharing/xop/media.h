@@ -17,6 +17,8 @@ enum MediaType
 	H264 = 96,
 	AAC  = 37,
 	H265 = 265,   
+	AV1  = 266,
+	OPUS = 111,
 	NONE
 };	
 
@@ -25,6 +25,11 @@ static const int RTMP_CHUNK_TYPE_1      = 1; // 7
 static const int RTMP_CHUNK_TYPE_2      = 2; // 3
 static const int RTMP_CHUNK_TYPE_3      = 3; // 0
 
+/* announced to the peer with set chunk size once connected, a video frame
+   mostly goes out as one chunk */
+static const uint32_t RTMP_DEFAULT_CHUNK_SIZE = 65536;
+static const uint32_t RTMP_MAX_CHUNK_SIZE     = 0xffffff; // the largest message
+
 static const int RTMP_CHUNK_CONTROL_ID  = 2;
 static const int RTMP_CHUNK_INVOKE_ID   = 3;
 static const int RTMP_CHUNK_AUDIO_ID    = 4;
@@ -32,25 +37,90 @@ static const int RTMP_CHUNK_VIDEO_ID    = 5;
 static const int RTMP_CHUNK_DATA_ID     = 6;
 
 static const int RTMP_CODEC_ID_H264     = 7;
+static const int RTMP_CODEC_ID_H265     = 12; /* sent with the enhanced rtmp header, FourCC 'hvc1' */
+static const int RTMP_CODEC_ID_AV1      = 13; /* sent with the enhanced rtmp header, FourCC 'av01' */
 static const int RTMP_CODEC_ID_AAC      = 10;
 static const int RTMP_CODEC_ID_G711A    = 7;
 static const int RTMP_CODEC_ID_G711U    = 8;
 
-static const int RTMP_AVC_SEQUENCE_HEADER = 0x18;
+static const int RTMP_AVC_SEQUENCE_HEADER = 0x18; /* avc, or hevc with the enhanced rtmp header */
 static const int RTMP_AAC_SEQUENCE_HEADER = 0x19;
 
+/* enhanced rtmp video tag header: IsExHeader(1) FrameType(3) PacketType(4) FourCC(32) */
+static const int RTMP_VIDEO_EX_HEADER              = 0x80;
+static const int RTMP_PACKET_TYPE_SEQUENCE_START   = 0;
+static const int RTMP_PACKET_TYPE_CODED_FRAMES     = 1; /* with composition time */
+static const int RTMP_PACKET_TYPE_SEQUENCE_END     = 2;
+static const int RTMP_PACKET_TYPE_CODED_FRAMES_X   = 3; /* composition time is 0 */
+static const uint32_t RTMP_FOURCC_HEVC             = 0x68766331; /* 'hvc1' */
+static const uint32_t RTMP_FOURCC_AV1              = 0x61763031; /* 'av01' */
+
 namespace xop
 {
 
+/* flv video tag body, legacy avc or enhanced rtmp header */
+inline bool IsVideoSequenceHeader(const uint8_t* payload, uint32_t size)
+{
+	if (size < 2) {
+		return false;
+	}
+
+	if (payload[0] & RTMP_VIDEO_EX_HEADER) {
+		return (payload[0] & 0x0f) == RTMP_PACKET_TYPE_SEQUENCE_START && size > 5;
+	}
+
+	return (payload[0] & 0x0f) == RTMP_CODEC_ID_H264 && payload[1] == 0;
+}
+
+/* a coded key frame, sequence headers excluded */
+inline bool IsVideoKeyFrame(const uint8_t* payload, uint32_t size)
+{
+	if (size < 2) {
+		return false;
+	}
+
+	if (payload[0] & RTMP_VIDEO_EX_HEADER) {
+		uint8_t packet_type = payload[0] & 0x0f;
+		return ((payload[0] >> 4) & 0x07) == 1 && (packet_type == RTMP_PACKET_TYPE_CODED_FRAMES
+			|| packet_type == RTMP_PACKET_TYPE_CODED_FRAMES_X);
+	}
+
+	return ((payload[0] >> 4) & 0x0f) == 1 && (payload[0] & 0x0f) == RTMP_CODEC_ID_H264 && payload[1] == 1;
+}
+
+/* offset of the length prefixed nals (or av1 obus) in a coded frame tag, 0 if it has none */
+inline uint32_t GetVideoDataOffset(const uint8_t* payload, uint32_t size)
+{
+	if (size < 5) {
+		return 0;
+	}
+
+	if (payload[0] & RTMP_VIDEO_EX_HEADER) {
+		uint8_t packet_type = payload[0] & 0x0f;
+		uint32_t fourcc = (payload[1] << 24) | (payload[2] << 16) | (payload[3] << 8) | payload[4];
+		if (packet_type == RTMP_PACKET_TYPE_CODED_FRAMES && fourcc != RTMP_FOURCC_AV1) {
+			return size > 8 ? 8 : 0; // header, FourCC, composition time
+		}
+		else if (packet_type == RTMP_PACKET_TYPE_CODED_FRAMES || packet_type == RTMP_PACKET_TYPE_CODED_FRAMES_X) {
+			return 5; // av1 has no composition time
+		}
+		return 0;
+	}
+
+	return ((payload[0] & 0x0f) == RTMP_CODEC_ID_H264 && payload[1] == 1) ? 5 : 0;
+}
+
 struct MediaInfo
 {
 	uint8_t  video_codec_id = RTMP_CODEC_ID_H264;
 	uint8_t  video_framerate = 0;
 	uint32_t video_width = 0;
 	uint32_t video_height = 0;
-	std::shared_ptr<uint8_t> sps;
+	std::shared_ptr<uint8_t> vps; // hevc only
+	std::shared_ptr<uint8_t> sps; // av1: sequence header obu
 	std::shared_ptr<uint8_t> pps;
 	std::shared_ptr<uint8_t> sei;
+	uint32_t vps_size = 0;
 	uint32_t sps_size = 0;
 	uint32_t pps_size = 0;
 	uint32_t sei_size = 0;
@@ -70,7 +140,7 @@ public:
 
 	void SetChunkSize(uint32_t size)
 	{
-		if (size > 0 && size <= 60000) {
+		if (size > 0 && size <= RTMP_MAX_CHUNK_SIZE) {
 			max_chunk_size_ = size;
 		}
 	}
@@ -78,6 +148,14 @@ public:
 	void SetGopCache(uint32_t len = 10000)
 	{ max_gop_cache_len_ = len; }
 
+	/* byte cap of the gop cache, 0: only the frame count is limited */
+	void SetGopCacheBytes(uint32_t bytes)
+	{ max_gop_cache_bytes_ = bytes; }
+
+	/* new players start at the latest key frame instead of the oldest cached gop */
+	void SetGopFastStart(bool fast_start)
+	{ gop_fast_start_ = fast_start; }
+
 	void SetPeerBandwidth(uint32_t size)
 	{ peer_bandwidth_ = size; }
 
@@ -87,6 +165,12 @@ public:
 	uint32_t GetGopCacheLen() const
 	{ return max_gop_cache_len_; }
 
+	uint32_t GetGopCacheBytes() const
+	{ return max_gop_cache_bytes_; }
+
+	bool IsGopFastStart() const
+	{ return gop_fast_start_; }
+
 	uint32_t GetAcknowledgementSize() const
 	{ return acknowledgement_size_; }
 
@@ -173,8 +257,10 @@ public:
 
 	uint32_t peer_bandwidth_ = 5000000;
 	uint32_t acknowledgement_size_ = 5000000;
-	uint32_t max_chunk_size_ = 128;
+	uint32_t max_chunk_size_ = RTMP_DEFAULT_CHUNK_SIZE;
 	uint32_t max_gop_cache_len_ = 0;
+	uint32_t max_gop_cache_bytes_ = 16 * 1024 * 1024;
+	bool gop_fast_start_ = false;
 };
 
 }